@@ -0,0 +1,166 @@
+#include <allok.h>
+
+#include <stdio.h>
+#include <time.h>
+#include <sys/resource.h>
+#include <unistd.h>
+
+#if defined(__linux__)
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#endif
+
+#define ARENA_SIZE (1024L * 1024 * 1024)
+#define POOL_SIZE (512L * 1024 * 1024)
+#define BLOCK_SIZE (1024L * 1024)
+#define MAX_BLOCKS (POOL_SIZE / BLOCK_SIZE)
+#define RANDOM_READS (32L * 1024 * 1024)
+
+typedef struct BenchResult {
+    double touch_ms;
+    double read_ms;
+    long faults;
+    long long tlb_misses;
+} BenchResult;
+
+static const char *g_mode_names[] = {"none", "transparent", "explicit"};
+static unsigned char *g_blocks[MAX_BLOCKS];
+
+double now_ms();
+long minor_faults();
+int tlb_counter_open();
+long long tlb_counter_read(int fd);
+void measure(BenchResult *p_result, unsigned char **pp_blocks, AllokSize block_count, AllokSize block_size, long faults);
+void print_result(const char *p_name, AllokHugePages mode, const BenchResult *p_result);
+
+int main() {
+    printf("======== allok Huge Pages ========\n");
+    printf("%-8s%-14s%12s%12s%14s%16s\n", "target", "huge pages", "touch ms", "faults", "read ms", "dTLB misses");
+
+    for (int mode = ALLOK_HUGE_PAGES_NONE; mode <= ALLOK_HUGE_PAGES_EXPLICIT; mode++) {
+        const long faults = minor_faults();
+        AkMemoryArena *arena;
+        if (akMemoryArenaAllocWithParams(&arena, ARENA_SIZE, (AkMemoryArenaParams){mode}) != ALLOK_SUCCESS) {
+            printf("%-8s%-14s  arena alloc failed\n", "arena", g_mode_names[mode]);
+            continue;
+        }
+
+        unsigned char *data;
+        akMemoryArenaClaim(VPTR(data), arena, ARENA_SIZE);
+
+        BenchResult result;
+        measure(&result, &data, 1, ARENA_SIZE, faults);
+        print_result("arena", mode, &result);
+
+        akMemoryArenaDestroy(&arena, ALLOK_FALSE);
+    }
+
+    for (int mode = ALLOK_HUGE_PAGES_NONE; mode <= ALLOK_HUGE_PAGES_EXPLICIT; mode++) {
+        // One fixed pool with the large path off, so every block comes from the pool mapping
+        const long faults = minor_faults();
+        akInit(1, POOL_SIZE, (AkMemoryMapParams){ALLOK_BEST_FIT, ALLOK_FALSE, ALLOK_FALSE, ALLOK_FALSE, ALLOK_FALSE, 0, mode});
+
+        AllokSize block_count = 0;
+        while (block_count < MAX_BLOCKS && akAlloc(VPTR(g_blocks[block_count]), BLOCK_SIZE - 64) == ALLOK_SUCCESS) {
+            block_count++;
+        }
+
+        BenchResult result;
+        measure(&result, g_blocks, block_count, BLOCK_SIZE - 64, faults);
+        print_result("pool", mode, &result);
+
+        akDump();
+    }
+
+    return 0;
+}
+
+double now_ms() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec * 1e3 + (double)ts.tv_nsec / 1e6;
+}
+
+long minor_faults() {
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_minflt;
+}
+
+int tlb_counter_open() {
+#if defined(__linux__)
+    struct perf_event_attr attr = {0};
+    attr.type = PERF_TYPE_HW_CACHE;
+    attr.size = sizeof(attr);
+    attr.config = PERF_COUNT_HW_CACHE_DTLB | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+    attr.disabled = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    return (int)syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+#else
+    return -1;
+#endif
+}
+
+long long tlb_counter_read(const int fd) {
+#if defined(__linux__)
+    long long count;
+    if (fd < 0 || read(fd, &count, sizeof(count)) != sizeof(count)) {
+        return -1;
+    }
+    return count;
+#else
+    (void)fd;
+    return -1;
+#endif
+}
+
+void measure(BenchResult *p_result, unsigned char **pp_blocks, const AllokSize block_count, const AllokSize block_size, const long faults) {
+    // Faults are counted from before the memory was mapped, since block headers are already touched by akAlloc
+    double start = now_ms();
+    for (AllokSize i = 0; i < block_count; i++) {
+        akMemset(VPTR(pp_blocks[i]), 1, block_size);
+    }
+    p_result->touch_ms = now_ms() - start;
+    p_result->faults = minor_faults() - faults;
+
+    // Random reads across the whole range stress the TLB
+    const int fd = tlb_counter_open();
+#if defined(__linux__)
+    if (fd >= 0) {
+        ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+        ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+    }
+#endif
+
+    unsigned long long seed = 7;
+    volatile unsigned long sum = 0;
+    start = now_ms();
+    for (long i = 0; i < RANDOM_READS; i++) {
+        seed = seed * 6364136223846793005ULL + 1442695040888963407ULL;
+        const AllokSize block = (AllokSize)(seed >> 33) % block_count;
+        const AllokSize offset = (AllokSize)(seed >> 11) % block_size;
+        sum += pp_blocks[block][offset];
+    }
+    p_result->read_ms = now_ms() - start;
+
+#if defined(__linux__)
+    if (fd >= 0) {
+        ioctl(fd, PERF_EVENT_IOC_DISABLE, 0);
+    }
+#endif
+    p_result->tlb_misses = tlb_counter_read(fd);
+    if (fd >= 0) {
+        close(fd);
+    }
+}
+
+void print_result(const char *p_name, const AllokHugePages mode, const BenchResult *p_result) {
+    printf("%-8s%-14s%12.1f%12ld%14.1f", p_name, g_mode_names[mode], p_result->touch_ms, p_result->faults, p_result->read_ms);
+    if (p_result->tlb_misses < 0) {
+        printf("%16s\n", "n/a");
+    } else {
+        printf("%16lld\n", p_result->tlb_misses);
+    }
+}
@@ -0,0 +1,111 @@
+#include <allok.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define BYTES_PER_RUN (512L * 1024 * 1024)
+#define MAX_SIZE (64L * 1024 * 1024)
+#define LIBC_COLUMN ALLOK_MEM_KERNEL_COUNT
+
+typedef enum BenchOp {
+    BENCH_MEMCPY,
+    BENCH_MEMSET
+} BenchOp;
+
+static const char *g_kernel_names[] = {"byte", "word", "sse2", "avx2", "avx512", "neon", "libc"};
+static const char *g_op_names[] = {"akMemcpy", "akMemset"};
+
+double now_seconds();
+double run_bench(BenchOp op, int kernel, unsigned char *p_dst, const unsigned char *p_src, AllokSize size);
+
+int main() {
+    unsigned char *src = malloc(MAX_SIZE + 64);
+    unsigned char *dst = malloc(MAX_SIZE + 64);
+    if (src == NULL || dst == NULL) {
+        return 1;
+    }
+    memset(src, 0x5A, MAX_SIZE + 64);
+    memset(dst, 0, MAX_SIZE + 64);
+
+    AllokMemKernel selected;
+    akMemKernelGet(&selected);
+
+    AllokBool supported[ALLOK_MEM_KERNEL_COUNT];
+    for (int kernel = 0; kernel < ALLOK_MEM_KERNEL_COUNT; kernel++) {
+        supported[kernel] = akMemKernelSet(kernel) == ALLOK_SUCCESS ? ALLOK_TRUE : ALLOK_FALSE;
+    }
+
+    printf("======== allok Memory Kernels ========\n");
+    printf("selected kernel: %s, non-temporal stores from %d bytes\n", g_kernel_names[selected], ALLOK_NON_TEMPORAL_THRESHOLD);
+
+    for (int op = BENCH_MEMCPY; op <= BENCH_MEMSET; op++) {
+        printf("\n%-10s", g_op_names[op]);
+        for (int kernel = 0; kernel <= LIBC_COLUMN; kernel++) {
+            if (kernel == LIBC_COLUMN || supported[kernel] == ALLOK_TRUE) {
+                printf("%10s", g_kernel_names[kernel]);
+            }
+        }
+        printf("   (GB/s)\n");
+
+        for (AllokSize size = 16; size <= MAX_SIZE; size *= 4) {
+            printf("%-10lu", (unsigned long)size);
+            for (int kernel = 0; kernel <= LIBC_COLUMN; kernel++) {
+                if (kernel == LIBC_COLUMN || supported[kernel] == ALLOK_TRUE) {
+                    // Offset the destination so the unaligned head and tail paths are exercised
+                    printf("%10.2f", run_bench(op, kernel, dst + 3, src + 1, size));
+                    fflush(stdout);
+                }
+            }
+            printf("\n");
+        }
+    }
+
+    akMemKernelSet(selected);
+    free(src);
+    free(dst);
+    return 0;
+}
+
+double now_seconds() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
+double run_bench(const BenchOp op, const int kernel, unsigned char *p_dst, const unsigned char *p_src, const AllokSize size) {
+    if (kernel != LIBC_COLUMN) {
+        akMemKernelSet(kernel);
+    }
+
+    long iterations = BYTES_PER_RUN / (long)size;
+    if (kernel == ALLOK_MEM_KERNEL_BYTE) {
+        iterations /= 4;
+    }
+    if (iterations < 2) {
+        iterations = 2;
+    }
+
+    void *dst = p_dst;
+    const double start = now_seconds();
+    for (long i = 0; i < iterations; i++) {
+        if (kernel == LIBC_COLUMN) {
+            if (op == BENCH_MEMCPY) {
+                memcpy(dst, p_src, size);
+            } else {
+                memset(dst, (int)i, size);
+            }
+        } else {
+            if (op == BENCH_MEMCPY) {
+                akMemcpy(&dst, p_src, size);
+            } else {
+                akMemset(&dst, (AllokByte)i, size);
+            }
+        }
+        __asm__ volatile("" : : "r"(dst) : "memory");
+    }
+    const double elapsed = now_seconds() - start;
+
+    return (double)size * (double)iterations / elapsed / 1e9;
+}
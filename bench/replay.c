@@ -0,0 +1,274 @@
+#include <allok.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define REPORT_SAMPLES 256
+
+typedef struct ReplaySlot {
+    unsigned long long id;
+    void *ptr;
+} ReplaySlot;
+
+// Open addressing from traced addresses to the addresses handed out by the replay
+typedef struct ReplayTable {
+    ReplaySlot *p_slots;
+    unsigned long long mask;
+} ReplayTable;
+
+typedef struct ReplayTrace {
+    AkTraceEvent *p_events;
+    long count;
+    long op_counts[ALLOK_TRACE_FREE + 1];
+    unsigned int thread_count;
+} ReplayTrace;
+
+typedef struct ReplayResult {
+    double elapsed;
+    long failed;
+    long unmatched;
+    AllokSize peak_alloc_size;
+    AllokSize peak_mapped_size;
+    double fragmentation_sum;
+    double fragmentation_max;
+    long fragmentation_samples;
+} ReplayResult;
+
+static const char *g_type_names[] = {"linear fit", "first fit", "best fit", "worst fit"};
+static const char *g_op_names[] = {"alloc", "calloc", "realloc", "free"};
+
+double now_seconds();
+int load_trace(ReplayTrace *p_trace, const char *path);
+void replay(const ReplayTrace *p_trace, const AkMemoryMapParams params, const AllokSize pool_size, ReplayResult *p_result, const AllokBool sample_heap);
+
+int main(int argc, char **argv) {
+    if (argc < 2) {
+        fprintf(stderr, "usage: %s <trace> [AllokType, -1 for all] [pool size] [large threshold]\n", argv[0]);
+        return 2;
+    }
+
+    int first_type = ALLOK_LINEAR_FIT;
+    int last_type = ALLOK_WORST_FIT;
+    if (argc > 2 && strtol(argv[2], NULL, 10) >= 0) {
+        first_type = last_type = (int)strtol(argv[2], NULL, 10);
+        if (first_type > ALLOK_WORST_FIT) {
+            fprintf(stderr, "unknown AllokType %d\n", first_type);
+            return 2;
+        }
+    }
+    const AllokSize pool_size = argc > 3 ? (AllokSize)strtoul(argv[3], NULL, 10) : ALLOK_DEFAULT_POOL_SIZE;
+    const AllokSize large_threshold = argc > 4 ? (AllokSize)strtoul(argv[4], NULL, 10) : ALLOK_DEFAULT_LARGE_THRESHOLD;
+
+    ReplayTrace trace;
+    if (load_trace(&trace, argv[1]) != 0) {
+        return 1;
+    }
+
+    const double span = trace.count > 0 ? (double)trace.p_events[trace.count - 1].timestamp * 1e-9 : 0.0;
+    printf("======== allok Replay ========\n");
+    printf("%s: %ld events from %u threads over %.3f s\n", argv[1], trace.count, trace.thread_count, span);
+    for (int op = ALLOK_TRACE_ALLOC; op <= ALLOK_TRACE_FREE; op++) {
+        printf("  %-8s%12ld\n", g_op_names[op], trace.op_counts[op]);
+    }
+    printf("Events are replayed on one thread in the order they were recorded\n");
+    printf("\n%-12s%10s%10s%14s%14s%10s%10s%8s\n", "type", "ms", "Mops/s", "peak alloc", "peak mapped", "frag avg", "frag max", "failed");
+
+    for (int type = first_type; type <= last_type; type++) {
+        const AkMemoryMapParams params = {(AllokType)type, ALLOK_DEFAULT_ALLOC_DYNAMIC, ALLOK_DEFAULT_ALLOC_SLAB, ALLOK_DEFAULT_ALLOC_THREAD_SAFE, ALLOK_DEFAULT_ALLOC_REALLOC_HEADROOM, large_threshold, ALLOK_DEFAULT_HUGE_PAGES, ALLOK_DEFAULT_POOL_CACHE_SIZE, ALLOK_DEFAULT_POOL_CACHE_DECAY, ALLOK_DEFAULT_ALLOC_PER_CPU};
+
+        // One pass for time, then a second that samples the footprint and fragmentation after each op
+        ReplayResult timed;
+        ReplayResult sampled;
+        replay(&trace, params, pool_size, &timed, ALLOK_FALSE);
+        replay(&trace, params, pool_size, &sampled, ALLOK_TRUE);
+
+        const double frag_avg = sampled.fragmentation_samples > 0 ? sampled.fragmentation_sum / (double)sampled.fragmentation_samples : 0.0;
+        printf("%-12s%10.2f%10.2f%14lu%14lu%9.1f%%%9.1f%%%8ld\n", g_type_names[type], timed.elapsed * 1e3, (double)trace.count / timed.elapsed / 1e6, (unsigned long)sampled.peak_alloc_size, (unsigned long)sampled.peak_mapped_size, frag_avg * 100.0, sampled.fragmentation_max * 100.0, timed.failed);
+        if (timed.unmatched > 0) {
+            printf("  %ld events named an id the trace never allocated and were skipped\n", timed.unmatched);
+        }
+        fflush(stdout);
+    }
+
+    free(trace.p_events);
+    return 0;
+}
+
+double now_seconds() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
+int load_trace(ReplayTrace *p_trace, const char *path) {
+    FILE *file = fopen(path, "rb");
+    if (file == NULL) {
+        fprintf(stderr, "cannot open %s\n", path);
+        return 1;
+    }
+
+    AkTraceHeader header;
+    if (fread(&header, sizeof(header), 1, file) != 1 || header.magic != ALLOK_TRACE_MAGIC || header.version != ALLOK_TRACE_VERSION || header.event_size != sizeof(AkTraceEvent)) {
+        fprintf(stderr, "%s is not an allok trace of version %d\n", path, ALLOK_TRACE_VERSION);
+        fclose(file);
+        return 1;
+    }
+
+    fseek(file, 0, SEEK_END);
+    const long count = (ftell(file) - (long)sizeof(header)) / (long)sizeof(AkTraceEvent);
+    fseek(file, sizeof(header), SEEK_SET);
+
+    *p_trace = (ReplayTrace){malloc(sizeof(AkTraceEvent) * (size_t)(count > 0 ? count : 1)), count};
+    if (p_trace->p_events == NULL || fread(p_trace->p_events, sizeof(AkTraceEvent), (size_t)count, file) != (size_t)count) {
+        fprintf(stderr, "cannot read %ld events from %s\n", count, path);
+        fclose(file);
+        return 1;
+    }
+    fclose(file);
+
+    for (long i = 0; i < count; i++) {
+        const AkTraceEvent *event = &p_trace->p_events[i];
+        if (event->op <= ALLOK_TRACE_FREE) {
+            p_trace->op_counts[event->op]++;
+        }
+        if (event->thread > p_trace->thread_count) {
+            p_trace->thread_count = event->thread;
+        }
+    }
+
+    return 0;
+}
+
+static inline unsigned long long table_hash(const unsigned long long id) {
+    return (id >> 4) * 0x9E3779B97F4A7C15ULL;
+}
+
+ReplaySlot *table_find(const ReplayTable *p_table, const unsigned long long id) {
+    unsigned long long i = table_hash(id) & p_table->mask;
+    while (p_table->p_slots[i].id != 0) {
+        if (p_table->p_slots[i].id == id) {
+            return &p_table->p_slots[i];
+        }
+        i = (i + 1) & p_table->mask;
+    }
+    return NULL;
+}
+
+void table_insert(ReplayTable *p_table, const unsigned long long id, void *ptr) {
+    unsigned long long i = table_hash(id) & p_table->mask;
+    while (p_table->p_slots[i].id != 0 && p_table->p_slots[i].id != id) {
+        i = (i + 1) & p_table->mask;
+    }
+    p_table->p_slots[i] = (ReplaySlot){id, ptr};
+}
+
+void table_remove(ReplayTable *p_table, ReplaySlot *p_slot) {
+    // Shift later entries of the probe run back so lookups never stop at the hole
+    unsigned long long hole = (unsigned long long)(p_slot - p_table->p_slots);
+    unsigned long long i = hole;
+    while (1) {
+        i = (i + 1) & p_table->mask;
+        if (p_table->p_slots[i].id == 0) {
+            break;
+        }
+        const unsigned long long home = table_hash(p_table->p_slots[i].id) & p_table->mask;
+        if (((i - home) & p_table->mask) >= ((i - hole) & p_table->mask)) {
+            p_table->p_slots[hole] = p_table->p_slots[i];
+            hole = i;
+        }
+    }
+    p_table->p_slots[hole] = (ReplaySlot){0, NULL};
+}
+
+void sample(ReplayResult *p_result, const AllokBool report) {
+    const AkMemoryMapMetadata metadata = akGetAllocMetadata();
+    if (metadata.peak_alloc_size > p_result->peak_alloc_size) {
+        p_result->peak_alloc_size = metadata.peak_alloc_size;
+    }
+    if (metadata.mapped_size > p_result->peak_mapped_size) {
+        p_result->peak_mapped_size = metadata.mapped_size;
+    }
+
+    AkMemoryMapReport heap;
+    if (report == ALLOK_TRUE && akGetHeapReport(&heap) == ALLOK_SUCCESS && heap.pool_count > 0) {
+        p_result->fragmentation_sum += heap.external_fragmentation;
+        if (heap.external_fragmentation > p_result->fragmentation_max) {
+            p_result->fragmentation_max = heap.external_fragmentation;
+        }
+        p_result->fragmentation_samples++;
+    }
+}
+
+void replay(const ReplayTrace *p_trace, const AkMemoryMapParams params, const AllokSize pool_size, ReplayResult *p_result, const AllokBool sample_heap) {
+    ReplayTable table = {NULL, 1};
+    const long allocs = p_trace->op_counts[ALLOK_TRACE_ALLOC] + p_trace->op_counts[ALLOK_TRACE_CALLOC] + p_trace->op_counts[ALLOK_TRACE_REALLOC];
+    while (table.mask + 1 < (unsigned long long)allocs * 2) {
+        table.mask = (table.mask << 1) | 1;
+    }
+    table.p_slots = calloc(table.mask + 1, sizeof(ReplaySlot));
+
+    *p_result = (ReplayResult){};
+    const long report_interval = p_trace->count / REPORT_SAMPLES + 1;
+
+    akInit(ALLOK_DEFAULT_POOL_COUNT, pool_size, params);
+    const double start = now_seconds();
+
+    for (long i = 0; i < p_trace->count; i++) {
+        const AkTraceEvent *event = &p_trace->p_events[i];
+        const AllokSize alignment = (AllokSize)1 << event->alignment_shift;
+        void *ptr = NULL;
+        AllokResult result = ALLOK_SUCCESS;
+
+        switch (event->op) {
+            case ALLOK_TRACE_ALLOC: {
+                result = akAllocAligned(&ptr, (AllokSize)event->size, alignment);
+                break;
+            }
+            case ALLOK_TRACE_CALLOC: {
+                result = akCallocAligned(&ptr, (AllokSize)event->size, alignment);
+                break;
+            }
+            case ALLOK_TRACE_REALLOC: {
+                ReplaySlot *slot = table_find(&table, event->src_id);
+                if (slot == NULL) {
+                    p_result->unmatched++;
+                    continue;
+                }
+                result = akRealloc(&ptr, slot->ptr, (AllokSize)event->size);
+                if (result == ALLOK_SUCCESS) {
+                    table_remove(&table, slot);
+                }
+                break;
+            }
+            case ALLOK_TRACE_FREE: {
+                ReplaySlot *slot = table_find(&table, event->id);
+                if (slot == NULL) {
+                    p_result->unmatched++;
+                    continue;
+                }
+                result = akFree(&slot->ptr);
+                table_remove(&table, slot);
+                break;
+            }
+            default: {
+                continue;
+            }
+        }
+
+        if (result != ALLOK_SUCCESS) {
+            p_result->failed++;
+        } else if (ptr != NULL) {
+            table_insert(&table, event->id, ptr);
+        }
+
+        if (sample_heap == ALLOK_TRUE) {
+            sample(p_result, i % report_interval == 0 ? ALLOK_TRUE : ALLOK_FALSE);
+        }
+    }
+
+    p_result->elapsed = now_seconds() - start;
+    akDump();
+    free(table.p_slots);
+}
@@ -0,0 +1,169 @@
+#include <allok.h>
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#define OPS_PER_THREAD 2000000
+#define SLOT_COUNT 256
+#define MAX_THREADS 64
+
+typedef enum BenchMode {
+    BENCH_ALLOK,
+    BENCH_ALLOK_PER_CPU,
+    BENCH_ALLOK_MUTEX,
+    BENCH_MALLOC
+} BenchMode;
+
+static const char *g_mode_names[] = {"allok", "allok per-cpu", "allok+mutex", "malloc"};
+
+static pthread_mutex_t g_mutex = PTHREAD_MUTEX_INITIALIZER;
+static BenchMode g_mode;
+
+double now_seconds();
+void *bench_thread(void *arg);
+double run_bench(BenchMode mode, int thread_count);
+
+int main(int argc, char **argv) {
+    int max_threads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    if (argc > 1) {
+        max_threads = (int)strtol(argv[1], NULL, 10);
+    }
+    if (max_threads < 1) {
+        max_threads = 1;
+    }
+    if (max_threads > MAX_THREADS) {
+        max_threads = MAX_THREADS;
+    }
+
+    printf("======== allok Thread Scaling ========\n");
+    printf("%d alloc/free ops per thread, sizes 16-512 bytes\n\n", OPS_PER_THREAD);
+    printf("%-8s", "threads");
+    for (int mode = 0; mode <= BENCH_MALLOC; mode++) {
+        printf("%16s", g_mode_names[mode]);
+    }
+    printf("   (Mops/s)\n");
+
+    for (int threads = 1; threads <= max_threads; threads *= 2) {
+        printf("%-8d", threads);
+        for (int mode = 0; mode <= BENCH_MALLOC; mode++) {
+            printf("%16.2f", run_bench(mode, threads));
+            fflush(stdout);
+        }
+        printf("\n");
+
+        if (threads < max_threads && threads * 2 > max_threads) {
+            threads = max_threads / 2;
+        }
+    }
+
+    return 0;
+}
+
+double now_seconds() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
+static inline void *bench_alloc(const AllokSize size) {
+    void *ptr = NULL;
+    switch (g_mode) {
+        case BENCH_ALLOK:
+        case BENCH_ALLOK_PER_CPU: {
+            akAlloc(&ptr, size);
+            break;
+        }
+        case BENCH_ALLOK_MUTEX: {
+            pthread_mutex_lock(&g_mutex);
+            akAlloc(&ptr, size);
+            pthread_mutex_unlock(&g_mutex);
+            break;
+        }
+        case BENCH_MALLOC: {
+            ptr = malloc(size);
+            break;
+        }
+    }
+    return ptr;
+}
+
+static inline void bench_free(void *ptr) {
+    switch (g_mode) {
+        case BENCH_ALLOK:
+        case BENCH_ALLOK_PER_CPU: {
+            akFree(&ptr);
+            break;
+        }
+        case BENCH_ALLOK_MUTEX: {
+            pthread_mutex_lock(&g_mutex);
+            akFree(&ptr);
+            pthread_mutex_unlock(&g_mutex);
+            break;
+        }
+        case BENCH_MALLOC: {
+            free(ptr);
+            break;
+        }
+    }
+}
+
+void *bench_thread(void *arg) {
+    unsigned int seed = (unsigned int)(size_t)arg * 2654435761u + 1;
+    void *slots[SLOT_COUNT] = {0};
+
+    for (int i = 0; i < OPS_PER_THREAD; i++) {
+        seed = seed * 1103515245u + 12345u;
+        const unsigned int slot = (seed >> 8) % SLOT_COUNT;
+
+        if (slots[slot] != NULL) {
+            bench_free(slots[slot]);
+            slots[slot] = NULL;
+        } else {
+            // Mostly slab sized requests with the occasional pool allocation
+            const AllokSize size = (seed >> 16) % 16 == 0 ? 257 + (seed >> 20) % 256 : 16 + (seed >> 20) % 241;
+            slots[slot] = bench_alloc(size);
+            *(volatile char *)slots[slot] = 1;
+        }
+    }
+
+    for (int i = 0; i < SLOT_COUNT; i++) {
+        if (slots[i] != NULL) {
+            bench_free(slots[i]);
+        }
+    }
+
+    if (g_mode == BENCH_ALLOK) {
+        akThreadCacheFlush();
+    }
+
+    return NULL;
+}
+
+double run_bench(const BenchMode mode, const int thread_count) {
+    pthread_t threads[MAX_THREADS];
+
+    g_mode = mode;
+    if (mode != BENCH_MALLOC) {
+        const AllokBool thread_safe = mode != BENCH_ALLOK_MUTEX ? ALLOK_TRUE : ALLOK_FALSE;
+        const AllokBool per_cpu = mode == BENCH_ALLOK_PER_CPU ? ALLOK_TRUE : ALLOK_FALSE;
+        akInit(ALLOK_DEFAULT_POOL_COUNT, ALLOK_DEFAULT_POOL_SIZE, (AkMemoryMapParams){ALLOK_DEFAULT_ALLOC_TYPE, ALLOK_DEFAULT_ALLOC_DYNAMIC, ALLOK_DEFAULT_ALLOC_SLAB, thread_safe, ALLOK_DEFAULT_ALLOC_REALLOC_HEADROOM, ALLOK_DEFAULT_LARGE_THRESHOLD, ALLOK_DEFAULT_HUGE_PAGES, ALLOK_DEFAULT_POOL_CACHE_SIZE, ALLOK_DEFAULT_POOL_CACHE_DECAY, per_cpu});
+    }
+
+    const double start = now_seconds();
+    for (int i = 0; i < thread_count; i++) {
+        pthread_create(&threads[i], NULL, bench_thread, (void *)(size_t)(i + 1));
+    }
+    for (int i = 0; i < thread_count; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    const double elapsed = now_seconds() - start;
+
+    if (mode != BENCH_MALLOC) {
+        akDump();
+    }
+
+    return (double)OPS_PER_THREAD * thread_count / elapsed / 1e6;
+}
@@ -0,0 +1,417 @@
+#include <allok.h>
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#define DEFAULT_OPS 1000000
+#define SLOT_COUNT 4096
+#define QUEUE_SIZE 1024
+#define REALLOC_BUFFERS 8
+#define REALLOC_MAX_SIZE (64 * 1024)
+#define ARENA_SIZE (4L * 1024 * 1024)
+#define ARENA_RESET_CLAIMS 10000
+#define LIBC_COLUMN (ALLOK_WORST_FIT + 1)
+
+typedef enum BenchWorkload {
+    BENCH_FIXED_CHURN,
+    BENCH_RANDOM_SIZES,
+    BENCH_PRODUCER_CONSUMER,
+    BENCH_HEAP_LOCKED,
+    BENCH_HEAP_REMOTE_FREE,
+    BENCH_REALLOC_GROWTH,
+    BENCH_ARENA_BUMP,
+    BENCH_WORKLOAD_COUNT
+} BenchWorkload;
+
+typedef struct BenchSamples {
+    unsigned int *p_ns;
+    long count;
+    long capacity;
+} BenchSamples;
+
+typedef struct BenchQueue {
+    void *slots[QUEUE_SIZE];
+    volatile long head;
+    volatile long tail;
+} BenchQueue;
+
+typedef struct BenchConsumer {
+    BenchQueue *p_queue;
+    BenchSamples *p_samples;
+    long ops;
+} BenchConsumer;
+
+static const char *g_workload_names[] = {"fixed-size churn", "random sizes", "producer/consumer", "p/c heap, locked", "p/c heap, remote", "realloc growth", "arena bump"};
+static const char *g_column_names[] = {"linear fit", "first fit", "best fit", "worst fit", "malloc"};
+
+static int g_column;
+static AkMemoryMap *g_heap;
+static AkMemoryArena *g_heap_arena;
+static unsigned int g_seed;
+
+double now_seconds();
+long run_workload(BenchWorkload workload, long ops, BenchSamples *p_samples);
+void print_row(const char *p_name, long ops, double elapsed, BenchSamples *p_samples);
+
+int main(int argc, char **argv) {
+    long ops = DEFAULT_OPS;
+    if (argc > 1) {
+        ops = strtol(argv[1], NULL, 10);
+    }
+    if (ops < 1000) {
+        ops = 1000;
+    }
+
+    // Producer/consumer records from two threads, so there is room for both of their samples
+    BenchSamples samples = {malloc(sizeof(unsigned int) * (size_t)ops * 2), 0, ops * 2};
+    if (samples.p_ns == NULL) {
+        return 1;
+    }
+
+    printf("======== allok Workloads ========\n");
+    printf("%ld ops per workload, latency of each op in ns\n", ops);
+
+    for (int workload = 0; workload < BENCH_WORKLOAD_COUNT; workload++) {
+        printf("\n%-20s%12s%10s%10s%10s\n", g_workload_names[workload], "Mops/s", "p50", "p99", "p999");
+
+        for (g_column = ALLOK_LINEAR_FIT; g_column <= LIBC_COLUMN; g_column++) {
+            // One untimed pass for throughput, then a second that times every op
+            g_seed = 7;
+            const double start = now_seconds();
+            const long done = run_workload(workload, ops, NULL);
+            const double elapsed = now_seconds() - start;
+
+            g_seed = 7;
+            samples.count = 0;
+            run_workload(workload, ops, &samples);
+
+            print_row(g_column_names[g_column], done, elapsed, &samples);
+            fflush(stdout);
+        }
+    }
+
+    free(samples.p_ns);
+    return 0;
+}
+
+double now_seconds() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
+static inline long now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000L + ts.tv_nsec;
+}
+
+static inline unsigned int next_random() {
+    g_seed = g_seed * 1103515245u + 12345u;
+    return g_seed >> 8;
+}
+
+static inline void record(BenchSamples *p_samples, const long start) {
+    if (p_samples != NULL && p_samples->count < p_samples->capacity) {
+        p_samples->p_ns[p_samples->count++] = (unsigned int)(now_ns() - start);
+    }
+}
+
+static inline long begin(const BenchSamples *p_samples) {
+    return p_samples != NULL ? now_ns() : 0;
+}
+
+void bench_init(const AllokBool thread_safe) {
+    if (g_column == LIBC_COLUMN) {
+        return;
+    }
+    akInit(ALLOK_DEFAULT_POOL_COUNT, ALLOK_DEFAULT_POOL_SIZE, (AkMemoryMapParams){(AllokType)g_column, ALLOK_DEFAULT_ALLOC_DYNAMIC, ALLOK_DEFAULT_ALLOC_SLAB, thread_safe, ALLOK_DEFAULT_ALLOC_REALLOC_HEADROOM, ALLOK_DEFAULT_LARGE_THRESHOLD, ALLOK_DEFAULT_HUGE_PAGES, ALLOK_DEFAULT_POOL_CACHE_SIZE, ALLOK_DEFAULT_POOL_CACHE_DECAY, ALLOK_DEFAULT_ALLOC_PER_CPU});
+}
+
+void bench_dump() {
+    if (g_column != LIBC_COLUMN) {
+        akDump();
+    }
+}
+
+void bench_heap_init(const AllokBool owned) {
+    // An owned heap queues the consumer's frees without a lock, otherwise both threads share the heap's lock
+    if (g_column == LIBC_COLUMN) {
+        return;
+    }
+    akMemoryMapAlloc(&g_heap, &g_heap_arena, ALLOK_DEFAULT_POOL_COUNT, ALLOK_DEFAULT_POOL_SIZE, (AkMemoryMapParams){(AllokType)g_column, ALLOK_DEFAULT_ALLOC_DYNAMIC, ALLOK_DEFAULT_ALLOC_SLAB, owned == ALLOK_TRUE ? ALLOK_FALSE : ALLOK_TRUE, ALLOK_DEFAULT_ALLOC_REALLOC_HEADROOM, ALLOK_DEFAULT_LARGE_THRESHOLD, ALLOK_DEFAULT_HUGE_PAGES, ALLOK_DEFAULT_POOL_CACHE_SIZE, ALLOK_DEFAULT_POOL_CACHE_DECAY, ALLOK_DEFAULT_ALLOC_PER_CPU});
+    if (owned == ALLOK_TRUE) {
+        akHeapSetOwner(g_heap);
+    }
+}
+
+void bench_heap_dump() {
+    akMemoryMapDestroy(&g_heap, &g_heap_arena);
+}
+
+static inline void *bench_alloc(const AllokSize size, BenchSamples *p_samples) {
+    void *ptr = NULL;
+    const long start = begin(p_samples);
+    if (g_column == LIBC_COLUMN) {
+        ptr = malloc(size);
+    } else if (g_heap != NULL) {
+        akHeapAlloc(&ptr, g_heap, size);
+    } else {
+        akAlloc(&ptr, size);
+    }
+    record(p_samples, start);
+
+    *(volatile char *)ptr = 1;
+    return ptr;
+}
+
+static inline void bench_free(void *ptr, BenchSamples *p_samples) {
+    const long start = begin(p_samples);
+    if (g_column == LIBC_COLUMN) {
+        free(ptr);
+    } else if (g_heap != NULL) {
+        akHeapFree(&ptr, g_heap);
+    } else {
+        akFree(&ptr);
+    }
+    record(p_samples, start);
+}
+
+static inline void *bench_realloc(void *ptr, const AllokSize size, BenchSamples *p_samples) {
+    void *result = NULL;
+    const long start = begin(p_samples);
+    if (g_column == LIBC_COLUMN) {
+        result = realloc(ptr, size);
+    } else {
+        akRealloc(&result, ptr, size);
+    }
+    record(p_samples, start);
+
+    ((volatile char *)result)[size - 1] = 1;
+    return result;
+}
+
+long churn(const long ops, const AllokBool random_sizes, BenchSamples *p_samples) {
+    void **slots = calloc(SLOT_COUNT, sizeof(void *));
+    long done = 0;
+
+    bench_init(ALLOK_FALSE);
+    while (done < ops) {
+        const unsigned int slot = next_random() % SLOT_COUNT;
+        if (slots[slot] != NULL) {
+            bench_free(slots[slot], p_samples);
+            slots[slot] = NULL;
+        } else {
+            // Random sizes are mostly small with a long tail, the same shape as typical heap traffic
+            AllokSize size = 64;
+            if (random_sizes == ALLOK_TRUE) {
+                const unsigned int roll = next_random() % 100;
+                size = roll < 70 ? 8 + next_random() % 249 : roll < 97 ? 257 + next_random() % 4096 : 4096 + next_random() % 60000;
+            }
+            slots[slot] = bench_alloc(size, p_samples);
+        }
+        done++;
+    }
+
+    for (int i = 0; i < SLOT_COUNT; i++) {
+        if (slots[i] != NULL) {
+            bench_free(slots[i], NULL);
+        }
+    }
+    bench_dump();
+
+    free(slots);
+    return done;
+}
+
+void *consumer_thread(void *arg) {
+    BenchConsumer *consumer = arg;
+    BenchQueue *queue = consumer->p_queue;
+
+    for (long i = 0; i < consumer->ops; i++) {
+        while (__atomic_load_n(&queue->head, __ATOMIC_ACQUIRE) == queue->tail) {
+            sched_yield();
+        }
+        void *ptr = queue->slots[queue->tail % QUEUE_SIZE];
+        __atomic_store_n(&queue->tail, queue->tail + 1, __ATOMIC_RELEASE);
+        bench_free(ptr, consumer->p_samples);
+    }
+
+    if (g_column != LIBC_COLUMN && g_heap == NULL) {
+        akThreadCacheFlush();
+    }
+
+    return NULL;
+}
+
+long producer_consumer(const long ops, const BenchWorkload workload, BenchSamples *p_samples) {
+    // Each message is allocated on this thread and freed on the consumer, so frees always cross threads
+    BenchQueue *queue = calloc(1, sizeof(BenchQueue));
+    const long messages = ops / 2;
+
+    BenchSamples consumer_samples = {0};
+    if (p_samples != NULL) {
+        consumer_samples.p_ns = p_samples->p_ns + p_samples->capacity / 2;
+        consumer_samples.capacity = p_samples->capacity / 2;
+        p_samples->capacity /= 2;
+    }
+
+    if (workload == BENCH_PRODUCER_CONSUMER) {
+        bench_init(ALLOK_TRUE);
+    } else {
+        bench_heap_init(workload == BENCH_HEAP_REMOTE_FREE ? ALLOK_TRUE : ALLOK_FALSE);
+    }
+    BenchConsumer consumer = {queue, p_samples != NULL ? &consumer_samples : NULL, messages};
+    pthread_t thread;
+    pthread_create(&thread, NULL, consumer_thread, &consumer);
+
+    for (long i = 0; i < messages; i++) {
+        void *ptr = bench_alloc(32 + next_random() % 480, p_samples);
+        while (__atomic_load_n(&queue->tail, __ATOMIC_ACQUIRE) + QUEUE_SIZE == queue->head) {
+            sched_yield();
+        }
+        queue->slots[queue->head % QUEUE_SIZE] = ptr;
+        __atomic_store_n(&queue->head, queue->head + 1, __ATOMIC_RELEASE);
+    }
+
+    pthread_join(thread, NULL);
+    if (workload != BENCH_PRODUCER_CONSUMER) {
+        bench_heap_dump();
+    } else if (g_column != LIBC_COLUMN) {
+        akThreadCacheFlush();
+        bench_dump();
+    }
+
+    // Move the consumer's samples up behind the producer's so the percentiles cover both
+    if (p_samples != NULL) {
+        p_samples->capacity *= 2;
+        for (long i = 0; i < consumer_samples.count; i++) {
+            p_samples->p_ns[p_samples->count++] = consumer_samples.p_ns[i];
+        }
+    }
+
+    free(queue);
+    return messages * 2;
+}
+
+long realloc_growth(const long ops, BenchSamples *p_samples) {
+    void *buffers[REALLOC_BUFFERS] = {0};
+    AllokSize sizes[REALLOC_BUFFERS] = {0};
+    long done = 0;
+
+    bench_init(ALLOK_FALSE);
+    while (done < ops) {
+        // Several buffers grow side by side so they get in each other's way, as appends to vectors do
+        const unsigned int index = next_random() % REALLOC_BUFFERS;
+        if (buffers[index] == NULL) {
+            sizes[index] = 16;
+            buffers[index] = bench_alloc(sizes[index], p_samples);
+        } else if (sizes[index] >= REALLOC_MAX_SIZE) {
+            bench_free(buffers[index], p_samples);
+            buffers[index] = NULL;
+        } else {
+            sizes[index] += 16 + next_random() % 240;
+            buffers[index] = bench_realloc(buffers[index], sizes[index], p_samples);
+        }
+        done++;
+    }
+
+    for (int i = 0; i < REALLOC_BUFFERS; i++) {
+        if (buffers[i] != NULL) {
+            bench_free(buffers[i], NULL);
+        }
+    }
+    bench_dump();
+
+    return done;
+}
+
+long arena_bump(const long ops, BenchSamples *p_samples) {
+    // allok claims from an arena and resets it, malloc has to free each object to get the same effect
+    void **claims = calloc(ARENA_RESET_CLAIMS, sizeof(void *));
+    AkMemoryArena *arena = NULL;
+    if (g_column != LIBC_COLUMN) {
+        akMemoryArenaAllocWithParams(&arena, ARENA_SIZE, (AkMemoryArenaParams){ALLOK_HUGE_PAGES_NONE, ALLOK_TRUE});
+    }
+
+    long done = 0;
+    long claimed = 0;
+    while (done < ops) {
+        const AllokSize size = 16 + next_random() % 240;
+        const long start = begin(p_samples);
+        if (arena != NULL) {
+            akMemoryArenaClaimAligned(&claims[claimed], arena, size, ALLOK_DEFAULT_ALIGNMENT);
+        } else {
+            claims[claimed] = malloc(size);
+        }
+        record(p_samples, start);
+        *(volatile char *)claims[claimed] = 1;
+        claimed++;
+        done++;
+
+        if (claimed == ARENA_RESET_CLAIMS || done == ops) {
+            if (arena != NULL) {
+                akMemoryArenaReset(arena);
+            } else {
+                for (long i = 0; i < claimed; i++) {
+                    free(claims[i]);
+                }
+            }
+            claimed = 0;
+        }
+    }
+
+    akMemoryArenaDestroy(&arena, ALLOK_TRUE);
+    free(claims);
+    return done;
+}
+
+long run_workload(const BenchWorkload workload, const long ops, BenchSamples *p_samples) {
+    switch (workload) {
+        case BENCH_FIXED_CHURN: {
+            return churn(ops, ALLOK_FALSE, p_samples);
+        }
+        case BENCH_RANDOM_SIZES: {
+            return churn(ops, ALLOK_TRUE, p_samples);
+        }
+        case BENCH_PRODUCER_CONSUMER:
+        case BENCH_HEAP_LOCKED:
+        case BENCH_HEAP_REMOTE_FREE: {
+            return producer_consumer(ops, workload, p_samples);
+        }
+        case BENCH_REALLOC_GROWTH: {
+            return realloc_growth(ops, p_samples);
+        }
+        case BENCH_ARENA_BUMP: {
+            return arena_bump(ops, p_samples);
+        }
+        default: {
+            return 0;
+        }
+    }
+}
+
+int compare_samples(const void *a, const void *b) {
+    const unsigned int x = *(const unsigned int *)a;
+    const unsigned int y = *(const unsigned int *)b;
+    return x < y ? -1 : x > y ? 1 : 0;
+}
+
+unsigned int percentile(const BenchSamples *p_samples, const long per_mille) {
+    if (p_samples->count == 0) {
+        return 0;
+    }
+    long index = p_samples->count * per_mille / 1000;
+    if (index >= p_samples->count) {
+        index = p_samples->count - 1;
+    }
+    return p_samples->p_ns[index];
+}
+
+void print_row(const char *p_name, const long ops, const double elapsed, BenchSamples *p_samples) {
+    qsort(p_samples->p_ns, (size_t)p_samples->count, sizeof(unsigned int), compare_samples);
+    printf("  %-18s%12.2f%10u%10u%10u\n", p_name, (double)ops / elapsed / 1e6, percentile(p_samples, 500), percentile(p_samples, 990), percentile(p_samples, 999));
+}
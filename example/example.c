@@ -101,10 +101,26 @@ int main(void) {
 void print_allok_metadata() {
     const AkMemoryMapMetadata metadata = akGetAllocMetadata();
     printf("\n================================\n");
-    printf("Pools Created         : %d\n", metadata.pools_created);
-    printf("Pools Freed           : %d\n", metadata.pools_freed);
-    printf("Blocks Created        : %d\n", metadata.blocks_created);
-    printf("Blocks Freed          : %d\n", metadata.blocks_freed);
+    printf("Pools Created         : %lu\n", metadata.pools_created);
+    printf("Pools Freed           : %lu\n", metadata.pools_freed);
+    printf("Blocks Created        : %lu\n", metadata.blocks_created);
+    printf("Blocks Freed          : %lu\n", metadata.blocks_freed);
+    printf("Slab Pages Created    : %lu\n", metadata.slab_pages_created);
+    printf("Slab Pages Freed      : %lu\n", metadata.slab_pages_freed);
+    printf("Slab Objects Created  : %lu\n", metadata.slab_objects_created);
+    printf("Slab Objects Freed    : %lu\n", metadata.slab_objects_freed);
+    printf("Reallocs In Place     : %lu\n", metadata.reallocs_in_place);
+    printf("Reallocs Shifted      : %lu\n", metadata.reallocs_shifted);
+    printf("Reallocs Moved        : %lu\n", metadata.reallocs_moved);
+    printf("Large Blocks Created  : %lu\n", metadata.large_blocks_created);
+    printf("Large Blocks Freed    : %lu\n", metadata.large_blocks_freed);
+    printf("Large Blocks Remapped : %lu\n", metadata.large_blocks_remapped);
+    printf("Pool Cache Hits       : %lu\n", metadata.pool_cache_hits);
+    printf("Pool Cache Misses     : %lu\n", metadata.pool_cache_misses);
+    printf("Allocs Failed         : %lu\n", metadata.allocs_failed);
+    printf("Peak Allocated        : %lu bytes\n", metadata.peak_alloc_size);
+    printf("Mapped                : %lu bytes\n", metadata.mapped_size);
+    printf("Header Overhead       : %lu bytes\n", metadata.header_size);
     printf("=================================\n");
 }
 
@@ -114,6 +130,13 @@ void print_allok_stats(AllokSize array_count) {
     printf("Memory Allocated : %lu bytes\n", akGetTotalAllocSize());
     printf("MemoryPool Count : %lu\n", akGetTotalPoolCount());
     printf("MemoryBlock Count: %lu\n", akGetTotalBlockCount());
+
+    AkMemoryMapReport report;
+    if (akGetHeapReport(&report) == ALLOK_SUCCESS) {
+        printf("Largest Free Gap : %lu bytes\n", report.largest_gap);
+        printf("Fragmentation    : %.1f%%\n", report.external_fragmentation * 100.0);
+        printf("Header Overhead  : %.1f%%\n", report.header_overhead * 100.0);
+    }
     printf("=================================\n");
 
     print_allok_metadata();
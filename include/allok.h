@@ -5,6 +5,52 @@
 #define ALLOK_DEFAULT_POOL_SIZE (8 * 1024)
 #define ALLOK_DEFAULT_ALLOC_TYPE ALLOK_BEST_FIT
 #define ALLOK_DEFAULT_ALLOC_DYNAMIC ALLOK_TRUE
+#define ALLOK_DEFAULT_ALLOC_SLAB ALLOK_TRUE
+#define ALLOK_DEFAULT_ALLOC_THREAD_SAFE ALLOK_FALSE
+#define ALLOK_DEFAULT_ALLOC_REALLOC_HEADROOM ALLOK_FALSE
+#define ALLOK_DEFAULT_LARGE_THRESHOLD (128 * 1024)
+#define ALLOK_DEFAULT_HUGE_PAGES ALLOK_HUGE_PAGES_NONE
+#define ALLOK_DEFAULT_POOL_CACHE_SIZE (1024 * 1024)
+#define ALLOK_DEFAULT_POOL_CACHE_DECAY 64
+#define ALLOK_DEFAULT_ALLOC_PER_CPU ALLOK_FALSE
+#define ALLOK_DEFAULT_ALIGNMENT 16
+
+#define ALLOK_SLAB_GRANULARITY 16
+#define ALLOK_SLAB_MAX_SIZE 256
+#define ALLOK_SLAB_CLASS_COUNT (ALLOK_SLAB_MAX_SIZE / ALLOK_SLAB_GRANULARITY)
+#define ALLOK_SLAB_PAGE_SIZE (64 * 1024)
+#ifndef ALLOK_SLAB_REGION_SIZE
+#define ALLOK_SLAB_REGION_SIZE (64 * 1024 * 1024)
+#endif
+
+#define ALLOK_THREAD_CACHE_BATCH 32
+#define ALLOK_THREAD_CACHE_MAX (2 * ALLOK_THREAD_CACHE_BATCH)
+
+#define ALLOK_REALLOC_HEADROOM_SHIFT 1
+
+#define ALLOK_COMPACT_EVACUATE_SHIFT 1
+#define ALLOK_COMPACT_SCAN_COST 64
+
+#define ALLOK_ARENA_GROWTH_FACTOR 2
+
+#define ALLOK_REPORT_GAP_BUCKET_COUNT 16
+#define ALLOK_REPORT_UTILIZATION_BUCKET_COUNT 10
+
+#define ALLOK_TRACE_DEFAULT_CAPACITY 4096
+// "AKTRACE1" read as a little endian 64 bit integer
+#define ALLOK_TRACE_MAGIC 0x3145434152544B41ULL
+#define ALLOK_TRACE_VERSION 1
+
+#define ALLOK_MAPPED_HEAP_MAGIC 0x5041454850414D41ULL
+#define ALLOK_MAPPED_HEAP_VERSION 2
+#define ALLOK_MAPPED_HEAP_CLASS_COUNT 64
+
+#define ALLOK_OS_PAGE_SIZE (4 * 1024)
+#define ALLOK_HUGE_PAGE_SIZE (2 * 1024 * 1024)
+
+#ifndef ALLOK_NON_TEMPORAL_THRESHOLD
+#define ALLOK_NON_TEMPORAL_THRESHOLD (4 * 1024 * 1024)
+#endif
 
 #define ALLOK_NULL ((void *)0)
 #define VPTR(p) ((void **)(&p))
@@ -28,10 +74,15 @@ typedef enum AllokResult {
     ALLOK_NULL_PARAM = 10,
     ALLOK_INVALID_SIZE = 11,
     ALLOK_INVALID_ADDR = 12,
+    ALLOK_INVALID_ALIGNMENT = 13,
+    ALLOK_UNSUPPORTED = 14,
     ALLOK_UNINITIALIZED = 15,
+    ALLOK_HANDLE_LOCKED = 16,
+    ALLOK_HEAP_CORRUPTED = 17,
     ALLOK_INSUFFICIENT_ARENA_MEMORY = 100,
     ALLOK_INSUFFICIENT_POOL_MEMORY = 150,
-    ALLOK_OS_MEMORY_ALLOC_FAILED = 1000
+    ALLOK_OS_MEMORY_ALLOC_FAILED = 1000,
+    ALLOK_OS_FILE_FAILED = 1001
 } AllokResult;
 
 typedef enum AllokType {
@@ -41,17 +92,70 @@ typedef enum AllokType {
     ALLOK_WORST_FIT
 } AllokType;
 
+typedef enum AllokHugePages {
+    ALLOK_HUGE_PAGES_NONE = 0,
+    ALLOK_HUGE_PAGES_TRANSPARENT,
+    ALLOK_HUGE_PAGES_EXPLICIT
+} AllokHugePages;
+
+typedef enum AllokHeapEntryType {
+    ALLOK_HEAP_ENTRY_POOL = 0,
+    ALLOK_HEAP_ENTRY_BLOCK,
+    ALLOK_HEAP_ENTRY_GAP,
+    ALLOK_HEAP_ENTRY_LARGE_BLOCK,
+    ALLOK_HEAP_ENTRY_SLAB_PAGE
+} AllokHeapEntryType;
+
+typedef enum AllokTraceOp {
+    ALLOK_TRACE_ALLOC = 0,
+    ALLOK_TRACE_CALLOC,
+    ALLOK_TRACE_REALLOC,
+    ALLOK_TRACE_FREE,
+} AllokTraceOp;
+
+typedef enum AllokMemKernel {
+    ALLOK_MEM_KERNEL_BYTE = 0,
+    ALLOK_MEM_KERNEL_WORD,
+    ALLOK_MEM_KERNEL_SSE2,
+    ALLOK_MEM_KERNEL_AVX2,
+    ALLOK_MEM_KERNEL_AVX512,
+    ALLOK_MEM_KERNEL_NEON,
+    ALLOK_MEM_KERNEL_COUNT
+} AllokMemKernel;
+
+typedef struct AkSpinLock {
+    volatile long state;
+} AkSpinLock;
+
+typedef struct AkMemoryArenaParams {
+    AllokHugePages huge_pages;
+    AllokBool is_growable;
+} AkMemoryArenaParams;
+
 typedef struct AkMemoryArena {
+    AkMemoryArenaParams params;
     AllokSize alloc_size;
     AllokSize size;
     void *p_start;
     void *p_current;
     struct AkMemoryArena *p_next;
     struct AkMemoryArena *p_prev;
+    struct AkMemoryArena *p_active;
+    AllokSize generation;
 } AkMemoryArena;
 
+typedef struct AkMemoryArenaMark {
+    AkMemoryArena *p_arena;
+    AkMemoryArena *p_chunk;
+    void *p_current;
+    AllokSize size;
+    AllokSize generation;
+} AkMemoryArenaMark;
+
 typedef struct AkMemoryPool AkMemoryPool;
 typedef struct AkMemoryMap AkMemoryMap;
+typedef struct AkCpuCache AkCpuCache;
+typedef struct AkMappedHeap AkMappedHeap;
 
 typedef struct AkMemoryBlock {
     AllokSize size;
@@ -59,38 +163,230 @@ typedef struct AkMemoryBlock {
     struct AkMemoryBlock *p_next;
     struct AkMemoryBlock *p_prev;
     AkMemoryPool *p_parent;
+    volatile AllokSize state;
 } AkMemoryBlock;
 
+typedef struct AkTreeNode {
+    AllokSize key;
+    AllokSize value;
+    AllokSize max_value;
+    AllokSize height;
+    struct AkTreeNode *p_left;
+    struct AkTreeNode *p_right;
+} AkTreeNode;
+
+typedef struct AkFreeGap {
+    AkTreeNode node;
+    AkMemoryBlock *p_prev_block;
+} AkFreeGap;
+
 typedef struct AkMemoryPool {
+    AkTreeNode fit_node;
+    AkTreeNode addr_node;
     AllokSize alloc_size;
     AllokSize size;
+    AllokSize largest_gap;
+    AllokSize cache_stamp;
     void *p_start;
     AkMemoryBlock *p_head;
     AkMemoryBlock *p_tail;
+    AkTreeNode *p_gap_root;
     AkMemoryPool *p_next;
     AkMemoryPool *p_prev;
     AkMemoryMap *p_parent_map;
 } AkMemoryPool;
 
+typedef struct AkLargeBlock {
+    AkTreeNode addr_node;
+    AllokSize alloc_size;
+    AllokSize size;
+    void *p_start;
+    struct AkLargeBlock *p_next;
+    struct AkLargeBlock *p_prev;
+    AkMemoryMap *p_parent_map;
+    volatile AllokSize state;
+} AkLargeBlock;
+
+typedef struct AkSlabPage {
+    AllokSize object_size;
+    AllokSize capacity;
+    AllokSize used;
+    AllokSize carved;
+    void *p_start;
+    void *p_free;
+    struct AkSlabPage *p_next;
+    struct AkSlabPage *p_prev;
+    AkMemoryMap *p_parent_map;
+    AllokByte live[ALLOK_SLAB_PAGE_SIZE / ALLOK_SLAB_GRANULARITY / 8];
+} AkSlabPage;
+
+typedef struct AkSlabClass {
+    AllokSize object_size;
+    AkSlabPage *p_partial_head;
+} AkSlabClass;
+
+typedef struct AkSlabRegion {
+    AllokSize alloc_size;
+    AllokSize committed_size;
+    AllokSize size;
+    void *p_start;
+    AkSlabPage *p_free_pages;
+    AkSlabClass classes[ALLOK_SLAB_CLASS_COUNT];
+} AkSlabRegion;
+
 typedef struct AkMemoryMapParams {
     AllokType type;
     AllokBool is_dynamic;
+    AllokBool is_slab_enabled;
+    AllokBool is_thread_safe;
+    AllokBool is_realloc_headroom;
+    AllokSize large_threshold;
+    AllokHugePages huge_pages;
+    AllokSize pool_cache_size;
+    AllokSize pool_cache_decay;
+    AllokBool is_per_cpu;
 } AkMemoryMapParams;
 
 typedef struct AkMemoryMapMetadata {
-    int blocks_created;
-    int blocks_freed;
-    int pools_created;
-    int pools_freed;
+    AllokSize blocks_created;
+    AllokSize blocks_freed;
+    AllokSize pools_created;
+    AllokSize pools_freed;
+    AllokSize slab_objects_created;
+    AllokSize slab_objects_freed;
+    AllokSize slab_pages_created;
+    AllokSize slab_pages_freed;
+    AllokSize reallocs_in_place;
+    AllokSize reallocs_shifted;
+    AllokSize reallocs_moved;
+    AllokSize large_blocks_created;
+    AllokSize large_blocks_freed;
+    AllokSize large_blocks_remapped;
+    AllokSize pool_cache_hits;
+    AllokSize pool_cache_misses;
+    AllokSize allocs_failed;
+    AllokSize remote_frees;
+    AllokSize handles_moved;
+    AllokSize pools_compacted;
+    AllokSize alloc_size;
+    AllokSize peak_alloc_size;
+    AllokSize mapped_size;
+    AllokSize header_size;
+    AllokSize pool_count;
+    AllokSize block_count;
+    AllokSize large_block_count;
+    AllokSize slab_object_count;
 } AkMemoryMapMetadata;
 
+typedef struct AkHeapEntry {
+    AllokHeapEntryType type;
+    void *p_start;
+    AllokSize size;
+    AllokSize used_size;
+    const AkMemoryPool *p_pool;
+} AkHeapEntry;
+
+typedef AllokBool (*AkHeapWalkFn)(const AkHeapEntry *p_entry, void *p_user);
+
+typedef struct AkMemoryMapReport {
+    AllokSize pool_count;
+    AllokSize pool_size;
+    AllokSize pool_used_size;
+    AllokSize pool_free_size;
+    double min_pool_utilization;
+    double max_pool_utilization;
+    AllokSize pool_utilization_histogram[ALLOK_REPORT_UTILIZATION_BUCKET_COUNT];
+    AllokSize gap_count;
+    AllokSize gap_size;
+    AllokSize largest_gap;
+    AllokSize gap_histogram[ALLOK_REPORT_GAP_BUCKET_COUNT];
+    double external_fragmentation;
+    AllokSize cached_pool_count;
+    AllokSize cached_pool_size;
+    AllokSize large_block_count;
+    AllokSize large_block_size;
+    AllokSize slab_page_count;
+    AllokSize slab_used_size;
+    AllokSize alloc_size;
+    AllokSize mapped_size;
+    AllokSize header_size;
+    double header_overhead;
+} AkMemoryMapReport;
+
+typedef struct AkTraceHeader {
+    unsigned long long magic;
+    unsigned int version;
+    unsigned int event_size;
+} AkTraceHeader;
+
+typedef struct AkTraceEvent {
+    unsigned long long timestamp;
+    unsigned long long id;
+    unsigned long long src_id;
+    unsigned long long size;
+    unsigned int thread;
+    unsigned short op;
+    unsigned short alignment_shift;
+} AkTraceEvent;
+
+// Everything inside a MappedHeap links by byte offset from the start of the mapping, so it can be mapped at any address
+typedef struct AkMappedBlock {
+    unsigned long long size;
+    unsigned long long prev_size;
+} AkMappedBlock;
+
+typedef struct AkMappedHeapHeader {
+    unsigned long long magic;
+    unsigned int version;
+    unsigned int is_clean;
+    unsigned long long size;
+    unsigned long long top;
+    unsigned long long tail;
+    unsigned long long root;
+    unsigned long long alloc_size;
+    unsigned long long block_count;
+    AkSpinLock lock;
+    volatile AllokSize remote_head;
+    unsigned long long remote_frees;
+    unsigned long long free_heads[ALLOK_MAPPED_HEAP_CLASS_COUNT];
+} AkMappedHeapHeader;
+
+typedef struct AkHandle {
+    void *p_data;
+    AllokSize size;
+    AllokSize lock_count;
+    struct AkHandle *p_next;
+    struct AkHandle *p_prev;
+} AkHandle;
+
 typedef struct AkMemoryMap {
     AkMemoryMapParams params;
     AkMemoryMapMetadata metadata;
     AllokSize pool_count;
+    AllokSize pool_sequence;
     void *p_start;
     AkMemoryPool *p_pool_head;
     AkMemoryPool *p_pool_tail;
+    AkTreeNode *p_pool_root;
+    AkTreeNode *p_pool_addr_root;
+    AllokSize pool_cache_count;
+    AllokSize pool_cache_size;
+    AllokSize pool_cache_clock;
+    AkMemoryPool *p_pool_cache_head;
+    AkMemoryPool *p_pool_cache_tail;
+    AllokSize large_count;
+    AkLargeBlock *p_large_head;
+    AkTreeNode *p_large_root;
+    AkSlabRegion slab;
+    AkCpuCache *p_cpu_caches;
+    AllokSize cpu_count;
+    AkHandle *p_handle_head;
+    AkHandle *p_compact_cursor;
+    AllokSize handle_count;
+    AkSpinLock lock;
+    void *volatile p_owner;
+    void *volatile p_remote_head;
+    void *volatile p_remote_block_head;
 } AkMemoryMap;
 
 /**
@@ -111,6 +407,29 @@ AllokResult akMemset(void **pp_result, const AllokByte value, const AllokSize si
  */
 AllokResult akMemcpy(void **pp_result, const void *p_src, const AllokSize size);
 
+/**
+ * Copy a region of memory to another, where the two regions may overlap
+ * @param pp_result A pointer to the start of memory to copy to
+ * @param p_src A pointer to the data to copy
+ * @param size The size of memory to copy
+ * @return AllocResult
+ */
+AllokResult akMemmove(void **pp_result, const void *p_src, const AllokSize size);
+
+/**
+ * Get the kernel used by akMemset, akMemcpy and akMemmove, detecting the widest one the CPU supports on first use
+ * @param p_result A pointer to store the kernel in
+ * @return AllocResult
+ */
+AllokResult akMemKernelGet(AllokMemKernel *p_result);
+
+/**
+ * Force the kernel used by akMemset, akMemcpy and akMemmove
+ * @param kernel The kernel to use, ALLOK_UNSUPPORTED is returned if the CPU or build lacks it
+ * @return AllocResult
+ */
+AllokResult akMemKernelSet(const AllokMemKernel kernel);
+
 
 /**
  * Allocate a specified amount of heap memory from the OS
@@ -120,8 +439,23 @@ AllokResult akMemcpy(void **pp_result, const void *p_src, const AllokSize size);
  */
 AllokResult akMemoryArenaAlloc(AkMemoryArena **pp_result, const AllokSize size);
 
+/**
+ * Allocate a specified amount of heap memory from the OS with parameters
+ * With params.huge_pages set, arenas of at least ALLOK_HUGE_PAGE_SIZE are rounded up to a 2 MiB aligned
+ * huge page mapping, falling back to transparent then regular pages when huge pages are unavailable
+ * With params.is_growable set, a claim that does not fit expands the arena in place with mremap on Linux,
+ * or chains a new chunk ALLOK_ARENA_GROWTH_FACTOR times larger through p_next, growable arenas must be
+ * destroyed recursively
+ * @param pp_result A pointer to the pointer of a MemoryArena to initialize
+ * @param size The amount of memory to allocate to the arena
+ * @param params Parameters to initialize the MemoryArena with
+ * @return AllocResult
+ */
+AllokResult akMemoryArenaAllocWithParams(AkMemoryArena **pp_result, const AllokSize size, const AkMemoryArenaParams params);
+
 /**
  * Claim a specified portion of memory from a MemoryArena
+ * Growable arenas chain a new chunk when the claim does not fit
  * @param pp_result A pointer to the result address of the arena
  * @param p_arena The MemoryArena to claim memory from
  * @param size The amount of memory to claim
@@ -129,13 +463,54 @@ AllokResult akMemoryArenaAlloc(AkMemoryArena **pp_result, const AllokSize size);
  */
 AllokResult akMemoryArenaClaim(void **pp_result, AkMemoryArena *p_arena, const AllokSize size);
 
+/**
+ * Claim a specified portion of memory from a MemoryArena starting at an aligned address
+ * Padding needed to reach the alignment is claimed from the arena as well
+ * @param pp_result A pointer to the result address of the arena
+ * @param p_arena The MemoryArena to claim memory from
+ * @param size The amount of memory to claim
+ * @param alignment The alignment of the result address, must be a power of two
+ * @return AllocResult
+ */
+AllokResult akMemoryArenaClaimAligned(void **pp_result, AkMemoryArena *p_arena, const AllokSize size, const AllokSize alignment);
+
 /**
  * Reset MemoryArena to initialized state, allowing it to overwrite previously claimed memory
+ * Growable arenas keep their largest chained chunk and return the others to the OS
  * @param p_arena The MemoryArena to reset
  * @return AllocResult
  */
 AllokResult akMemoryArenaReset(AkMemoryArena *p_arena);
 
+/**
+ * Save the current top of a MemoryArena so later claims can be dropped together with akMemoryArenaRollback
+ * @param p_result A pointer to the ArenaMark to save the top into
+ * @param p_arena The MemoryArena to mark
+ * @return AllocResult
+ */
+AllokResult akMemoryArenaMark(AkMemoryArenaMark *p_result, AkMemoryArena *p_arena);
+
+/**
+ * Drop every claim made since an ArenaMark was taken in O(1), including claims in chunks chained since
+ * Chained chunks are kept for reuse. Marks taken before an akMemoryArenaReset, or before akMemoryArenaFree destroyed a
+ * chunk, are stale and rejected without touching their chunk. The arena itself must still be alive
+ * @param p_mark A pointer to the ArenaMark to roll its MemoryArena back to
+ * @return AllocResult, ALLOK_INVALID_ADDR for a stale ArenaMark
+ */
+AllokResult akMemoryArenaRollback(const AkMemoryArenaMark *p_mark);
+
+#if defined(__GNUC__) || defined(__clang__)
+#define ALLOK_CONCAT_INNER(a, b) a##b
+#define ALLOK_CONCAT(a, b) ALLOK_CONCAT_INNER(a, b)
+
+/**
+ * Mark p_arena and roll it back automatically however the enclosing scope is left
+ */
+#define ALLOK_ARENA_SCOPE(p_arena)                                                                                      \
+    AkMemoryArenaMark ALLOK_CONCAT(ak_arena_scope_, __LINE__) __attribute__((cleanup(akMemoryArenaRollback))) = {0};   \
+    akMemoryArenaMark(&ALLOK_CONCAT(ak_arena_scope_, __LINE__), (p_arena))
+#endif
+
 /**
  * Free a portion of memory within a MemoryArena, allowing it to overwrite it
  * @param pp_target A pointer to the start of memory to free from the arena
@@ -166,6 +541,14 @@ void akMemoryArenaDestroy(AkMemoryArena **pp_arena, const AllokBool recursive);
  */
 AllokResult akMemoryMapAlloc(AkMemoryMap **pp_map_result, AkMemoryArena **pp_arena_result, const AllokSize init_pool_count, const AllokSize init_pool_size, const AkMemoryMapParams params);
 
+/**
+ * Destroy a MemoryMap and every pool, LargeBlock and slab page it holds, invalidating all memory allocated from it
+ * Sets the map and arena to ALLOC_NULL
+ * @param pp_map A pointer to a pointer of the MemoryMap to destroy
+ * @param pp_arena A pointer to a pointer of the MemoryArena returned with the MemoryMap by akMemoryMapAlloc
+ */
+void akMemoryMapDestroy(AkMemoryMap **pp_map, AkMemoryArena **pp_arena);
+
 /**
  * Initialize a MemoryPool of a specified size of heap memory from the OS
  * @param pp_result A pointer to a pointer of the MemoryPool that will be initialized
@@ -185,6 +568,22 @@ AllokResult akMemoryPoolAlloc(AkMemoryPool **pp_result, AkMemoryMap *p_map, cons
 AllokResult akMemoryPoolFree(AkMemoryPool **pp_pool, const AllokBool recursive);
 
 
+/**
+ * Retire a MemoryPool that no longer holds any MemoryBlock's from its parent MemoryMap
+ * The pool is kept in the map's empty-pool cache when it fits within params.pool_cache_size, otherwise it is freed
+ * Sets the pool to ALLOC_NULL
+ * @param pp_pool A pointer to a pointer of the empty MemoryPool to retire
+ * @return AllocResult
+ */
+AllokResult akMemoryPoolRetire(AkMemoryPool **pp_pool);
+
+/**
+ * Release every MemoryPool held in a MemoryMap's empty-pool cache back to the OS
+ * @param p_map The MemoryMap whose cache to release
+ */
+void akMemoryPoolCacheRelease(AkMemoryMap *p_map);
+
+
 /**
  * Initialize a MemoryBlock
  * @param pp_result A pointer to a pointer of the MemoryBlock to initialize
@@ -204,6 +603,17 @@ AllokResult akMemoryBlockCreate(AkMemoryBlock **pp_result, AkMemoryPool *p_pool,
  */
 AllokResult akMemoryBlockFind(AkMemoryBlock **pp_result, const AkMemoryMap *p_map, const void *ptr);
 
+/**
+ * Resolve the MemoryBlock that owns ptr from the header stored directly before it
+ * The owning MemoryPool is first found in O(log n) by address, so foreign pointers return ALLOK_NOT_FOUND
+ * without being dereferenced, use akMemoryBlockFind as a slow path
+ * @param pp_result A pointer to a pointer of the resolved MemoryBlock
+ * @param p_map The MemoryMap the MemoryBlock's parent MemoryPool must belong to
+ * @param ptr A pointer to the beginning of memory previously returned by a MemoryBlock
+ * @return AllocResult
+ */
+AllokResult akMemoryBlockFromPtr(AkMemoryBlock **pp_result, const AkMemoryMap *p_map, const void *ptr);
+
 /**
  * Free a MemoryBlock from its allocated memory within its parent MemoryPool
  * Sets the block to ALLOC_NULL
@@ -211,9 +621,317 @@ AllokResult akMemoryBlockFind(AkMemoryBlock **pp_result, const AkMemoryMap *p_ma
  */
 void akMemoryBlockFree(AkMemoryBlock **pp_block);
 
+/**
+ * Map a LargeBlock of its own for an allocation at or above params.large_threshold
+ * LargeBlock's are tracked apart from the MemoryPool's so they never enter the fit searches
+ * @param pp_result A pointer to a pointer of the LargeBlock that will be initialized
+ * @param p_map The MemoryMap that tracks the LargeBlock
+ * @param size The amount of bytes to allocate
+ * @param alignment The alignment of p_start, must be a power of two
+ * @return AllocResult
+ */
+AllokResult akLargeBlockAlloc(AkLargeBlock **pp_result, AkMemoryMap *p_map, const AllokSize size, const AllokSize alignment);
+
+/**
+ * Resolve the LargeBlock that owns ptr by address in O(log n)
+ * @param pp_result A pointer to a pointer of the resolved LargeBlock
+ * @param p_map The MemoryMap that tracks the LargeBlock
+ * @param ptr A pointer to the beginning of memory previously returned by a LargeBlock
+ * @return AllocResult
+ */
+AllokResult akLargeBlockFind(AkLargeBlock **pp_result, const AkMemoryMap *p_map, const void *ptr);
+
+/**
+ * Resize the mapping of a LargeBlock without copying its data, the LargeBlock may move
+ * Growth needs mremap and returns ALLOK_UNSUPPORTED on other platforms, shrinking always succeeds
+ * @param pp_block A pointer to a pointer of the LargeBlock to resize, updated if it moved
+ * @param size The amount of bytes the LargeBlock must hold
+ * @return AllocResult
+ */
+AllokResult akLargeBlockResize(AkLargeBlock **pp_block, const AllokSize size);
+
+/**
+ * Free a LargeBlock and return its mapping to the OS immediately
+ * Sets the block to ALLOC_NULL
+ * @param pp_block A pointer to a pointer of the LargeBlock to free
+ * @return AllocResult
+ */
+AllokResult akLargeBlockFree(AkLargeBlock **pp_block);
+
+/**
+ * Allocate an object from the size-class slab of a MemoryMap
+ * The slab region is reserved on first use, sizes above ALLOK_SLAB_MAX_SIZE are rejected
+ * @param pp_result A pointer to the starting address in memory that will be allocated
+ * @param p_map The MemoryMap that owns the slab region
+ * @param size The amount of bytes to allocate
+ * @return AllocResult
+ */
+AllokResult akSlabAlloc(void **pp_result, AkMemoryMap *p_map, const AllokSize size);
+
+/**
+ * Return an object to the size-class slab of a MemoryMap
+ * Sets the pointer to ALLOC_NULL
+ * @param pp_target A pointer to the start of memory allocated by akSlabAlloc
+ * @param p_map The MemoryMap that owns the slab region
+ * @return AllocResult
+ */
+AllokResult akSlabFree(void **pp_target, AkMemoryMap *p_map);
+
+/**
+ * Resolve the SlabPage that holds ptr
+ * @param pp_result A pointer to a pointer of the SlabPage, will be ALLOC_NULL if not found
+ * @param p_map The MemoryMap that owns the slab region
+ * @param ptr A pointer to the beginning of memory previously returned by akSlabAlloc
+ * @return AllocResult
+ */
+AllokResult akSlabPageFind(AkSlabPage **pp_result, const AkMemoryMap *p_map, const void *ptr);
+
+/**
+ * Release the slab region of a MemoryMap back to the OS, invalidating every object allocated from it
+ * @param p_map The MemoryMap that owns the slab region
+ */
+void akSlabRegionFree(AkMemoryMap *p_map);
+
+/**
+ * Visit every MemoryPool of a MemoryMap with the MemoryBlock's and free gaps inside it in address order,
+ * followed by every LargeBlock and every committed SlabPage
+ * size is the capacity of the entry and used_size the bytes of it in use, p_pool is set for pools, blocks and gaps
+ * The MemoryMap must not be changed while it is walked, including from the callback
+ * @param p_map The MemoryMap to walk
+ * @param fn The callback to call for each entry, returning ALLOK_FALSE stops the walk
+ * @param p_user A pointer passed through to each call of fn
+ * @return AllocResult
+ */
+AllokResult akMemoryMapWalk(const AkMemoryMap *p_map, AkHeapWalkFn fn, void *p_user);
+
+/**
+ * Summarize the utilization and fragmentation of a MemoryMap
+ * Only pools, indexed free gaps, LargeBlock's and SlabPage's are visited, never individual MemoryBlock's
+ * gap_histogram bucket i counts gaps of 32 << i bytes up to 64 << i, the last bucket also counts anything larger
+ * pool_utilization_histogram bucket i counts pools whose used bytes are at least i tenths of their size
+ * external_fragmentation is 1 - largest_gap / pool_free_size, 0 when all free pool memory is one gap
+ * header_overhead is the share of mapped_size taken by pool, block, LargeBlock and SlabPage headers
+ * @param p_result A pointer to the report to fill
+ * @param p_map The MemoryMap to summarize
+ * @return AllocResult
+ */
+AllokResult akMemoryMapReport(AkMemoryMapReport *p_result, const AkMemoryMap *p_map);
+
+/**
+ * Allocate a specified amount of heap memory from a MemoryMap made with akMemoryMapAlloc
+ * The map's own params pick the fit strategy, slab, large block and pool cache behaviour
+ * With params.is_thread_safe set the map's lock is taken for every call, there is no per-thread cache
+ * @param pp_result A pointer to the starting address in memory that will be allocated
+ * @param p_map The MemoryMap to allocate from
+ * @param size The amount of bytes to allocate
+ * @return AllocResult
+ */
+AllokResult akHeapAlloc(void **pp_result, AkMemoryMap *p_map, const AllokSize size);
+
+/**
+ * Allocate a specified amount of heap memory starting at an aligned address from a MemoryMap
+ * @param pp_result A pointer to the starting address in memory that will be allocated
+ * @param p_map The MemoryMap to allocate from
+ * @param size The amount of bytes to allocate
+ * @param alignment The alignment of the result address, must be a power of two
+ * @return AllocResult
+ */
+AllokResult akHeapAllocAligned(void **pp_result, AkMemoryMap *p_map, const AllokSize size, AllokSize alignment);
+
+/**
+ * Allocate a specified amount of heap memory from a MemoryMap and set all its bytes to 0
+ * @param pp_result A pointer to the starting address in memory that has been allocated
+ * @param p_map The MemoryMap to allocate from
+ * @param size The amount of bytes to allocate
+ * @return AllocResult
+ */
+AllokResult akHeapCalloc(void **pp_result, AkMemoryMap *p_map, const AllokSize size);
+
+/**
+ * Reallocate memory previously allocated from a MemoryMap, copying all data from the p_src
+ * @param pp_result A pointer to the starting address in memory that has been reallocated
+ * @param p_map The MemoryMap p_src was allocated from
+ * @param p_src A pointer to memory that has been previously allocated
+ * @param size The amount of bytes to reallocate
+ * @return AllocResult
+ */
+AllokResult akHeapRealloc(void **pp_result, AkMemoryMap *p_map, void *p_src, const AllokSize size);
+
+/**
+ * Free memory previously allocated from a MemoryMap
+ * When another thread owns the map the memory is claimed and pushed onto one of the map's lock-free remote free queues
+ * instead, and freed by the owner in a batch on its next akHeapAlloc, akHeapRealloc or akHeapCollect. Pool and large
+ * blocks are found from the header in front of the pointer, so the pointer must come from some MemoryMap
+ * Sets the pointer to ALLOC_NULL
+ * @param pp_target A pointer to the start of memory allocated
+ * @param p_map The MemoryMap the memory was allocated from
+ * @return AllocResult, ALLOK_NOT_FOUND or ALLOK_INVALID_ADDR when the pointer is not live memory of the map
+ */
+AllokResult akHeapFree(void **pp_target, AkMemoryMap *p_map);
+
+/**
+ * Make the calling thread the owner of a MemoryMap
+ * Other threads may then free its memory with akHeapFree without taking any lock, when the map is not thread safe
+ * they may not allocate or reallocate from it and get ALLOK_UNSUPPORTED, and the owner takes no lock either
+ * @param p_map The MemoryMap to own
+ * @return AllocResult
+ */
+AllokResult akHeapSetOwner(AkMemoryMap *p_map);
+
+/**
+ * Free every pointer other threads have queued on a MemoryMap with akHeapFree
+ * @param p_map The MemoryMap to collect
+ * @return AllocResult
+ */
+AllokResult akHeapCollect(AkMemoryMap *p_map);
+
+/**
+ * Open a MappedHeap backed by a file, creating and formatting the file when it is empty or missing
+ * Blocks and free lists are linked by offsets rather than pointers, so a later process can open the same file and
+ * find every allocation intact, reached through akMappedHeapGetRoot. A file that was not closed cleanly has its
+ * blocks walked and its free lists rebuilt before use, and is rejected if the walk finds damage
+ * The heap never grows past its size. The file is locked exclusively with flock or LockFileEx until it is closed,
+ * so a second open from this or any other process fails
+ * @param pp_result A pointer to the MappedHeap that has been opened
+ * @param path The path of the heap file
+ * @param size The size of a new heap file, rounded up to ALLOK_OS_PAGE_SIZE and ignored for existing files
+ * @return AllocResult, ALLOK_HEAP_CORRUPTED when an existing file fails the check, ALLOK_OS_FILE_FAILED when the
+ * file can't be opened or another MappedHeap has it open
+ */
+AllokResult akMappedHeapOpenFile(AkMappedHeap **pp_result, const char *path, const AllokSize size);
+
+/**
+ * Open a MappedHeap in shared memory that several processes allocate from at once, creating it when it does not exist
+ * A named heap lives in a shm_open object until akMappedHeapUnlinkShared, an unnamed one is a memfd that only a
+ * forked child inherits. Processes pass messages as offsets from akMappedHeapAllocOffset, which every mapping resolves
+ * without a copy. Allocation takes the spin lock in the header, while akMappedHeapFree only claims the block and pushes it onto a
+ * lock-free stack that the next allocation or check merges back into the free lists
+ * The lock holds its owner's process id. A process that dies holding it is taken over by the next waiter, which rebuilds
+ * the free lists first; if the walk finds the dead owner's update half done, every later call that needs the lock gets
+ * ALLOK_HEAP_CORRUPTED. Blocks it had taken off the free stack stay pending and are lost. An owner that is alive but
+ * stopped, or a thread of the waiter's own process that exits holding the lock, still blocks everyone
+ * @param pp_result A pointer to the MappedHeap that has been opened
+ * @param name The shm_open name of the heap, or ALLOK_NULL for an unnamed heap on Linux
+ * @param size The size of a new heap, rounded up to ALLOK_OS_PAGE_SIZE and ignored for existing heaps except on Windows
+ * @return AllocResult, ALLOK_UNINITIALIZED when the creator never finished formatting the heap
+ */
+AllokResult akMappedHeapOpenShared(AkMappedHeap **pp_result, const char *name, const AllokSize size);
+
+/**
+ * Remove the name of a shared MappedHeap, the memory is released once every process has closed it
+ * @param name The shm_open name of the heap
+ * @return AllocResult
+ */
+AllokResult akMappedHeapUnlinkShared(const char *name);
+
+/**
+ * Flush a MappedHeap to its file, mark it clean and unmap it, the MappedHeap is set to ALLOK_NULL
+ * A shared heap is only unmapped, it stays open in every other process
+ * @param pp_heap A pointer to the MappedHeap to close
+ * @return AllocResult
+ */
+AllokResult akMappedHeapClose(AkMappedHeap **pp_heap);
+
+/**
+ * Allocate a specified amount of memory from a MappedHeap
+ * Pointers stored inside the heap should be converted with akMappedHeapToOffset, as the next mapping may start elsewhere
+ * @param pp_result A pointer to the starting address in memory that has been allocated
+ * @param p_heap A pointer to the MappedHeap to allocate from
+ * @param size The amount of bytes to allocate
+ * @return AllocResult, ALLOK_HEAP_CORRUPTED when a process died holding a shared heap's lock and left it damaged
+ */
+AllokResult akMappedHeapAlloc(void **pp_result, AkMappedHeap *p_heap, const AllokSize size);
+
+/**
+ * Free memory allocated from a MappedHeap, merging it with free neighbours, the pointer is set to ALLOK_NULL
+ * A pointer that is not the start of a live block, including one already freed, gets ALLOK_INVALID_ADDR
+ * @param pp_target A pointer to the start of memory allocated
+ * @param p_heap A pointer to the MappedHeap it was allocated from
+ * @return AllocResult
+ */
+AllokResult akMappedHeapFree(void **pp_target, AkMappedHeap *p_heap);
+
+/**
+ * Allocate a specified amount of memory from a MappedHeap and return its offset, ready to hand to another process
+ * @param p_result A pointer to the offset of the memory that has been allocated
+ * @param p_heap A pointer to the MappedHeap to allocate from
+ * @param size The amount of bytes to allocate
+ * @return AllocResult
+ */
+AllokResult akMappedHeapAllocOffset(AllokSize *p_result, AkMappedHeap *p_heap, const AllokSize size);
+
+/**
+ * Free memory from a MappedHeap by the offset akMappedHeapAllocOffset returned, in any process that has the heap open
+ * @param p_heap A pointer to the MappedHeap it was allocated from
+ * @param offset The offset of the memory to free
+ * @return AllocResult
+ */
+AllokResult akMappedHeapFreeOffset(AkMappedHeap *p_heap, const AllokSize offset);
+
+/**
+ * Set the allocation a re-opened MappedHeap hands back from akMappedHeapGetRoot, ALLOK_NULL clears it
+ * @param p_heap A pointer to the MappedHeap
+ * @param ptr A pointer to memory allocated from the heap
+ * @return AllocResult
+ */
+AllokResult akMappedHeapSetRoot(AkMappedHeap *p_heap, void *ptr);
+
+/**
+ * Get the root allocation of a MappedHeap
+ * @param pp_result A pointer to the root allocation at its current address
+ * @param p_heap A pointer to the MappedHeap
+ * @return AllocResult, ALLOK_NOT_FOUND when no root is set
+ */
+AllokResult akMappedHeapGetRoot(void **pp_result, AkMappedHeap *p_heap);
+
+/**
+ * Convert an address inside a MappedHeap to an offset that stays valid across mappings
+ * @param p_result A pointer to the offset
+ * @param p_heap A pointer to the MappedHeap
+ * @param ptr An address inside the heap
+ * @return AllocResult
+ */
+AllokResult akMappedHeapToOffset(AllokSize *p_result, const AkMappedHeap *p_heap, const void *ptr);
+
+/**
+ * Convert an offset from akMappedHeapToOffset back to an address in the current mapping
+ * @param pp_result A pointer to the address
+ * @param p_heap A pointer to the MappedHeap
+ * @param offset The offset to convert
+ * @return AllocResult
+ */
+AllokResult akMappedHeapFromOffset(void **pp_result, const AkMappedHeap *p_heap, const AllokSize offset);
+
+/**
+ * Walk every block and free list of a MappedHeap and verify the links, sizes and counters agree
+ * @param p_heap A pointer to the MappedHeap to check
+ * @return AllocResult, ALLOK_HEAP_CORRUPTED when anything disagrees
+ */
+AllokResult akMappedHeapCheck(AkMappedHeap *p_heap);
+
+/**
+ * Write every dirty page of a MappedHeap back to its file with msync and wait for it to finish
+ * Allocations made since the last sync may be lost if the process or the machine crashes
+ * @param p_heap A pointer to the MappedHeap to sync
+ * @return AllocResult
+ */
+AllokResult akMappedHeapSync(AkMappedHeap *p_heap);
+
 /**
  * Initialize the global MemoryMap used by Alloc, Realloc, Calloc, and Free
  * If this is not called then default values will be used to initialize when Alloc is first called
+ * With params.is_thread_safe set the global functions may be called from any thread, small
+ * allocations are then served from a per-thread cache and only refills and flushes take the lock. Up to
+ * ALLOK_THREAD_CACHE_MAX objects per size class stay in a thread's cache until it calls akThreadCacheFlush, so a thread
+ * that exits without it leaks them until akDump unless akThreadCacheFlushOnExit has been called
+ * Setting params.is_per_cpu as well replaces the per-thread caches with one cache per CPU, picked with
+ * sched_getcpu on Linux and GetCurrentProcessorNumber on Windows, so cached memory grows with the number of
+ * cores rather than threads. A call that finds its CPU's cache busy falls back to the map's lock
+ * Dynamic MemoryMap's serve sizes at or above params.large_threshold from a LargeBlock, 0 disables this
+ * With params.huge_pages set, pools, LargeBlock's and the slab region of at least ALLOK_HUGE_PAGE_SIZE are
+ * backed by huge pages where the OS provides them
+ * Emptied MemoryPool's are kept for reuse up to params.pool_cache_size bytes, 0 disables this, and released
+ * once params.pool_cache_decay more pools have been emptied or requested since, 0 keeps them until akDump
  * @param init_pool_count The initial amount of MemoryPool's allocated within the MemoryMap
  * @param init_pool_size The size of each MemoryPool in bytes to be allocated
  * @param params Parameters to initialize the MemoryMap with
@@ -223,14 +941,39 @@ AllokResult akInit(const AllokSize init_pool_count, const AllokSize init_pool_si
 
 /**
  * Allocate a specified amount of heap memory
+ * The result is aligned to at least ALLOK_DEFAULT_ALIGNMENT bytes
  * @param pp_result A pointer to the starting address in memory that will be allocated
  * @param size The amount of bytes to allocate
  * @return AllocResult
  */
 AllokResult akAlloc(void **pp_result, const AllokSize size);
 
+/**
+ * Allocate a specified amount of heap memory starting at an aligned address
+ * Padding is taken from the free space of the chosen MemoryPool, reallocating the result does not keep its alignment
+ * @param pp_result A pointer to the starting address in memory that will be allocated
+ * @param size The amount of bytes to allocate
+ * @param alignment The alignment of the result address, must be a power of two
+ * @return AllocResult
+ */
+AllokResult akAllocAligned(void **pp_result, const AllokSize size, AllokSize alignment);
+
+/**
+ * Allocate count blocks of the same size of heap memory in one call
+ * Pool blocks are carved back to back from as few free gaps as possible, with one fit search per gap
+ * If any allocation fails every block allocated by the call is freed again and the error is returned
+ * @param pp_results An array of count pointers to store the starting address of each allocation in
+ * @param count The number of allocations to make
+ * @param size The amount of bytes to allocate for each
+ * @return AllocResult
+ */
+AllokResult akAllocBatch(void **pp_results, const AllokSize count, const AllokSize size);
+
 /**
  * Reallocate a specified amount of heap memory, copying all data from the p_src
+ * The block grows in place into the free space after it, or before it with a memmove, when possible
+ * With params.is_realloc_headroom set, growth reserves extra capacity so repeated appends rarely copy
+ * Large allocations are resized with mremap on Linux so their data is never copied
  * @param pp_result A pointer to the starting address in memory that has been reallocated
  * @param p_src A pointer to memory that has been previously allocated
  * @param size The amount of bytes to reallocate
@@ -247,29 +990,138 @@ AllokResult akRealloc(void **pp_result, void *p_src, const AllokSize size);
 AllokResult akCalloc(void **pp_result, const AllokSize size);
 
 /**
- * Calculate the total number of bytes that is currently globally allocated
+ * Allocate a specified amount of heap memory starting at an aligned address and set all its bytes to 0
+ * @param pp_result A pointer to the starting address in memory that has been allocated
+ * @param size The amount of bytes to allocate
+ * @param alignment The alignment of the result address, must be a power of two
+ * @return AllocResult
+ */
+AllokResult akCallocAligned(void **pp_result, const AllokSize size, const AllokSize alignment);
+
+/**
+ * Allocate a specified amount of global heap memory behind a Handle, which akCompact may relocate
+ * The memory is always served from a MemoryPool and its address is only stable while the Handle is locked,
+ * it must not be passed to akFree or akRealloc
+ * @param pp_result A pointer to the Handle that has been allocated
+ * @param size The amount of bytes to allocate
+ * @return AllocResult
+ */
+AllokResult akHandleAlloc(AkHandle **pp_result, const AllokSize size);
+
+/**
+ * Pin a Handle's memory so akCompact leaves it in place, locks nest and each needs its own akHandleUnlock
+ * @param pp_result A pointer to the current start of the Handle's memory
+ * @param p_handle A pointer to the Handle to lock
+ * @return AllocResult
+ */
+AllokResult akHandleLock(void **pp_result, AkHandle *p_handle);
+
+/**
+ * Release one lock taken by akHandleLock, any address read while it was held may then go stale
+ * @param p_handle A pointer to the Handle to unlock
+ * @return AllocResult, ALLOK_INVALID_ADDR when the Handle isn't locked
+ */
+AllokResult akHandleUnlock(AkHandle *p_handle);
+
+/**
+ * Free a Handle and its memory, the Handle is set to ALLOK_NULL
+ * @param pp_handle A pointer to the Handle to free
+ * @return AllocResult, ALLOK_HANDLE_LOCKED when the Handle is still locked
+ */
+AllokResult akHandleFree(AkHandle **pp_handle);
+
+/**
+ * Move the memory of unlocked Handle's to defragment the global MemoryMap's pools
+ * Handle's in pools less than half full are moved into fuller pools and pools left empty are returned to the OS,
+ * the rest slide back over the gap before them. Each call picks up after the last Handle the previous one looked at
+ * and looks at every Handle at most once. Call repeatedly until it reports 0 bytes to compact incrementally, a call
+ * that has not moved anything yet keeps looking past its budget so 0 always means no Handle could move
+ * @param p_result A pointer to the number of bytes moved
+ * @param budget The number of bytes to move before returning, every Handle looked at counts as
+ * ALLOK_COMPACT_SCAN_COST bytes of it, 0 for no limit
+ * @return AllocResult
+ */
+AllokResult akCompact(AllokSize *p_result, const AllokSize budget);
+
+/**
+ * Get the total number of bytes that is currently globally allocated, excluding headers
+ * Read from a counter kept by the global MemoryMap, so it does not walk the pools
  * @return The number of bytes allocated
  */
 AllokSize akGetTotalAllocSize();
 
 /**
- * Calculate the total number of MemoryPool's that are currently allocated for global memory
+ * Get the total number of MemoryPool's that are currently in use for global memory, excluding cached pools
  * @return The number of pools
  */
 AllokSize akGetTotalPoolCount();
 
 /**
- * Calculate the total number of MemoryBlock's that are currently allocated for global memory
+ * Get the total number of MemoryBlock's that are currently allocated for global memory
  * @return The number of blocks
  */
 AllokSize akGetTotalBlockCount();
 
 /**
- * Get the current metadata for the global MemoryMap
+ * Get the number of bytes that may be used at an address allocated by the global functions
+ * This is the requested size for MemoryBlock's and LargeBlock's, and the size class for slab objects
+ * @param p_result A pointer to store the size in
+ * @param ptr The start of memory allocated
+ * @return AllocResult
+ */
+AllokResult akGetUsableSize(AllokSize *p_result, const void *ptr);
+
+/**
+ * Get a snapshot of the metadata for the global MemoryMap in O(1)
+ * Besides the event counters it holds the live byte, peak byte, mapped byte and header byte totals,
+ * the current pool, block, large block and slab object counts, and the number of failed allocations
  * @return Global memory metadata
  */
 AkMemoryMapMetadata akGetAllocMetadata();
 
+/**
+ * Walk the global MemoryMap with akMemoryMapWalk while holding its lock
+ * The callback must not call any of the global functions
+ * @param fn The callback to call for each entry, returning ALLOK_FALSE stops the walk
+ * @param p_user A pointer passed through to each call of fn
+ * @return AllocResult
+ */
+AllokResult akHeapWalk(AkHeapWalkFn fn, void *p_user);
+
+/**
+ * Summarize the global MemoryMap with akMemoryMapReport while holding its lock
+ * @param p_result A pointer to the report to fill
+ * @return AllocResult
+ */
+AllokResult akGetHeapReport(AkMemoryMapReport *p_result);
+
+/**
+ * Start recording every global Alloc, Calloc, Realloc and Free to a binary trace file
+ * The file starts with an AkTraceHeader followed by AkTraceEvent's in the order they happened, each holding
+ * the op, size, alignment, the address of the result as its id (and of the source for a Realloc), the
+ * nanoseconds since the trace started and a small id for the calling thread
+ * Events are written into one of two buffers of capacity events allocated up front, so tracing itself never
+ * allocates. A full buffer is swapped for the other one and written to the file after the tracing thread has
+ * released its locks, so other threads keep recording while it is written. A trace that is already running is
+ * stopped first
+ * @param path The path of the file to create or truncate
+ * @param capacity The number of events in each buffer, 0 uses ALLOK_TRACE_DEFAULT_CAPACITY
+ * @return AllocResult
+ */
+AllokResult akTraceStart(const char *path, const AllokSize capacity);
+
+/**
+ * Write every buffered event of the running trace to its file
+ * @return AllocResult, ALLOK_OS_FILE_FAILED if this or any earlier write of the trace failed
+ */
+AllokResult akTraceFlush();
+
+/**
+ * Flush and close the running trace, the file can then be replayed with allok_replay
+ * @return AllocResult, ALLOK_OS_FILE_FAILED if any write of the trace failed
+ */
+AllokResult akTraceStop();
+
 /**
  * Free memory that was previously allocated by Alloc, Realloc, or Calloc
  * Sets the pointer to ALLOC_NULL
@@ -278,8 +1130,50 @@ AkMemoryMapMetadata akGetAllocMetadata();
  */
 AllokResult akFree(void **pp_target);
 
+/**
+ * Free count pointers that were previously allocated by Alloc, Realloc, Calloc or AllocBatch in one call
+ * Consecutive pointers from the same MemoryPool only update its indexes once, ALLOC_NULL entries are skipped
+ * Every freed pointer is set to ALLOC_NULL, pointers that fail are left as they are and the first error is returned
+ * @param pp_targets An array of count pointers to the start of memory allocated
+ * @param count The number of pointers to free
+ * @return AllocResult
+ */
+AllokResult akFreeBatch(void **pp_targets, const AllokSize count);
+
+/**
+ * Return every object held in the calling thread's cache to the global MemoryMap
+ * Threads should call this before exiting when the global MemoryMap is thread safe, otherwise the objects left in
+ * their cache stay allocated until akDump, see akThreadCacheFlushOnExit
+ */
+void akThreadCacheFlush();
+
+/**
+ * Call akThreadCacheFlush automatically on every thread as it exits, from a pthread key destructor or a fiber local
+ * storage callback on Windows. Threads register the first time they use their cache, so it can be called at any point
+ * @return AllocResult, ALLOK_UNSUPPORTED when the OS has no key left to register with
+ */
+AllokResult akThreadCacheFlushOnExit();
+
+/**
+ * Take every global lock so a fork can't copy one while another thread holds it
+ * Pass akForkPrepare, akForkParent and akForkChild to pthread_atfork when forking a thread safe process
+ */
+void akForkPrepare();
+
+/**
+ * Release the locks taken by akForkPrepare in the parent after a fork
+ */
+void akForkParent();
+
+/**
+ * Release the locks taken by akForkPrepare in the child after a fork
+ * A running trace is left to the parent, the child stops tracing without writing its buffered events
+ */
+void akForkChild();
+
 /**
  * Destroy all global memory, invalidating all previously allocated memory
+ * No other thread may use the global functions while this is running
  */
 void akDump();
 
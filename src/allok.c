@@ -1,4 +1,10 @@
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+// mremap and MREMAP_MAYMOVE are Linux extensions
+#define _GNU_SOURCE
+#endif
+
 #include <allok.h>
+#include <stddef.h>
 
 static AkMemoryMap *g_map;
 static AkMemoryArena *g_map_arena;
@@ -8,10 +14,48 @@ static AkMemoryArena *g_map_arena;
 #include <memoryapi.h>
 #elif defined(__APPLE__) || defined(__linux__)
 #include <sys/mman.h>
+#include <sched.h>
+#include <sys/file.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <sys/wait.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
 #else
 #error "Unsupported OS"
 #endif
 
+#if defined(_MSC_VER)
+#include <intrin.h>
+#define ALLOK_THREAD_LOCAL __declspec(thread)
+#else
+#define ALLOK_THREAD_LOCAL _Thread_local
+#endif
+
+#if defined(__x86_64__) || defined(_M_X64)
+#define ALLOK_ARCH_X64
+#include <immintrin.h>
+#if !defined(_MSC_VER)
+#include <cpuid.h>
+#endif
+#elif defined(__aarch64__) || defined(_M_ARM64)
+#define ALLOK_ARCH_ARM64
+#include <arm_neon.h>
+#endif
+
+#if defined(_MSC_VER)
+#define ALLOK_TARGET(features)
+#define ALLOK_MAY_ALIAS
+#else
+#define ALLOK_TARGET(features) __attribute__((target(features)))
+#define ALLOK_MAY_ALIAS __attribute__((__may_alias__))
+#endif
+
+#define ALLOK_SPIN_COUNT 64
+#define ALLOK_MAPPED_LOCK_POISONED (-1L)
+
 static inline AllokSize max_size(const AllokSize a, const AllokSize b) {
     return a > b ? a : b;
 }
@@ -20,13 +64,280 @@ static inline AllokSize min_size(const AllokSize a, const AllokSize b) {
     return a < b ? a : b;
 }
 
-static inline AllokResult get_ptr_fragment(const AllokByte *a, const AllokSize size_a, const AllokByte *b, AllokSize *p_result) {
-    const AllokByte *end_a = a + size_a;
-    if (end_a > b) {
-        return ALLOK_INVALID_ADDR;
+static inline AllokSize align_up(const AllokSize value, const AllokSize alignment) {
+    return (value + alignment - 1) & ~(alignment - 1);
+}
+
+static inline AllokBool is_valid_alignment(const AllokSize alignment) {
+    return alignment != 0 && (alignment & (alignment - 1)) == 0 ? ALLOK_TRUE : ALLOK_FALSE;
+}
+
+static inline long atomic_exchange_long(volatile long *p_target, const long value) {
+#if defined(_MSC_VER)
+    return _InterlockedExchange(p_target, value);
+#else
+    return __atomic_exchange_n(p_target, value, __ATOMIC_ACQUIRE);
+#endif
+}
+
+static inline long atomic_fetch_add_long(volatile long *p_target, const long value) {
+#if defined(_MSC_VER)
+    return _InterlockedExchangeAdd(p_target, value);
+#else
+    return __atomic_fetch_add(p_target, value, __ATOMIC_ACQ_REL);
+#endif
+}
+
+static inline long atomic_load_long(const volatile long *p_target) {
+#if defined(_MSC_VER)
+    return *p_target;
+#else
+    return __atomic_load_n(p_target, __ATOMIC_ACQUIRE);
+#endif
+}
+
+static inline void atomic_store_long(volatile long *p_target, const long value) {
+#if defined(_MSC_VER)
+    _InterlockedExchange(p_target, value);
+#else
+    __atomic_store_n(p_target, value, __ATOMIC_RELEASE);
+#endif
+}
+
+static inline AllokBool atomic_compare_exchange_long(volatile long *p_target, long *p_expected, const long value) {
+#if defined(_MSC_VER)
+    const long prev = _InterlockedCompareExchange(p_target, value, *p_expected);
+    if (prev == *p_expected) {
+        return ALLOK_TRUE;
+    }
+    *p_expected = prev;
+    return ALLOK_FALSE;
+#else
+    return __atomic_compare_exchange_n(p_target, p_expected, value, ALLOK_TRUE, __ATOMIC_ACQUIRE, __ATOMIC_ACQUIRE) ? ALLOK_TRUE : ALLOK_FALSE;
+#endif
+}
+
+static inline AllokByte atomic_fetch_or_byte(volatile AllokByte *p_target, const AllokByte value) {
+#if defined(_MSC_VER)
+    return (AllokByte)_InterlockedOr8((volatile char *)p_target, (char)value);
+#else
+    return __atomic_fetch_or(p_target, value, __ATOMIC_ACQ_REL);
+#endif
+}
+
+static inline AllokByte atomic_fetch_and_byte(volatile AllokByte *p_target, const AllokByte value) {
+#if defined(_MSC_VER)
+    return (AllokByte)_InterlockedAnd8((volatile char *)p_target, (char)value);
+#else
+    return __atomic_fetch_and(p_target, value, __ATOMIC_ACQ_REL);
+#endif
+}
+
+static inline AllokByte atomic_load_byte(const volatile AllokByte *p_target) {
+#if defined(_MSC_VER)
+    return *p_target;
+#else
+    return __atomic_load_n(p_target, __ATOMIC_ACQUIRE);
+#endif
+}
+
+static inline AllokSize atomic_load_size(const volatile AllokSize *p_target) {
+#if defined(_MSC_VER)
+    return *p_target;
+#else
+    return __atomic_load_n(p_target, __ATOMIC_ACQUIRE);
+#endif
+}
+
+static inline void atomic_store_size(volatile AllokSize *p_target, const AllokSize value) {
+#if defined(_MSC_VER)
+    _ReadWriteBarrier();
+    *p_target = value;
+#else
+    __atomic_store_n(p_target, value, __ATOMIC_RELEASE);
+#endif
+}
+
+static inline AllokSize atomic_exchange_size(volatile AllokSize *p_target, const AllokSize value) {
+#if defined(_MSC_VER)
+    return (AllokSize)_InterlockedExchangePointer((void *volatile *)p_target, (void *)value);
+#else
+    return __atomic_exchange_n(p_target, value, __ATOMIC_ACQ_REL);
+#endif
+}
+
+static inline AllokBool atomic_compare_exchange_size(volatile AllokSize *p_target, AllokSize *p_expected, const AllokSize value) {
+#if defined(_MSC_VER)
+    const AllokSize prev = (AllokSize)_InterlockedCompareExchangePointer((void *volatile *)p_target, (void *)value, (void *)*p_expected);
+    if (prev == *p_expected) {
+        return ALLOK_TRUE;
+    }
+    *p_expected = prev;
+    return ALLOK_FALSE;
+#else
+    return __atomic_compare_exchange_n(p_target, p_expected, value, ALLOK_TRUE, __ATOMIC_RELEASE, __ATOMIC_ACQUIRE) ? ALLOK_TRUE : ALLOK_FALSE;
+#endif
+}
+
+static inline void atomic_fence() {
+#if defined(_MSC_VER)
+    MemoryBarrier();
+#else
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+#endif
+}
+
+static inline void *atomic_load_ptr(void *const volatile *pp_target) {
+#if defined(_MSC_VER)
+    return *pp_target;
+#else
+    return __atomic_load_n(pp_target, __ATOMIC_ACQUIRE);
+#endif
+}
+
+static inline void atomic_store_ptr(void *volatile *pp_target, void *value) {
+#if defined(_MSC_VER)
+    _InterlockedExchangePointer(pp_target, value);
+#else
+    __atomic_store_n(pp_target, value, __ATOMIC_RELEASE);
+#endif
+}
+
+static inline void *atomic_exchange_ptr(void *volatile *pp_target, void *value) {
+#if defined(_MSC_VER)
+    return _InterlockedExchangePointer(pp_target, value);
+#else
+    return __atomic_exchange_n(pp_target, value, __ATOMIC_ACQ_REL);
+#endif
+}
+
+static inline AllokBool atomic_compare_exchange_ptr(void *volatile *pp_target, void **pp_expected, void *value) {
+#if defined(_MSC_VER)
+    void *prev = _InterlockedCompareExchangePointer(pp_target, value, *pp_expected);
+    if (prev == *pp_expected) {
+        return ALLOK_TRUE;
+    }
+    *pp_expected = prev;
+    return ALLOK_FALSE;
+#else
+    return __atomic_compare_exchange_n(pp_target, pp_expected, value, ALLOK_TRUE, __ATOMIC_RELEASE, __ATOMIC_ACQUIRE) ? ALLOK_TRUE : ALLOK_FALSE;
+#endif
+}
+
+AllokSize os_cpu_count() {
+#if _WIN32 || _WIN64
+    return GetActiveProcessorCount(ALL_PROCESSOR_GROUPS);
+#elif __APPLE__ || __linux__
+    const long count = sysconf(_SC_NPROCESSORS_CONF);
+    return count > 0 ? (AllokSize)count : 1;
+#else
+    return 1;
+#endif
+}
+
+AllokSize os_cpu_current() {
+#if _WIN32 || _WIN64
+    return GetCurrentProcessorNumber();
+#elif __linux__
+    const int cpu = sched_getcpu();
+    return cpu > 0 ? (AllokSize)cpu : 0;
+#else
+    return 0;
+#endif
+}
+
+void os_thread_yield() {
+#if _WIN32 || _WIN64
+    SwitchToThread();
+#elif __APPLE__ || __linux__
+    sched_yield();
+#endif
+}
+
+long os_process_id() {
+#if _WIN32 || _WIN64
+    return (long)GetCurrentProcessId();
+#elif __APPLE__ || __linux__
+    return (long)getpid();
+#else
+    return 1;
+#endif
+}
+
+// A process that can't be asked about, such as one owned by another user, is taken to be alive
+AllokBool os_process_is_dead(const long pid) {
+#if _WIN32 || _WIN64
+    HANDLE process = OpenProcess(SYNCHRONIZE, FALSE, (DWORD)pid);
+    if (process == ALLOK_NULL) {
+        return GetLastError() == ERROR_INVALID_PARAMETER ? ALLOK_TRUE : ALLOK_FALSE;
+    }
+    const DWORD wait = WaitForSingleObject(process, 0);
+    CloseHandle(process);
+    return wait == WAIT_OBJECT_0 ? ALLOK_TRUE : ALLOK_FALSE;
+#elif __APPLE__ || __linux__
+    if (kill((pid_t)pid, 0) == -1) {
+        return errno == ESRCH ? ALLOK_TRUE : ALLOK_FALSE;
+    }
+
+    // An exited child stays a zombie until its parent reaps it, and the parent may be the one waiting
+    siginfo_t info;
+    info.si_pid = 0;
+    return waitid(P_PID, (id_t)pid, &info, WEXITED | WNOHANG | WNOWAIT) == 0 && info.si_pid == (pid_t)pid ? ALLOK_TRUE : ALLOK_FALSE;
+#else
+    (void)pid;
+    return ALLOK_FALSE;
+#endif
+}
+
+#if _WIN32 || _WIN64
+static DWORD g_thread_exit_key = FLS_OUT_OF_INDEXES;
+static void (*g_thread_exit_callback)(void *);
+
+static void WINAPI os_thread_exit_fls(PVOID p_value) {
+    if (p_value != NULL) {
+        g_thread_exit_callback(p_value);
+    }
+}
+#elif __APPLE__ || __linux__
+static pthread_key_t g_thread_exit_key;
+#endif
+
+// The callback runs on every thread that called os_thread_exit_register as it exits, a pthread key destructor or the
+// callback of a fiber local slot on Windows
+AllokBool os_thread_exit_create(void (*p_callback)(void *)) {
+#if _WIN32 || _WIN64
+    g_thread_exit_callback = p_callback;
+    g_thread_exit_key = FlsAlloc(os_thread_exit_fls);
+    return g_thread_exit_key != FLS_OUT_OF_INDEXES ? ALLOK_TRUE : ALLOK_FALSE;
+#elif __APPLE__ || __linux__
+    return pthread_key_create(&g_thread_exit_key, p_callback) == 0 ? ALLOK_TRUE : ALLOK_FALSE;
+#else
+    return ALLOK_FALSE;
+#endif
+}
+
+void os_thread_exit_register() {
+#if _WIN32 || _WIN64
+    FlsSetValue(g_thread_exit_key, (PVOID)1);
+#elif __APPLE__ || __linux__
+    pthread_setspecific(g_thread_exit_key, (void *)1);
+#endif
+}
+
+void spin_lock(AkSpinLock *p_lock) {
+    while (atomic_exchange_long(&p_lock->state, 1) != 0) {
+        int spins = 0;
+        while (atomic_load_long(&p_lock->state) != 0) {
+            if (++spins >= ALLOK_SPIN_COUNT) {
+                os_thread_yield();
+                spins = 0;
+            }
+        }
     }
-    *p_result = (AllokSize)(b - end_a);
-    return ALLOK_SUCCESS;
+}
+
+void spin_unlock(AkSpinLock *p_lock) {
+    atomic_store_long(&p_lock->state, 0);
 }
 
 AllokBool is_ptr_in_range(const void *ptr, const void *p_start, const AllokSize size) {
@@ -41,816 +352,5281 @@ AllokBool is_ptr_in_range(const void *ptr, const void *p_start, const AllokSize
     return addr >= start && addr < end;
 }
 
-AllokResult akMemset(void **pp_result, const AllokByte value, const AllokSize size) {
-    if (pp_result == ALLOK_NULL) {
-        return ALLOK_NULL_PARAM;
+typedef AllokSize ALLOK_MAY_ALIAS AkMemWord;
+
+typedef struct AkMemKernelTable {
+    void (*p_set)(AllokByte *p_dst, const AllokByte value, AllokSize size);
+    void (*p_copy)(AllokByte *p_dst, const AllokByte *p_src, AllokSize size);
+} AkMemKernelTable;
+
+static volatile long g_mem_kernel = -1;
+static volatile long g_mem_kernel_mask = 0;
+
+static inline AllokBool is_word_aligned(const void *ptr) {
+    return ((AllokSize)ptr & (sizeof(AkMemWord) - 1)) == 0 ? ALLOK_TRUE : ALLOK_FALSE;
+}
+
+void mem_set_byte(AllokByte *p_dst, const AllokByte value, AllokSize size) {
+    for (AllokSize i = 0; i < size; ++i) {
+        p_dst[i] = value;
     }
+}
 
-    AllokByte *result = (AllokByte *)(*pp_result);
+void mem_copy_byte(AllokByte *p_dst, const AllokByte *p_src, AllokSize size) {
     for (AllokSize i = 0; i < size; ++i) {
-        result[i] = value;
+        p_dst[i] = p_src[i];
     }
-    return ALLOK_SUCCESS;
 }
 
-AllokResult akMemcpy(void **pp_result, const void *p_src, const AllokSize size) {
-    if (pp_result == ALLOK_NULL) {
-        return ALLOK_NULL_PARAM;
+void mem_set_word(AllokByte *p_dst, const AllokByte value, AllokSize size) {
+    for (; size > 0 && is_word_aligned(p_dst) == ALLOK_FALSE; --size) {
+        *p_dst++ = value;
     }
 
-    AllokByte *result = (AllokByte *)(*pp_result);
-    const AllokByte *src = (AllokByte *)p_src;
-    for (AllokSize i = 0; i < size; ++i) {
-        result[i] = src[i];
+    const AkMemWord pattern = ((AkMemWord)-1 / 0xFF) * value;
+    AkMemWord *dst = (AkMemWord *)p_dst;
+    for (; size >= sizeof(AkMemWord); size -= sizeof(AkMemWord)) {
+        *dst++ = pattern;
     }
 
-    return ALLOK_SUCCESS;
+    mem_set_byte((AllokByte *)dst, value, size);
 }
 
-void *os_mem_alloc(const AllokSize size) {
-#if _WIN32 || _WIN64
-     return VirtualAlloc(NULL, size, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
-#elif __APPLE__ || __linux__
-    return mmap(ALLOK_NULL, size, PROT_READ | PROT_WRITE, MAP_ANON | MAP_PRIVATE, -1, 0);
-#else
-    return ALLOC_NULL;
-#endif
+// Copies strictly front to back, one word or byte at a time, so it is also
+// safe for overlapping ranges where the destination starts below the source.
+void mem_copy_word(AllokByte *p_dst, const AllokByte *p_src, AllokSize size) {
+    if ((((AllokSize)p_dst ^ (AllokSize)p_src) & (sizeof(AkMemWord) - 1)) == 0) {
+        for (; size > 0 && is_word_aligned(p_dst) == ALLOK_FALSE; --size) {
+            *p_dst++ = *p_src++;
+        }
+
+        AkMemWord *dst = (AkMemWord *)p_dst;
+        const AkMemWord *src = (const AkMemWord *)p_src;
+        for (; size >= sizeof(AkMemWord); size -= sizeof(AkMemWord)) {
+            *dst++ = *src++;
+        }
+        p_dst = (AllokByte *)dst;
+        p_src = (const AllokByte *)src;
+    }
+
+    mem_copy_byte(p_dst, p_src, size);
 }
 
-void os_mem_free(void *ptr, const AllokSize size) {
-#if _WIN32 || _WIN64
-    VirtualFree(ptr, 0, MEM_RELEASE);
-#elif __APPLE__ || __linux__
-    munmap(ptr, size);
-#endif
+void mem_move_backward(AllokByte *p_dst, const AllokByte *p_src, AllokSize size) {
+    AllokByte *dst_end = p_dst + size;
+    const AllokByte *src_end = p_src + size;
+
+    if ((((AllokSize)dst_end ^ (AllokSize)src_end) & (sizeof(AkMemWord) - 1)) == 0) {
+        for (; size > 0 && is_word_aligned(dst_end) == ALLOK_FALSE; --size) {
+            *--dst_end = *--src_end;
+        }
+
+        AkMemWord *dst = (AkMemWord *)dst_end;
+        const AkMemWord *src = (const AkMemWord *)src_end;
+        for (; size >= sizeof(AkMemWord); size -= sizeof(AkMemWord)) {
+            *--dst = *--src;
+        }
+        dst_end = (AllokByte *)dst;
+        src_end = (const AllokByte *)src;
+    }
+
+    for (; size > 0; --size) {
+        *--dst_end = *--src_end;
+    }
 }
 
-AllokResult akMemoryArenaAlloc(AkMemoryArena **pp_result, const AllokSize size) {
-    AllokSize alloc_size = size + sizeof(AkMemoryArena);
+#if defined(ALLOK_ARCH_X64)
+// The SIMD kernels finish with one unaligned vector that overlaps the last
+// full one, so they only run on non-overlapping ranges. Once a fill or copy
+// reaches ALLOK_NON_TEMPORAL_THRESHOLD the destination is aligned and written
+// with streaming stores, which keeps it from evicting the working set.
 
-    AkMemoryArena *arena = os_mem_alloc(alloc_size);
-    if (arena == ALLOK_NULL) {
-        return ALLOK_OS_MEMORY_ALLOC_FAILED;
+ALLOK_TARGET("sse2")
+void mem_set_sse2(AllokByte *p_dst, const AllokByte value, AllokSize size) {
+    if (size < 16) {
+        mem_set_byte(p_dst, value, size);
+        return;
     }
 
-    arena->p_start = (char *)arena + sizeof(AkMemoryArena);
-    arena->p_current = arena->p_start;
-    arena->size = 0;
-    arena->alloc_size = size;
-    arena->p_next = ALLOK_NULL;
-    arena->p_prev = ALLOK_NULL;
+    const __m128i v = _mm_set1_epi8((char)value);
+    AllokByte *end = p_dst + size;
+    if (size >= ALLOK_NON_TEMPORAL_THRESHOLD) {
+        _mm_storeu_si128((__m128i *)p_dst, v);
+        const AllokSize head = 16 - ((AllokSize)p_dst & 15);
+        p_dst += head;
+        size -= head;
+        for (; size >= 64; size -= 64, p_dst += 64) {
+            _mm_stream_si128((__m128i *)p_dst, v);
+            _mm_stream_si128((__m128i *)(p_dst + 16), v);
+            _mm_stream_si128((__m128i *)(p_dst + 32), v);
+            _mm_stream_si128((__m128i *)(p_dst + 48), v);
+        }
+        _mm_sfence();
+    }
+    for (; size >= 64; size -= 64, p_dst += 64) {
+        _mm_storeu_si128((__m128i *)p_dst, v);
+        _mm_storeu_si128((__m128i *)(p_dst + 16), v);
+        _mm_storeu_si128((__m128i *)(p_dst + 32), v);
+        _mm_storeu_si128((__m128i *)(p_dst + 48), v);
+    }
+    for (; size >= 16; size -= 16, p_dst += 16) {
+        _mm_storeu_si128((__m128i *)p_dst, v);
+    }
+    if (size > 0) {
+        _mm_storeu_si128((__m128i *)(end - 16), v);
+    }
+}
 
-    *pp_result = arena;
+ALLOK_TARGET("sse2")
+void mem_copy_sse2(AllokByte *p_dst, const AllokByte *p_src, AllokSize size) {
+    if (size < 16) {
+        mem_copy_byte(p_dst, p_src, size);
+        return;
+    }
 
-    return ALLOK_SUCCESS;
+    AllokByte *dst_end = p_dst + size;
+    const AllokByte *src_end = p_src + size;
+    if (size >= ALLOK_NON_TEMPORAL_THRESHOLD) {
+        _mm_storeu_si128((__m128i *)p_dst, _mm_loadu_si128((const __m128i *)p_src));
+        const AllokSize head = 16 - ((AllokSize)p_dst & 15);
+        p_dst += head;
+        p_src += head;
+        size -= head;
+        for (; size >= 64; size -= 64, p_dst += 64, p_src += 64) {
+            const __m128i a = _mm_loadu_si128((const __m128i *)p_src);
+            const __m128i b = _mm_loadu_si128((const __m128i *)(p_src + 16));
+            const __m128i c = _mm_loadu_si128((const __m128i *)(p_src + 32));
+            const __m128i d = _mm_loadu_si128((const __m128i *)(p_src + 48));
+            _mm_stream_si128((__m128i *)p_dst, a);
+            _mm_stream_si128((__m128i *)(p_dst + 16), b);
+            _mm_stream_si128((__m128i *)(p_dst + 32), c);
+            _mm_stream_si128((__m128i *)(p_dst + 48), d);
+        }
+        _mm_sfence();
+    }
+    for (; size >= 64; size -= 64, p_dst += 64, p_src += 64) {
+        const __m128i a = _mm_loadu_si128((const __m128i *)p_src);
+        const __m128i b = _mm_loadu_si128((const __m128i *)(p_src + 16));
+        const __m128i c = _mm_loadu_si128((const __m128i *)(p_src + 32));
+        const __m128i d = _mm_loadu_si128((const __m128i *)(p_src + 48));
+        _mm_storeu_si128((__m128i *)p_dst, a);
+        _mm_storeu_si128((__m128i *)(p_dst + 16), b);
+        _mm_storeu_si128((__m128i *)(p_dst + 32), c);
+        _mm_storeu_si128((__m128i *)(p_dst + 48), d);
+    }
+    for (; size >= 16; size -= 16, p_dst += 16, p_src += 16) {
+        _mm_storeu_si128((__m128i *)p_dst, _mm_loadu_si128((const __m128i *)p_src));
+    }
+    if (size > 0) {
+        _mm_storeu_si128((__m128i *)(dst_end - 16), _mm_loadu_si128((const __m128i *)(src_end - 16)));
+    }
 }
 
-AllokResult akMemoryArenaClaim(void **pp_result, AkMemoryArena *p_arena, const AllokSize size) {
-    if (p_arena == ALLOK_NULL) {
-        return ALLOK_NULL_PARAM;
+ALLOK_TARGET("avx2")
+void mem_set_avx2(AllokByte *p_dst, const AllokByte value, AllokSize size) {
+    if (size < 32) {
+        mem_set_sse2(p_dst, value, size);
+        return;
     }
 
-    if (p_arena->alloc_size < size || p_arena->size + size > p_arena->alloc_size) {
-        return ALLOK_INSUFFICIENT_ARENA_MEMORY;
+    const __m256i v = _mm256_set1_epi8((char)value);
+    AllokByte *end = p_dst + size;
+    if (size >= ALLOK_NON_TEMPORAL_THRESHOLD) {
+        _mm256_storeu_si256((__m256i *)p_dst, v);
+        const AllokSize head = 32 - ((AllokSize)p_dst & 31);
+        p_dst += head;
+        size -= head;
+        for (; size >= 128; size -= 128, p_dst += 128) {
+            _mm256_stream_si256((__m256i *)p_dst, v);
+            _mm256_stream_si256((__m256i *)(p_dst + 32), v);
+            _mm256_stream_si256((__m256i *)(p_dst + 64), v);
+            _mm256_stream_si256((__m256i *)(p_dst + 96), v);
+        }
+        _mm_sfence();
+    }
+    for (; size >= 128; size -= 128, p_dst += 128) {
+        _mm256_storeu_si256((__m256i *)p_dst, v);
+        _mm256_storeu_si256((__m256i *)(p_dst + 32), v);
+        _mm256_storeu_si256((__m256i *)(p_dst + 64), v);
+        _mm256_storeu_si256((__m256i *)(p_dst + 96), v);
+    }
+    for (; size >= 32; size -= 32, p_dst += 32) {
+        _mm256_storeu_si256((__m256i *)p_dst, v);
     }
+    if (size > 0) {
+        _mm256_storeu_si256((__m256i *)(end - 32), v);
+    }
+}
+
+ALLOK_TARGET("avx2")
+void mem_copy_avx2(AllokByte *p_dst, const AllokByte *p_src, AllokSize size) {
+    if (size < 32) {
+        mem_copy_sse2(p_dst, p_src, size);
+        return;
+    }
+
+    AllokByte *dst_end = p_dst + size;
+    const AllokByte *src_end = p_src + size;
+    if (size >= ALLOK_NON_TEMPORAL_THRESHOLD) {
+        _mm256_storeu_si256((__m256i *)p_dst, _mm256_loadu_si256((const __m256i *)p_src));
+        const AllokSize head = 32 - ((AllokSize)p_dst & 31);
+        p_dst += head;
+        p_src += head;
+        size -= head;
+        for (; size >= 128; size -= 128, p_dst += 128, p_src += 128) {
+            const __m256i a = _mm256_loadu_si256((const __m256i *)p_src);
+            const __m256i b = _mm256_loadu_si256((const __m256i *)(p_src + 32));
+            const __m256i c = _mm256_loadu_si256((const __m256i *)(p_src + 64));
+            const __m256i d = _mm256_loadu_si256((const __m256i *)(p_src + 96));
+            _mm256_stream_si256((__m256i *)p_dst, a);
+            _mm256_stream_si256((__m256i *)(p_dst + 32), b);
+            _mm256_stream_si256((__m256i *)(p_dst + 64), c);
+            _mm256_stream_si256((__m256i *)(p_dst + 96), d);
+        }
+        _mm_sfence();
+    }
+    for (; size >= 128; size -= 128, p_dst += 128, p_src += 128) {
+        const __m256i a = _mm256_loadu_si256((const __m256i *)p_src);
+        const __m256i b = _mm256_loadu_si256((const __m256i *)(p_src + 32));
+        const __m256i c = _mm256_loadu_si256((const __m256i *)(p_src + 64));
+        const __m256i d = _mm256_loadu_si256((const __m256i *)(p_src + 96));
+        _mm256_storeu_si256((__m256i *)p_dst, a);
+        _mm256_storeu_si256((__m256i *)(p_dst + 32), b);
+        _mm256_storeu_si256((__m256i *)(p_dst + 64), c);
+        _mm256_storeu_si256((__m256i *)(p_dst + 96), d);
+    }
+    for (; size >= 32; size -= 32, p_dst += 32, p_src += 32) {
+        _mm256_storeu_si256((__m256i *)p_dst, _mm256_loadu_si256((const __m256i *)p_src));
+    }
+    if (size > 0) {
+        _mm256_storeu_si256((__m256i *)(dst_end - 32), _mm256_loadu_si256((const __m256i *)(src_end - 32)));
+    }
+}
+
+ALLOK_TARGET("avx512f")
+void mem_set_avx512(AllokByte *p_dst, const AllokByte value, AllokSize size) {
+    if (size < 64) {
+        mem_set_avx2(p_dst, value, size);
+        return;
+    }
+
+    const __m512i v = _mm512_set1_epi8((char)value);
+    AllokByte *end = p_dst + size;
+    if (size >= ALLOK_NON_TEMPORAL_THRESHOLD) {
+        _mm512_storeu_si512((void *)p_dst, v);
+        const AllokSize head = 64 - ((AllokSize)p_dst & 63);
+        p_dst += head;
+        size -= head;
+        for (; size >= 256; size -= 256, p_dst += 256) {
+            _mm512_stream_si512((void *)p_dst, v);
+            _mm512_stream_si512((void *)(p_dst + 64), v);
+            _mm512_stream_si512((void *)(p_dst + 128), v);
+            _mm512_stream_si512((void *)(p_dst + 192), v);
+        }
+        _mm_sfence();
+    }
+    for (; size >= 256; size -= 256, p_dst += 256) {
+        _mm512_storeu_si512((void *)p_dst, v);
+        _mm512_storeu_si512((void *)(p_dst + 64), v);
+        _mm512_storeu_si512((void *)(p_dst + 128), v);
+        _mm512_storeu_si512((void *)(p_dst + 192), v);
+    }
+    for (; size >= 64; size -= 64, p_dst += 64) {
+        _mm512_storeu_si512((void *)p_dst, v);
+    }
+    if (size > 0) {
+        _mm512_storeu_si512((void *)(end - 64), v);
+    }
+}
+
+ALLOK_TARGET("avx512f")
+void mem_copy_avx512(AllokByte *p_dst, const AllokByte *p_src, AllokSize size) {
+    if (size < 64) {
+        mem_copy_avx2(p_dst, p_src, size);
+        return;
+    }
+
+    AllokByte *dst_end = p_dst + size;
+    const AllokByte *src_end = p_src + size;
+    if (size >= ALLOK_NON_TEMPORAL_THRESHOLD) {
+        _mm512_storeu_si512((void *)p_dst, _mm512_loadu_si512((const void *)p_src));
+        const AllokSize head = 64 - ((AllokSize)p_dst & 63);
+        p_dst += head;
+        p_src += head;
+        size -= head;
+        for (; size >= 256; size -= 256, p_dst += 256, p_src += 256) {
+            const __m512i a = _mm512_loadu_si512((const void *)p_src);
+            const __m512i b = _mm512_loadu_si512((const void *)(p_src + 64));
+            const __m512i c = _mm512_loadu_si512((const void *)(p_src + 128));
+            const __m512i d = _mm512_loadu_si512((const void *)(p_src + 192));
+            _mm512_stream_si512((void *)p_dst, a);
+            _mm512_stream_si512((void *)(p_dst + 64), b);
+            _mm512_stream_si512((void *)(p_dst + 128), c);
+            _mm512_stream_si512((void *)(p_dst + 192), d);
+        }
+        _mm_sfence();
+    }
+    for (; size >= 256; size -= 256, p_dst += 256, p_src += 256) {
+        const __m512i a = _mm512_loadu_si512((const void *)p_src);
+        const __m512i b = _mm512_loadu_si512((const void *)(p_src + 64));
+        const __m512i c = _mm512_loadu_si512((const void *)(p_src + 128));
+        const __m512i d = _mm512_loadu_si512((const void *)(p_src + 192));
+        _mm512_storeu_si512((void *)p_dst, a);
+        _mm512_storeu_si512((void *)(p_dst + 64), b);
+        _mm512_storeu_si512((void *)(p_dst + 128), c);
+        _mm512_storeu_si512((void *)(p_dst + 192), d);
+    }
+    for (; size >= 64; size -= 64, p_dst += 64, p_src += 64) {
+        _mm512_storeu_si512((void *)p_dst, _mm512_loadu_si512((const void *)p_src));
+    }
+    if (size > 0) {
+        _mm512_storeu_si512((void *)(dst_end - 64), _mm512_loadu_si512((const void *)(src_end - 64)));
+    }
+}
 
-    *pp_result = p_arena->p_current;
-    p_arena->size += size;
-    p_arena->p_current = (AllokByte *)p_arena->p_current + size;
+void cpu_id(const int leaf, const int subleaf, unsigned int regs[4]) {
+#if defined(_MSC_VER)
+    __cpuidex((int *)regs, leaf, subleaf);
+#else
+    __cpuid_count(leaf, subleaf, regs[0], regs[1], regs[2], regs[3]);
+#endif
+}
+
+unsigned long long cpu_xgetbv() {
+#if defined(_MSC_VER)
+    return _xgetbv(0);
+#else
+    unsigned int lo, hi;
+    __asm__ volatile("xgetbv" : "=a"(lo), "=d"(hi) : "c"(0));
+    return ((unsigned long long)hi << 32) | lo;
+#endif
+}
+#elif defined(ALLOK_ARCH_ARM64)
+// NEON has no streaming store that bypasses the cache from C, so large
+// copies use the regular store loop.
+
+void mem_set_neon(AllokByte *p_dst, const AllokByte value, AllokSize size) {
+    if (size < 16) {
+        mem_set_byte(p_dst, value, size);
+        return;
+    }
+
+    const uint8x16_t v = vdupq_n_u8(value);
+    AllokByte *end = p_dst + size;
+    for (; size >= 64; size -= 64, p_dst += 64) {
+        vst1q_u8(p_dst, v);
+        vst1q_u8(p_dst + 16, v);
+        vst1q_u8(p_dst + 32, v);
+        vst1q_u8(p_dst + 48, v);
+    }
+    for (; size >= 16; size -= 16, p_dst += 16) {
+        vst1q_u8(p_dst, v);
+    }
+    if (size > 0) {
+        vst1q_u8(end - 16, v);
+    }
+}
+
+void mem_copy_neon(AllokByte *p_dst, const AllokByte *p_src, AllokSize size) {
+    if (size < 16) {
+        mem_copy_byte(p_dst, p_src, size);
+        return;
+    }
+
+    AllokByte *dst_end = p_dst + size;
+    const AllokByte *src_end = p_src + size;
+    for (; size >= 64; size -= 64, p_dst += 64, p_src += 64) {
+        const uint8x16_t a = vld1q_u8(p_src);
+        const uint8x16_t b = vld1q_u8(p_src + 16);
+        const uint8x16_t c = vld1q_u8(p_src + 32);
+        const uint8x16_t d = vld1q_u8(p_src + 48);
+        vst1q_u8(p_dst, a);
+        vst1q_u8(p_dst + 16, b);
+        vst1q_u8(p_dst + 32, c);
+        vst1q_u8(p_dst + 48, d);
+    }
+    for (; size >= 16; size -= 16, p_dst += 16, p_src += 16) {
+        vst1q_u8(p_dst, vld1q_u8(p_src));
+    }
+    if (size > 0) {
+        vst1q_u8(dst_end - 16, vld1q_u8(src_end - 16));
+    }
+}
+#endif
+
+static const AkMemKernelTable g_mem_kernels[ALLOK_MEM_KERNEL_COUNT] = {
+    [ALLOK_MEM_KERNEL_BYTE] = {mem_set_byte, mem_copy_byte},
+    [ALLOK_MEM_KERNEL_WORD] = {mem_set_word, mem_copy_word},
+#if defined(ALLOK_ARCH_X64)
+    [ALLOK_MEM_KERNEL_SSE2] = {mem_set_sse2, mem_copy_sse2},
+    [ALLOK_MEM_KERNEL_AVX2] = {mem_set_avx2, mem_copy_avx2},
+    [ALLOK_MEM_KERNEL_AVX512] = {mem_set_avx512, mem_copy_avx512},
+#elif defined(ALLOK_ARCH_ARM64)
+    [ALLOK_MEM_KERNEL_NEON] = {mem_set_neon, mem_copy_neon},
+#endif
+};
+
+long mem_kernel_detect_mask() {
+    long mask = (1L << ALLOK_MEM_KERNEL_BYTE) | (1L << ALLOK_MEM_KERNEL_WORD);
+#if defined(ALLOK_ARCH_X64)
+    mask |= 1L << ALLOK_MEM_KERNEL_SSE2;
+
+    unsigned int regs[4];
+    cpu_id(0, 0, regs);
+    const unsigned int max_leaf = regs[0];
+    cpu_id(1, 0, regs);
+    const AllokBool has_osxsave = (regs[2] & (1u << 27)) != 0 ? ALLOK_TRUE : ALLOK_FALSE;
+    const AllokBool has_avx = (regs[2] & (1u << 28)) != 0 ? ALLOK_TRUE : ALLOK_FALSE;
+    if (max_leaf < 7 || has_osxsave == ALLOK_FALSE || has_avx == ALLOK_FALSE) {
+        return mask;
+    }
+
+    // The OS has to save the wider register state on context switches before
+    // the instructions that use it are safe, which XCR0 reports.
+    const unsigned long long xcr0 = cpu_xgetbv();
+    cpu_id(7, 0, regs);
+    if ((xcr0 & 0x6) == 0x6 && (regs[1] & (1u << 5)) != 0) {
+        mask |= 1L << ALLOK_MEM_KERNEL_AVX2;
+    }
+    if ((xcr0 & 0xE6) == 0xE6 && (regs[1] & (1u << 16)) != 0) {
+        mask |= 1L << ALLOK_MEM_KERNEL_AVX512;
+    }
+#elif defined(ALLOK_ARCH_ARM64)
+    mask |= 1L << ALLOK_MEM_KERNEL_NEON;
+#endif
+    return mask;
+}
+
+// Selects the widest supported kernel once and caches the choice. Racing
+// threads all compute the same answer, so plain atomic stores are enough.
+AllokMemKernel mem_kernel_resolve() {
+    long kernel = atomic_load_long(&g_mem_kernel);
+    if (kernel >= 0) {
+        return (AllokMemKernel)kernel;
+    }
+
+    const long mask = mem_kernel_detect_mask();
+    static const AllokMemKernel preference[] = {
+        ALLOK_MEM_KERNEL_AVX512,
+        ALLOK_MEM_KERNEL_AVX2,
+        ALLOK_MEM_KERNEL_NEON,
+        ALLOK_MEM_KERNEL_SSE2,
+        ALLOK_MEM_KERNEL_WORD,
+    };
+    kernel = ALLOK_MEM_KERNEL_BYTE;
+    for (AllokSize i = 0; i < sizeof(preference) / sizeof(preference[0]); ++i) {
+        if ((mask & (1L << preference[i])) != 0) {
+            kernel = preference[i];
+            break;
+        }
+    }
+
+    atomic_store_long(&g_mem_kernel_mask, mask);
+    atomic_store_long(&g_mem_kernel, kernel);
+    return (AllokMemKernel)kernel;
+}
+
+static inline const AkMemKernelTable *mem_kernel_table() {
+    return &g_mem_kernels[mem_kernel_resolve()];
+}
+
+AllokResult akMemset(void **pp_result, const AllokByte value, const AllokSize size) {
+    if (pp_result == ALLOK_NULL) {
+        return ALLOK_NULL_PARAM;
+    }
+
+    mem_kernel_table()->p_set((AllokByte *)(*pp_result), value, size);
+    return ALLOK_SUCCESS;
+}
+
+AllokResult akMemcpy(void **pp_result, const void *p_src, const AllokSize size) {
+    if (pp_result == ALLOK_NULL) {
+        return ALLOK_NULL_PARAM;
+    }
+
+    mem_kernel_table()->p_copy((AllokByte *)(*pp_result), (const AllokByte *)p_src, size);
+    return ALLOK_SUCCESS;
+}
+
+AllokResult akMemmove(void **pp_result, const void *p_src, const AllokSize size) {
+    if (pp_result == ALLOK_NULL) {
+        return ALLOK_NULL_PARAM;
+    }
+
+    AllokByte *dst = (AllokByte *)(*pp_result);
+    const AllokByte *src = (const AllokByte *)p_src;
+    if (dst == src || size == 0) {
+        return ALLOK_SUCCESS;
+    }
+
+    if (dst + size <= src || src + size <= dst) {
+        mem_kernel_table()->p_copy(dst, src, size);
+    } else if (dst < src) {
+        mem_copy_word(dst, src, size);
+    } else {
+        mem_move_backward(dst, src, size);
+    }
+    return ALLOK_SUCCESS;
+}
+
+AllokResult akMemKernelGet(AllokMemKernel *p_result) {
+    if (p_result == ALLOK_NULL) {
+        return ALLOK_NULL_PARAM;
+    }
+
+    *p_result = mem_kernel_resolve();
+    return ALLOK_SUCCESS;
+}
+
+AllokResult akMemKernelSet(const AllokMemKernel kernel) {
+    if ((int)kernel < 0 || kernel >= ALLOK_MEM_KERNEL_COUNT) {
+        return ALLOK_NOT_FOUND;
+    }
+
+    mem_kernel_resolve();
+    if ((atomic_load_long(&g_mem_kernel_mask) & (1L << kernel)) == 0) {
+        return ALLOK_UNSUPPORTED;
+    }
+
+    atomic_store_long(&g_mem_kernel, kernel);
+    return ALLOK_SUCCESS;
+}
+
+void *os_mem_alloc(const AllokSize size) {
+#if _WIN32 || _WIN64
+     return VirtualAlloc(NULL, size, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
+#elif __APPLE__ || __linux__
+    void *ptr = mmap(ALLOK_NULL, size, PROT_READ | PROT_WRITE, MAP_ANON | MAP_PRIVATE, -1, 0);
+    return ptr == MAP_FAILED ? ALLOK_NULL : ptr;
+#else
+    return ALLOC_NULL;
+#endif
+}
+
+void os_mem_free(void *ptr, const AllokSize size) {
+#if _WIN32 || _WIN64
+    VirtualFree(ptr, 0, MEM_RELEASE);
+#elif __APPLE__ || __linux__
+    munmap(ptr, size);
+#endif
+}
+
+void *os_mem_reserve(const AllokSize size, const AllokSize alignment) {
+#if _WIN32 || _WIN64
+    // Reservations are always aligned to the 64 KiB allocation granularity
+    (void)alignment;
+    return VirtualAlloc(NULL, size, MEM_RESERVE, PAGE_NOACCESS);
+#elif __APPLE__ || __linux__
+    AllokByte *base = mmap(ALLOK_NULL, size + alignment, PROT_NONE, MAP_ANON | MAP_PRIVATE, -1, 0);
+    if (base == MAP_FAILED) {
+        return ALLOK_NULL;
+    }
+
+    AllokByte *aligned = (AllokByte *)(((AllokSize)base + alignment - 1) & ~(alignment - 1));
+    if (aligned != base) {
+        munmap(base, (AllokSize)(aligned - base));
+    }
+    munmap(aligned + size, (AllokSize)(base + alignment - aligned));
+
+    return aligned;
+#else
+    return ALLOK_NULL;
+#endif
+}
+
+AllokBool os_mem_commit(void *ptr, const AllokSize size) {
+#if _WIN32 || _WIN64
+    return VirtualAlloc(ptr, size, MEM_COMMIT, PAGE_READWRITE) != NULL ? ALLOK_TRUE : ALLOK_FALSE;
+#elif __APPLE__ || __linux__
+    return mprotect(ptr, size, PROT_READ | PROT_WRITE) == 0 ? ALLOK_TRUE : ALLOK_FALSE;
+#else
+    return ALLOK_FALSE;
+#endif
+}
+
+void os_mem_decommit(void *ptr, const AllokSize size) {
+#if _WIN32 || _WIN64
+    VirtualFree(ptr, size, MEM_DECOMMIT);
+#elif __APPLE__ || __linux__
+    madvise(ptr, size, MADV_DONTNEED);
+#endif
+}
+
+AllokSize os_mem_page_size(const AllokHugePages huge_pages, const AllokSize size) {
+    return huge_pages != ALLOK_HUGE_PAGES_NONE && size >= ALLOK_HUGE_PAGE_SIZE ? ALLOK_HUGE_PAGE_SIZE : ALLOK_OS_PAGE_SIZE;
+}
+
+void os_mem_advise_huge(void *ptr, const AllokSize size) {
+#if __linux__
+    // Only a hint, kernels without transparent huge pages keep using regular pages
+    madvise(ptr, size, MADV_HUGEPAGE);
+#else
+    (void)ptr;
+    (void)size;
+#endif
+}
+
+void *os_mem_alloc_pages(AllokSize *p_size, const AllokHugePages huge_pages) {
+    if (os_mem_page_size(huge_pages, *p_size) != ALLOK_HUGE_PAGE_SIZE) {
+        return os_mem_alloc(*p_size);
+    }
+
+    const AllokSize size = align_up(*p_size, ALLOK_HUGE_PAGE_SIZE);
+    void *ptr = ALLOK_NULL;
+
+#if __linux__
+    if (huge_pages == ALLOK_HUGE_PAGES_EXPLICIT) {
+        ptr = mmap(ALLOK_NULL, size, PROT_READ | PROT_WRITE, MAP_ANON | MAP_PRIVATE | MAP_HUGETLB, -1, 0);
+        if (ptr == MAP_FAILED) {
+            ptr = ALLOK_NULL;
+        }
+    }
+#endif
+
+    // Without reserved hugetlb pages fall back to a 2 MiB aligned mapping the kernel may back with transparent huge pages
+    if (ptr == ALLOK_NULL) {
+        ptr = os_mem_reserve(size, ALLOK_HUGE_PAGE_SIZE);
+        if (ptr == ALLOK_NULL) {
+            return ALLOK_NULL;
+        }
+
+        if (os_mem_commit(ptr, size) == ALLOK_FALSE) {
+            os_mem_free(ptr, size);
+            return ALLOK_NULL;
+        }
+        os_mem_advise_huge(ptr, size);
+    }
+
+    *p_size = size;
+
+    return ptr;
+}
+
+AllokBool os_mem_expand(void *ptr, const AllokSize old_size, const AllokSize new_size) {
+#if __linux__
+    // Without MREMAP_MAYMOVE this only succeeds when the pages after the mapping are free
+    return mremap(ptr, old_size, new_size, 0) != MAP_FAILED ? ALLOK_TRUE : ALLOK_FALSE;
+#else
+    (void)ptr;
+    (void)old_size;
+    (void)new_size;
+    return ALLOK_FALSE;
+#endif
+}
+
+void *os_mem_remap(void *ptr, const AllokSize old_size, const AllokSize new_size) {
+#if __linux__
+    void *result = mremap(ptr, old_size, new_size, MREMAP_MAYMOVE);
+    return result == MAP_FAILED ? ALLOK_NULL : result;
+#else
+    (void)ptr;
+    (void)old_size;
+    (void)new_size;
+    return ALLOK_NULL;
+#endif
+}
+
+#if _WIN32 || _WIN64
+typedef HANDLE AkOsFile;
+#else
+typedef int AkOsFile;
+#endif
+
+// Plain OS calls rather than stdio, which may allocate and would recurse when allok replaces malloc
+AllokBool os_file_create(AkOsFile *p_result, const char *path) {
+#if _WIN32 || _WIN64
+    *p_result = CreateFileA(path, GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+    return *p_result != INVALID_HANDLE_VALUE ? ALLOK_TRUE : ALLOK_FALSE;
+#elif __APPLE__ || __linux__
+    *p_result = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    return *p_result >= 0 ? ALLOK_TRUE : ALLOK_FALSE;
+#else
+    return ALLOK_FALSE;
+#endif
+}
+
+AllokBool os_file_write(AkOsFile file, const void *p_src, AllokSize size) {
+    const AllokByte *src = (const AllokByte *)p_src;
+
+    while (size > 0) {
+#if _WIN32 || _WIN64
+        DWORD written;
+        if (WriteFile(file, src, size > 0x40000000 ? 0x40000000 : (DWORD)size, &written, NULL) == FALSE || written == 0) {
+            return ALLOK_FALSE;
+        }
+#elif __APPLE__ || __linux__
+        const ssize_t written = write(file, src, size);
+        if (written <= 0) {
+            return ALLOK_FALSE;
+        }
+#endif
+        src += written;
+        size -= (AllokSize)written;
+    }
+
+    return ALLOK_TRUE;
+}
+
+void os_file_close(AkOsFile file) {
+#if _WIN32 || _WIN64
+    CloseHandle(file);
+#elif __APPLE__ || __linux__
+    close(file);
+#endif
+}
+
+AllokBool os_file_open(AkOsFile *p_result, const char *path) {
+#if _WIN32 || _WIN64
+    *p_result = CreateFileA(path, GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_WRITE, NULL, OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+    return *p_result != INVALID_HANDLE_VALUE ? ALLOK_TRUE : ALLOK_FALSE;
+#elif __APPLE__ || __linux__
+    *p_result = open(path, O_RDWR | O_CREAT, 0644);
+    return *p_result >= 0 ? ALLOK_TRUE : ALLOK_FALSE;
+#else
+    return ALLOK_FALSE;
+#endif
+}
+
+// Held until the file is closed, a second open of the same file fails to take it even within this process
+AllokBool os_file_lock(AkOsFile file) {
+#if _WIN32 || _WIN64
+    // A byte far past the end is locked so reads and writes through the mapping are never blocked by it
+    OVERLAPPED overlapped = {0};
+    overlapped.Offset = 0xFFFFFFFE;
+    overlapped.OffsetHigh = 0x7FFFFFFF;
+    return LockFileEx(file, LOCKFILE_EXCLUSIVE_LOCK | LOCKFILE_FAIL_IMMEDIATELY, 0, 1, 0, &overlapped) != FALSE ? ALLOK_TRUE : ALLOK_FALSE;
+#elif __APPLE__ || __linux__
+    return flock(file, LOCK_EX | LOCK_NB) == 0 ? ALLOK_TRUE : ALLOK_FALSE;
+#else
+    return ALLOK_FALSE;
+#endif
+}
+
+AllokSize os_file_size(AkOsFile file) {
+#if _WIN32 || _WIN64
+    LARGE_INTEGER size;
+    return GetFileSizeEx(file, &size) != FALSE ? (AllokSize)size.QuadPart : 0;
+#elif __APPLE__ || __linux__
+    const off_t size = lseek(file, 0, SEEK_END);
+    return size > 0 ? (AllokSize)size : 0;
+#else
+    return 0;
+#endif
+}
+
+AllokBool os_file_resize(AkOsFile file, const AllokSize size) {
+#if _WIN32 || _WIN64
+    LARGE_INTEGER offset;
+    offset.QuadPart = (LONGLONG)size;
+    return SetFilePointerEx(file, offset, NULL, FILE_BEGIN) != FALSE && SetEndOfFile(file) != FALSE ? ALLOK_TRUE : ALLOK_FALSE;
+#elif __APPLE__ || __linux__
+    return ftruncate(file, (off_t)size) == 0 ? ALLOK_TRUE : ALLOK_FALSE;
+#else
+    return ALLOK_FALSE;
+#endif
+}
+
+// Windows keeps a separate mapping object alive for the view, other systems leave p_mapping untouched
+void *os_file_map(AkOsFile file, AkOsFile *p_mapping, const AllokSize size) {
+#if _WIN32 || _WIN64
+    *p_mapping = CreateFileMappingA(file, NULL, PAGE_READWRITE, (DWORD)((unsigned long long)size >> 32), (DWORD)size, NULL);
+    if (*p_mapping == NULL) {
+        return ALLOK_NULL;
+    }
+    void *ptr = MapViewOfFile(*p_mapping, FILE_MAP_ALL_ACCESS, 0, 0, size);
+    if (ptr == NULL) {
+        CloseHandle(*p_mapping);
+    }
+    return ptr;
+#elif __APPLE__ || __linux__
+    (void)p_mapping;
+    void *ptr = mmap(ALLOK_NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, file, 0);
+    return ptr == MAP_FAILED ? ALLOK_NULL : ptr;
+#else
+    return ALLOK_NULL;
+#endif
+}
+
+void os_file_unmap(void *ptr, AkOsFile mapping, const AllokSize size) {
+#if _WIN32 || _WIN64
+    (void)size;
+    UnmapViewOfFile(ptr);
+    CloseHandle(mapping);
+#elif __APPLE__ || __linux__
+    (void)mapping;
+    munmap(ptr, size);
+#endif
+}
+
+AllokBool os_file_sync(AkOsFile file, void *ptr, const AllokSize size) {
+#if _WIN32 || _WIN64
+    return FlushViewOfFile(ptr, size) != FALSE && FlushFileBuffers(file) != FALSE ? ALLOK_TRUE : ALLOK_FALSE;
+#elif __APPLE__ || __linux__
+    (void)file;
+    return msync(ptr, size, MS_SYNC) == 0 ? ALLOK_TRUE : ALLOK_FALSE;
+#else
+    return ALLOK_FALSE;
+#endif
+}
+
+// A name that exists already is opened rather than created, and its size is read back into p_size except on Windows
+// where a named mapping can't report it. A creator that has not sized the object yet leaves p_size at 0
+AllokBool os_shared_open(AkOsFile *p_result, const char *name, AllokSize *p_size, AllokBool *p_is_new) {
+#if _WIN32 || _WIN64
+    *p_result = CreateFileMappingA(INVALID_HANDLE_VALUE, NULL, PAGE_READWRITE, (DWORD)((unsigned long long)*p_size >> 32), (DWORD)*p_size, name);
+    if (*p_result == NULL) {
+        return ALLOK_FALSE;
+    }
+    *p_is_new = GetLastError() != ERROR_ALREADY_EXISTS ? ALLOK_TRUE : ALLOK_FALSE;
+    return ALLOK_TRUE;
+#elif __APPLE__ || __linux__
+    if (name == ALLOK_NULL) {
+#if __linux__
+        *p_result = memfd_create("allok", MFD_CLOEXEC);
+        *p_is_new = ALLOK_TRUE;
+        if (*p_result < 0) {
+            return ALLOK_FALSE;
+        }
+        if (ftruncate(*p_result, (off_t)*p_size) != 0) {
+            close(*p_result);
+            return ALLOK_FALSE;
+        }
+        return ALLOK_TRUE;
+#else
+        return ALLOK_FALSE;
+#endif
+    }
+
+    *p_result = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600);
+    if (*p_result >= 0) {
+        *p_is_new = ALLOK_TRUE;
+        if (ftruncate(*p_result, (off_t)*p_size) != 0) {
+            close(*p_result);
+            shm_unlink(name);
+            return ALLOK_FALSE;
+        }
+        return ALLOK_TRUE;
+    }
+    if (errno != EEXIST) {
+        return ALLOK_FALSE;
+    }
+
+    *p_result = shm_open(name, O_RDWR, 0600);
+    if (*p_result < 0) {
+        return ALLOK_FALSE;
+    }
+    *p_is_new = ALLOK_FALSE;
+
+    // The creator sizes the object straight after creating it
+    *p_size = 0;
+    for (AllokSize i = 0; i < ALLOK_SPIN_COUNT * ALLOK_SPIN_COUNT && *p_size == 0; i++) {
+        *p_size = os_file_size(*p_result);
+        if (*p_size == 0) {
+            os_thread_yield();
+        }
+    }
+    return ALLOK_TRUE;
+#else
+    return ALLOK_FALSE;
+#endif
+}
+
+// Maps the whole object, on Windows the view gets its own handle so os_file_unmap and os_file_close each release one
+void *os_shared_map(AkOsFile file, AkOsFile *p_mapping, const AllokSize size) {
+#if _WIN32 || _WIN64
+    if (DuplicateHandle(GetCurrentProcess(), file, GetCurrentProcess(), p_mapping, 0, FALSE, DUPLICATE_SAME_ACCESS) == FALSE) {
+        return ALLOK_NULL;
+    }
+    void *ptr = MapViewOfFile(*p_mapping, FILE_MAP_ALL_ACCESS, 0, 0, size);
+    if (ptr == NULL) {
+        CloseHandle(*p_mapping);
+    }
+    return ptr;
+#elif __APPLE__ || __linux__
+    return os_file_map(file, p_mapping, size);
+#else
+    return ALLOK_NULL;
+#endif
+}
+
+AllokBool os_shared_unlink(const char *name) {
+#if _WIN32 || _WIN64
+    // Named mappings go away with their last handle
+    (void)name;
+    return ALLOK_TRUE;
+#elif __APPLE__ || __linux__
+    return shm_unlink(name) == 0 ? ALLOK_TRUE : ALLOK_FALSE;
+#else
+    return ALLOK_FALSE;
+#endif
+}
+
+unsigned long long os_clock_ns() {
+#if _WIN32 || _WIN64
+    LARGE_INTEGER counter;
+    LARGE_INTEGER frequency;
+    QueryPerformanceCounter(&counter);
+    QueryPerformanceFrequency(&frequency);
+    return (unsigned long long)(counter.QuadPart / frequency.QuadPart) * 1000000000ULL + (unsigned long long)(counter.QuadPart % frequency.QuadPart) * 1000000000ULL / (unsigned long long)frequency.QuadPart;
+#elif __APPLE__ || __linux__
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long long)ts.tv_sec * 1000000000ULL + (unsigned long long)ts.tv_nsec;
+#else
+    return 0;
+#endif
+}
+
+AllokResult akMemoryArenaAlloc(AkMemoryArena **pp_result, const AllokSize size) {
+    return akMemoryArenaAllocWithParams(pp_result, size, (AkMemoryArenaParams){ALLOK_HUGE_PAGES_NONE, ALLOK_FALSE});
+}
+
+AllokResult akMemoryArenaAllocWithParams(AkMemoryArena **pp_result, const AllokSize size, const AkMemoryArenaParams params) {
+    AllokSize alloc_size = size + sizeof(AkMemoryArena);
+
+    AkMemoryArena *arena = os_mem_alloc_pages(&alloc_size, params.huge_pages);
+    if (arena == ALLOK_NULL) {
+        return ALLOK_OS_MEMORY_ALLOC_FAILED;
+    }
+
+    arena->params = params;
+    arena->p_start = (char *)arena + sizeof(AkMemoryArena);
+    arena->p_current = arena->p_start;
+    arena->size = 0;
+    arena->alloc_size = alloc_size - sizeof(AkMemoryArena);
+    arena->p_next = ALLOK_NULL;
+    arena->p_prev = ALLOK_NULL;
+    arena->p_active = arena;
+    arena->generation = 0;
+
+    *pp_result = arena;
+
+    return ALLOK_SUCCESS;
+}
+
+AllokResult arena_claim(void **pp_result, AkMemoryArena *p_chunk, const AllokSize size, const AllokSize alignment) {
+    const AllokSize padding = align_up((AllokSize)p_chunk->p_current, alignment) - (AllokSize)p_chunk->p_current;
+    const AllokSize available = p_chunk->alloc_size - p_chunk->size;
+    if (size > available || padding > available - size) {
+        return ALLOK_INSUFFICIENT_ARENA_MEMORY;
+    }
+
+    *pp_result = (AllokByte *)p_chunk->p_current + padding;
+    p_chunk->size += padding + size;
+    p_chunk->p_current = (AllokByte *)p_chunk->p_current + padding + size;
+
+    return ALLOK_SUCCESS;
+}
+
+AllokResult arena_grow(AkMemoryArena *p_arena, const AllokSize size) {
+    AkMemoryArena *chunk = p_arena->p_active;
+
+    // Chunks kept by a reset or rollback are reused before any more memory is mapped
+    while (chunk->p_next != ALLOK_NULL) {
+        chunk = chunk->p_next;
+        chunk->size = 0;
+        chunk->p_current = chunk->p_start;
+        if (chunk->alloc_size >= size) {
+            p_arena->p_active = chunk;
+            return ALLOK_SUCCESS;
+        }
+    }
+
+    if (size > (AllokSize)-1 - chunk->size - sizeof(AkMemoryArena) - ALLOK_HUGE_PAGE_SIZE) {
+        return ALLOK_INVALID_SIZE;
+    }
+
+    const AllokSize grown_size = chunk->alloc_size > (AllokSize)-1 / ALLOK_ARENA_GROWTH_FACTOR ? (AllokSize)-1 : chunk->alloc_size * ALLOK_ARENA_GROWTH_FACTOR;
+
+    // Expanding the last chunk in place keeps everything claimed from it valid and the chain short
+    const AllokSize expanded_size = max_size(grown_size, chunk->size + size);
+    const AllokSize mapping_size = chunk->alloc_size + sizeof(AkMemoryArena);
+    const AllokSize expanded_mapping_size = align_up(expanded_size + sizeof(AkMemoryArena), os_mem_page_size(chunk->params.huge_pages, expanded_size));
+    if (os_mem_expand(chunk, mapping_size, expanded_mapping_size) == ALLOK_TRUE) {
+        chunk->alloc_size = expanded_mapping_size - sizeof(AkMemoryArena);
+        p_arena->p_active = chunk;
+        return ALLOK_SUCCESS;
+    }
+
+    AkMemoryArena *next;
+    const AllokResult result = akMemoryArenaAllocWithParams(&next, max_size(grown_size, size), p_arena->params);
+    if (result != ALLOK_SUCCESS) {
+        return result;
+    }
+
+    next->p_prev = chunk;
+    chunk->p_next = next;
+    p_arena->p_active = next;
+
+    return ALLOK_SUCCESS;
+}
+
+AllokResult akMemoryArenaClaim(void **pp_result, AkMemoryArena *p_arena, const AllokSize size) {
+    return akMemoryArenaClaimAligned(pp_result, p_arena, size, 1);
+}
+
+AllokResult akMemoryArenaClaimAligned(void **pp_result, AkMemoryArena *p_arena, const AllokSize size, const AllokSize alignment) {
+    if (pp_result == ALLOK_NULL || p_arena == ALLOK_NULL) {
+        return ALLOK_NULL_PARAM;
+    }
+
+    if (is_valid_alignment(alignment) == ALLOK_FALSE) {
+        return ALLOK_INVALID_ALIGNMENT;
+    }
+
+    AllokResult result = arena_claim(pp_result, p_arena->p_active, size, alignment);
+    if (result != ALLOK_INSUFFICIENT_ARENA_MEMORY || p_arena->params.is_growable == ALLOK_FALSE) {
+        return result;
+    }
+
+    if (size > (AllokSize)-1 - alignment) {
+        return ALLOK_INVALID_SIZE;
+    }
+
+    result = arena_grow(p_arena, size + alignment - 1);
+    if (result != ALLOK_SUCCESS) {
+        return result;
+    }
+
+    return arena_claim(pp_result, p_arena->p_active, size, alignment);
+}
+
+AllokResult akMemoryArenaReset(AkMemoryArena *p_arena) {
+    if (p_arena == ALLOK_NULL) {
+        return ALLOK_NULL_PARAM;
+    }
+
+    p_arena->size = 0;
+    p_arena->p_current = p_arena->p_start;
+    p_arena->p_active = p_arena;
+    p_arena->generation++;
+
+    if (p_arena->params.is_growable == ALLOK_FALSE) {
+        return ALLOK_SUCCESS;
+    }
+
+    // The first chunk holds the arena itself, so only the largest of the chained chunks is kept alongside it
+    AkMemoryArena *largest = ALLOK_NULL;
+    for (AkMemoryArena *chunk = p_arena->p_next; chunk != ALLOK_NULL; chunk = chunk->p_next) {
+        if (largest == ALLOK_NULL || chunk->alloc_size > largest->alloc_size) {
+            largest = chunk;
+        }
+    }
+
+    AkMemoryArena *chunk = p_arena->p_next;
+    while (chunk != ALLOK_NULL) {
+        AkMemoryArena *next = chunk->p_next;
+        if (chunk != largest || chunk->alloc_size <= p_arena->alloc_size) {
+            akMemoryArenaDestroy(&chunk, ALLOK_FALSE);
+        }
+        chunk = next;
+    }
+
+    if (p_arena->p_next != ALLOK_NULL) {
+        p_arena->p_next->size = 0;
+        p_arena->p_next->p_current = p_arena->p_next->p_start;
+    }
+
+    return ALLOK_SUCCESS;
+}
+
+AllokResult akMemoryArenaMark(AkMemoryArenaMark *p_result, AkMemoryArena *p_arena) {
+    if (p_result == ALLOK_NULL || p_arena == ALLOK_NULL) {
+        return ALLOK_NULL_PARAM;
+    }
+
+    AkMemoryArena *chunk = p_arena->p_active;
+    p_result->p_arena = p_arena;
+    p_result->p_chunk = chunk;
+    p_result->p_current = chunk->p_current;
+    p_result->size = chunk->size;
+    p_result->generation = p_arena->generation;
+
+    return ALLOK_SUCCESS;
+}
+
+AllokResult akMemoryArenaRollback(const AkMemoryArenaMark *p_mark) {
+    if (p_mark == ALLOK_NULL || p_mark->p_arena == ALLOK_NULL || p_mark->p_chunk == ALLOK_NULL) {
+        return ALLOK_NULL_PARAM;
+    }
+
+    // The marked chunk may have been unmapped since, so a stale mark is rejected before it is read
+    if (p_mark->generation != p_mark->p_arena->generation) {
+        return ALLOK_INVALID_ADDR;
+    }
+
+    AkMemoryArena *chunk = p_mark->p_chunk;
+    if (p_mark->size > chunk->alloc_size || is_ptr_in_range(p_mark->p_current, chunk->p_start, chunk->alloc_size + 1) == ALLOK_FALSE) {
+        return ALLOK_INVALID_ADDR;
+    }
+
+    // Chunks after the marked one are emptied when the arena grows back into them
+    p_mark->p_arena->p_active = chunk;
+    chunk->p_current = p_mark->p_current;
+    chunk->size = p_mark->size;
+
+    return ALLOK_SUCCESS;
+}
+
+AllokResult akMemoryArenaFree(void **pp_target, AkMemoryArena *p_arena, const AllokSize size, const AllokBool auto_destroy) {
+    if (pp_target == ALLOK_NULL || p_arena == ALLOK_NULL) {
+        return ALLOK_NULL_PARAM;
+    }
+
+    // Chunks past the active one only hold memory that has been reset or rolled back
+    AkMemoryArena *chunk = p_arena;
+    while (is_ptr_in_range(*pp_target, chunk->p_start, chunk->size) == ALLOK_FALSE) {
+        if (chunk == p_arena->p_active || chunk->p_next == ALLOK_NULL) {
+            return ALLOK_INVALID_ADDR;
+        }
+        chunk = chunk->p_next;
+    }
+
+    if (chunk->size < size) {
+        return ALLOK_INVALID_SIZE;
+    }
+
+    if ((AllokByte *)chunk->p_current == (AllokByte *)*pp_target + size) {
+        chunk->p_current = (AllokByte *)chunk->p_current - size;
+    }
+    chunk->size -= size;
+
+    if (chunk->size <= 0) {
+        chunk->p_current = chunk->p_start;
+
+        // The first chunk of a growable arena owns the chain, so it is only destroyed once it is alone
+        const AllokBool is_owner = chunk == p_arena && p_arena->params.is_growable == ALLOK_TRUE && p_arena->p_next != ALLOK_NULL ? ALLOK_TRUE : ALLOK_FALSE;
+        if (auto_destroy && is_owner == ALLOK_FALSE) {
+            if (chunk != p_arena && p_arena->p_active == chunk) {
+                p_arena->p_active = chunk->p_prev;
+            }
+            if (chunk != p_arena) {
+                p_arena->generation++;
+            }
+            akMemoryArenaDestroy(&chunk, ALLOK_FALSE);
+        }
+    }
+
+    *pp_target = ALLOK_NULL;
+
+    return ALLOK_SUCCESS;
+
+}
+
+void akMemoryArenaDestroy(AkMemoryArena **pp_arena, const AllokBool recursive) {
+    if (pp_arena == ALLOK_NULL) {
+        return;
+    }
+
+    AkMemoryArena *arena = *pp_arena;
+    if (arena == ALLOK_NULL) {
+        return;
+    }
+
+    AkMemoryArena *next = arena->p_next;
+    AkMemoryArena *prev = arena->p_prev;
+    if (prev != ALLOK_NULL) {
+        prev->p_next = next;
+    }
+    if (next != ALLOK_NULL) {
+        next->p_prev = prev;
+    }
+
+    os_mem_free(arena, arena->alloc_size + sizeof(AkMemoryArena));
+
+    if (recursive) {
+        akMemoryArenaDestroy(&next, recursive);
+    }
+
+    *pp_arena = ALLOK_NULL;
+}
+
+static inline AllokSize gap_min_size() {
+    // Smaller gaps can't hold a MemoryBlock header so they are never indexed
+    return max_size(sizeof(AkFreeGap), sizeof(AkMemoryBlock));
+}
+
+static inline AllokSize tree_height(const AkTreeNode *p_node) {
+    return p_node == ALLOK_NULL ? 0 : p_node->height;
+}
+
+static inline AllokBool tree_less(const AkTreeNode *a, const AkTreeNode *b) {
+    if (a->key != b->key) {
+        return a->key < b->key ? ALLOK_TRUE : ALLOK_FALSE;
+    }
+    return (AllokByte *)a < (AllokByte *)b ? ALLOK_TRUE : ALLOK_FALSE;
+}
+
+static inline AllokSize tree_max_value(const AkTreeNode *p_node) {
+    return p_node == ALLOK_NULL ? 0 : p_node->max_value;
+}
+
+static inline void tree_update_height(AkTreeNode *p_node) {
+    p_node->height = 1 + max_size(tree_height(p_node->p_left), tree_height(p_node->p_right));
+    p_node->max_value = max_size(p_node->value, max_size(tree_max_value(p_node->p_left), tree_max_value(p_node->p_right)));
+}
+
+AkTreeNode *tree_rotate_right(AkTreeNode *p_node) {
+    AkTreeNode *left = p_node->p_left;
+    p_node->p_left = left->p_right;
+    left->p_right = p_node;
+    tree_update_height(p_node);
+    tree_update_height(left);
+    return left;
+}
+
+AkTreeNode *tree_rotate_left(AkTreeNode *p_node) {
+    AkTreeNode *right = p_node->p_right;
+    p_node->p_right = right->p_left;
+    right->p_left = p_node;
+    tree_update_height(p_node);
+    tree_update_height(right);
+    return right;
+}
+
+AkTreeNode *tree_balance(AkTreeNode *p_node) {
+    tree_update_height(p_node);
+
+    const AllokSize left_height = tree_height(p_node->p_left);
+    const AllokSize right_height = tree_height(p_node->p_right);
+
+    if (left_height > right_height + 1) {
+        if (tree_height(p_node->p_left->p_left) < tree_height(p_node->p_left->p_right)) {
+            p_node->p_left = tree_rotate_left(p_node->p_left);
+        }
+        return tree_rotate_right(p_node);
+    }
+
+    if (right_height > left_height + 1) {
+        if (tree_height(p_node->p_right->p_right) < tree_height(p_node->p_right->p_left)) {
+            p_node->p_right = tree_rotate_right(p_node->p_right);
+        }
+        return tree_rotate_left(p_node);
+    }
+
+    return p_node;
+}
+
+AkTreeNode *tree_insert(AkTreeNode *p_root, AkTreeNode *p_node) {
+    if (p_root == ALLOK_NULL) {
+        p_node->height = 1;
+        p_node->max_value = p_node->value;
+        p_node->p_left = ALLOK_NULL;
+        p_node->p_right = ALLOK_NULL;
+        return p_node;
+    }
+
+    if (tree_less(p_node, p_root) == ALLOK_TRUE) {
+        p_root->p_left = tree_insert(p_root->p_left, p_node);
+    } else {
+        p_root->p_right = tree_insert(p_root->p_right, p_node);
+    }
+
+    return tree_balance(p_root);
+}
+
+AkTreeNode *tree_remove_min(AkTreeNode *p_root, AkTreeNode **pp_min) {
+    if (p_root->p_left == ALLOK_NULL) {
+        *pp_min = p_root;
+        return p_root->p_right;
+    }
+
+    p_root->p_left = tree_remove_min(p_root->p_left, pp_min);
+    return tree_balance(p_root);
+}
+
+AkTreeNode *tree_remove(AkTreeNode *p_root, AkTreeNode *p_node) {
+    if (p_root == ALLOK_NULL) {
+        return ALLOK_NULL;
+    }
+
+    if (p_root != p_node) {
+        if (tree_less(p_node, p_root) == ALLOK_TRUE) {
+            p_root->p_left = tree_remove(p_root->p_left, p_node);
+        } else {
+            p_root->p_right = tree_remove(p_root->p_right, p_node);
+        }
+        return tree_balance(p_root);
+    }
+
+    if (p_root->p_left == ALLOK_NULL) {
+        return p_root->p_right;
+    }
+    if (p_root->p_right == ALLOK_NULL) {
+        return p_root->p_left;
+    }
+
+    AkTreeNode *successor;
+    AkTreeNode *right = tree_remove_min(p_root->p_right, &successor);
+    successor->p_left = p_root->p_left;
+    successor->p_right = right;
+
+    return tree_balance(successor);
+}
+
+AkTreeNode *tree_lower_bound(AkTreeNode *p_root, const AllokSize key) {
+    AkTreeNode *result = ALLOK_NULL;
+    while (p_root != ALLOK_NULL) {
+        if (p_root->key >= key) {
+            result = p_root;
+            p_root = p_root->p_left;
+        } else {
+            p_root = p_root->p_right;
+        }
+    }
+    return result;
+}
+
+AkTreeNode *tree_floor(AkTreeNode *p_root, const AllokSize key) {
+    AkTreeNode *result = ALLOK_NULL;
+    while (p_root != ALLOK_NULL) {
+        if (p_root->key <= key) {
+            result = p_root;
+            p_root = p_root->p_right;
+        } else {
+            p_root = p_root->p_left;
+        }
+    }
+    return result;
+}
+
+AkTreeNode *tree_first_fit(AkTreeNode *p_root, const AllokSize value) {
+    // max_value guarantees a match somewhere below, so the lowest keyed one is found in one descent
+    while (p_root != ALLOK_NULL && p_root->max_value >= value) {
+        if (tree_max_value(p_root->p_left) >= value) {
+            p_root = p_root->p_left;
+        } else if (p_root->value >= value) {
+            return p_root;
+        } else {
+            p_root = p_root->p_right;
+        }
+    }
+    return ALLOK_NULL;
+}
+
+AkTreeNode *tree_max(AkTreeNode *p_root) {
+    if (p_root == ALLOK_NULL) {
+        return ALLOK_NULL;
+    }
+    while (p_root->p_right != ALLOK_NULL) {
+        p_root = p_root->p_right;
+    }
+    return p_root;
+}
+
+static inline AkFreeGap *gap_node_at(const AllokByte *p_start) {
+    // Blocks end on arbitrary bytes, the node is stored at the first pointer aligned address of the gap
+    return (AkFreeGap *)align_up((AllokSize)p_start, sizeof(void *));
+}
+
+void pool_gap_insert(AkMemoryPool *p_pool, AllokByte *p_start, const AllokByte *p_end, AkMemoryBlock *p_prev_block) {
+    AkFreeGap *gap = gap_node_at(p_start);
+    if ((AllokByte *)gap >= p_end || (AllokSize)(p_end - (AllokByte *)gap) < gap_min_size()) {
+        return;
+    }
+
+    const AllokSize size = (AllokSize)(p_end - (AllokByte *)gap);
+    gap->node.key = size;
+    gap->node.value = 0;
+    gap->p_prev_block = p_prev_block;
+
+    p_pool->p_gap_root = tree_insert(p_pool->p_gap_root, &gap->node);
+}
+
+void pool_gap_remove(AkMemoryPool *p_pool, AllokByte *p_start, const AllokByte *p_end) {
+    AkFreeGap *gap = gap_node_at(p_start);
+    if ((AllokByte *)gap >= p_end || (AllokSize)(p_end - (AllokByte *)gap) < gap_min_size()) {
+        return;
+    }
+
+    p_pool->p_gap_root = tree_remove(p_pool->p_gap_root, &gap->node);
+}
+
+// The state word ends every pool and large block header, so it sits right in front of the block's pointer (aligned large
+// blocks copy it into their padding). A live block keeps the page aligned address of its pool or large block header
+// there, tagged with its kind, which lets a foreign free find the owning map without the map's trees. A block queued by
+// a foreign free holds ALLOK_BLOCK_PENDING and the next queued state word instead
+#define ALLOK_BLOCK_TAG 0xA10
+#define ALLOK_BLOCK_TAG_MASK ((AllokSize)0xFFF)
+#define ALLOK_BLOCK_POOL 1
+#define ALLOK_BLOCK_LARGE 2
+#define ALLOK_BLOCK_KIND_MASK ((AllokSize)3)
+#define ALLOK_BLOCK_PENDING ((AllokSize)4)
+#define ALLOK_BLOCK_LINK_MASK ((AllokSize)7)
+
+static inline AllokSize block_tag(const void *p_header, const AllokSize kind) {
+    return (AllokSize)p_header | ALLOK_BLOCK_TAG | kind;
+}
+
+static inline AllokBool block_is_pending(const volatile AllokSize *p_state) {
+    return (atomic_load_size(p_state) & ALLOK_BLOCK_PENDING) != 0 ? ALLOK_TRUE : ALLOK_FALSE;
+}
+
+static inline AllokByte *block_end(const AkMemoryBlock *p_block) {
+    return (AllokByte *)p_block->p_start + p_block->size;
+}
+
+static inline AllokByte *gap_start_after(const AkMemoryPool *p_pool, const AkMemoryBlock *p_prev) {
+    return p_prev == ALLOK_NULL ? (AllokByte *)p_pool->p_start : block_end(p_prev);
+}
+
+static inline AllokByte *gap_end_before(const AkMemoryPool *p_pool, const AkMemoryBlock *p_next) {
+    return p_next == ALLOK_NULL ? (AllokByte *)p_pool->p_start + p_pool->alloc_size : (AllokByte *)p_next;
+}
+
+AllokSize pool_fit_gap(const AkMemoryPool *p_pool) {
+    // Linear fit only ever places blocks after the tail, so that is the only gap worth indexing
+    if (p_pool->p_parent_map != ALLOK_NULL && p_pool->p_parent_map->params.type == ALLOK_LINEAR_FIT) {
+        return (AllokSize)(gap_end_before(p_pool, ALLOK_NULL) - gap_start_after(p_pool, p_pool->p_tail));
+    }
+    return p_pool->largest_gap;
+}
+
+void pool_refresh_gaps(AkMemoryPool *p_pool) {
+    const AkTreeNode *largest = tree_max(p_pool->p_gap_root);
+    p_pool->largest_gap = largest == ALLOK_NULL ? 0 : largest->key;
+
+    AkMemoryMap *map = p_pool->p_parent_map;
+    if (map == ALLOK_NULL) {
+        return;
+    }
+
+    AllokSize *fit_field = map->params.type == ALLOK_FIRST_FIT ? &p_pool->fit_node.value : &p_pool->fit_node.key;
+    const AllokSize fit_gap = pool_fit_gap(p_pool);
+    if (fit_gap == *fit_field) {
+        return;
+    }
+
+    map->p_pool_root = tree_remove(map->p_pool_root, &p_pool->fit_node);
+    *fit_field = fit_gap;
+    map->p_pool_root = tree_insert(map->p_pool_root, &p_pool->fit_node);
+}
+
+static inline void map_stats_alloc(AkMemoryMap *p_map, const AllokSize size) {
+    AkMemoryMapMetadata *metadata = &p_map->metadata;
+    metadata->alloc_size += size;
+    if (metadata->alloc_size > metadata->peak_alloc_size) {
+        metadata->peak_alloc_size = metadata->alloc_size;
+    }
+}
+
+static inline void map_stats_resize(AkMemoryMap *p_map, const AllokSize old_size, const AllokSize size) {
+    if (size > old_size) {
+        map_stats_alloc(p_map, size - old_size);
+    } else {
+        p_map->metadata.alloc_size -= old_size - size;
+    }
+}
+
+AkMemoryPool *map_find_pool_by_addr(const AkMemoryMap *p_map, const void *ptr) {
+    AkTreeNode *node = tree_floor(p_map->p_pool_addr_root, (AllokSize)ptr);
+    if (node == ALLOK_NULL) {
+        return ALLOK_NULL;
+    }
+
+    AkMemoryPool *pool = (AkMemoryPool *)((AllokByte *)node - offsetof(AkMemoryPool, addr_node));
+    return is_ptr_in_range(ptr, pool->p_start, pool->alloc_size) == ALLOK_TRUE ? pool : ALLOK_NULL;
+}
+
+AkMemoryPool *map_find_pool(const AkMemoryMap *p_map, const AllokSize alloc_size) {
+    // fit_node is the first member of AkMemoryPool, so a node is its pool
+    if (p_map->params.type == ALLOK_WORST_FIT) {
+        AkTreeNode *node = tree_max(p_map->p_pool_root);
+        return node != ALLOK_NULL && node->key >= alloc_size ? (AkMemoryPool *)node : ALLOK_NULL;
+    }
+
+    if (p_map->params.type == ALLOK_FIRST_FIT) {
+        return (AkMemoryPool *)tree_first_fit(p_map->p_pool_root, alloc_size);
+    }
+
+    return (AkMemoryPool *)tree_lower_bound(p_map->p_pool_root, alloc_size);
+}
+
+void map_link_pool(AkMemoryMap *p_map, AkMemoryPool *p_pool) {
+    // First fit keys pools by creation order, which is list order, and searches on the fit gap as the value
+    if (p_map->params.type == ALLOK_FIRST_FIT) {
+        p_pool->fit_node.key = p_map->pool_sequence++;
+        p_pool->fit_node.value = pool_fit_gap(p_pool);
+    } else {
+        p_pool->fit_node.key = pool_fit_gap(p_pool);
+        p_pool->fit_node.value = 0;
+    }
+    p_pool->addr_node.key = (AllokSize)p_pool->p_start;
+    p_pool->addr_node.value = 0;
+
+    p_pool->p_next = ALLOK_NULL;
+    p_pool->p_prev = p_map->p_pool_tail;
+    if (p_map->p_pool_tail != ALLOK_NULL) {
+        p_map->p_pool_tail->p_next = p_pool;
+    } else {
+        p_map->p_pool_head = p_pool;
+    }
+    p_map->p_pool_tail = p_pool;
+
+    p_map->p_pool_root = tree_insert(p_map->p_pool_root, &p_pool->fit_node);
+    p_map->p_pool_addr_root = tree_insert(p_map->p_pool_addr_root, &p_pool->addr_node);
+    p_map->pool_count++;
+    p_map->metadata.pool_count++;
+}
+
+void map_unlink_pool(AkMemoryMap *p_map, AkMemoryPool *p_pool) {
+    if (p_pool->p_prev != ALLOK_NULL) {
+        p_pool->p_prev->p_next = p_pool->p_next;
+    } else {
+        p_map->p_pool_head = p_pool->p_next;
+    }
+    if (p_pool->p_next != ALLOK_NULL) {
+        p_pool->p_next->p_prev = p_pool->p_prev;
+    } else {
+        p_map->p_pool_tail = p_pool->p_prev;
+    }
+
+    p_map->p_pool_root = tree_remove(p_map->p_pool_root, &p_pool->fit_node);
+    p_map->p_pool_addr_root = tree_remove(p_map->p_pool_addr_root, &p_pool->addr_node);
+    p_map->pool_count--;
+    p_map->metadata.pool_count--;
+}
+
+static inline AllokSize pool_mapping_size(const AkMemoryPool *p_pool) {
+    return p_pool->alloc_size + sizeof(AkMemoryPool);
+}
+
+void pool_cache_unlink(AkMemoryMap *p_map, AkMemoryPool *p_pool) {
+    if (p_pool->p_prev != ALLOK_NULL) {
+        p_pool->p_prev->p_next = p_pool->p_next;
+    } else {
+        p_map->p_pool_cache_head = p_pool->p_next;
+    }
+    if (p_pool->p_next != ALLOK_NULL) {
+        p_pool->p_next->p_prev = p_pool->p_prev;
+    } else {
+        p_map->p_pool_cache_tail = p_pool->p_prev;
+    }
+
+    p_map->pool_cache_count--;
+    p_map->pool_cache_size -= pool_mapping_size(p_pool);
+}
+
+void pool_cache_release(AkMemoryMap *p_map, AkMemoryPool *p_pool) {
+    pool_cache_unlink(p_map, p_pool);
+    p_map->metadata.pools_freed++;
+    p_map->metadata.mapped_size -= pool_mapping_size(p_pool);
+    p_map->metadata.header_size -= sizeof(AkMemoryPool);
+    os_mem_free(p_pool, pool_mapping_size(p_pool));
+}
+
+void pool_cache_decay(AkMemoryMap *p_map) {
+    // The cache is ordered newest first, so decayed pools collect at the tail
+    const AllokSize decay = p_map->params.pool_cache_decay;
+    while (p_map->p_pool_cache_tail != ALLOK_NULL) {
+        AkMemoryPool *oldest = p_map->p_pool_cache_tail;
+        const AllokBool is_decayed = decay != 0 && p_map->pool_cache_clock - oldest->cache_stamp > decay ? ALLOK_TRUE : ALLOK_FALSE;
+        if (is_decayed == ALLOK_FALSE && p_map->pool_cache_size <= p_map->params.pool_cache_size) {
+            break;
+        }
+        pool_cache_release(p_map, oldest);
+    }
+}
+
+AllokResult map_acquire_pool(AkMemoryPool **pp_result, AkMemoryMap *p_map, const AllokSize size) {
+    if (p_map->params.pool_cache_size == 0) {
+        return akMemoryPoolAlloc(pp_result, p_map, size);
+    }
+
+    p_map->pool_cache_clock++;
+
+    // The cache is bounded by pool_cache_size, so a scan for the tightest pool stays short
+    AkMemoryPool *best = ALLOK_NULL;
+    for (AkMemoryPool *pool = p_map->p_pool_cache_head; pool != ALLOK_NULL; pool = pool->p_next) {
+        if (pool->alloc_size >= size && (best == ALLOK_NULL || pool->alloc_size < best->alloc_size)) {
+            best = pool;
+        }
+    }
+
+    if (best == ALLOK_NULL) {
+        p_map->metadata.pool_cache_misses++;
+        pool_cache_decay(p_map);
+        return akMemoryPoolAlloc(pp_result, p_map, size);
+    }
+
+    pool_cache_unlink(p_map, best);
+    map_link_pool(p_map, best);
+    p_map->metadata.pool_cache_hits++;
+    pool_cache_decay(p_map);
+
+    *pp_result = best;
+
+    return ALLOK_SUCCESS;
+}
+
+AllokResult akMemoryPoolRetire(AkMemoryPool **pp_pool) {
+    if (pp_pool == ALLOK_NULL || *pp_pool == ALLOK_NULL) {
+        return ALLOK_NULL_PARAM;
+    }
+
+    AkMemoryPool *pool = *pp_pool;
+    if (pool->p_head != ALLOK_NULL) {
+        return ALLOK_INVALID_SIZE;
+    }
+
+    AkMemoryMap *map = pool->p_parent_map;
+    if (map == ALLOK_NULL || pool_mapping_size(pool) > map->params.pool_cache_size) {
+        return akMemoryPoolFree(pp_pool, ALLOK_FALSE);
+    }
+
+    // An empty pool still holds its single gap, so it only needs relinking when reused
+    map_unlink_pool(map, pool);
+
+    map->pool_cache_clock++;
+    pool->cache_stamp = map->pool_cache_clock;
+    pool->p_prev = ALLOK_NULL;
+    pool->p_next = map->p_pool_cache_head;
+    if (map->p_pool_cache_head != ALLOK_NULL) {
+        map->p_pool_cache_head->p_prev = pool;
+    } else {
+        map->p_pool_cache_tail = pool;
+    }
+    map->p_pool_cache_head = pool;
+    map->pool_cache_count++;
+    map->pool_cache_size += pool_mapping_size(pool);
+
+    pool_cache_decay(map);
+
+    *pp_pool = ALLOK_NULL;
+
+    return ALLOK_SUCCESS;
+}
+
+void akMemoryPoolCacheRelease(AkMemoryMap *p_map) {
+    if (p_map == ALLOK_NULL) {
+        return;
+    }
+
+    while (p_map->p_pool_cache_head != ALLOK_NULL) {
+        pool_cache_release(p_map, p_map->p_pool_cache_head);
+    }
+}
+
+AllokResult block_create_after(AkMemoryBlock **pp_result, AkMemoryPool *p_pool, AkMemoryBlock *p_prev, const AllokSize size, const AllokSize offset) {
+    if (offset + size + sizeof(AkMemoryBlock) > p_pool->alloc_size) {
+        return ALLOK_INSUFFICIENT_POOL_MEMORY;
+    }
+
+    AkMemoryBlock *next = p_prev == ALLOK_NULL ? p_pool->p_head : p_prev->p_next;
+    AllokByte *gap_start = gap_start_after(p_pool, p_prev);
+    AllokByte *gap_end = gap_end_before(p_pool, next);
+
+    // The gap node lives in the memory the header is about to occupy, so unindex it first
+    pool_gap_remove(p_pool, gap_start, gap_end);
+
+    AkMemoryBlock *block = (AkMemoryBlock *)((AllokByte *)p_pool->p_start + offset);
+    block->size = size;
+    block->p_start = (AllokByte *)block + sizeof(AkMemoryBlock);
+    block->p_parent = p_pool;
+    block->state = block_tag(p_pool, ALLOK_BLOCK_POOL);
+    block->p_prev = p_prev;
+    block->p_next = next;
+
+    if (p_prev == ALLOK_NULL) {
+        p_pool->p_head = block;
+    } else {
+        p_prev->p_next = block;
+    }
+
+    if (next == ALLOK_NULL) {
+        p_pool->p_tail = block;
+    } else {
+        next->p_prev = block;
+    }
+
+    pool_gap_insert(p_pool, gap_start, (AllokByte *)block, p_prev);
+    pool_gap_insert(p_pool, block_end(block), gap_end, block);
+    pool_refresh_gaps(p_pool);
+
+    p_pool->size += size + sizeof(AkMemoryBlock);
+    AkMemoryMap *map = p_pool->p_parent_map;
+    if (map != ALLOK_NULL) {
+        map->metadata.blocks_created++;
+        map->metadata.block_count++;
+        map->metadata.header_size += sizeof(AkMemoryBlock);
+        map_stats_alloc(map, size);
+    }
+
+    *pp_result = block;
+
+    return ALLOK_SUCCESS;
+}
+
+void block_create_run(void **pp_results, AkMemoryPool *p_pool, AkMemoryBlock *p_prev, const AllokSize size, const AllokSize offset, const AllokSize count, const AllokSize stride) {
+    AkMemoryBlock *next = p_prev == ALLOK_NULL ? p_pool->p_head : p_prev->p_next;
+    AllokByte *gap_start = gap_start_after(p_pool, p_prev);
+    AllokByte *gap_end = gap_end_before(p_pool, next);
+
+    pool_gap_remove(p_pool, gap_start, gap_end);
+
+    // The padding between blocks of a run is below gap_min_size, so only the gaps around the run are indexed
+    AkMemoryBlock *first = (AkMemoryBlock *)((AllokByte *)p_pool->p_start + offset);
+    AkMemoryBlock *last = p_prev;
+    for (AllokSize i = 0; i < count; i++) {
+        AkMemoryBlock *block = (AkMemoryBlock *)((AllokByte *)first + i * stride);
+        block->size = size;
+        block->p_start = (AllokByte *)block + sizeof(AkMemoryBlock);
+        block->p_parent = p_pool;
+        block->state = block_tag(p_pool, ALLOK_BLOCK_POOL);
+        block->p_prev = last;
+
+        if (last == ALLOK_NULL) {
+            p_pool->p_head = block;
+        } else {
+            last->p_next = block;
+        }
+
+        pp_results[i] = block->p_start;
+        last = block;
+    }
+
+    last->p_next = next;
+    if (next == ALLOK_NULL) {
+        p_pool->p_tail = last;
+    } else {
+        next->p_prev = last;
+    }
+
+    pool_gap_insert(p_pool, gap_start, (AllokByte *)first, p_prev);
+    pool_gap_insert(p_pool, block_end(last), gap_end, last);
+    pool_refresh_gaps(p_pool);
+
+    p_pool->size += count * (size + sizeof(AkMemoryBlock));
+    AkMemoryMap *map = p_pool->p_parent_map;
+    if (map != ALLOK_NULL) {
+        map->metadata.blocks_created += count;
+        map->metadata.block_count += count;
+        map->metadata.header_size += count * sizeof(AkMemoryBlock);
+        map_stats_alloc(map, count * size);
+    }
+}
+
+void block_resize(AkMemoryBlock *p_block, const AllokSize size) {
+    AkMemoryPool *pool = p_block->p_parent;
+    const AllokByte *gap_end = gap_end_before(pool, p_block->p_next);
+
+    pool_gap_remove(pool, block_end(p_block), gap_end);
+
+    pool->size = pool->size - p_block->size + size;
+    if (pool->p_parent_map != ALLOK_NULL) {
+        map_stats_resize(pool->p_parent_map, p_block->size, size);
+    }
+    p_block->size = size;
+
+    pool_gap_insert(pool, block_end(p_block), gap_end, p_block);
+    pool_refresh_gaps(pool);
+}
+
+AllokResult akMemoryBlockCreate(AkMemoryBlock **pp_result, AkMemoryPool *p_pool, const AllokSize size, const AllokSize offset) {
+    if (pp_result == ALLOK_NULL || p_pool == ALLOK_NULL) {
+        return ALLOK_NULL_PARAM;
+    }
+
+    AllokByte *block_start = (AllokByte *)p_pool->p_start + offset;
+
+    AkMemoryBlock *current = p_pool->p_head;
+    AkMemoryBlock *prev = ALLOK_NULL;
+
+    while (current != ALLOK_NULL && (AllokByte *)current < block_start) {
+        prev = current;
+        current = current->p_next;
+    }
+
+    return block_create_after(pp_result, p_pool, prev, size, offset);
+}
+
+AllokResult akMemoryBlockFind(AkMemoryBlock **pp_result, const AkMemoryMap *p_map, const void *ptr) {
+    if (p_map == ALLOK_NULL || ptr == ALLOK_NULL) {
+        return ALLOK_NULL_PARAM;
+    }
+
+    const AkMemoryPool *pool = p_map->p_pool_head;
+    while (pool != ALLOK_NULL) {
+        if (is_ptr_in_range(ptr, pool->p_start, pool->alloc_size)) {
+            AkMemoryBlock *block = pool->p_head;
+            while (block != ALLOK_NULL) {
+                if ((AllokByte *)block->p_start == (AllokByte *)ptr) {
+                    *pp_result = block;
+                    return ALLOK_SUCCESS;
+                }
+                block = block->p_next;
+            }
+        }
+        pool = pool->p_next;
+    }
+
+    return ALLOK_NOT_FOUND;
+}
+
+AllokResult akMemoryBlockFromPtr(AkMemoryBlock **pp_result, const AkMemoryMap *p_map, const void *ptr) {
+    if (pp_result == ALLOK_NULL || p_map == ALLOK_NULL || ptr == ALLOK_NULL) {
+        return ALLOK_NULL_PARAM;
+    }
+
+    // Only read the header once the address is known to lie inside one of the map's pools
+    const AkMemoryPool *pool = map_find_pool_by_addr(p_map, ptr);
+    if (pool == ALLOK_NULL) {
+        return ALLOK_NOT_FOUND;
+    }
+
+    if ((AllokByte *)ptr < (AllokByte *)pool->p_start + sizeof(AkMemoryBlock)) {
+        return ALLOK_INVALID_ADDR;
+    }
+
+    // A block queued by a foreign free is already freed as far as the caller is concerned
+    AkMemoryBlock *block = (AkMemoryBlock *)((AllokByte *)ptr - sizeof(AkMemoryBlock));
+    if ((AllokByte *)block->p_start != (AllokByte *)ptr || block->p_parent != pool || block_is_pending(&block->state) == ALLOK_TRUE) {
+        return ALLOK_INVALID_ADDR;
+    }
+
+    *pp_result = block;
+
+    return ALLOK_SUCCESS;
+}
+
+void block_unlink(AkMemoryBlock *p_block) {
+    AkMemoryPool *pool = p_block->p_parent;
+    AkMemoryBlock *prev = p_block->p_prev;
+    AkMemoryBlock *next = p_block->p_next;
+
+    AllokByte *gap_start = gap_start_after(pool, prev);
+    AllokByte *gap_end = gap_end_before(pool, next);
+
+    pool_gap_remove(pool, gap_start, (AllokByte *)p_block);
+    pool_gap_remove(pool, block_end(p_block), gap_end);
+
+    if (prev == ALLOK_NULL) {
+        pool->p_head = next;
+    } else {
+        prev->p_next = next;
+    }
+
+    if (next == ALLOK_NULL) {
+        pool->p_tail = prev;
+    } else {
+        next->p_prev = prev;
+    }
+
+    pool->size -= p_block->size + sizeof(AkMemoryBlock);
+    AkMemoryMap *map = pool->p_parent_map;
+    if (map != ALLOK_NULL) {
+        map->metadata.blocks_freed++;
+        map->metadata.block_count--;
+        map->metadata.header_size -= sizeof(AkMemoryBlock);
+        map->metadata.alloc_size -= p_block->size;
+    }
+
+    // Invalidate the header so a stale pointer can't be resolved again
+    p_block->p_start = ALLOK_NULL;
+
+    pool_gap_insert(pool, gap_start, gap_end, prev);
+}
+
+void pool_settle(AkMemoryPool *p_pool) {
+    pool_refresh_gaps(p_pool);
+
+    if (p_pool->size <= 0) {
+        akMemoryPoolRetire(&p_pool);
+    }
+}
+
+void akMemoryBlockFree(AkMemoryBlock **pp_block) {
+    if (pp_block == ALLOK_NULL) {
+        return;
+    }
+
+    AkMemoryBlock *block = *pp_block;
+    if (block == ALLOK_NULL) {
+        return;
+    }
+
+    AkMemoryPool *pool = block->p_parent;
+    block_unlink(block);
+
+    *pp_block = ALLOK_NULL;
+
+    pool_settle(pool);
+}
+
+AllokResult akMemoryPoolAlloc(AkMemoryPool **pp_result, AkMemoryMap *p_map, const AllokSize size) {
+    if (pp_result == ALLOK_NULL) {
+        return ALLOK_NULL_PARAM;
+    }
+
+    // Huge page mappings are rounded up and the pool keeps the extra space
+    AllokSize alloc_size = size + sizeof(AkMemoryPool);
+    AkMemoryPool *pool = os_mem_alloc_pages(&alloc_size, p_map != ALLOK_NULL ? p_map->params.huge_pages : ALLOK_HUGE_PAGES_NONE);
+    if (pool == ALLOK_NULL) {
+        return ALLOK_OS_MEMORY_ALLOC_FAILED;
+    }
+
+    pool->alloc_size = alloc_size - sizeof(AkMemoryPool);
+    pool->size = 0;
+    pool->p_start = (AllokByte *)pool + sizeof(AkMemoryPool);
+    pool->p_next = ALLOK_NULL;
+    pool->p_parent_map = p_map;
+    pool->p_head = ALLOK_NULL;
+    pool->p_tail = ALLOK_NULL;
+    pool->p_gap_root = ALLOK_NULL;
+
+    pool_gap_insert(pool, pool->p_start, (AllokByte *)pool->p_start + pool->alloc_size, ALLOK_NULL);
+    pool->largest_gap = pool->p_gap_root == ALLOK_NULL ? 0 : pool->p_gap_root->key;
+    pool->cache_stamp = 0;
+
+    if (p_map != ALLOK_NULL) {
+        map_link_pool(p_map, pool);
+        p_map->metadata.pools_created++;
+        p_map->metadata.mapped_size += alloc_size;
+        p_map->metadata.header_size += sizeof(AkMemoryPool);
+    } else {
+        pool->fit_node.key = pool_fit_gap(pool);
+        pool->fit_node.value = 0;
+        pool->p_prev = ALLOK_NULL;
+    }
+
+    *pp_result = pool;
+
+    return ALLOK_SUCCESS;
+}
+
+AllokResult akMemoryPoolFree(AkMemoryPool **pp_pool, const AllokBool recursive) {
+    if (pp_pool == ALLOK_NULL) {
+        return ALLOK_NULL_PARAM;
+    }
+
+    AkMemoryPool *pool = *pp_pool;
+    if (pool == ALLOK_NULL) {
+        return ALLOK_NULL_PARAM;
+    }
+
+    if (recursive) {
+        akMemoryPoolFree(&pool->p_next, recursive);
+    }
+
+    AkMemoryMap *map = pool->p_parent_map;
+    if (map != ALLOK_NULL) {
+        map_unlink_pool(map, pool);
+        map->metadata.pools_freed++;
+        map->metadata.mapped_size -= pool_mapping_size(pool);
+        map->metadata.header_size -= sizeof(AkMemoryPool);
+    } else {
+        if (pool->p_prev != ALLOK_NULL) {
+            pool->p_prev->p_next = pool->p_next;
+        }
+        if (pool->p_next != ALLOK_NULL) {
+            pool->p_next->p_prev = pool->p_prev;
+        }
+    }
+
+    os_mem_free(pool, pool->alloc_size + sizeof(AkMemoryPool));
+
+    *pp_pool = ALLOK_NULL;
+
+    return ALLOK_SUCCESS;
+}
+
+void large_block_link(AkMemoryMap *p_map, AkLargeBlock *p_block) {
+    p_block->addr_node.key = (AllokSize)p_block;
+    p_block->addr_node.value = 0;
+    p_block->p_prev = ALLOK_NULL;
+    p_block->p_next = p_map->p_large_head;
+
+    if (p_map->p_large_head != ALLOK_NULL) {
+        p_map->p_large_head->p_prev = p_block;
+    }
+    p_map->p_large_head = p_block;
+    p_map->p_large_root = tree_insert(p_map->p_large_root, &p_block->addr_node);
+    p_map->large_count++;
+    p_map->metadata.large_block_count++;
+}
+
+void large_block_tag(AkLargeBlock *p_block) {
+    p_block->state = block_tag(p_block, ALLOK_BLOCK_LARGE);
+
+    // Aligned blocks leave padding between the header and p_start, which gets a copy of the tag
+    AllokSize *front = (AllokSize *)p_block->p_start - 1;
+    if (front != (AllokSize *)&p_block->state) {
+        *front = p_block->state;
+    }
+}
+
+void large_block_unlink(AkMemoryMap *p_map, AkLargeBlock *p_block) {
+    if (p_block->p_prev != ALLOK_NULL) {
+        p_block->p_prev->p_next = p_block->p_next;
+    } else {
+        p_map->p_large_head = p_block->p_next;
+    }
+    if (p_block->p_next != ALLOK_NULL) {
+        p_block->p_next->p_prev = p_block->p_prev;
+    }
+
+    p_map->p_large_root = tree_remove(p_map->p_large_root, &p_block->addr_node);
+    p_map->large_count--;
+    p_map->metadata.large_block_count--;
+}
+
+AllokResult akLargeBlockAlloc(AkLargeBlock **pp_result, AkMemoryMap *p_map, const AllokSize size, const AllokSize alignment) {
+    if (pp_result == ALLOK_NULL || p_map == ALLOK_NULL) {
+        return ALLOK_NULL_PARAM;
+    }
+
+    if (is_valid_alignment(alignment) == ALLOK_FALSE) {
+        return ALLOK_INVALID_ALIGNMENT;
+    }
+
+    // Mappings are only page aligned, so room is left to align p_start past the header
+    const AllokSize header_size = sizeof(AkLargeBlock) + alignment - 1;
+    if (size > (AllokSize)-1 - header_size - ALLOK_HUGE_PAGE_SIZE) {
+        return ALLOK_INVALID_SIZE;
+    }
+
+    AllokSize alloc_size = align_up(header_size + size, ALLOK_OS_PAGE_SIZE);
+    AkLargeBlock *block = os_mem_alloc_pages(&alloc_size, p_map->params.huge_pages);
+    if (block == ALLOK_NULL) {
+        return ALLOK_OS_MEMORY_ALLOC_FAILED;
+    }
+
+    block->alloc_size = alloc_size;
+    block->size = size;
+    block->p_start = (void *)align_up((AllokSize)block + sizeof(AkLargeBlock), alignment);
+    block->p_parent_map = p_map;
+    large_block_tag(block);
+
+    large_block_link(p_map, block);
+    p_map->metadata.large_blocks_created++;
+    p_map->metadata.mapped_size += alloc_size;
+    p_map->metadata.header_size += (AllokSize)((AllokByte *)block->p_start - (AllokByte *)block);
+    map_stats_alloc(p_map, size);
+
+    *pp_result = block;
+
+    return ALLOK_SUCCESS;
+}
+
+AllokResult akLargeBlockFind(AkLargeBlock **pp_result, const AkMemoryMap *p_map, const void *ptr) {
+    if (pp_result == ALLOK_NULL || p_map == ALLOK_NULL) {
+        return ALLOK_NULL_PARAM;
+    }
+
+    AkTreeNode *node = tree_floor(p_map->p_large_root, (AllokSize)ptr);
+    if (node == ALLOK_NULL) {
+        return ALLOK_NOT_FOUND;
+    }
+
+    AkLargeBlock *block = (AkLargeBlock *)((AllokByte *)node - offsetof(AkLargeBlock, addr_node));
+    if (is_ptr_in_range(ptr, block, block->alloc_size) == ALLOK_FALSE) {
+        return ALLOK_NOT_FOUND;
+    }
+
+    if (block->p_start != ptr || block_is_pending(&block->state) == ALLOK_TRUE) {
+        return ALLOK_INVALID_ADDR;
+    }
+
+    *pp_result = block;
+
+    return ALLOK_SUCCESS;
+}
+
+AllokResult akLargeBlockResize(AkLargeBlock **pp_block, const AllokSize size) {
+    if (pp_block == ALLOK_NULL || *pp_block == ALLOK_NULL) {
+        return ALLOK_NULL_PARAM;
+    }
+
+    AkLargeBlock *block = *pp_block;
+    const AllokSize offset = (AllokSize)((AllokByte *)block->p_start - (AllokByte *)block);
+    if (size > (AllokSize)-1 - offset - ALLOK_HUGE_PAGE_SIZE) {
+        return ALLOK_INVALID_SIZE;
+    }
+
+    AkMemoryMap *map = block->p_parent_map;
+    const AllokSize alloc_size = align_up(offset + size, os_mem_page_size(map->params.huge_pages, offset + size));
+    if (alloc_size == block->alloc_size) {
+        map_stats_resize(map, block->size, size);
+        block->size = size;
+        return ALLOK_SUCCESS;
+    }
+
+    // The header moves with the mapping, so it is detached from its neighbours and the address tree first
+    large_block_unlink(map, block);
+
+    AkLargeBlock *remapped = os_mem_remap(block, block->alloc_size, alloc_size);
+    if (remapped == ALLOK_NULL) {
+        large_block_link(map, block);
+        if (alloc_size > block->alloc_size) {
+#if __linux__
+            return ALLOK_OS_MEMORY_ALLOC_FAILED;
+#else
+            return ALLOK_UNSUPPORTED;
+#endif
+        }
+
+        // Without mremap a shrunk block keeps its whole mapping
+        map_stats_resize(map, block->size, size);
+        block->size = size;
+        return ALLOK_SUCCESS;
+    }
+
+    if (os_mem_page_size(map->params.huge_pages, alloc_size) == ALLOK_HUGE_PAGE_SIZE) {
+        os_mem_advise_huge(remapped, alloc_size);
+    }
+
+    map->metadata.mapped_size = map->metadata.mapped_size - remapped->alloc_size + alloc_size;
+    map_stats_resize(map, remapped->size, size);
+    remapped->alloc_size = alloc_size;
+    remapped->size = size;
+    remapped->p_start = (AllokByte *)remapped + offset;
+    large_block_tag(remapped);
+    large_block_link(map, remapped);
+    map->metadata.large_blocks_remapped++;
+
+    *pp_block = remapped;
+
+    return ALLOK_SUCCESS;
+}
+
+AllokResult akLargeBlockFree(AkLargeBlock **pp_block) {
+    if (pp_block == ALLOK_NULL || *pp_block == ALLOK_NULL) {
+        return ALLOK_NULL_PARAM;
+    }
+
+    AkLargeBlock *block = *pp_block;
+    AkMemoryMap *map = block->p_parent_map;
+
+    large_block_unlink(map, block);
+    map->metadata.large_blocks_freed++;
+    map->metadata.mapped_size -= block->alloc_size;
+    map->metadata.header_size -= (AllokSize)((AllokByte *)block->p_start - (AllokByte *)block);
+    map->metadata.alloc_size -= block->size;
+
+    os_mem_free(block, block->alloc_size);
+
+    *pp_block = ALLOK_NULL;
+
+    return ALLOK_SUCCESS;
+}
+
+AllokResult akMemoryMapAlloc(AkMemoryMap **pp_map_result, AkMemoryArena **pp_arena_result, const AllokSize init_pool_count, const AllokSize init_pool_size, const AkMemoryMapParams params) {
+    if (pp_map_result == ALLOK_NULL) {
+        return ALLOK_NULL_PARAM;
+    }
+
+    AllokSize map_alloc_size = sizeof(AkMemoryMap);
+
+    AkMemoryArena *arena;
+    AllokResult result = akMemoryArenaAlloc(&arena, map_alloc_size);
+    if (result != ALLOK_SUCCESS) {
+        return result;
+    }
+
+    AkMemoryMap *map;
+    result = akMemoryArenaClaim(VPTR(map), arena, map_alloc_size);
+    if (result != ALLOK_SUCCESS) {
+        return result;
+    }
+
+    map->pool_count = 0;
+    map->p_pool_head = ALLOK_NULL;
+    map->p_pool_tail = ALLOK_NULL;
+    map->p_pool_root = ALLOK_NULL;
+    map->p_pool_addr_root = ALLOK_NULL;
+    map->pool_sequence = 0;
+    map->pool_cache_count = 0;
+    map->pool_cache_size = 0;
+    map->pool_cache_clock = 0;
+    map->p_pool_cache_head = ALLOK_NULL;
+    map->p_pool_cache_tail = ALLOK_NULL;
+    map->large_count = 0;
+    map->p_large_head = ALLOK_NULL;
+    map->p_large_root = ALLOK_NULL;
+    map->p_start = (AllokByte *)map + sizeof(AkMemoryMap);
+    map->metadata = (AkMemoryMapMetadata){};
+    map->params.type = params.type;
+    map->params.is_dynamic = params.is_dynamic;
+    map->params.is_slab_enabled = params.is_slab_enabled;
+    map->params.is_thread_safe = params.is_thread_safe;
+    map->params.is_realloc_headroom = params.is_realloc_headroom;
+    map->params.large_threshold = params.large_threshold;
+    map->params.huge_pages = params.huge_pages;
+    map->params.pool_cache_size = params.pool_cache_size;
+    map->params.pool_cache_decay = params.pool_cache_decay;
+    map->params.is_per_cpu = params.is_per_cpu;
+    map->slab = (AkSlabRegion){};
+    map->p_cpu_caches = ALLOK_NULL;
+    map->cpu_count = 0;
+    map->p_handle_head = ALLOK_NULL;
+    map->p_compact_cursor = ALLOK_NULL;
+    map->handle_count = 0;
+    map->lock = (AkSpinLock){};
+    map->p_owner = ALLOK_NULL;
+    map->p_remote_head = ALLOK_NULL;
+    map->p_remote_block_head = ALLOK_NULL;
+
+    for (AllokSize i = 0; i < init_pool_count; i++) {
+        AkMemoryPool *pool;
+        result = akMemoryPoolAlloc(&pool, map, init_pool_size);
+        if (result != ALLOK_SUCCESS) {
+            break;
+        }
+    }
+
+    if (result != ALLOK_SUCCESS) {
+        akMemoryPoolFree(&map->p_pool_head, ALLOK_TRUE);
+        akMemoryArenaDestroy(&arena, ALLOK_FALSE);
+        return result;
+    }
+
+    *pp_arena_result = arena;
+    *pp_map_result = map;
+
+    return ALLOK_SUCCESS;
+}
+
+static inline AllokSize slab_class_index(const AllokSize size) {
+    return size == 0 ? 0 : (size - 1) / ALLOK_SLAB_GRANULARITY;
+}
+
+static inline AllokSize slab_page_header_size() {
+    return (sizeof(AkSlabPage) + ALLOK_SLAB_GRANULARITY - 1) & ~(AllokSize)(ALLOK_SLAB_GRANULARITY - 1);
+}
+
+// Decommitted pages keep their first 16 KiB resident so the header survives on every supported page size
+#define ALLOK_SLAB_PAGE_RESIDENT_SIZE (16 * 1024)
+
+AllokResult slab_region_reserve(AkMemoryMap *p_map) {
+    AkSlabRegion *region = &p_map->slab;
+
+    // Slab pages are committed one at a time, so the region can only use transparent huge pages
+    const AllokBool is_huge = os_mem_page_size(p_map->params.huge_pages, ALLOK_SLAB_REGION_SIZE) == ALLOK_HUGE_PAGE_SIZE ? ALLOK_TRUE : ALLOK_FALSE;
+    void *start = os_mem_reserve(ALLOK_SLAB_REGION_SIZE, is_huge == ALLOK_TRUE ? ALLOK_HUGE_PAGE_SIZE : ALLOK_SLAB_PAGE_SIZE);
+    if (start == ALLOK_NULL) {
+        return ALLOK_OS_MEMORY_ALLOC_FAILED;
+    }
+    if (is_huge == ALLOK_TRUE) {
+        os_mem_advise_huge(start, ALLOK_SLAB_REGION_SIZE);
+    }
+
+    region->alloc_size = ALLOK_SLAB_REGION_SIZE;
+    region->committed_size = 0;
+    region->size = 0;
+    region->p_free_pages = ALLOK_NULL;
+
+    for (AllokSize i = 0; i < ALLOK_SLAB_CLASS_COUNT; i++) {
+        region->classes[i].object_size = (i + 1) * ALLOK_SLAB_GRANULARITY;
+        region->classes[i].p_partial_head = ALLOK_NULL;
+    }
+
+    // Published last so lock-free readers that see p_start also see alloc_size
+    atomic_store_ptr(&region->p_start, start);
+
+    return ALLOK_SUCCESS;
+}
+
+AllokResult slab_page_create(AkSlabPage **pp_result, AkMemoryMap *p_map, AkSlabClass *p_class) {
+    AkSlabRegion *region = &p_map->slab;
+
+    AkSlabPage *page = region->p_free_pages;
+    if (page != ALLOK_NULL) {
+        if (os_mem_commit(page, ALLOK_SLAB_PAGE_SIZE) == ALLOK_FALSE) {
+            return ALLOK_OS_MEMORY_ALLOC_FAILED;
+        }
+        region->p_free_pages = page->p_next;
+        p_map->metadata.mapped_size += ALLOK_SLAB_PAGE_SIZE - ALLOK_SLAB_PAGE_RESIDENT_SIZE;
+    } else {
+        if (region->committed_size + ALLOK_SLAB_PAGE_SIZE > region->alloc_size) {
+            return ALLOK_INSUFFICIENT_POOL_MEMORY;
+        }
+
+        page = (AkSlabPage *)((AllokByte *)region->p_start + region->committed_size);
+        if (os_mem_commit(page, ALLOK_SLAB_PAGE_SIZE) == ALLOK_FALSE) {
+            return ALLOK_OS_MEMORY_ALLOC_FAILED;
+        }
+        atomic_store_size(&region->committed_size, region->committed_size + ALLOK_SLAB_PAGE_SIZE);
+        p_map->metadata.mapped_size += ALLOK_SLAB_PAGE_SIZE;
+    }
+
+    const AllokSize header_size = slab_page_header_size();
+
+    page->object_size = p_class->object_size;
+    page->capacity = (ALLOK_SLAB_PAGE_SIZE - header_size) / p_class->object_size;
+    page->used = 0;
+    page->carved = 0;
+    page->p_start = (AllokByte *)page + header_size;
+    page->p_free = ALLOK_NULL;
+    page->p_prev = ALLOK_NULL;
+    page->p_next = p_class->p_partial_head;
+    page->p_parent_map = p_map;
+
+    void *live = page->live;
+    akMemset(&live, 0, sizeof(page->live));
+
+    if (p_class->p_partial_head != ALLOK_NULL) {
+        p_class->p_partial_head->p_prev = page;
+    }
+    p_class->p_partial_head = page;
+
+    p_map->metadata.slab_pages_created++;
+    p_map->metadata.header_size += header_size;
+
+    *pp_result = page;
+
+    return ALLOK_SUCCESS;
+}
+
+static inline void slab_page_unlink(AkSlabClass *p_class, AkSlabPage *p_page) {
+    if (p_page->p_prev != ALLOK_NULL) {
+        p_page->p_prev->p_next = p_page->p_next;
+    } else {
+        p_class->p_partial_head = p_page->p_next;
+    }
+    if (p_page->p_next != ALLOK_NULL) {
+        p_page->p_next->p_prev = p_page->p_prev;
+    }
+    p_page->p_next = ALLOK_NULL;
+    p_page->p_prev = ALLOK_NULL;
+}
+
+void slab_page_release(AkMemoryMap *p_map, AkSlabPage *p_page) {
+    AkSlabRegion *region = &p_map->slab;
+
+    p_page->object_size = 0;
+    p_page->p_next = region->p_free_pages;
+    region->p_free_pages = p_page;
+
+    os_mem_decommit((AllokByte *)p_page + ALLOK_SLAB_PAGE_RESIDENT_SIZE, ALLOK_SLAB_PAGE_SIZE - ALLOK_SLAB_PAGE_RESIDENT_SIZE);
+
+    p_map->metadata.slab_pages_freed++;
+    p_map->metadata.mapped_size -= ALLOK_SLAB_PAGE_SIZE - ALLOK_SLAB_PAGE_RESIDENT_SIZE;
+    p_map->metadata.header_size -= slab_page_header_size();
+}
+
+AllokBool slab_region_contains(const AkMemoryMap *p_map, const void *ptr) {
+    // Safe without the lock: p_start is published once, alloc_size is fixed and committed_size only grows
+    const AllokByte *start = atomic_load_ptr((void *const volatile *)&p_map->slab.p_start);
+    if (start == ALLOK_NULL || is_ptr_in_range(ptr, start, p_map->slab.alloc_size) == ALLOK_FALSE) {
+        return ALLOK_FALSE;
+    }
+
+    return (AllokByte *)ptr < start + atomic_load_size(&p_map->slab.committed_size) ? ALLOK_TRUE : ALLOK_FALSE;
+}
+
+static inline AkSlabPage *slab_page_of(const void *ptr) {
+    return (AkSlabPage *)((AllokSize)ptr & ~(AllokSize)(ALLOK_SLAB_PAGE_SIZE - 1));
+}
+
+AllokResult slab_object_validate(const AkSlabPage *p_page, const void *ptr) {
+    if (p_page->object_size == 0 || (AllokByte *)ptr < (AllokByte *)p_page->p_start) {
+        return ALLOK_INVALID_ADDR;
+    }
+
+    const AllokSize offset = (AllokSize)((AllokByte *)ptr - (AllokByte *)p_page->p_start);
+    if (offset % p_page->object_size != 0 || offset / p_page->object_size >= p_page->capacity) {
+        return ALLOK_INVALID_ADDR;
+    }
+
+    return ALLOK_SUCCESS;
+}
+
+AllokResult slab_object_pop(void **pp_result, AkMemoryMap *p_map, const AllokSize size) {
+    AllokResult result;
+    if (p_map->slab.p_start == ALLOK_NULL) {
+        result = slab_region_reserve(p_map);
+        if (result != ALLOK_SUCCESS) {
+            return result;
+        }
+    }
+
+    AkSlabClass *slab_class = &p_map->slab.classes[slab_class_index(size)];
+
+    AkSlabPage *page = slab_class->p_partial_head;
+    if (page == ALLOK_NULL) {
+        result = slab_page_create(&page, p_map, slab_class);
+        if (result != ALLOK_SUCCESS) {
+            return result;
+        }
+    }
+
+    void *object = page->p_free;
+    if (object != ALLOK_NULL) {
+        page->p_free = *(void **)object;
+    } else {
+        object = (AllokByte *)page->p_start + page->carved * page->object_size;
+        page->carved++;
+    }
+
+    page->used++;
+    if (page->used == page->capacity) {
+        slab_page_unlink(slab_class, page);
+    }
+
+    p_map->slab.size += page->object_size;
+    p_map->metadata.slab_objects_created++;
+    p_map->metadata.slab_object_count++;
+    map_stats_alloc(p_map, page->object_size);
+
+    *pp_result = object;
+
+    return ALLOK_SUCCESS;
+}
+
+// One bit per object slot, set while the object is held by the caller. Updated atomically because
+// thread caches hand out and take back objects of a shared page without the map lock
+static inline AllokByte *slab_live_byte(AkSlabPage *p_page, const void *ptr, AllokByte *p_mask) {
+    const AllokSize index = (AllokSize)((AllokByte *)ptr - (AllokByte *)p_page->p_start) / p_page->object_size;
+    *p_mask = (AllokByte)(1u << (index % 8));
+    return &p_page->live[index / 8];
+}
+
+void slab_object_mark_live(void *ptr) {
+    AllokByte mask;
+    AllokByte *live = slab_live_byte(slab_page_of(ptr), ptr, &mask);
+    atomic_fetch_or_byte(live, mask);
+}
+
+AllokResult slab_object_clear_live(void *ptr) {
+    AllokByte mask;
+    AllokByte *live = slab_live_byte(slab_page_of(ptr), ptr, &mask);
+    if ((atomic_fetch_and_byte(live, (AllokByte)~mask) & mask) == 0) {
+        return ALLOK_INVALID_ADDR;
+    }
+    return ALLOK_SUCCESS;
+}
+
+AllokResult akSlabAlloc(void **pp_result, AkMemoryMap *p_map, const AllokSize size) {
+    if (pp_result == ALLOK_NULL || p_map == ALLOK_NULL) {
+        return ALLOK_NULL_PARAM;
+    }
+
+    if (size > ALLOK_SLAB_MAX_SIZE) {
+        return ALLOK_INVALID_SIZE;
+    }
+
+    const AllokResult result = slab_object_pop(pp_result, p_map, size);
+    if (result != ALLOK_SUCCESS) {
+        return result;
+    }
+
+    slab_object_mark_live(*pp_result);
+
+    return ALLOK_SUCCESS;
+}
+
+AllokResult akSlabPageFind(AkSlabPage **pp_result, const AkMemoryMap *p_map, const void *ptr) {
+    if (pp_result == ALLOK_NULL || p_map == ALLOK_NULL || ptr == ALLOK_NULL) {
+        return ALLOK_NULL_PARAM;
+    }
+
+    *pp_result = ALLOK_NULL;
+
+    if (slab_region_contains(p_map, ptr) == ALLOK_FALSE) {
+        return ALLOK_NOT_FOUND;
+    }
+
+    AkSlabPage *page = slab_page_of(ptr);
+    if (slab_object_validate(page, ptr) != ALLOK_SUCCESS) {
+        return ALLOK_INVALID_ADDR;
+    }
+
+    const AllokSize offset = (AllokSize)((AllokByte *)ptr - (AllokByte *)page->p_start);
+    if (offset / page->object_size >= page->carved) {
+        return ALLOK_INVALID_ADDR;
+    }
+
+    AllokByte mask;
+    if ((atomic_load_byte(slab_live_byte(page, ptr, &mask)) & mask) == 0) {
+        return ALLOK_INVALID_ADDR;
+    }
+
+    *pp_result = page;
+
+    return ALLOK_SUCCESS;
+}
+
+void slab_object_push(AkMemoryMap *p_map, AkSlabPage *p_page, void *p_object) {
+    AkSlabClass *slab_class = &p_map->slab.classes[slab_class_index(p_page->object_size)];
+
+    *(void **)p_object = p_page->p_free;
+    p_page->p_free = p_object;
+
+    if (p_page->used == p_page->capacity) {
+        p_page->p_next = slab_class->p_partial_head;
+        if (slab_class->p_partial_head != ALLOK_NULL) {
+            slab_class->p_partial_head->p_prev = p_page;
+        }
+        slab_class->p_partial_head = p_page;
+    }
+    p_page->used--;
+
+    p_map->slab.size -= p_page->object_size;
+    p_map->metadata.slab_objects_freed++;
+    p_map->metadata.slab_object_count--;
+    p_map->metadata.alloc_size -= p_page->object_size;
+
+    // Keep the last partial page of a class warm so alloc/free at a page boundary doesn't thrash
+    if (p_page->used == 0 && (p_page->p_next != ALLOK_NULL || p_page->p_prev != ALLOK_NULL)) {
+        slab_page_unlink(slab_class, p_page);
+        slab_page_release(p_map, p_page);
+    }
+}
+
+AllokResult akSlabFree(void **pp_target, AkMemoryMap *p_map) {
+    if (pp_target == ALLOK_NULL || p_map == ALLOK_NULL) {
+        return ALLOK_NULL_PARAM;
+    }
+
+    AkSlabPage *page;
+    const AllokResult result = akSlabPageFind(&page, p_map, *pp_target);
+    if (result != ALLOK_SUCCESS) {
+        return result;
+    }
+
+    if (slab_object_clear_live(*pp_target) != ALLOK_SUCCESS) {
+        return ALLOK_INVALID_ADDR;
+    }
+
+    slab_object_push(p_map, page, *pp_target);
+
+    *pp_target = ALLOK_NULL;
+
+    return ALLOK_SUCCESS;
+}
+
+void akSlabRegionFree(AkMemoryMap *p_map) {
+    if (p_map == ALLOK_NULL || p_map->slab.p_start == ALLOK_NULL) {
+        return;
+    }
+
+    // Pages on the free list only keep their resident header, the others are still committed with live objects
+    AkSlabRegion *region = &p_map->slab;
+    AllokSize free_page_count = 0;
+    for (const AkSlabPage *page = region->p_free_pages; page != ALLOK_NULL; page = page->p_next) {
+        free_page_count++;
+    }
+    const AllokSize live_page_count = region->committed_size / ALLOK_SLAB_PAGE_SIZE - free_page_count;
+    p_map->metadata.mapped_size -= region->committed_size - free_page_count * (ALLOK_SLAB_PAGE_SIZE - ALLOK_SLAB_PAGE_RESIDENT_SIZE);
+    p_map->metadata.header_size -= live_page_count * slab_page_header_size();
+    p_map->metadata.alloc_size -= region->size;
+    p_map->metadata.slab_object_count = 0;
+
+    os_mem_free(region->p_start, region->alloc_size);
+    p_map->slab = (AkSlabRegion){};
+}
+
+AllokBool heap_walk_pool(const AkMemoryPool *p_pool, AkHeapWalkFn fn, void *p_user) {
+    AkHeapEntry entry = {ALLOK_HEAP_ENTRY_POOL, p_pool->p_start, p_pool->alloc_size, p_pool->size, p_pool};
+    if (fn(&entry, p_user) == ALLOK_FALSE) {
+        return ALLOK_FALSE;
+    }
+
+    const AkMemoryBlock *prev = ALLOK_NULL;
+    for (const AkMemoryBlock *block = p_pool->p_head;; block = block->p_next) {
+        AllokByte *gap_start = gap_start_after(p_pool, prev);
+        const AllokByte *gap_end = gap_end_before(p_pool, block);
+        if (gap_end > gap_start) {
+            entry = (AkHeapEntry){ALLOK_HEAP_ENTRY_GAP, gap_start, (AllokSize)(gap_end - gap_start), 0, p_pool};
+            if (fn(&entry, p_user) == ALLOK_FALSE) {
+                return ALLOK_FALSE;
+            }
+        }
+
+        if (block == ALLOK_NULL) {
+            return ALLOK_TRUE;
+        }
+
+        entry = (AkHeapEntry){ALLOK_HEAP_ENTRY_BLOCK, block->p_start, block->size, block->size, p_pool};
+        if (fn(&entry, p_user) == ALLOK_FALSE) {
+            return ALLOK_FALSE;
+        }
+        prev = block;
+    }
+}
+
+AllokResult akMemoryMapWalk(const AkMemoryMap *p_map, AkHeapWalkFn fn, void *p_user) {
+    if (p_map == ALLOK_NULL || fn == ALLOK_NULL) {
+        return ALLOK_NULL_PARAM;
+    }
+
+    for (const AkMemoryPool *pool = p_map->p_pool_head; pool != ALLOK_NULL; pool = pool->p_next) {
+        if (heap_walk_pool(pool, fn, p_user) == ALLOK_FALSE) {
+            return ALLOK_SUCCESS;
+        }
+    }
+
+    AkHeapEntry entry;
+    for (const AkLargeBlock *large = p_map->p_large_head; large != ALLOK_NULL; large = large->p_next) {
+        entry = (AkHeapEntry){ALLOK_HEAP_ENTRY_LARGE_BLOCK, large->p_start, large->alloc_size, large->size, ALLOK_NULL};
+        if (fn(&entry, p_user) == ALLOK_FALSE) {
+            return ALLOK_SUCCESS;
+        }
+    }
+
+    // Released pages stay in the committed range with an object_size of 0
+    const AkSlabRegion *region = &p_map->slab;
+    for (AllokSize offset = 0; region->p_start != ALLOK_NULL && offset < region->committed_size; offset += ALLOK_SLAB_PAGE_SIZE) {
+        const AkSlabPage *page = (AkSlabPage *)((AllokByte *)region->p_start + offset);
+        if (page->object_size == 0) {
+            continue;
+        }
+
+        entry = (AkHeapEntry){ALLOK_HEAP_ENTRY_SLAB_PAGE, page->p_start, page->capacity * page->object_size, page->used * page->object_size, ALLOK_NULL};
+        if (fn(&entry, p_user) == ALLOK_FALSE) {
+            return ALLOK_SUCCESS;
+        }
+    }
+
+    return ALLOK_SUCCESS;
+}
+
+void heap_report_gaps(AkMemoryMapReport *p_report, const AkTreeNode *p_node) {
+    if (p_node == ALLOK_NULL) {
+        return;
+    }
+
+    AllokSize bucket = 0;
+    while (bucket + 1 < ALLOK_REPORT_GAP_BUCKET_COUNT && p_node->key >= (AllokSize)64 << bucket) {
+        bucket++;
+    }
+
+    p_report->gap_histogram[bucket]++;
+    p_report->gap_count++;
+    p_report->gap_size += p_node->key;
+
+    heap_report_gaps(p_report, p_node->p_left);
+    heap_report_gaps(p_report, p_node->p_right);
+}
+
+AllokResult akMemoryMapReport(AkMemoryMapReport *p_result, const AkMemoryMap *p_map) {
+    if (p_result == ALLOK_NULL || p_map == ALLOK_NULL) {
+        return ALLOK_NULL_PARAM;
+    }
+
+    AkMemoryMapReport report = {};
+
+    // Each pool's free gaps are already indexed, so they are counted from its gap tree without visiting blocks
+    for (const AkMemoryPool *pool = p_map->p_pool_head; pool != ALLOK_NULL; pool = pool->p_next) {
+        const double utilization = pool->alloc_size == 0 ? 1.0 : (double)pool->size / (double)pool->alloc_size;
+        if (report.pool_count == 0 || utilization < report.min_pool_utilization) {
+            report.min_pool_utilization = utilization;
+        }
+        if (report.pool_count == 0 || utilization > report.max_pool_utilization) {
+            report.max_pool_utilization = utilization;
+        }
+
+        const AllokSize bucket = pool->alloc_size == 0 ? ALLOK_REPORT_UTILIZATION_BUCKET_COUNT - 1 : pool->size * ALLOK_REPORT_UTILIZATION_BUCKET_COUNT / pool->alloc_size;
+        report.pool_utilization_histogram[min_size(bucket, ALLOK_REPORT_UTILIZATION_BUCKET_COUNT - 1)]++;
+
+        report.pool_count++;
+        report.pool_size += pool->alloc_size;
+        report.pool_used_size += pool->size;
+        report.largest_gap = max_size(report.largest_gap, pool->largest_gap);
+        heap_report_gaps(&report, pool->p_gap_root);
+    }
+    report.pool_free_size = report.pool_size - report.pool_used_size;
+    if (report.pool_free_size != 0) {
+        report.external_fragmentation = 1.0 - (double)report.largest_gap / (double)report.pool_free_size;
+    }
+
+    report.cached_pool_count = p_map->pool_cache_count;
+    report.cached_pool_size = p_map->pool_cache_size;
+
+    for (const AkLargeBlock *large = p_map->p_large_head; large != ALLOK_NULL; large = large->p_next) {
+        report.large_block_count++;
+        report.large_block_size += large->size;
+    }
+
+    report.slab_page_count = p_map->metadata.slab_pages_created - p_map->metadata.slab_pages_freed;
+    report.slab_used_size = p_map->slab.size;
+
+    report.alloc_size = p_map->metadata.alloc_size;
+    report.mapped_size = p_map->metadata.mapped_size;
+    report.header_size = p_map->metadata.header_size;
+    if (report.mapped_size != 0) {
+        report.header_overhead = (double)report.header_size / (double)report.mapped_size;
+    }
+
+    *p_result = report;
+
+    return ALLOK_SUCCESS;
+}
+
+AllokBool gap_fit_aligned(const AkMemoryPool *p_pool, const AllokByte *p_gap_start, const AllokByte *p_gap_end, const AllokSize size, const AllokSize alignment, AllokSize *p_offset_result) {
+    const AllokByte *payload = (AllokByte *)align_up((AllokSize)p_gap_start + sizeof(AkMemoryBlock), alignment);
+    if (payload > p_gap_end || (AllokSize)(p_gap_end - payload) < size) {
+        return ALLOK_FALSE;
+    }
+
+    *p_offset_result = (AllokSize)(payload - sizeof(AkMemoryBlock) - (AllokByte *)p_pool->p_start);
+    return ALLOK_TRUE;
+}
+
+AllokBool gap_tree_fit(const AkMemoryPool *p_pool, const AkFreeGap *p_gap, const AllokSize size, const AllokSize alignment, AllokSize *p_offset_result, AkMemoryBlock **pp_prev_result) {
+    if (p_gap == ALLOK_NULL) {
+        return ALLOK_FALSE;
+    }
+
+    const AllokByte *gap_start = (AllokByte *)p_gap;
+    if (gap_fit_aligned(p_pool, gap_start, gap_start + p_gap->node.key, size, alignment, p_offset_result) == ALLOK_FALSE) {
+        return ALLOK_FALSE;
+    }
+
+    *pp_prev_result = p_gap->p_prev_block;
+    return ALLOK_TRUE;
+}
+
+AllokBool alloc_first_fit(const AkMemoryPool *p_pool, const AllokSize size, const AllokSize alignment, AllokSize *p_offset_result, AkMemoryBlock **pp_prev_result) {
+    if (p_pool == ALLOK_NULL) {
+        return ALLOK_FALSE;
+    }
+
+    AkMemoryBlock *prev = ALLOK_NULL;
+    AkMemoryBlock *curr = p_pool->p_head;
+
+    while (ALLOK_TRUE) {
+        if (gap_fit_aligned(p_pool, gap_start_after(p_pool, prev), gap_end_before(p_pool, curr), size, alignment, p_offset_result) == ALLOK_TRUE) {
+            *pp_prev_result = prev;
+            return ALLOK_TRUE;
+        }
+
+        if (curr == ALLOK_NULL) {
+            return ALLOK_FALSE;
+        }
+
+        prev = curr;
+        curr = curr->p_next;
+    }
+}
+
+AllokBool alloc_best_fit(const AkMemoryPool *p_pool, const AllokSize size, const AllokSize alignment, AllokSize *p_offset_result, AkMemoryBlock **pp_prev_result) {
+    if (p_pool == ALLOK_NULL) {
+        return ALLOK_FALSE;
+    }
+
+    const AllokSize alloc_size = sizeof(AkMemoryBlock) + size;
+
+    // The smallest gap may fall short once padded, any gap of alloc_size + alignment - 1 always fits
+    const AkFreeGap *gap = (AkFreeGap *)tree_lower_bound(p_pool->p_gap_root, alloc_size);
+    if (gap_tree_fit(p_pool, gap, size, alignment, p_offset_result, pp_prev_result) == ALLOK_TRUE) {
+        return ALLOK_TRUE;
+    }
+
+    gap = (AkFreeGap *)tree_lower_bound(p_pool->p_gap_root, alloc_size + alignment - 1);
+    return gap_tree_fit(p_pool, gap, size, alignment, p_offset_result, pp_prev_result);
+}
+
+AllokBool alloc_worst_fit(const AkMemoryPool *p_pool, const AllokSize size, const AllokSize alignment, AllokSize *p_offset_result, AkMemoryBlock **pp_prev_result) {
+    if (p_pool == ALLOK_NULL) {
+        return ALLOK_FALSE;
+    }
+
+    const AkFreeGap *gap = (AkFreeGap *)tree_max(p_pool->p_gap_root);
+    return gap_tree_fit(p_pool, gap, size, alignment, p_offset_result, pp_prev_result);
+}
+
+AllokBool alloc_linear_fit(const AkMemoryPool *p_pool, const AllokSize size, const AllokSize alignment, AllokSize *p_offset_result, AkMemoryBlock **pp_prev_result) {
+    if (p_pool == ALLOK_NULL) {
+        return ALLOK_FALSE;
+    }
+
+    AkMemoryBlock *tail = p_pool->p_tail;
+    if (gap_fit_aligned(p_pool, gap_start_after(p_pool, tail), gap_end_before(p_pool, ALLOK_NULL), size, alignment, p_offset_result) == ALLOK_FALSE) {
+        return ALLOK_FALSE;
+    }
+
+    *pp_prev_result = tail;
+    return ALLOK_TRUE;
+}
+
+AllokBool find_block_fit(const AkMemoryPool *p_pool, const AllokSize size, const AllokSize alignment, AllokSize *p_offset_result, AkMemoryBlock **pp_prev_result) {
+    switch (p_pool->p_parent_map->params.type) {
+        case ALLOK_FIRST_FIT: {
+            return alloc_first_fit(p_pool, size, alignment, p_offset_result, pp_prev_result);
+        }
+        case ALLOK_BEST_FIT: {
+            return alloc_best_fit(p_pool, size, alignment, p_offset_result, pp_prev_result);
+        }
+        case ALLOK_WORST_FIT: {
+            return alloc_worst_fit(p_pool, size, alignment, p_offset_result, pp_prev_result);
+        }
+        case ALLOK_LINEAR_FIT: {
+            return alloc_linear_fit(p_pool, size, alignment, p_offset_result, pp_prev_result);
+        }
+        default: {
+            return ALLOK_FALSE;
+        }
+    }
+}
+
+static AkSpinLock g_init_lock;
+static volatile long g_map_generation;
+static volatile long g_is_thread_exit_ready;
+static ALLOK_THREAD_LOCAL AllokBool t_is_exit_registered;
+
+typedef struct AkThreadCacheBin {
+    void *p_head;
+    AllokSize count;
+} AkThreadCacheBin;
+
+typedef struct AkThreadCache {
+    long generation;
+    AkThreadCacheBin bins[ALLOK_SLAB_CLASS_COUNT];
+} AkThreadCache;
+
+static ALLOK_THREAD_LOCAL AkThreadCache t_cache;
+
+static inline AkMemoryMap *global_map() {
+    return atomic_load_ptr((void *const volatile *)&g_map);
+}
+
+static inline void map_lock(AkMemoryMap *p_map) {
+    if (p_map->params.is_thread_safe == ALLOK_TRUE) {
+        spin_lock(&p_map->lock);
+    }
+}
+
+static inline void map_unlock(AkMemoryMap *p_map) {
+    if (p_map->params.is_thread_safe == ALLOK_TRUE) {
+        spin_unlock(&p_map->lock);
+    }
+}
+
+AkThreadCache *thread_cache_get() {
+    AkThreadCache *cache = &t_cache;
+
+    // The flag goes first, registering may allocate and find its way back here
+    if (t_is_exit_registered == ALLOK_FALSE && atomic_load_long(&g_is_thread_exit_ready) != 0) {
+        t_is_exit_registered = ALLOK_TRUE;
+        os_thread_exit_register();
+    }
+
+    // Objects cached against a previous global MemoryMap were released by akDump
+    const long generation = atomic_load_long(&g_map_generation);
+    if (cache->generation != generation) {
+        *cache = (AkThreadCache){};
+        cache->generation = generation;
+    }
+
+    return cache;
+}
+
+void thread_cache_flush_bin(AkMemoryMap *p_map, AkThreadCacheBin *p_bin, AllokSize count) {
+    spin_lock(&p_map->lock);
+    while (count > 0 && p_bin->p_head != ALLOK_NULL) {
+        void *object = p_bin->p_head;
+        p_bin->p_head = *(void **)object;
+        p_bin->count--;
+        slab_object_push(p_map, slab_page_of(object), object);
+        count--;
+    }
+    spin_unlock(&p_map->lock);
+}
+
+AllokResult thread_cache_alloc(void **pp_result, AkMemoryMap *p_map, const AllokSize size) {
+    AkThreadCacheBin *bin = &thread_cache_get()->bins[slab_class_index(size)];
+
+    if (bin->p_head == ALLOK_NULL) {
+        spin_lock(&p_map->lock);
+        for (AllokSize i = 0; i < ALLOK_THREAD_CACHE_BATCH; i++) {
+            void *object;
+            if (slab_object_pop(&object, p_map, size) != ALLOK_SUCCESS) {
+                break;
+            }
+            *(void **)object = bin->p_head;
+            bin->p_head = object;
+            bin->count++;
+        }
+        spin_unlock(&p_map->lock);
+
+        if (bin->p_head == ALLOK_NULL) {
+            return ALLOK_INSUFFICIENT_POOL_MEMORY;
+        }
+    }
+
+    void *object = bin->p_head;
+    bin->p_head = *(void **)object;
+    bin->count--;
+
+    slab_object_mark_live(object);
+    *pp_result = object;
+
+    return ALLOK_SUCCESS;
+}
+
+AllokResult thread_cache_free(void **pp_target, AkMemoryMap *p_map) {
+    // The page layout can't change while the page holds a live object, but carved and the free list
+    // are only stable under the lock, so they are left to akSlabFree when the bin is flushed
+    const AkSlabPage *page = slab_page_of(*pp_target);
+    if (slab_object_validate(page, *pp_target) != ALLOK_SUCCESS || slab_object_clear_live(*pp_target) != ALLOK_SUCCESS) {
+        return ALLOK_INVALID_ADDR;
+    }
+
+    AkThreadCacheBin *bin = &thread_cache_get()->bins[slab_class_index(page->object_size)];
+
+    *(void **)(*pp_target) = bin->p_head;
+    bin->p_head = *pp_target;
+    bin->count++;
+
+    if (bin->count > ALLOK_THREAD_CACHE_MAX) {
+        thread_cache_flush_bin(p_map, bin, ALLOK_THREAD_CACHE_BATCH);
+    }
+
+    *pp_target = ALLOK_NULL;
+
+    return ALLOK_SUCCESS;
+}
+
+// Padded to a cache line so CPUs never share one
+typedef struct AkCpuCache {
+    AkSpinLock lock;
+    AkThreadCacheBin bins[ALLOK_SLAB_CLASS_COUNT];
+    AllokByte padding[64 - (sizeof(AkSpinLock) + sizeof(AkThreadCacheBin) * ALLOK_SLAB_CLASS_COUNT) % 64];
+} AkCpuCache;
+
+AllokResult cpu_caches_create(AkMemoryMap *p_map) {
+    const AllokSize count = os_cpu_count();
+    AkCpuCache *caches = os_mem_alloc(count * sizeof(AkCpuCache));
+    if (caches == ALLOK_NULL) {
+        return ALLOK_OS_MEMORY_ALLOC_FAILED;
+    }
+
+    p_map->p_cpu_caches = caches;
+    p_map->cpu_count = count;
+
+    return ALLOK_SUCCESS;
+}
+
+// The CPU can change at any point, the cache lock keeps a stale pick correct and a busy cache is reported instead of waited on
+AkCpuCache *cpu_cache_acquire(AkMemoryMap *p_map) {
+    AkCpuCache *cache = &p_map->p_cpu_caches[os_cpu_current() % p_map->cpu_count];
+    if (atomic_exchange_long(&cache->lock.state, 1) != 0) {
+        return ALLOK_NULL;
+    }
+
+    return cache;
+}
+
+AllokResult cpu_cache_alloc(void **pp_result, AkMemoryMap *p_map, const AllokSize size) {
+    AkCpuCache *cache = cpu_cache_acquire(p_map);
+    if (cache == ALLOK_NULL) {
+        return ALLOK_UNSUPPORTED;
+    }
+
+    AkThreadCacheBin *bin = &cache->bins[slab_class_index(size)];
+    if (bin->p_head == ALLOK_NULL) {
+        spin_lock(&p_map->lock);
+        for (AllokSize i = 0; i < ALLOK_THREAD_CACHE_BATCH; i++) {
+            void *object;
+            if (slab_object_pop(&object, p_map, size) != ALLOK_SUCCESS) {
+                break;
+            }
+            *(void **)object = bin->p_head;
+            bin->p_head = object;
+            bin->count++;
+        }
+        spin_unlock(&p_map->lock);
+
+        if (bin->p_head == ALLOK_NULL) {
+            spin_unlock(&cache->lock);
+            return ALLOK_INSUFFICIENT_POOL_MEMORY;
+        }
+    }
+
+    void *object = bin->p_head;
+    bin->p_head = *(void **)object;
+    bin->count--;
+    spin_unlock(&cache->lock);
+
+    slab_object_mark_live(object);
+    *pp_result = object;
+
+    return ALLOK_SUCCESS;
+}
+
+AllokResult cpu_cache_free(void **pp_target, AkMemoryMap *p_map) {
+    AkSlabPage *page = slab_page_of(*pp_target);
+    if (slab_object_validate(page, *pp_target) != ALLOK_SUCCESS || slab_object_clear_live(*pp_target) != ALLOK_SUCCESS) {
+        return ALLOK_INVALID_ADDR;
+    }
+
+    AkCpuCache *cache = cpu_cache_acquire(p_map);
+    if (cache == ALLOK_NULL) {
+        spin_lock(&p_map->lock);
+        slab_object_push(p_map, page, *pp_target);
+        spin_unlock(&p_map->lock);
+        *pp_target = ALLOK_NULL;
+        return ALLOK_SUCCESS;
+    }
+
+    AkThreadCacheBin *bin = &cache->bins[slab_class_index(page->object_size)];
+
+    *(void **)(*pp_target) = bin->p_head;
+    bin->p_head = *pp_target;
+    bin->count++;
+
+    if (bin->count > ALLOK_THREAD_CACHE_MAX) {
+        thread_cache_flush_bin(p_map, bin, ALLOK_THREAD_CACHE_BATCH);
+    }
+    spin_unlock(&cache->lock);
+
+    *pp_target = ALLOK_NULL;
+
+    return ALLOK_SUCCESS;
+}
+
+static inline AllokResult front_cache_alloc(void **pp_result, AkMemoryMap *p_map, const AllokSize size) {
+    return p_map->p_cpu_caches != ALLOK_NULL ? cpu_cache_alloc(pp_result, p_map, size) : thread_cache_alloc(pp_result, p_map, size);
+}
+
+static inline AllokResult front_cache_free(void **pp_target, AkMemoryMap *p_map) {
+    return p_map->p_cpu_caches != ALLOK_NULL ? cpu_cache_free(pp_target, p_map) : thread_cache_free(pp_target, p_map);
+}
+
+static inline AllokBool is_large_size(const AkMemoryMap *p_map, const AllokSize size) {
+    return p_map->params.is_dynamic == ALLOK_TRUE && p_map->params.large_threshold != 0 && size >= p_map->params.large_threshold ? ALLOK_TRUE : ALLOK_FALSE;
+}
+
+AkMemoryPool *map_find_fit(const AkMemoryMap *p_map, const AllokSize size, const AllokSize alignment, AllokSize *p_offset_result, AkMemoryBlock **pp_prev_result) {
+    const AllokSize block_alloc_size = sizeof(AkMemoryBlock) + size;
+
+    // The tightest pool may be short once padded, retry with room for the worst case padding
+    AkMemoryPool *pool = map_find_pool(p_map, block_alloc_size);
+    if (pool != ALLOK_NULL && find_block_fit(pool, size, alignment, p_offset_result, pp_prev_result) == ALLOK_FALSE) {
+        pool = map_find_pool(p_map, block_alloc_size + alignment - 1);
+        if (pool != ALLOK_NULL && find_block_fit(pool, size, alignment, p_offset_result, pp_prev_result) == ALLOK_FALSE) {
+            pool = ALLOK_NULL;
+        }
+    }
+
+    return pool;
+}
+
+AllokResult heap_alloc_block(AkMemoryBlock **pp_result, AkMemoryMap *p_map, const AllokSize size, const AllokSize alignment) {
+    AllokResult result;
+    const AllokSize block_alloc_size = sizeof(AkMemoryBlock) + size;
+
+    AllokSize block_offset = 0;
+    AkMemoryBlock *prev_block = ALLOK_NULL;
+
+    AkMemoryPool *pool = map_find_fit(p_map, size, alignment, &block_offset, &prev_block);
+    if (pool != ALLOK_NULL) {
+        return block_create_after(pp_result, pool, prev_block, size, block_offset);
+    }
+
+    if (p_map->params.is_dynamic == ALLOK_FALSE) {
+        return ALLOK_INSUFFICIENT_POOL_MEMORY;
+    }
+
+    AkMemoryPool *new_pool;
+    const AllokSize alloc_size = max_size(ALLOK_DEFAULT_POOL_SIZE, block_alloc_size + alignment - 1);
+    result = map_acquire_pool(&new_pool, p_map, alloc_size);
+    if (result != ALLOK_SUCCESS) {
+        return result;
+    }
+
+    gap_fit_aligned(new_pool, new_pool->p_start, gap_end_before(new_pool, ALLOK_NULL), size, alignment, &block_offset);
+
+    return block_create_after(pp_result, new_pool, ALLOK_NULL, size, block_offset);
+}
+
+AllokResult heap_alloc(void **pp_result, AkMemoryMap *p_map, const AllokSize size, const AllokSize alignment) {
+    AllokResult result;
+
+    // Large requests get a mapping of their own and never enter the pool searches
+    if (is_large_size(p_map, size) == ALLOK_TRUE) {
+        AkLargeBlock *large;
+        result = akLargeBlockAlloc(&large, p_map, size, alignment);
+        if (result != ALLOK_SUCCESS) {
+            return result;
+        }
+
+        *pp_result = large->p_start;
+        return ALLOK_SUCCESS;
+    }
+
+    // Small requests are served by the slab, falling through to the pools once its region is exhausted
+    if (size <= ALLOK_SLAB_MAX_SIZE && alignment <= ALLOK_SLAB_GRANULARITY && p_map->params.is_slab_enabled == ALLOK_TRUE) {
+        if (akSlabAlloc(pp_result, p_map, size) == ALLOK_SUCCESS) {
+            return ALLOK_SUCCESS;
+        }
+    }
+
+    AkMemoryBlock *block;
+    result = heap_alloc_block(&block, p_map, size, alignment);
+    if (result != ALLOK_SUCCESS) {
+        return result;
+    }
+
+    *pp_result = block->p_start;
+
+    return ALLOK_SUCCESS;
+}
+
+AllokResult heap_free(void **pp_target, AkMemoryMap *p_map) {
+    if (slab_region_contains(p_map, *pp_target) == ALLOK_TRUE) {
+        return akSlabFree(pp_target, p_map);
+    }
+
+    AkLargeBlock *large;
+    AllokResult result = akLargeBlockFind(&large, p_map, *pp_target);
+    if (result == ALLOK_SUCCESS) {
+        akLargeBlockFree(&large);
+        *pp_target = ALLOK_NULL;
+        return ALLOK_SUCCESS;
+    }
+    if (result == ALLOK_INVALID_ADDR) {
+        return result;
+    }
+
+    AkMemoryBlock *block = ALLOK_NULL;
+    result = akMemoryBlockFromPtr(&block, p_map, *pp_target);
+    if (result != ALLOK_SUCCESS) {
+        return result;
+    }
+
+    akMemoryBlockFree(&block);
+
+    *pp_target = ALLOK_NULL;
+
+    return ALLOK_SUCCESS;
+}
+
+AllokResult heap_free_batch(void **pp_targets, AkMemoryMap *p_map, const AllokSize count) {
+    AllokResult batch_result = ALLOK_SUCCESS;
+    AkMemoryPool *pending = ALLOK_NULL;
+
+    for (AllokSize i = 0; i < count; i++) {
+        if (pp_targets[i] == ALLOK_NULL) {
+            continue;
+        }
+
+        AkMemoryBlock *block = ALLOK_NULL;
+        if (slab_region_contains(p_map, pp_targets[i]) == ALLOK_FALSE && akMemoryBlockFromPtr(&block, p_map, pp_targets[i]) == ALLOK_SUCCESS) {
+            // Consecutive blocks of one pool only refresh its gap and fit indexes once the run ends
+            if (block->p_parent != pending) {
+                if (pending != ALLOK_NULL) {
+                    pool_settle(pending);
+                }
+                pending = block->p_parent;
+            }
+
+            block_unlink(block);
+            pp_targets[i] = ALLOK_NULL;
+            continue;
+        }
+
+        const AllokResult result = heap_free(&pp_targets[i], p_map);
+        if (result != ALLOK_SUCCESS && batch_result == ALLOK_SUCCESS) {
+            batch_result = result;
+        }
+    }
+
+    if (pending != ALLOK_NULL) {
+        pool_settle(pending);
+    }
+
+    return batch_result;
+}
+
+AllokResult heap_alloc_batch(void **pp_results, AkMemoryMap *p_map, const AllokSize count, const AllokSize size) {
+    AllokResult result;
+    const AllokSize alignment = ALLOK_DEFAULT_ALIGNMENT;
+
+    // Slab and large allocations have no fit search to share, so they are served one at a time
+    const AllokBool is_slab_size = size <= ALLOK_SLAB_MAX_SIZE && p_map->params.is_slab_enabled == ALLOK_TRUE ? ALLOK_TRUE : ALLOK_FALSE;
+    if (is_slab_size == ALLOK_TRUE || is_large_size(p_map, size) == ALLOK_TRUE) {
+        for (AllokSize i = 0; i < count; i++) {
+            result = heap_alloc(&pp_results[i], p_map, size, alignment);
+            if (result != ALLOK_SUCCESS) {
+                heap_free_batch(pp_results, p_map, i);
+                return result;
+            }
+        }
+        return ALLOK_SUCCESS;
+    }
+
+    // Payloads stay aligned when every block of a run starts a whole stride after the previous one
+    const AllokSize block_alloc_size = sizeof(AkMemoryBlock) + size;
+    const AllokSize stride = align_up(block_alloc_size, alignment);
+    if (size > (AllokSize)-1 - sizeof(AkMemoryBlock) - alignment || count > ((AllokSize)-1 - alignment) / stride) {
+        return ALLOK_INVALID_SIZE;
+    }
+
+    AllokSize done = 0;
+    while (done < count) {
+        AllokSize block_offset = 0;
+        AkMemoryBlock *prev_block = ALLOK_NULL;
+
+        AkMemoryPool *pool = map_find_fit(p_map, size, alignment, &block_offset, &prev_block);
+        if (pool == ALLOK_NULL) {
+            if (p_map->params.is_dynamic == ALLOK_FALSE) {
+                heap_free_batch(pp_results, p_map, done);
+                return ALLOK_INSUFFICIENT_POOL_MEMORY;
+            }
+
+            // One pool is sized for everything left, so the rest of the batch is carved in a single run
+            result = map_acquire_pool(&pool, p_map, max_size(ALLOK_DEFAULT_POOL_SIZE, (count - done) * stride + alignment - 1));
+            if (result != ALLOK_SUCCESS) {
+                heap_free_batch(pp_results, p_map, done);
+                return result;
+            }
+
+            gap_fit_aligned(pool, pool->p_start, gap_end_before(pool, ALLOK_NULL), size, alignment, &block_offset);
+        }
+
+        const AkMemoryBlock *next = prev_block == ALLOK_NULL ? pool->p_head : prev_block->p_next;
+        const AllokByte *run_start = (AllokByte *)pool->p_start + block_offset;
+        const AllokSize run_size = (AllokSize)(gap_end_before(pool, next) - run_start);
+        const AllokSize run_count = min_size(count - done, 1 + (run_size - block_alloc_size) / stride);
+
+        block_create_run(&pp_results[done], pool, prev_block, size, block_offset, run_count, stride);
+        done += run_count;
+    }
+
+    return ALLOK_SUCCESS;
+}
+
+AllokBool block_grow_forward(AkMemoryBlock *p_block, const AllokSize size) {
+    if ((AllokByte *)p_block->p_start + size > gap_end_before(p_block->p_parent, p_block->p_next)) {
+        return ALLOK_FALSE;
+    }
+
+    block_resize(p_block, size);
+    return ALLOK_TRUE;
+}
+
+AkMemoryBlock *block_grow_backward(AkMemoryBlock *p_block, const AllokSize size) {
+    AkMemoryPool *pool = p_block->p_parent;
+    AkMemoryBlock *prev = p_block->p_prev;
+    AkMemoryBlock *next = p_block->p_next;
+    AllokByte *front_start = gap_start_after(pool, prev);
+    AllokByte *back_end = gap_end_before(pool, next);
+
+    AllokSize offset;
+    if (gap_fit_aligned(pool, front_start, back_end, size, ALLOK_DEFAULT_ALIGNMENT, &offset) == ALLOK_FALSE) {
+        return ALLOK_NULL;
+    }
+
+    AkMemoryBlock *block = (AkMemoryBlock *)((AllokByte *)pool->p_start + offset);
+    if (block >= p_block) {
+        return ALLOK_NULL;
+    }
+
+    // Both gaps are about to be overwritten by the moved data, so unindex them first
+    pool_gap_remove(pool, front_start, (AllokByte *)p_block);
+    pool_gap_remove(pool, block_end(p_block), back_end);
+
+    const AllokSize old_size = p_block->size;
+    void *p_src = p_block->p_start;
+    p_block->p_start = ALLOK_NULL;
+
+    void *p_dst = (AllokByte *)block + sizeof(AkMemoryBlock);
+    akMemmove(&p_dst, p_src, old_size);
+
+    block->size = size;
+    block->p_start = p_dst;
+    block->p_parent = pool;
+    block->state = block_tag(pool, ALLOK_BLOCK_POOL);
+    block->p_prev = prev;
+    block->p_next = next;
+
+    if (prev == ALLOK_NULL) {
+        pool->p_head = block;
+    } else {
+        prev->p_next = block;
+    }
+
+    if (next == ALLOK_NULL) {
+        pool->p_tail = block;
+    } else {
+        next->p_prev = block;
+    }
+
+    pool->size = pool->size - old_size + size;
+    if (pool->p_parent_map != ALLOK_NULL) {
+        map_stats_resize(pool->p_parent_map, old_size, size);
+    }
+
+    pool_gap_insert(pool, front_start, (AllokByte *)block, prev);
+    pool_gap_insert(pool, block_end(block), back_end, block);
+    pool_refresh_gaps(pool);
+
+    return block;
+}
+
+AllokSize realloc_capacity(const AkMemoryMap *p_map, const AllokSize size) {
+    if (p_map->params.is_realloc_headroom == ALLOK_FALSE) {
+        return size;
+    }
+
+    const AllokSize capacity = size + (size >> ALLOK_REALLOC_HEADROOM_SHIFT);
+    return capacity < size ? size : capacity;
+}
+
+AllokResult heap_realloc(void **pp_result, AkMemoryMap *p_map, void *p_src, const AllokSize size) {
+    AllokResult result;
+
+    AkSlabPage *page;
+    if (akSlabPageFind(&page, p_map, p_src) == ALLOK_SUCCESS) {
+        if (size <= page->object_size) {
+            *pp_result = p_src;
+            return ALLOK_SUCCESS;
+        }
+
+        result = heap_alloc(pp_result, p_map, realloc_capacity(p_map, size), ALLOK_DEFAULT_ALIGNMENT);
+        if (result != ALLOK_SUCCESS) {
+            *pp_result = ALLOK_NULL;
+            return result;
+        }
+
+        akMemcpy(pp_result, p_src, page->object_size);
+        akSlabFree(&p_src, p_map);
+        p_map->metadata.reallocs_moved++;
+
+        return ALLOK_SUCCESS;
+    }
+
+    AkLargeBlock *large;
+    result = akLargeBlockFind(&large, p_map, p_src);
+    if (result == ALLOK_INVALID_ADDR) {
+        return result;
+    }
+    if (result == ALLOK_SUCCESS) {
+        const AllokSize old_size = large->size;
+        if (akLargeBlockResize(&large, size) == ALLOK_SUCCESS) {
+            *pp_result = large->p_start;
+            return ALLOK_SUCCESS;
+        }
+
+        result = heap_alloc(pp_result, p_map, realloc_capacity(p_map, size), ALLOK_DEFAULT_ALIGNMENT);
+        if (result != ALLOK_SUCCESS) {
+            *pp_result = ALLOK_NULL;
+            return result;
+        }
+
+        akMemcpy(pp_result, p_src, old_size);
+        akLargeBlockFree(&large);
+        p_map->metadata.reallocs_moved++;
+
+        return ALLOK_SUCCESS;
+    }
+
+    AkMemoryBlock *block = ALLOK_NULL;
+    result = akMemoryBlockFromPtr(&block, p_map, p_src);
+    if (result != ALLOK_SUCCESS) {
+        return result;
+    }
+
+    const AllokSize old_size = block->size;
+
+    if (size <= old_size) {
+        // With headroom enabled a block keeps its spare capacity until less than half of it is in use
+        if (p_map->params.is_realloc_headroom == ALLOK_FALSE || size < old_size / 2) {
+            block_resize(block, size);
+        }
+        *pp_result = block->p_start;
+        return ALLOK_SUCCESS;
+    }
+
+    const AllokSize capacity = realloc_capacity(p_map, size);
+    if (block_grow_forward(block, capacity) == ALLOK_TRUE || (capacity != size && block_grow_forward(block, size) == ALLOK_TRUE)) {
+        p_map->metadata.reallocs_in_place++;
+        *pp_result = block->p_start;
+        return ALLOK_SUCCESS;
+    }
+
+    AkMemoryBlock *moved = block_grow_backward(block, capacity);
+    if (moved == ALLOK_NULL && capacity != size) {
+        moved = block_grow_backward(block, size);
+    }
+    if (moved != ALLOK_NULL) {
+        p_map->metadata.reallocs_shifted++;
+        *pp_result = moved->p_start;
+        return ALLOK_SUCCESS;
+    }
+
+    result = heap_alloc(pp_result, p_map, capacity, ALLOK_DEFAULT_ALIGNMENT);
+    if (result != ALLOK_SUCCESS) {
+        *pp_result = ALLOK_NULL;
+        return result;
+    }
+
+    result = akMemcpy(pp_result, p_src, old_size);
+    if (result != ALLOK_SUCCESS) {
+        *pp_result = ALLOK_NULL;
+        return result;
+    }
+
+    heap_free(&p_src, p_map);
+    p_map->metadata.reallocs_moved++;
+
+    return ALLOK_SUCCESS;
+}
+
+AllokResult handle_alloc(AkHandle **pp_result, AkMemoryMap *p_map, const AllokSize size) {
+    AkHandle *handle;
+    AllokResult result = heap_alloc((void **)&handle, p_map, sizeof(AkHandle), ALLOK_DEFAULT_ALIGNMENT);
+    if (result != ALLOK_SUCCESS) {
+        return result;
+    }
+
+    // The slab can't move its objects, so handle memory skips it and comes straight from the pools
+    void *data;
+    if (is_large_size(p_map, size) == ALLOK_TRUE) {
+        result = heap_alloc(&data, p_map, size, ALLOK_DEFAULT_ALIGNMENT);
+    } else {
+        AkMemoryBlock *block;
+        result = heap_alloc_block(&block, p_map, size, ALLOK_DEFAULT_ALIGNMENT);
+        data = result == ALLOK_SUCCESS ? block->p_start : ALLOK_NULL;
+    }
+    if (result != ALLOK_SUCCESS) {
+        heap_free((void **)&handle, p_map);
+        return result;
+    }
+
+    handle->p_data = data;
+    handle->size = size;
+    handle->lock_count = 0;
+    handle->p_prev = ALLOK_NULL;
+    handle->p_next = p_map->p_handle_head;
+    if (p_map->p_handle_head != ALLOK_NULL) {
+        p_map->p_handle_head->p_prev = handle;
+    }
+    p_map->p_handle_head = handle;
+    p_map->handle_count++;
+
+    *pp_result = handle;
+
+    return ALLOK_SUCCESS;
+}
+
+void handle_free(AkHandle *p_handle, AkMemoryMap *p_map) {
+    if (p_map->p_compact_cursor == p_handle) {
+        p_map->p_compact_cursor = p_handle->p_next;
+    }
+    if (p_handle->p_prev != ALLOK_NULL) {
+        p_handle->p_prev->p_next = p_handle->p_next;
+    } else {
+        p_map->p_handle_head = p_handle->p_next;
+    }
+    if (p_handle->p_next != ALLOK_NULL) {
+        p_handle->p_next->p_prev = p_handle->p_prev;
+    }
+    p_map->handle_count--;
+
+    heap_free(&p_handle->p_data, p_map);
+    heap_free((void **)&p_handle, p_map);
+}
+
+AllokBool compact_evacuate(AkMemoryMap *p_map, AkHandle *p_handle, AkMemoryBlock *p_block) {
+    AkMemoryPool *pool = p_block->p_parent;
+    if (pool->size >= pool->alloc_size >> ALLOK_COMPACT_EVACUATE_SHIFT) {
+        return ALLOK_FALSE;
+    }
+
+    // The source pool leaves the fit index for the search, so only the other pools are considered
+    AllokSize offset;
+    AkMemoryBlock *prev;
+    p_map->p_pool_root = tree_remove(p_map->p_pool_root, &pool->fit_node);
+    AkMemoryPool *target = map_find_fit(p_map, p_block->size, ALLOK_DEFAULT_ALIGNMENT, &offset, &prev);
+    p_map->p_pool_root = tree_insert(p_map->p_pool_root, &pool->fit_node);
+
+    // Blocks only flow towards fuller pools, so two sparse pools never trade the same block back and forth
+    if (target == ALLOK_NULL || target->size < pool->size) {
+        return ALLOK_FALSE;
+    }
+
+    AkMemoryBlock *moved;
+    if (block_create_after(&moved, target, prev, p_block->size, offset) != ALLOK_SUCCESS) {
+        return ALLOK_FALSE;
+    }
+
+    void *p_dst = moved->p_start;
+    akMemcpy(&p_dst, p_block->p_start, p_block->size);
+    p_handle->p_data = p_dst;
+
+    block_unlink(p_block);
+    if (pool->size == 0) {
+        akMemoryPoolFree(&pool, ALLOK_FALSE);
+        p_map->metadata.pools_compacted++;
+    } else {
+        pool_refresh_gaps(pool);
+    }
+
+    return ALLOK_TRUE;
+}
+
+AllokBool compact_slide(AkHandle *p_handle, AkMemoryBlock *p_block) {
+    // A gap too small to index isn't worth the copy
+    const AllokByte *front_start = gap_start_after(p_block->p_parent, p_block->p_prev);
+    if ((AllokSize)((AllokByte *)p_block - front_start) < gap_min_size()) {
+        return ALLOK_FALSE;
+    }
+
+    AkMemoryBlock *moved = block_grow_backward(p_block, p_block->size);
+    if (moved == ALLOK_NULL) {
+        return ALLOK_FALSE;
+    }
+
+    p_handle->p_data = moved->p_start;
+
+    return ALLOK_TRUE;
+}
+
+AllokSize heap_compact(AkMemoryMap *p_map, const AllokSize budget) {
+    AllokSize moved = 0;
+    AllokSize spent = 0;
+    AkHandle *handle = p_map->p_compact_cursor;
+
+    // Resumes at the cursor and wraps around once, so a budgeted call only pays for the handles it gets to
+    for (AllokSize scanned = 0; scanned < p_map->handle_count && (budget == 0 || moved == 0 || spent < budget); scanned++) {
+        if (handle == ALLOK_NULL) {
+            handle = p_map->p_handle_head;
+        }
+        AkHandle *current = handle;
+        handle = handle->p_next;
+        spent += ALLOK_COMPACT_SCAN_COST;
+
+        AkMemoryBlock *block;
+        if (current->lock_count > 0 || akMemoryBlockFromPtr(&block, p_map, current->p_data) != ALLOK_SUCCESS) {
+            continue;
+        }
+
+        const AllokSize size = block->size;
+        if (compact_evacuate(p_map, current, block) == ALLOK_TRUE || compact_slide(current, block) == ALLOK_TRUE) {
+            p_map->metadata.handles_moved++;
+            moved += size;
+            spent += size;
+        }
+    }
+    p_map->p_compact_cursor = handle;
+
+    return moved;
+}
+
+static ALLOK_THREAD_LOCAL AllokByte t_thread_token;
+
+static inline AllokBool heap_is_foreign(const AkMemoryMap *p_map) {
+    const void *owner = atomic_load_ptr(&p_map->p_owner);
+    return owner != ALLOK_NULL && owner != &t_thread_token ? ALLOK_TRUE : ALLOK_FALSE;
+}
+
+// A slab object's live bit is cleared first, so the object is claimed before anything is written to it
+AllokResult heap_remote_push(AkMemoryMap *p_map, void *ptr) {
+    const AkSlabPage *page = slab_page_of(ptr);
+    if (slab_object_validate(page, ptr) != ALLOK_SUCCESS || slab_object_clear_live(ptr) != ALLOK_SUCCESS) {
+        return ALLOK_INVALID_ADDR;
+    }
+
+    // Producers only ever push and the owner takes the whole list at once, so there is no ABA to guard against
+    void *head = atomic_load_ptr(&p_map->p_remote_head);
+    do {
+        *(void **)ptr = head;
+    } while (atomic_compare_exchange_ptr(&p_map->p_remote_head, &head, ptr) == ALLOK_FALSE);
+
+    return ALLOK_SUCCESS;
+}
+
+// Pool and large blocks are found from the state word in front of ptr and checked against their header, then claimed by
+// setting ALLOK_BLOCK_PENDING. A block can be as small as a byte, so the queue links the state words rather than the
+// blocks themselves
+AllokResult heap_remote_push_block(AkMemoryMap *p_map, void *ptr) {
+    const AllokSize tag = atomic_load_size((const volatile AllokSize *)ptr - 1);
+    const AllokSize kind = tag & ALLOK_BLOCK_KIND_MASK;
+    if ((tag & ALLOK_BLOCK_PENDING) != 0 && kind != 0) {
+        return ALLOK_INVALID_ADDR;
+    }
+    if ((tag & ALLOK_BLOCK_TAG_MASK) != (ALLOK_BLOCK_TAG | kind) || kind == 0) {
+        return ALLOK_NOT_FOUND;
+    }
+
+    volatile AllokSize *state;
+    const AkMemoryMap *map;
+    if (kind == ALLOK_BLOCK_POOL) {
+        AkMemoryBlock *block = (AkMemoryBlock *)((AllokByte *)ptr - sizeof(AkMemoryBlock));
+        const AkMemoryPool *pool = (const AkMemoryPool *)(tag & ~ALLOK_BLOCK_TAG_MASK);
+        if (block->p_parent != pool || block->p_start != ptr) {
+            return ALLOK_INVALID_ADDR;
+        }
+        state = &block->state;
+        map = pool->p_parent_map;
+    } else {
+        AkLargeBlock *block = (AkLargeBlock *)(tag & ~ALLOK_BLOCK_TAG_MASK);
+        if (block->p_start != ptr) {
+            return ALLOK_INVALID_ADDR;
+        }
+        state = &block->state;
+        map = block->p_parent_map;
+    }
+
+    if (map != p_map) {
+        return ALLOK_NOT_FOUND;
+    }
+
+    // A second free finds the block pending and loses the exchange
+    AllokSize expected = tag;
+    while (atomic_compare_exchange_size(state, &expected, ALLOK_BLOCK_PENDING | kind) == ALLOK_FALSE) {
+        if (expected != tag) {
+            return ALLOK_INVALID_ADDR;
+        }
+    }
+
+    void *head = atomic_load_ptr(&p_map->p_remote_block_head);
+    do {
+        atomic_store_size(state, (AllokSize)head | ALLOK_BLOCK_PENDING | kind);
+    } while (atomic_compare_exchange_ptr(&p_map->p_remote_block_head, &head, (void *)state) == ALLOK_FALSE);
+
+    return ALLOK_SUCCESS;
+}
+
+void heap_remote_drain(AkMemoryMap *p_map) {
+    void *object = atomic_exchange_ptr(&p_map->p_remote_head, ALLOK_NULL);
+    while (object != ALLOK_NULL) {
+        void *next = *(void **)object;
+        slab_object_push(p_map, slab_page_of(object), object);
+        p_map->metadata.remote_frees++;
+        object = next;
+    }
+
+    AllokByte *state = atomic_exchange_ptr(&p_map->p_remote_block_head, ALLOK_NULL);
+    while (state != ALLOK_NULL) {
+        const AllokSize word = atomic_load_size((const volatile AllokSize *)state);
+        if ((word & ALLOK_BLOCK_KIND_MASK) == ALLOK_BLOCK_POOL) {
+            AkMemoryBlock *block = (AkMemoryBlock *)(state - offsetof(AkMemoryBlock, state));
+            akMemoryBlockFree(&block);
+        } else {
+            AkLargeBlock *block = (AkLargeBlock *)(state - offsetof(AkLargeBlock, state));
+            akLargeBlockFree(&block);
+        }
+        p_map->metadata.remote_frees++;
+        state = (AllokByte *)(word & ~ALLOK_BLOCK_LINK_MASK);
+    }
+}
+
+static inline AllokBool heap_lock(AkMemoryMap *p_map) {
+    if (p_map->params.is_thread_safe == ALLOK_FALSE) {
+        return ALLOK_FALSE;
+    }
+
+    spin_lock(&p_map->lock);
+    return ALLOK_TRUE;
+}
+
+static inline void heap_unlock(AkMemoryMap *p_map, const AllokBool is_locked) {
+    if (is_locked == ALLOK_TRUE) {
+        spin_unlock(&p_map->lock);
+    }
+}
+
+static inline AllokBool heap_enter(AkMemoryMap *p_map) {
+    const AllokBool is_locked = heap_lock(p_map);
+    if (atomic_load_ptr(&p_map->p_remote_head) != ALLOK_NULL || atomic_load_ptr(&p_map->p_remote_block_head) != ALLOK_NULL) {
+        heap_remote_drain(p_map);
+    }
+    return is_locked;
+}
+
+AllokResult akHeapSetOwner(AkMemoryMap *p_map) {
+    if (p_map == ALLOK_NULL) {
+        return ALLOK_NULL_PARAM;
+    }
+
+    atomic_store_ptr(&p_map->p_owner, &t_thread_token);
+
+    return ALLOK_SUCCESS;
+}
+
+AllokResult akHeapCollect(AkMemoryMap *p_map) {
+    if (p_map == ALLOK_NULL) {
+        return ALLOK_NULL_PARAM;
+    }
+    if (heap_is_foreign(p_map) == ALLOK_TRUE && p_map->params.is_thread_safe == ALLOK_FALSE) {
+        return ALLOK_UNSUPPORTED;
+    }
+
+    heap_unlock(p_map, heap_enter(p_map));
+
+    return ALLOK_SUCCESS;
+}
+
+AllokResult akHeapAlloc(void **pp_result, AkMemoryMap *p_map, const AllokSize size) {
+    return akHeapAllocAligned(pp_result, p_map, size, ALLOK_DEFAULT_ALIGNMENT);
+}
+
+AllokResult akHeapAllocAligned(void **pp_result, AkMemoryMap *p_map, const AllokSize size, AllokSize alignment) {
+    if (pp_result == ALLOK_NULL || p_map == ALLOK_NULL) {
+        return ALLOK_NULL_PARAM;
+    }
+
+    if (is_valid_alignment(alignment) == ALLOK_FALSE) {
+        return ALLOK_INVALID_ALIGNMENT;
+    }
+    alignment = max_size(alignment, ALLOK_DEFAULT_ALIGNMENT);
+
+    if (heap_is_foreign(p_map) == ALLOK_TRUE && p_map->params.is_thread_safe == ALLOK_FALSE) {
+        return ALLOK_UNSUPPORTED;
+    }
+
+    const AllokBool is_locked = heap_enter(p_map);
+    const AllokResult result = heap_alloc(pp_result, p_map, size, alignment);
+    if (result != ALLOK_SUCCESS) {
+        p_map->metadata.allocs_failed++;
+    }
+    heap_unlock(p_map, is_locked);
+
+    return result;
+}
+
+AllokResult akHeapCalloc(void **pp_result, AkMemoryMap *p_map, const AllokSize size) {
+    const AllokResult result = akHeapAlloc(pp_result, p_map, size);
+    if (result != ALLOK_SUCCESS) {
+        return result;
+    }
+
+    return akMemset(pp_result, 0, size);
+}
+
+AllokResult akHeapRealloc(void **pp_result, AkMemoryMap *p_map, void *p_src, const AllokSize size) {
+    if (pp_result == ALLOK_NULL || p_map == ALLOK_NULL || p_src == ALLOK_NULL) {
+        return ALLOK_NULL_PARAM;
+    }
+    if (heap_is_foreign(p_map) == ALLOK_TRUE && p_map->params.is_thread_safe == ALLOK_FALSE) {
+        return ALLOK_UNSUPPORTED;
+    }
+
+    const AllokBool is_locked = heap_enter(p_map);
+    const AllokResult result = heap_realloc(pp_result, p_map, p_src, size);
+    if (result != ALLOK_SUCCESS) {
+        p_map->metadata.allocs_failed++;
+    }
+    heap_unlock(p_map, is_locked);
+
+    return result;
+}
+
+AllokResult akHeapFree(void **pp_target, AkMemoryMap *p_map) {
+    if (pp_target == ALLOK_NULL || p_map == ALLOK_NULL) {
+        return ALLOK_NULL_PARAM;
+    }
+    if (*pp_target == ALLOK_NULL) {
+        return ALLOK_SUCCESS;
+    }
+
+    // Frees from other threads are queued without a lock. The slab region is fixed, and every other block leads to its
+    // map through its own header, so none of the trees the owner changes are read
+    if (heap_is_foreign(p_map) == ALLOK_TRUE) {
+        const AllokResult result = slab_region_contains(p_map, *pp_target) == ALLOK_TRUE ? heap_remote_push(p_map, *pp_target) : heap_remote_push_block(p_map, *pp_target);
+        if (result == ALLOK_SUCCESS) {
+            *pp_target = ALLOK_NULL;
+        }
+        return result;
+    }
+
+    const AllokBool is_locked = heap_lock(p_map);
+    const AllokResult result = heap_free(pp_target, p_map);
+    heap_unlock(p_map, is_locked);
+
+    return result;
+}
+
+void akMemoryMapDestroy(AkMemoryMap **pp_map, AkMemoryArena **pp_arena) {
+    if (pp_map == ALLOK_NULL || *pp_map == ALLOK_NULL) {
+        return;
+    }
+
+    AkMemoryMap *map = *pp_map;
+    while (map->p_large_head != ALLOK_NULL) {
+        AkLargeBlock *large = map->p_large_head;
+        akLargeBlockFree(&large);
+    }
+    akMemoryPoolFree(&map->p_pool_head, ALLOK_TRUE);
+    akMemoryPoolCacheRelease(map);
+    akSlabRegionFree(map);
+    if (map->p_cpu_caches != ALLOK_NULL) {
+        os_mem_free(map->p_cpu_caches, map->cpu_count * sizeof(AkCpuCache));
+        map->p_cpu_caches = ALLOK_NULL;
+    }
+
+    // The map itself lives in the arena, so it goes last
+    *pp_map = ALLOK_NULL;
+    if (pp_arena != ALLOK_NULL) {
+        akMemoryArenaDestroy(pp_arena, ALLOK_FALSE);
+    }
+}
+
+struct AkMappedHeap {
+    AkMappedHeapHeader *p_header;
+    AllokSize size;
+    AkOsFile file;
+    AkOsFile mapping;
+    AllokBool is_shared;
+};
+
+// A free block keeps its list links in its first bytes
+typedef struct AkMappedFreeLinks {
+    unsigned long long next;
+    unsigned long long prev;
+} AkMappedFreeLinks;
+
+static inline unsigned long long mapped_data_start() {
+    return align_up(sizeof(AkMappedHeapHeader), ALLOK_DEFAULT_ALIGNMENT);
+}
+
+static inline AkMappedBlock *mapped_block_at(const AkMappedHeap *p_heap, const unsigned long long offset) {
+    return (AkMappedBlock *)((AllokByte *)p_heap->p_header + offset);
+}
+
+static inline AkMappedFreeLinks *mapped_links_at(const AkMappedHeap *p_heap, const unsigned long long offset) {
+    return (AkMappedFreeLinks *)(mapped_block_at(p_heap, offset) + 1);
+}
+
+// The low bit of a block's size is set while it is free and the next one while a shared free of it waits to be
+// drained, sizes are multiples of ALLOK_DEFAULT_ALIGNMENT
+static inline unsigned long long mapped_block_size(const AkMappedBlock *p_block) {
+    return p_block->size & ~3ULL;
+}
+
+static inline AllokBool mapped_block_is_free(const AkMappedBlock *p_block) {
+    return (p_block->size & 1ULL) != 0 ? ALLOK_TRUE : ALLOK_FALSE;
+}
+
+static inline AllokBool mapped_block_is_pending(const AkMappedBlock *p_block) {
+    return (p_block->size & 2ULL) != 0 ? ALLOK_TRUE : ALLOK_FALSE;
+}
+
+static inline unsigned long long mapped_block_next(const AkMappedHeap *p_heap, const unsigned long long offset) {
+    return offset + sizeof(AkMappedBlock) + mapped_block_size(mapped_block_at(p_heap, offset));
+}
+
+// Exact classes up to ALLOK_SLAB_MAX_SIZE like the slab, then one class per power of two
+AllokSize mapped_class_index(const unsigned long long size) {
+    if (size <= ALLOK_SLAB_MAX_SIZE) {
+        return slab_class_index((AllokSize)size);
+    }
+
+    AllokSize index = ALLOK_SLAB_CLASS_COUNT;
+    for (unsigned long long rest = size / (2 * ALLOK_SLAB_MAX_SIZE); rest > 0 && index < ALLOK_MAPPED_HEAP_CLASS_COUNT - 1; rest >>= 1) {
+        index++;
+    }
+    return index;
+}
+
+void mapped_free_push(AkMappedHeap *p_heap, const unsigned long long offset) {
+    unsigned long long *head = &p_heap->p_header->free_heads[mapped_class_index(mapped_block_size(mapped_block_at(p_heap, offset)))];
+    AkMappedFreeLinks *links = mapped_links_at(p_heap, offset);
+    links->prev = 0;
+    links->next = *head;
+    if (*head != 0) {
+        mapped_links_at(p_heap, *head)->prev = offset;
+    }
+    *head = offset;
+}
+
+void mapped_free_remove(AkMappedHeap *p_heap, const unsigned long long offset) {
+    const AkMappedFreeLinks *links = mapped_links_at(p_heap, offset);
+    if (links->prev != 0) {
+        mapped_links_at(p_heap, links->prev)->next = links->next;
+    } else {
+        p_heap->p_header->free_heads[mapped_class_index(mapped_block_size(mapped_block_at(p_heap, offset)))] = links->next;
+    }
+    if (links->next != 0) {
+        mapped_links_at(p_heap, links->next)->prev = links->prev;
+    }
+}
+
+void mapped_block_split(AkMappedHeap *p_heap, const unsigned long long offset, const unsigned long long size) {
+    AkMappedHeapHeader *header = p_heap->p_header;
+    AkMappedBlock *block = mapped_block_at(p_heap, offset);
+    const unsigned long long block_size = mapped_block_size(block);
+    if (block_size < size + sizeof(AkMappedBlock) + sizeof(AkMappedFreeLinks)) {
+        return;
+    }
+
+    block->size = size;
+    const unsigned long long rest = mapped_block_next(p_heap, offset);
+    const unsigned long long rest_size = block_size - size - sizeof(AkMappedBlock);
+    AkMappedBlock *rest_block = mapped_block_at(p_heap, rest);
+    rest_block->size = rest_size | 1ULL;
+    rest_block->prev_size = size;
+
+    const unsigned long long next = mapped_block_next(p_heap, rest);
+    if (next < header->top) {
+        mapped_block_at(p_heap, next)->prev_size = rest_size;
+    } else {
+        header->tail = rest;
+    }
+
+    mapped_free_push(p_heap, rest);
+}
+
+AllokResult mapped_heap_alloc(void **pp_result, AkMappedHeap *p_heap, const AllokSize size) {
+    AkMappedHeapHeader *header = p_heap->p_header;
+    const unsigned long long block_size = align_up(max_size(size, sizeof(AkMappedFreeLinks)), ALLOK_DEFAULT_ALIGNMENT);
+
+    // Every block in a class above the first is large enough, so only the first class needs a search
+    unsigned long long offset = 0;
+    for (AllokSize i = mapped_class_index(block_size); i < ALLOK_MAPPED_HEAP_CLASS_COUNT && offset == 0; i++) {
+        for (unsigned long long free = header->free_heads[i]; free != 0; free = mapped_links_at(p_heap, free)->next) {
+            if (mapped_block_size(mapped_block_at(p_heap, free)) >= block_size) {
+                offset = free;
+                break;
+            }
+        }
+    }
+
+    if (offset != 0) {
+        mapped_free_remove(p_heap, offset);
+        AkMappedBlock *block = mapped_block_at(p_heap, offset);
+        block->size = mapped_block_size(block);
+        mapped_block_split(p_heap, offset, block_size);
+    } else {
+        if (header->top + sizeof(AkMappedBlock) + block_size > header->size) {
+            return ALLOK_INSUFFICIENT_POOL_MEMORY;
+        }
+
+        offset = header->top;
+        AkMappedBlock *block = mapped_block_at(p_heap, offset);
+        block->size = block_size;
+        block->prev_size = header->tail != 0 ? mapped_block_size(mapped_block_at(p_heap, header->tail)) : 0;
+        header->top += sizeof(AkMappedBlock) + block_size;
+        header->tail = offset;
+    }
+
+    header->alloc_size += mapped_block_size(mapped_block_at(p_heap, offset));
+    header->block_count++;
+
+    *pp_result = mapped_block_at(p_heap, offset) + 1;
+
+    return ALLOK_SUCCESS;
+}
+
+AllokResult mapped_block_find(unsigned long long *p_result, const AkMappedHeap *p_heap, const void *ptr) {
+    const AllokByte *base = (const AllokByte *)p_heap->p_header;
+    if ((const AllokByte *)ptr < base + mapped_data_start() + sizeof(AkMappedBlock) || (const AllokByte *)ptr >= base + p_heap->p_header->top) {
+        return ALLOK_NOT_FOUND;
+    }
+
+    const unsigned long long offset = (unsigned long long)((const AllokByte *)ptr - base) - sizeof(AkMappedBlock);
+    const AkMappedBlock *block = mapped_block_at(p_heap, offset);
+    const unsigned long long size = mapped_block_size(block);
+    if (offset % ALLOK_DEFAULT_ALIGNMENT != 0 || mapped_block_is_free(block) == ALLOK_TRUE || mapped_block_is_pending(block) == ALLOK_TRUE || size < sizeof(AkMappedFreeLinks) || size > p_heap->p_header->top - offset - sizeof(AkMappedBlock)) {
+        return ALLOK_INVALID_ADDR;
+    }
+
+    // Bytes inside an allocation can look like a header, the boundary tags on both sides must agree with it as well
+    const unsigned long long next = mapped_block_next(p_heap, offset);
+    if (next < p_heap->p_header->top && mapped_block_at(p_heap, next)->prev_size != size) {
+        return ALLOK_INVALID_ADDR;
+    }
+    if (offset == mapped_data_start()) {
+        if (block->prev_size != 0) {
+            return ALLOK_INVALID_ADDR;
+        }
+    } else if (block->prev_size < sizeof(AkMappedFreeLinks) || block->prev_size > offset - mapped_data_start() - sizeof(AkMappedBlock) || mapped_block_next(p_heap, offset - sizeof(AkMappedBlock) - block->prev_size) != offset) {
+        return ALLOK_INVALID_ADDR;
+    }
+
+    *p_result = offset;
+
+    return ALLOK_SUCCESS;
+}
+
+void mapped_heap_free(AkMappedHeap *p_heap, unsigned long long offset) {
+    AkMappedHeapHeader *header = p_heap->p_header;
+    unsigned long long size = mapped_block_size(mapped_block_at(p_heap, offset));
+    header->alloc_size -= size;
+    header->block_count--;
+
+    // Free blocks are never adjacent, so at most one merge happens on each side
+    const unsigned long long next = mapped_block_next(p_heap, offset);
+    if (next < header->top && mapped_block_is_free(mapped_block_at(p_heap, next)) == ALLOK_TRUE) {
+        mapped_free_remove(p_heap, next);
+        size += sizeof(AkMappedBlock) + mapped_block_size(mapped_block_at(p_heap, next));
+    }
+
+    if (offset != mapped_data_start()) {
+        const unsigned long long prev = offset - sizeof(AkMappedBlock) - mapped_block_at(p_heap, offset)->prev_size;
+        if (mapped_block_is_free(mapped_block_at(p_heap, prev)) == ALLOK_TRUE) {
+            mapped_free_remove(p_heap, prev);
+            size += sizeof(AkMappedBlock) + mapped_block_size(mapped_block_at(p_heap, prev));
+            offset = prev;
+        }
+    }
+
+    AkMappedBlock *block = mapped_block_at(p_heap, offset);
+    const unsigned long long end = offset + sizeof(AkMappedBlock) + size;
+    if (end == header->top) {
+        // The last block goes back to the untouched space at the top
+        header->top = offset;
+        header->tail = offset != mapped_data_start() ? offset - sizeof(AkMappedBlock) - block->prev_size : 0;
+        return;
+    }
+
+    block->size = size | 1ULL;
+    mapped_block_at(p_heap, end)->prev_size = size;
+    mapped_free_push(p_heap, offset);
+}
+
+// Frees from any process land on one stack linked through the blocks' first bytes, so freeing never waits on the lock.
+// The block is claimed by setting its pending bit first, so a second free of it fails instead of pushing it twice
+AllokResult mapped_remote_push(AkMappedHeap *p_heap, const unsigned long long offset) {
+    AkMappedHeapHeader *header = p_heap->p_header;
+    AkMappedBlock *block = mapped_block_at(p_heap, offset);
+    const AllokSize size = (AllokSize)mapped_block_size(block);
+    AllokSize expected = size;
+    while (atomic_compare_exchange_size((volatile AllokSize *)&block->size, &expected, size | 2) == ALLOK_FALSE) {
+        if (expected != size) {
+            return ALLOK_INVALID_ADDR;
+        }
+    }
+
+    AkMappedFreeLinks *links = mapped_links_at(p_heap, offset);
+    AllokSize head = atomic_load_size(&header->remote_head);
+    do {
+        links->next = head;
+    } while (atomic_compare_exchange_size(&header->remote_head, &head, (AllokSize)offset) == ALLOK_FALSE);
+
+    return ALLOK_SUCCESS;
+}
+
+// Takes the whole stack at once and merges it back while holding the lock
+void mapped_remote_drain(AkMappedHeap *p_heap) {
+    AkMappedHeapHeader *header = p_heap->p_header;
+    if (atomic_load_size(&header->remote_head) == 0) {
+        return;
+    }
+
+    unsigned long long offset = atomic_exchange_size(&header->remote_head, 0);
+    while (offset != 0) {
+        // Freeing reuses the links, so the next entry is read first
+        const unsigned long long next = mapped_links_at(p_heap, offset)->next;
+        if (header->root == offset + sizeof(AkMappedBlock)) {
+            header->root = 0;
+        }
+        // The pending bit stays set until mapped_heap_free writes the free tag over it, so a racing free never sees
+        // the block live in between
+        mapped_heap_free(p_heap, offset);
+        header->remote_frees++;
+        offset = next;
+    }
+}
+
+// Walks the blocks in address order, then either rebuilds the free lists and counters from them or verifies them
+AllokResult mapped_heap_walk(AkMappedHeap *p_heap, const AllokBool rebuild) {
+    AkMappedHeapHeader *header = p_heap->p_header;
+    const unsigned long long start = mapped_data_start();
+    if (header->top < start || header->top > header->size || header->top % ALLOK_DEFAULT_ALIGNMENT != 0) {
+        return ALLOK_HEAP_CORRUPTED;
+    }
+
+    if (rebuild == ALLOK_TRUE) {
+        for (AllokSize i = 0; i < ALLOK_MAPPED_HEAP_CLASS_COUNT; i++) {
+            header->free_heads[i] = 0;
+        }
+    }
+
+    unsigned long long alloc_size = 0;
+    unsigned long long block_count = 0;
+    unsigned long long free_count = 0;
+    unsigned long long prev_size = 0;
+    unsigned long long last = 0;
+    AllokBool is_prev_free = ALLOK_FALSE;
+    for (unsigned long long offset = start; offset < header->top; offset = mapped_block_next(p_heap, offset)) {
+        const AkMappedBlock *block = mapped_block_at(p_heap, offset);
+        const unsigned long long size = mapped_block_size(block);
+        if (header->top - offset < sizeof(AkMappedBlock) || size < sizeof(AkMappedFreeLinks) || size % ALLOK_DEFAULT_ALIGNMENT != 0 || size > header->top - offset - sizeof(AkMappedBlock) || block->prev_size != prev_size) {
+            return ALLOK_HEAP_CORRUPTED;
+        }
+
+        if (mapped_block_is_free(block) == ALLOK_TRUE) {
+            if (is_prev_free == ALLOK_TRUE) {
+                return ALLOK_HEAP_CORRUPTED;
+            }
+            free_count++;
+            if (rebuild == ALLOK_TRUE) {
+                mapped_free_push(p_heap, offset);
+            }
+        } else {
+            alloc_size += size;
+            block_count++;
+        }
+
+        is_prev_free = mapped_block_is_free(block);
+        prev_size = size;
+        last = offset;
+    }
+
+    if (is_prev_free == ALLOK_TRUE || (header->root != 0 && (header->root < start + sizeof(AkMappedBlock) || header->root >= header->top))) {
+        return ALLOK_HEAP_CORRUPTED;
+    }
+
+    if (rebuild == ALLOK_TRUE) {
+        header->tail = last;
+        header->alloc_size = alloc_size;
+        header->block_count = block_count;
+        return ALLOK_SUCCESS;
+    }
+
+    if (header->tail != last || header->alloc_size != alloc_size || header->block_count != block_count) {
+        return ALLOK_HEAP_CORRUPTED;
+    }
+
+    // Bounded by the free blocks the walk found, so a cycle in a list can't loop forever
+    unsigned long long listed = 0;
+    for (AllokSize i = 0; i < ALLOK_MAPPED_HEAP_CLASS_COUNT; i++) {
+        unsigned long long prev = 0;
+        for (unsigned long long offset = header->free_heads[i]; offset != 0; offset = mapped_links_at(p_heap, offset)->next) {
+            if (offset < start || offset >= header->top || offset % ALLOK_DEFAULT_ALIGNMENT != 0 || ++listed > free_count) {
+                return ALLOK_HEAP_CORRUPTED;
+            }
+
+            const AkMappedBlock *block = mapped_block_at(p_heap, offset);
+            if (mapped_block_is_free(block) == ALLOK_FALSE || mapped_class_index(mapped_block_size(block)) != i || mapped_links_at(p_heap, offset)->prev != prev) {
+                return ALLOK_HEAP_CORRUPTED;
+            }
+            prev = offset;
+        }
+    }
+
+    return listed == free_count ? ALLOK_SUCCESS : ALLOK_HEAP_CORRUPTED;
+}
+
+// The lock word holds the owner's process id, so a waiter can tell when the owner died holding it and take over.
+// The owner may have been cut off mid update, so the free lists are rebuilt from the blocks first, and a heap the
+// walk rejects leaves the lock poisoned so every later call fails instead of working on the damage
+AllokResult mapped_lock(AkMappedHeap *p_heap) {
+    volatile long *state = &p_heap->p_header->lock.state;
+    const long pid = os_process_id();
+    int spins = 0;
+    while (ALLOK_TRUE) {
+        long owner = 0;
+        if (atomic_compare_exchange_long(state, &owner, pid) == ALLOK_TRUE) {
+            return ALLOK_SUCCESS;
+        }
+        if (owner == ALLOK_MAPPED_LOCK_POISONED) {
+            return ALLOK_HEAP_CORRUPTED;
+        }
+        if (owner == 0 || ++spins < ALLOK_SPIN_COUNT) {
+            continue;
+        }
+
+        spins = 0;
+        if (owner != pid && os_process_is_dead(owner) == ALLOK_TRUE && atomic_compare_exchange_long(state, &owner, pid) == ALLOK_TRUE) {
+            if (mapped_heap_walk(p_heap, ALLOK_TRUE) != ALLOK_SUCCESS) {
+                atomic_store_long(state, ALLOK_MAPPED_LOCK_POISONED);
+                return ALLOK_HEAP_CORRUPTED;
+            }
+            return ALLOK_SUCCESS;
+        }
+        os_thread_yield();
+    }
+}
+
+void mapped_unlock(AkMappedHeap *p_heap) {
+    atomic_store_long(&p_heap->p_header->lock.state, 0);
+}
+
+void mapped_heap_format(AkMappedHeap *p_heap) {
+    AkMappedHeapHeader *header = p_heap->p_header;
+    header->version = ALLOK_MAPPED_HEAP_VERSION;
+    header->is_clean = 0;
+    header->size = p_heap->size;
+    header->top = mapped_data_start();
+    header->tail = 0;
+    header->root = 0;
+    header->alloc_size = 0;
+    header->block_count = 0;
+    header->lock.state = 0;
+    header->remote_head = 0;
+    header->remote_frees = 0;
+    for (AllokSize i = 0; i < ALLOK_MAPPED_HEAP_CLASS_COUNT; i++) {
+        header->free_heads[i] = 0;
+    }
+
+    // The magic goes in last, a shared heap's other processes wait for it before touching anything else
+    atomic_fence();
+    *(volatile unsigned long long *)&header->magic = ALLOK_MAPPED_HEAP_MAGIC;
+}
+
+void mapped_heap_release(AkMappedHeap *p_heap) {
+    os_file_unmap(p_heap->p_header, p_heap->mapping, p_heap->size);
+    os_file_close(p_heap->file);
+    os_mem_free(p_heap, sizeof(AkMappedHeap));
+}
+
+AllokResult akMappedHeapOpenFile(AkMappedHeap **pp_result, const char *path, const AllokSize size) {
+    if (pp_result == ALLOK_NULL || path == ALLOK_NULL) {
+        return ALLOK_NULL_PARAM;
+    }
+
+    AkOsFile file;
+    if (os_file_open(&file, path) == ALLOK_FALSE) {
+        return ALLOK_OS_FILE_FAILED;
+    }
+    if (os_file_lock(file) == ALLOK_FALSE) {
+        os_file_close(file);
+        return ALLOK_OS_FILE_FAILED;
+    }
+
+    AllokSize file_size = os_file_size(file);
+    const AllokBool is_new = file_size == 0 ? ALLOK_TRUE : ALLOK_FALSE;
+    if (is_new == ALLOK_TRUE) {
+        file_size = align_up(size, ALLOK_OS_PAGE_SIZE);
+        if (file_size < mapped_data_start() + sizeof(AkMappedBlock) + sizeof(AkMappedFreeLinks)) {
+            os_file_close(file);
+            return ALLOK_INVALID_SIZE;
+        }
+        if (os_file_resize(file, file_size) == ALLOK_FALSE) {
+            os_file_close(file);
+            return ALLOK_OS_FILE_FAILED;
+        }
+    } else if (file_size < sizeof(AkMappedHeapHeader)) {
+        os_file_close(file);
+        return ALLOK_HEAP_CORRUPTED;
+    }
+
+    AkMappedHeap *heap = os_mem_alloc(sizeof(AkMappedHeap));
+    if (heap == ALLOK_NULL) {
+        os_file_close(file);
+        return ALLOK_OS_MEMORY_ALLOC_FAILED;
+    }
+    heap->size = file_size;
+    heap->file = file;
+    heap->is_shared = ALLOK_FALSE;
+    heap->p_header = os_file_map(file, &heap->mapping, file_size);
+    if (heap->p_header == ALLOK_NULL) {
+        os_file_close(file);
+        os_mem_free(heap, sizeof(AkMappedHeap));
+        return ALLOK_OS_FILE_FAILED;
+    }
+
+    AkMappedHeapHeader *header = heap->p_header;
+    if (is_new == ALLOK_TRUE) {
+        mapped_heap_format(heap);
+    } else {
+        if (header->magic != ALLOK_MAPPED_HEAP_MAGIC || header->version != ALLOK_MAPPED_HEAP_VERSION || header->size != file_size) {
+            mapped_heap_release(heap);
+            return ALLOK_HEAP_CORRUPTED;
+        }
 
-    return ALLOK_SUCCESS;
-}
+        // A file that was never closed may have been cut off mid update, its free lists are rebuilt from the blocks
+        if (header->is_clean == 0 && mapped_heap_walk(heap, ALLOK_TRUE) != ALLOK_SUCCESS) {
+            mapped_heap_release(heap);
+            return ALLOK_HEAP_CORRUPTED;
+        }
 
-AllokResult akMemoryArenaReset(AkMemoryArena *p_arena) {
-    if (p_arena == ALLOK_NULL) {
-        return ALLOK_NULL_PARAM;
+        // The file lock keeps every other opener out, so a spin lock still set was left behind by one that died holding it
+        header->lock.state = 0;
     }
 
-    p_arena->size = 0;
-    p_arena->p_current = p_arena->p_start;
+    header->is_clean = 0;
+    os_file_sync(heap->file, header, ALLOK_OS_PAGE_SIZE);
+
+    *pp_result = heap;
 
     return ALLOK_SUCCESS;
 }
 
-AllokResult akMemoryArenaFree(void **pp_target, AkMemoryArena *p_arena, const AllokSize size, const AllokBool auto_destroy) {
-    if (pp_target == ALLOK_NULL || p_arena == ALLOK_NULL) {
+AllokResult akMappedHeapOpenShared(AkMappedHeap **pp_result, const char *name, const AllokSize size) {
+    if (pp_result == ALLOK_NULL) {
         return ALLOK_NULL_PARAM;
     }
 
-    if (p_arena->alloc_size < size) {
+    AllokSize shared_size = align_up(size, ALLOK_OS_PAGE_SIZE);
+    const AllokSize min_size = mapped_data_start() + sizeof(AkMappedBlock) + sizeof(AkMappedFreeLinks);
+    if (name == ALLOK_NULL && shared_size < min_size) {
         return ALLOK_INVALID_SIZE;
     }
 
-    if (is_ptr_in_range(*pp_target, p_arena->p_start, p_arena->size) == ALLOK_FALSE) {
-        return ALLOK_INVALID_ADDR;
+    AkOsFile file;
+    AllokBool is_new;
+    if (os_shared_open(&file, name, &shared_size, &is_new) == ALLOK_FALSE) {
+        return ALLOK_OS_FILE_FAILED;
     }
 
-    if ((AllokByte *)p_arena->p_current == (AllokByte *)pp_target + size) {
-        p_arena->p_current = (AllokByte *)p_arena->p_current - size;
+    if (shared_size < min_size) {
+        os_file_close(file);
+        if (is_new == ALLOK_TRUE) {
+            os_shared_unlink(name);
+            return ALLOK_INVALID_SIZE;
+        }
+        return ALLOK_UNINITIALIZED;
     }
-    p_arena->size -= size;
 
-    if (p_arena->size <= 0) {
-        if (auto_destroy) {
-            if (p_arena->p_prev) {
-                p_arena->p_prev->p_next = p_arena->p_next;
-            }
+    AkMappedHeap *heap = os_mem_alloc(sizeof(AkMappedHeap));
+    if (heap == ALLOK_NULL) {
+        os_file_close(file);
+        return ALLOK_OS_MEMORY_ALLOC_FAILED;
+    }
+    heap->size = shared_size;
+    heap->file = file;
+    heap->is_shared = ALLOK_TRUE;
+    heap->p_header = os_shared_map(file, &heap->mapping, shared_size);
+    if (heap->p_header == ALLOK_NULL) {
+        os_file_close(file);
+        os_mem_free(heap, sizeof(AkMappedHeap));
+        return ALLOK_OS_FILE_FAILED;
+    }
 
-            if (p_arena->p_next) {
-                p_arena->p_next->p_prev = p_arena->p_prev;
-            }
+    AkMappedHeapHeader *header = heap->p_header;
+    if (is_new == ALLOK_TRUE) {
+        mapped_heap_format(heap);
+    } else {
+        // Other processes may be allocating already, so the lock and lists are left as they are
+        AllokSize spins = 0;
+        while (*(volatile unsigned long long *)&header->magic != ALLOK_MAPPED_HEAP_MAGIC && spins++ < ALLOK_SPIN_COUNT * ALLOK_SPIN_COUNT) {
+            os_thread_yield();
+        }
+        atomic_fence();
 
-            akMemoryArenaDestroy(&p_arena, ALLOK_FALSE);
-        } else {
-            p_arena->p_current = p_arena->p_start;
+        if (header->magic != ALLOK_MAPPED_HEAP_MAGIC) {
+            mapped_heap_release(heap);
+            return ALLOK_UNINITIALIZED;
+        }
+        if (header->version != ALLOK_MAPPED_HEAP_VERSION || header->size != shared_size) {
+            mapped_heap_release(heap);
+            return ALLOK_HEAP_CORRUPTED;
         }
     }
 
-    *pp_target = ALLOK_NULL;
+    *pp_result = heap;
 
     return ALLOK_SUCCESS;
-
 }
 
-void akMemoryArenaDestroy(AkMemoryArena **pp_arena, const AllokBool recursive) {
-    if (pp_arena == ALLOK_NULL) {
-        return;
+AllokResult akMappedHeapUnlinkShared(const char *name) {
+    if (name == ALLOK_NULL) {
+        return ALLOK_NULL_PARAM;
     }
 
-    AkMemoryArena *arena = *pp_arena;
-    if (arena == ALLOK_NULL) {
-        return;
-    }
+    return os_shared_unlink(name) == ALLOK_TRUE ? ALLOK_SUCCESS : ALLOK_OS_FILE_FAILED;
+}
 
-    AkMemoryArena *next = arena->p_next;
-    AkMemoryArena *prev = arena->p_prev;
-    if (prev != ALLOK_NULL) {
-        prev->p_next = next;
-    }
-    if (next != ALLOK_NULL) {
-        next->p_prev = prev;
+AllokResult akMappedHeapClose(AkMappedHeap **pp_heap) {
+    if (pp_heap == ALLOK_NULL || *pp_heap == ALLOK_NULL) {
+        return ALLOK_NULL_PARAM;
     }
 
-    os_mem_free(arena, arena->alloc_size + sizeof(AkMemoryArena));
+    AkMappedHeap *heap = *pp_heap;
+    AkMappedHeapHeader *header = heap->p_header;
 
-    if (recursive) {
-        akMemoryArenaDestroy(&next, recursive);
+    if (heap->is_shared == ALLOK_TRUE) {
+        mapped_heap_release(heap);
+        *pp_heap = ALLOK_NULL;
+        return ALLOK_SUCCESS;
     }
 
-    *pp_arena = ALLOK_NULL;
+    // The data reaches the file before the flag that vouches for it
+    mapped_lock(heap);
+    AllokBool is_synced = os_file_sync(heap->file, header, heap->size);
+    header->is_clean = 1;
+    is_synced = is_synced == ALLOK_TRUE && os_file_sync(heap->file, header, ALLOK_OS_PAGE_SIZE) == ALLOK_TRUE ? ALLOK_TRUE : ALLOK_FALSE;
+    mapped_unlock(heap);
+
+    mapped_heap_release(heap);
+    *pp_heap = ALLOK_NULL;
+
+    return is_synced == ALLOK_TRUE ? ALLOK_SUCCESS : ALLOK_OS_FILE_FAILED;
 }
 
-AllokResult akMemoryBlockCreate(AkMemoryBlock **pp_result, AkMemoryPool *p_pool, const AllokSize size, const AllokSize offset) {
-    if (pp_result == ALLOK_NULL || p_pool == ALLOK_NULL) {
+AllokResult akMappedHeapAlloc(void **pp_result, AkMappedHeap *p_heap, const AllokSize size) {
+    if (pp_result == ALLOK_NULL || p_heap == ALLOK_NULL) {
         return ALLOK_NULL_PARAM;
     }
 
-    AllokByte *block_start = (AllokByte *)p_pool->p_start + offset;
-
-    if (offset + size + sizeof(AkMemoryBlock) > p_pool->alloc_size) {
-        return ALLOK_INSUFFICIENT_POOL_MEMORY;
+    AllokResult result = mapped_lock(p_heap);
+    if (result != ALLOK_SUCCESS) {
+        return result;
     }
+    mapped_remote_drain(p_heap);
+    result = mapped_heap_alloc(pp_result, p_heap, size);
+    mapped_unlock(p_heap);
 
-    AkMemoryBlock *block = (AkMemoryBlock *)block_start;
-    block->size = size;
-    block->p_start = (char *)block + sizeof(AkMemoryBlock);
-    block->p_parent = p_pool;
-
-    AkMemoryBlock *current = p_pool->p_head;
-    AkMemoryBlock *prev = ALLOK_NULL;
+    return result;
+}
 
-    while (current != ALLOK_NULL && (AllokByte *)current < (AllokByte *)block) {
-        prev = current;
-        current = current->p_next;
+AllokResult akMappedHeapFree(void **pp_target, AkMappedHeap *p_heap) {
+    if (pp_target == ALLOK_NULL || *pp_target == ALLOK_NULL || p_heap == ALLOK_NULL) {
+        return ALLOK_NULL_PARAM;
     }
 
-    if (prev == ALLOK_NULL) {
-        block->p_next = p_pool->p_head;
-        if (p_pool->p_head != ALLOK_NULL) {
-            p_pool->p_head->p_prev = block;
+    if (p_heap->is_shared == ALLOK_TRUE) {
+        // A live block's own header and the next block's tag hold still without the lock, but a neighbour being split
+        // or merged under it can fail the other tag for a moment, so a failed lookup is settled under the lock
+        unsigned long long offset;
+        AllokResult result = mapped_block_find(&offset, p_heap, *pp_target);
+        if (result != ALLOK_SUCCESS && (result = mapped_lock(p_heap)) == ALLOK_SUCCESS) {
+            result = mapped_block_find(&offset, p_heap, *pp_target);
+            mapped_unlock(p_heap);
         }
-        p_pool->p_head = block;
-
-        if (p_pool->p_tail == ALLOK_NULL) {
-            p_pool->p_tail = block;
+        if (result == ALLOK_SUCCESS) {
+            result = mapped_remote_push(p_heap, offset);
         }
-    } else {
-        block->p_prev = prev;
-        block->p_next = prev->p_next;
-
-        if (prev->p_next != ALLOK_NULL) {
-            prev->p_next->p_prev = block;
-        } else {
-            p_pool->p_tail = block;
+        if (result == ALLOK_SUCCESS) {
+            *pp_target = ALLOK_NULL;
         }
-
-        prev->p_next = block;
+        return result;
     }
 
-    p_pool->size += size + sizeof(AkMemoryBlock);
-    if (p_pool->p_parent_map != ALLOK_NULL) {
-        p_pool->p_parent_map->metadata.blocks_created++;
+    AllokResult result = mapped_lock(p_heap);
+    if (result != ALLOK_SUCCESS) {
+        return result;
     }
+    unsigned long long offset;
+    result = mapped_block_find(&offset, p_heap, *pp_target);
+    if (result == ALLOK_SUCCESS) {
+        if (p_heap->p_header->root == offset + sizeof(AkMappedBlock)) {
+            p_heap->p_header->root = 0;
+        }
+        mapped_heap_free(p_heap, offset);
+    }
+    mapped_unlock(p_heap);
 
-    *pp_result = block;
+    if (result == ALLOK_SUCCESS) {
+        *pp_target = ALLOK_NULL;
+    }
 
-    return ALLOK_SUCCESS;
+    return result;
 }
 
-AllokResult akMemoryBlockFind(AkMemoryBlock **pp_result, const AkMemoryMap *p_map, const void *ptr) {
-    if (p_map == ALLOK_NULL || ptr == ALLOK_NULL) {
+AllokResult akMappedHeapAllocOffset(AllokSize *p_result, AkMappedHeap *p_heap, const AllokSize size) {
+    if (p_result == ALLOK_NULL || p_heap == ALLOK_NULL) {
         return ALLOK_NULL_PARAM;
     }
 
-    const AkMemoryPool *pool = p_map->p_pool_head;
-    while (pool != ALLOK_NULL) {
-        if (is_ptr_in_range(ptr, pool->p_start, pool->alloc_size)) {
-            AkMemoryBlock *block = pool->p_head;
-            while (block != ALLOK_NULL) {
-                if ((AllokByte *)block->p_start == (AllokByte *)ptr) {
-                    *pp_result = block;
-                    return ALLOK_SUCCESS;
-                }
-                block = block->p_next;
-            }
-        }
-        pool = pool->p_next;
+    void *ptr;
+    const AllokResult result = akMappedHeapAlloc(&ptr, p_heap, size);
+    if (result == ALLOK_SUCCESS) {
+        *p_result = (AllokSize)((AllokByte *)ptr - (AllokByte *)p_heap->p_header);
     }
 
-    return ALLOK_NOT_FOUND;
+    return result;
 }
 
-void akMemoryBlockFree(AkMemoryBlock **pp_block) {
-    if (pp_block == ALLOK_NULL) {
-        return;
+AllokResult akMappedHeapFreeOffset(AkMappedHeap *p_heap, const AllokSize offset) {
+    if (p_heap == ALLOK_NULL) {
+        return ALLOK_NULL_PARAM;
     }
 
-    const AkMemoryBlock *block = *pp_block;
-    if (block == ALLOK_NULL) {
-        return;
+    void *ptr;
+    const AllokResult result = akMappedHeapFromOffset(&ptr, p_heap, offset);
+    if (result != ALLOK_SUCCESS) {
+        return result;
     }
 
-    AkMemoryPool *pool = block->p_parent;
-    AkMemoryBlock *prev = block->p_prev;
-    AkMemoryBlock *next = block->p_next;
+    return akMappedHeapFree(&ptr, p_heap);
+}
 
-    if (prev == ALLOK_NULL) {
-        pool->p_head = next;
-    } else {
-        prev->p_next = next;
+AllokResult akMappedHeapSetRoot(AkMappedHeap *p_heap, void *ptr) {
+    if (p_heap == ALLOK_NULL) {
+        return ALLOK_NULL_PARAM;
     }
 
-    if (next == ALLOK_NULL) {
-        pool->p_tail = prev;
-    } else {
-        next->p_prev = prev;
+    AllokResult result = mapped_lock(p_heap);
+    if (result != ALLOK_SUCCESS) {
+        return result;
     }
-
-    pool->size -= block->size + sizeof(AkMemoryBlock);
-    if (pool->p_parent_map != ALLOK_NULL) {
-        pool->p_parent_map->metadata.blocks_freed++;
+    unsigned long long offset = 0;
+    result = ptr == ALLOK_NULL ? ALLOK_SUCCESS : mapped_block_find(&offset, p_heap, ptr);
+    if (result == ALLOK_SUCCESS) {
+        p_heap->p_header->root = ptr == ALLOK_NULL ? 0 : offset + sizeof(AkMappedBlock);
     }
+    mapped_unlock(p_heap);
 
-    *pp_block = ALLOK_NULL;
+    return result;
+}
 
-    if (pool->size <= 0) {
-        akMemoryPoolFree(&pool, ALLOK_FALSE);
+AllokResult akMappedHeapGetRoot(void **pp_result, AkMappedHeap *p_heap) {
+    if (pp_result == ALLOK_NULL || p_heap == ALLOK_NULL) {
+        return ALLOK_NULL_PARAM;
     }
+
+    const unsigned long long root = p_heap->p_header->root;
+    if (root == 0) {
+        return ALLOK_NOT_FOUND;
+    }
+
+    *pp_result = (AllokByte *)p_heap->p_header + root;
+
+    return ALLOK_SUCCESS;
 }
 
-AllokResult akMemoryPoolAlloc(AkMemoryPool **pp_result, AkMemoryMap *p_map, const AllokSize size) {
-    if (pp_result == ALLOK_NULL) {
+AllokResult akMappedHeapToOffset(AllokSize *p_result, const AkMappedHeap *p_heap, const void *ptr) {
+    if (p_result == ALLOK_NULL || p_heap == ALLOK_NULL) {
         return ALLOK_NULL_PARAM;
     }
 
-    AllokSize alloc_size = size + sizeof(AkMemoryPool);
-
-    AkMemoryPool *pool = os_mem_alloc(alloc_size);
-    if (pool == ALLOK_NULL) {
-        return ALLOK_OS_MEMORY_ALLOC_FAILED;
+    if (is_ptr_in_range(ptr, p_heap->p_header, p_heap->size) == ALLOK_FALSE) {
+        return ALLOK_INVALID_ADDR;
     }
 
-    pool->alloc_size = size;
-    pool->size = 0;
-    pool->p_start = (AllokByte *)pool + sizeof(AkMemoryPool);
-    pool->p_next = ALLOK_NULL;
-    pool->p_parent_map = p_map;
-    pool->p_head = ALLOK_NULL;
-    pool->p_tail = ALLOK_NULL;
+    *p_result = (AllokSize)((const AllokByte *)ptr - (const AllokByte *)p_heap->p_header);
 
-    if (p_map != ALLOK_NULL) {
-        if (p_map->p_pool_tail != ALLOK_NULL) {
-            p_map->p_pool_tail->p_next = pool;
-            pool->p_prev = p_map->p_pool_tail;
-        } else {
-            pool->p_prev = ALLOK_NULL;
-            p_map->p_pool_head = pool;
-        }
-        p_map->p_pool_tail = pool;
-        p_map->pool_count++;
-        p_map->metadata.pools_created++;
-    } else {
-        pool->p_prev = ALLOK_NULL;
+    return ALLOK_SUCCESS;
+}
+
+AllokResult akMappedHeapFromOffset(void **pp_result, const AkMappedHeap *p_heap, const AllokSize offset) {
+    if (pp_result == ALLOK_NULL || p_heap == ALLOK_NULL) {
+        return ALLOK_NULL_PARAM;
     }
 
-    *pp_result = pool;
+    if (offset >= p_heap->size) {
+        return ALLOK_INVALID_ADDR;
+    }
+
+    *pp_result = (AllokByte *)p_heap->p_header + offset;
 
     return ALLOK_SUCCESS;
 }
 
-AllokResult akMemoryPoolFree(AkMemoryPool **pp_pool, const AllokBool recursive) {
-    if (pp_pool == ALLOK_NULL) {
+AllokResult akMappedHeapCheck(AkMappedHeap *p_heap) {
+    if (p_heap == ALLOK_NULL) {
         return ALLOK_NULL_PARAM;
     }
 
-    AkMemoryPool *pool = *pp_pool;
-    if (pool == ALLOK_NULL) {
-        return ALLOK_NULL_PARAM;
+    AllokResult result = mapped_lock(p_heap);
+    if (result != ALLOK_SUCCESS) {
+        return result;
     }
+    mapped_remote_drain(p_heap);
+    result = mapped_heap_walk(p_heap, ALLOK_FALSE);
+    mapped_unlock(p_heap);
 
-    if (recursive) {
-        akMemoryPoolFree(&pool->p_next, recursive);
+    return result;
+}
+
+AllokResult akMappedHeapSync(AkMappedHeap *p_heap) {
+    if (p_heap == ALLOK_NULL) {
+        return ALLOK_NULL_PARAM;
     }
 
-    AkMemoryPool *prev = pool->p_prev;
-    AkMemoryPool *next = pool->p_next;
-    AkMemoryMap *map = pool->p_parent_map;
+    return os_file_sync(p_heap->file, p_heap->p_header, p_heap->size) == ALLOK_TRUE ? ALLOK_SUCCESS : ALLOK_OS_FILE_FAILED;
+}
 
-    if (prev != ALLOK_NULL) {
-        prev->p_next = next;
-    } else if (map != ALLOK_NULL) {
-        map->p_pool_head = next;
+// Events go into p_events while the other half of p_buffer is either p_spare, p_full waiting to be written, or being
+// written. Writes only hold write_lock, so appending threads never wait on the file unless both halves are full
+typedef struct AkTraceState {
+    volatile long is_enabled;
+    AkSpinLock lock;
+    AkSpinLock write_lock;
+    AkOsFile file;
+    AllokBool is_failed;
+    unsigned long long start_ns;
+    AkTraceEvent *p_buffer;
+    AkTraceEvent *p_events;
+    AkTraceEvent *p_spare;
+    AkTraceEvent *p_full;
+    AllokSize capacity;
+    AllokSize count;
+    AllokSize full_count;
+} AkTraceState;
+
+static AkTraceState g_trace;
+static volatile long g_trace_thread_count;
+static ALLOK_THREAD_LOCAL unsigned int t_trace_thread;
+
+static inline AllokBool trace_is_enabled() {
+    return atomic_load_long(&g_trace.is_enabled) != 0 ? ALLOK_TRUE : ALLOK_FALSE;
+}
+
+static inline void trace_swap() {
+    g_trace.p_full = g_trace.p_events;
+    g_trace.full_count = g_trace.count;
+    g_trace.p_events = g_trace.p_spare;
+    g_trace.p_spare = ALLOK_NULL;
+    g_trace.count = 0;
+}
+
+// Writes the full buffer, and with is_forced the events appended since as well. The caller holds write_lock, which
+// keeps the halves written in the order they were filled
+void trace_write_locked(const AllokBool is_forced) {
+    AllokBool is_swap_due = is_forced;
+    for (;;) {
+        spin_lock(&g_trace.lock);
+        // Nothing is being written and p_full is empty, so the other half is the spare
+        if (g_trace.p_full == ALLOK_NULL && is_swap_due == ALLOK_TRUE && g_trace.p_events != ALLOK_NULL && g_trace.count > 0) {
+            trace_swap();
+        }
+        is_swap_due = ALLOK_FALSE;
+        AkTraceEvent *events = g_trace.p_full;
+        const AllokSize count = g_trace.full_count;
+        g_trace.p_full = ALLOK_NULL;
+        spin_unlock(&g_trace.lock);
+
+        if (events == ALLOK_NULL) {
+            return;
+        }
+
+        if (os_file_write(g_trace.file, events, count * sizeof(AkTraceEvent)) == ALLOK_FALSE) {
+            g_trace.is_failed = ALLOK_TRUE;
+        }
+
+        spin_lock(&g_trace.lock);
+        g_trace.p_spare = events;
+        spin_unlock(&g_trace.lock);
     }
-    if (next != ALLOK_NULL) {
-        next->p_prev = prev;
-    } else if (map != ALLOK_NULL) {
-        map->p_pool_tail = prev;
+}
+
+void trace_write(const AllokBool is_forced) {
+    spin_lock(&g_trace.write_lock);
+    trace_write_locked(is_forced);
+    spin_unlock(&g_trace.write_lock);
+}
+
+// Returns ALLOK_TRUE when this event filled a buffer, the caller then writes it with trace_write once it holds no
+// other lock
+AllokBool trace_append(const AllokTraceOp op, const void *ptr, const void *p_src, const AllokSize size, const AllokSize alignment) {
+    if (t_trace_thread == 0) {
+        t_trace_thread = (unsigned int)atomic_fetch_add_long(&g_trace_thread_count, 1) + 1;
     }
 
-    if (map != ALLOK_NULL) {
-        map->pool_count--;
-        map->metadata.pools_freed++;
+    unsigned short alignment_shift = 0;
+    while (((AllokSize)1 << alignment_shift) < alignment) {
+        alignment_shift++;
     }
 
-    os_mem_free(pool, pool->alloc_size + sizeof(AkMemoryPool));
+    const unsigned long long now = os_clock_ns();
 
-    *pp_pool = ALLOK_NULL;
+    spin_lock(&g_trace.lock);
+    // Both halves full means the writes fell behind, only then does an appending thread help write
+    while (g_trace.p_events != ALLOK_NULL && g_trace.count == g_trace.capacity && g_trace.p_spare == ALLOK_NULL) {
+        spin_unlock(&g_trace.lock);
+        trace_write(ALLOK_FALSE);
+        spin_lock(&g_trace.lock);
+    }
 
-    return ALLOK_SUCCESS;
+    // Re-checked under the lock since akTraceStop may have released the buffer
+    AllokBool is_full = ALLOK_FALSE;
+    if (g_trace.p_events != ALLOK_NULL) {
+        if (g_trace.count == g_trace.capacity) {
+            trace_swap();
+        }
+        g_trace.p_events[g_trace.count++] = (AkTraceEvent){now > g_trace.start_ns ? now - g_trace.start_ns : 0, (unsigned long long)(AllokSize)ptr, (unsigned long long)(AllokSize)p_src, size, t_trace_thread, (unsigned short)op, alignment_shift};
+        is_full = g_trace.p_full != ALLOK_NULL ? ALLOK_TRUE : ALLOK_FALSE;
+    }
+    spin_unlock(&g_trace.lock);
+
+    return is_full;
 }
 
-AllokResult akMemoryMapAlloc(AkMemoryMap **pp_map_result, AkMemoryArena **pp_arena_result, const AllokSize init_pool_count, const AllokSize init_pool_size, const AkMemoryMapParams params) {
-    if (pp_map_result == ALLOK_NULL) {
-        return ALLOK_NULL_PARAM;
+static inline void trace_record(const AllokTraceOp op, const void *ptr, const void *p_src, const AllokSize size, const AllokSize alignment) {
+    if (trace_is_enabled() == ALLOK_TRUE && trace_append(op, ptr, p_src, size, alignment) == ALLOK_TRUE) {
+        trace_write(ALLOK_FALSE);
     }
+}
 
-    AllokSize map_alloc_size = sizeof(AkMemoryMap);
-
-    AkMemoryArena *arena;
-    AllokResult result = akMemoryArenaAlloc(&arena, map_alloc_size);
-    if (result != ALLOK_SUCCESS) {
-        return result;
+AllokResult akInit(const AllokSize init_pool_count, const AllokSize init_pool_size, const AkMemoryMapParams params) {
+    if (g_map != ALLOK_NULL) {
+        akDump();
     }
 
+    mem_kernel_resolve();
+
     AkMemoryMap *map;
-    result = akMemoryArenaClaim(VPTR(map), arena, map_alloc_size);
+    AllokResult result = akMemoryMapAlloc(&map, &g_map_arena, init_pool_count, init_pool_size, params);
     if (result != ALLOK_SUCCESS) {
         return result;
     }
 
-    map->pool_count = 1;
-    map->p_pool_head = ALLOK_NULL;
-    map->p_pool_tail = ALLOK_NULL;
-    map->p_start = (AllokByte *)map + sizeof(AkMemoryMap);
-    map->metadata = (AkMemoryMapMetadata){};
-    map->params.type = params.type;
-    map->params.is_dynamic = params.is_dynamic;
-
-    for (AllokSize i = 0; i < init_pool_count; i++) {
-        AkMemoryPool *pool;
-        result = akMemoryPoolAlloc(&pool, map, init_pool_size);
+    if (params.is_thread_safe == ALLOK_TRUE && params.is_per_cpu == ALLOK_TRUE) {
+        result = cpu_caches_create(map);
         if (result != ALLOK_SUCCESS) {
-            break;
+            akMemoryMapDestroy(&map, &g_map_arena);
+            return result;
         }
     }
 
-    if (result != ALLOK_SUCCESS) {
-        akMemoryArenaDestroy(&arena, ALLOK_FALSE);
-        akMemoryPoolFree(&map->p_pool_head, ALLOK_TRUE);
-        return result;
+    atomic_store_long(&g_map_generation, g_map_generation + 1);
+    atomic_store_ptr((void *volatile *)&g_map, map);
+
+    return ALLOK_SUCCESS;
+}
+
+AllokResult global_map_acquire(AkMemoryMap **pp_result) {
+    AkMemoryMap *map = global_map();
+    if (map == ALLOK_NULL) {
+        spin_lock(&g_init_lock);
+        AllokResult result = ALLOK_SUCCESS;
+        if (g_map == ALLOK_NULL) {
+            result = akInit(ALLOK_DEFAULT_POOL_COUNT, ALLOK_DEFAULT_POOL_SIZE, (AkMemoryMapParams){ALLOK_DEFAULT_ALLOC_TYPE, ALLOK_DEFAULT_ALLOC_DYNAMIC, ALLOK_DEFAULT_ALLOC_SLAB, ALLOK_DEFAULT_ALLOC_THREAD_SAFE, ALLOK_DEFAULT_ALLOC_REALLOC_HEADROOM, ALLOK_DEFAULT_LARGE_THRESHOLD, ALLOK_DEFAULT_HUGE_PAGES, ALLOK_DEFAULT_POOL_CACHE_SIZE, ALLOK_DEFAULT_POOL_CACHE_DECAY, ALLOK_DEFAULT_ALLOC_PER_CPU});
+        }
+        spin_unlock(&g_init_lock);
+        if (result != ALLOK_SUCCESS) {
+            return result;
+        }
+        map = global_map();
     }
 
-    *pp_arena_result = arena;
-    *pp_map_result = map;
+    *pp_result = map;
 
     return ALLOK_SUCCESS;
 }
 
-AllokBool alloc_first_fit(const AkMemoryPool *p_pool, const AllokSize size, AllokSize *p_offset_result) {
-    if (p_pool == ALLOK_NULL) {
-        return ALLOK_FALSE;
+AllokResult akAlloc(void **pp_result, const AllokSize size) {
+    return akAllocAligned(pp_result, size, ALLOK_DEFAULT_ALIGNMENT);
+}
+
+AllokResult alloc_aligned(void **pp_result, const AllokSize size, AllokSize alignment) {
+    if (is_valid_alignment(alignment) == ALLOK_FALSE) {
+        return ALLOK_INVALID_ALIGNMENT;
     }
+    alignment = max_size(alignment, ALLOK_DEFAULT_ALIGNMENT);
 
-    const AllokSize alloc_size = sizeof(AkMemoryBlock) + size;
+    AkMemoryMap *map;
+    AllokResult result = global_map_acquire(&map);
+    if (result != ALLOK_SUCCESS) {
+        return result;
+    }
+
+    if (map->params.is_thread_safe == ALLOK_TRUE && size <= ALLOK_SLAB_MAX_SIZE && alignment <= ALLOK_SLAB_GRANULARITY && map->params.is_slab_enabled == ALLOK_TRUE) {
+        if (front_cache_alloc(pp_result, map, size) == ALLOK_SUCCESS) {
+            return ALLOK_SUCCESS;
+        }
+    }
+
+    map_lock(map);
+    result = heap_alloc(pp_result, map, size, alignment);
+    if (result != ALLOK_SUCCESS) {
+        map->metadata.allocs_failed++;
+    }
+    map_unlock(map);
 
-    AkMemoryBlock *head = p_pool->p_head;
-    const AkMemoryBlock *tail = p_pool->p_tail;
+    return result;
+}
 
-    if (head == ALLOK_NULL) {
-        *p_offset_result = 0;
-        return p_pool->alloc_size >= alloc_size ? ALLOK_TRUE : ALLOK_FALSE;
+AllokResult akAllocAligned(void **pp_result, const AllokSize size, AllokSize alignment) {
+    const AllokResult result = alloc_aligned(pp_result, size, alignment);
+    if (result == ALLOK_SUCCESS) {
+        trace_record(ALLOK_TRACE_ALLOC, *pp_result, ALLOK_NULL, size, max_size(alignment, ALLOK_DEFAULT_ALIGNMENT));
     }
 
-    AllokSize frag_size = 0;
-    if (get_ptr_fragment(p_pool->p_start, 0, (AllokByte *)head, &frag_size) == ALLOK_SUCCESS) {
-        if (frag_size >= alloc_size) {
-            *p_offset_result = 0;
-            return ALLOK_TRUE;
-        }
+    return result;
+}
+
+AllokResult akAllocBatch(void **pp_results, const AllokSize count, const AllokSize size) {
+    if (pp_results == ALLOK_NULL) {
+        return ALLOK_NULL_PARAM;
     }
 
-    AkMemoryBlock *prev = head;
-    AkMemoryBlock *curr = head->p_next;
+    AkMemoryMap *map;
+    AllokResult result = global_map_acquire(&map);
+    if (result != ALLOK_SUCCESS) {
+        return result;
+    }
 
-    while (curr != ALLOK_NULL) {
-        if (get_ptr_fragment(prev->p_start, prev->size, (AllokByte *)curr, &frag_size) != ALLOK_SUCCESS) {
-            continue;
+    // Small objects come from the thread cache without the lock, the lock is only taken for what it can't serve
+    AllokSize cached = 0;
+    if (map->params.is_thread_safe == ALLOK_TRUE && size <= ALLOK_SLAB_MAX_SIZE && map->params.is_slab_enabled == ALLOK_TRUE) {
+        while (cached < count && front_cache_alloc(&pp_results[cached], map, size) == ALLOK_SUCCESS) {
+            cached++;
         }
-        if (frag_size >= alloc_size) {
-            *p_offset_result = (AllokSize)((AllokByte *)prev->p_start + prev->size - (AllokByte *)p_pool->p_start);
-            return ALLOK_TRUE;
+    }
+    if (cached < count) {
+        map_lock(map);
+        result = heap_alloc_batch(&pp_results[cached], map, count - cached, size);
+        if (result != ALLOK_SUCCESS) {
+            heap_free_batch(pp_results, map, cached);
+            map->metadata.allocs_failed++;
         }
-        prev = curr;
-        curr = curr->p_next;
+        map_unlock(map);
     }
 
-    if (get_ptr_fragment(tail->p_start, tail->size, (AllokByte *)p_pool->p_start + p_pool->alloc_size, &frag_size) == ALLOK_SUCCESS) {
-        if (frag_size >= alloc_size) {
-            *p_offset_result = (AllokSize)((AllokByte *)tail->p_start + tail->size - (AllokByte *)p_pool->p_start);
-            return ALLOK_TRUE;
+    if (result == ALLOK_SUCCESS && trace_is_enabled() == ALLOK_TRUE) {
+        for (AllokSize i = 0; i < count; i++) {
+            trace_record(ALLOK_TRACE_ALLOC, pp_results[i], ALLOK_NULL, size, ALLOK_DEFAULT_ALIGNMENT);
         }
     }
 
-    return ALLOK_FALSE;
-
+    return result;
 }
 
-AllokBool alloc_best_fit(const AkMemoryPool *p_pool, const AllokSize size, AllokSize *p_offset_result) {
-    if (p_pool == ALLOK_NULL) {
-        return ALLOK_FALSE;
+AllokResult akRealloc(void **pp_result, void *p_src, const AllokSize size) {
+    AkMemoryMap *map = global_map();
+    if (map == ALLOK_NULL || p_src == ALLOK_NULL) {
+        return ALLOK_NULL_PARAM;
     }
 
-    const AllokSize alloc_size = sizeof(AkMemoryBlock) + size;
-
-    AkMemoryBlock *head = p_pool->p_head;
-    const AkMemoryBlock *tail = p_pool->p_tail;
+    AllokBool is_trace_full = ALLOK_FALSE;
+    map_lock(map);
+    const AllokResult result = heap_realloc(pp_result, map, p_src, size);
+    if (result != ALLOK_SUCCESS) {
+        map->metadata.allocs_failed++;
+    } else if (trace_is_enabled() == ALLOK_TRUE) {
+        // Recorded under the lock, before another thread can be handed the address p_src had, but written after it
+        is_trace_full = trace_append(ALLOK_TRACE_REALLOC, *pp_result, p_src, size, ALLOK_DEFAULT_ALIGNMENT);
+    }
+    map_unlock(map);
 
-    if (head == ALLOK_NULL) {
-        *p_offset_result = 0;
-        return p_pool->alloc_size >= alloc_size ? ALLOK_TRUE : ALLOK_FALSE;
+    if (is_trace_full == ALLOK_TRUE) {
+        trace_write(ALLOK_FALSE);
     }
 
-    AllokSize best_size = p_pool->alloc_size;
-    AllokSize best_fit_offset = 0;
+    return result;
+}
 
-    AllokSize frag_size = 0;
-    if (get_ptr_fragment(p_pool->p_start, 0, (AllokByte *)head, &frag_size) == ALLOK_SUCCESS) {
-        if (frag_size >= alloc_size) {
-            best_size = frag_size;
-            best_fit_offset = 0;
-        }
-    }
+AllokResult akCalloc(void **pp_result, const AllokSize size) {
+    return akCallocAligned(pp_result, size, ALLOK_DEFAULT_ALIGNMENT);
+}
 
+AllokResult akCallocAligned(void **pp_result, const AllokSize size, const AllokSize alignment) {
+    const AllokResult result = alloc_aligned(pp_result, size, alignment);
+    if (result != ALLOK_SUCCESS) {
+        return result;
+    }
+    trace_record(ALLOK_TRACE_CALLOC, *pp_result, ALLOK_NULL, size, max_size(alignment, ALLOK_DEFAULT_ALIGNMENT));
 
-    AllokBool block_found = ALLOK_FALSE;
-    AkMemoryBlock *prev = head;
-    AkMemoryBlock *curr = head->p_next;
+    return akMemset(pp_result, 0, size);
+}
 
-    while (curr != ALLOK_NULL) {
-        if (get_ptr_fragment(prev->p_start, prev->size, (AllokByte *)curr, &frag_size) != ALLOK_SUCCESS) {
-            continue;
-        }
-        if (frag_size >= alloc_size && frag_size < best_size) {
-            best_size = frag_size;
-            best_fit_offset = (AllokSize)((AllokByte *)prev->p_start + prev->size - (AllokByte *)p_pool->p_start);
-            block_found = ALLOK_TRUE;
-        }
-        prev = curr;
-        curr = curr->p_next;
+AllokResult akHandleAlloc(AkHandle **pp_result, const AllokSize size) {
+    if (pp_result == ALLOK_NULL) {
+        return ALLOK_NULL_PARAM;
     }
 
-    if (get_ptr_fragment(tail->p_start, tail->size, (AllokByte *)p_pool->p_start + p_pool->alloc_size, &frag_size) == ALLOK_SUCCESS) {
-        if (frag_size >= alloc_size && frag_size < best_size) {
-            *p_offset_result = (AllokSize)((AllokByte *)tail->p_start + tail->size - (AllokByte *)p_pool->p_start);
-            return ALLOK_TRUE;
-        }
+    AkMemoryMap *map;
+    AllokResult result = global_map_acquire(&map);
+    if (result != ALLOK_SUCCESS) {
+        return result;
     }
 
-    if (block_found == ALLOK_TRUE) {
-        *p_offset_result = best_fit_offset;
-        return ALLOK_TRUE;
+    map_lock(map);
+    result = handle_alloc(pp_result, map, size);
+    if (result != ALLOK_SUCCESS) {
+        map->metadata.allocs_failed++;
     }
+    map_unlock(map);
 
-    return ALLOK_FALSE;
+    return result;
 }
 
-AllokBool alloc_worst_fit(const AkMemoryPool *p_pool, const AllokSize size, AllokSize *p_offset_result) {
-    if (p_pool == ALLOK_NULL) {
-        return ALLOK_FALSE;
+AllokResult akHandleLock(void **pp_result, AkHandle *p_handle) {
+    AkMemoryMap *map = global_map();
+    if (map == ALLOK_NULL || pp_result == ALLOK_NULL || p_handle == ALLOK_NULL) {
+        return ALLOK_NULL_PARAM;
     }
 
-    const AllokSize alloc_size = sizeof(AkMemoryBlock) + size;
+    map_lock(map);
+    p_handle->lock_count++;
+    *pp_result = p_handle->p_data;
+    map_unlock(map);
 
-    AkMemoryBlock *head = p_pool->p_head;
-    const AkMemoryBlock *tail = p_pool->p_tail;
+    return ALLOK_SUCCESS;
+}
 
-    if (head == ALLOK_NULL) {
-        *p_offset_result = 0;
-        return p_pool->alloc_size >= alloc_size ? ALLOK_TRUE : ALLOK_FALSE;
+AllokResult akHandleUnlock(AkHandle *p_handle) {
+    AkMemoryMap *map = global_map();
+    if (map == ALLOK_NULL || p_handle == ALLOK_NULL) {
+        return ALLOK_NULL_PARAM;
     }
 
-    AllokSize worst_size = 0;
-    AllokSize worst_fit_offset = 0;
-
-    AllokSize frag_size = 0;
-    if (get_ptr_fragment(p_pool->p_start, 0, (AllokByte *)head, &frag_size) == ALLOK_SUCCESS) {
-        if (frag_size >= alloc_size) {
-            worst_size = frag_size;
-            worst_fit_offset = 0;
-        }
+    AllokResult result = ALLOK_SUCCESS;
+    map_lock(map);
+    if (p_handle->lock_count == 0) {
+        result = ALLOK_INVALID_ADDR;
+    } else {
+        p_handle->lock_count--;
     }
+    map_unlock(map);
 
-    AllokBool block_found = ALLOK_FALSE;
-    AkMemoryBlock *prev = head;
-    AkMemoryBlock *curr = head->p_next;
+    return result;
+}
 
-    while (curr != ALLOK_NULL) {
-        if (get_ptr_fragment(prev->p_start, prev->size, (AllokByte *)curr, &frag_size) != ALLOK_SUCCESS) {
-            continue;
-        }
-        if (frag_size >= alloc_size && frag_size > worst_size) {
-            worst_size = frag_size;
-            worst_fit_offset = (AllokSize)((AllokByte *)prev->p_start + prev->size - (AllokByte *)p_pool->p_start);
-            block_found = ALLOK_TRUE;
-        }
-        prev = curr;
-        curr = curr->p_next;
+AllokResult akHandleFree(AkHandle **pp_handle) {
+    AkMemoryMap *map = global_map();
+    if (map == ALLOK_NULL || pp_handle == ALLOK_NULL || *pp_handle == ALLOK_NULL) {
+        return ALLOK_NULL_PARAM;
     }
 
-    if (get_ptr_fragment(tail->p_start, tail->size, (AllokByte *)p_pool->p_start + p_pool->alloc_size, &frag_size) == ALLOK_SUCCESS) {
-        if (frag_size >= alloc_size && frag_size > worst_size) {
-            *p_offset_result = (AllokSize)((AllokByte *)tail->p_start + tail->size - (AllokByte *)p_pool->p_start);
-            return ALLOK_TRUE;
-        }
+    map_lock(map);
+    if ((*pp_handle)->lock_count > 0) {
+        map_unlock(map);
+        return ALLOK_HANDLE_LOCKED;
     }
+    handle_free(*pp_handle, map);
+    map_unlock(map);
 
+    *pp_handle = ALLOK_NULL;
 
-    if (block_found == ALLOK_TRUE) {
-        *p_offset_result = worst_fit_offset;
-        return ALLOK_TRUE;
+    return ALLOK_SUCCESS;
+}
+
+AllokResult akCompact(AllokSize *p_result, const AllokSize budget) {
+    if (p_result == ALLOK_NULL) {
+        return ALLOK_NULL_PARAM;
     }
 
-    return ALLOK_FALSE;
+    AkMemoryMap *map = global_map();
+    if (map == ALLOK_NULL) {
+        return ALLOK_UNINITIALIZED;
+    }
+
+    map_lock(map);
+    *p_result = heap_compact(map, budget);
+    map_unlock(map);
+
+    return ALLOK_SUCCESS;
 }
 
-AllokBool alloc_linear_fit(const AkMemoryPool *p_pool, const AllokSize size, AllokSize *p_offset_result) {
-    if (p_pool == ALLOK_NULL) {
-        return ALLOK_FALSE;
+AllokSize akGetTotalAllocSize() {
+    AkMemoryMap *map = global_map();
+    if (map == ALLOK_NULL) {
+        return 0;
     }
 
-    const AllokSize alloc_size = sizeof(AkMemoryBlock) + size;
+    map_lock(map);
+    const AllokSize size = map->metadata.alloc_size;
+    map_unlock(map);
 
-    const AkMemoryBlock *tail = p_pool->p_tail;
-    AllokSize block_offset = 0;
-    if (tail != ALLOK_NULL) {
-        block_offset = (AllokSize)((AllokByte *)tail->p_start + tail->size - ((AllokByte *)p_pool->p_start));
-        if (block_offset + alloc_size > p_pool->alloc_size) {
-            return ALLOK_FALSE;
-        }
+    return size;
+}
+
+AllokSize akGetTotalPoolCount() {
+    AkMemoryMap *map = global_map();
+    if (map == ALLOK_NULL) {
+        return 0;
     }
 
-    *p_offset_result = block_offset;
-    return ALLOK_TRUE;
+    map_lock(map);
+    const AllokSize count = map->metadata.pool_count;
+    map_unlock(map);
+
+    return count;
 }
 
-AllokBool find_block_fit(const AkMemoryPool *p_pool, const AllokSize size, AllokSize *p_offset_result) {
-    switch (g_map->params.type) {
-        case ALLOK_FIRST_FIT: {
-            return alloc_first_fit(p_pool, size, p_offset_result);
-        }
-        case ALLOK_BEST_FIT: {
-            return alloc_best_fit(p_pool, size, p_offset_result);
-        }
-        case ALLOK_WORST_FIT: {
-            return alloc_worst_fit(p_pool, size, p_offset_result);
-        }
-        case ALLOK_LINEAR_FIT: {
-            return alloc_linear_fit(p_pool, size, p_offset_result);
-        }
-        default: {
-            return ALLOK_FALSE;
-        }
+AllokSize akGetTotalBlockCount() {
+    AkMemoryMap *map = global_map();
+    if (map == ALLOK_NULL) {
+        return 0;
     }
+
+    map_lock(map);
+    const AllokSize count = map->metadata.block_count;
+    map_unlock(map);
+
+    return count;
 }
 
-AllokResult akInit(const AllokSize init_pool_count, const AllokSize init_pool_size, const AkMemoryMapParams params) {
-    if (g_map != ALLOK_NULL && g_map->p_pool_head != ALLOK_NULL) {
-        akDump();
+AllokResult heap_usable_size(AllokSize *p_result, AkMemoryMap *p_map, const void *ptr) {
+    AkSlabPage *page;
+    if (akSlabPageFind(&page, p_map, ptr) == ALLOK_SUCCESS) {
+        *p_result = page->object_size;
+        return ALLOK_SUCCESS;
+    }
+
+    AkLargeBlock *large;
+    AllokResult result = akLargeBlockFind(&large, p_map, ptr);
+    if (result == ALLOK_SUCCESS) {
+        *p_result = large->size;
+        return ALLOK_SUCCESS;
+    }
+    if (result == ALLOK_INVALID_ADDR) {
+        return result;
     }
 
-    AllokResult result = akMemoryMapAlloc(&g_map, &g_map_arena, init_pool_count, init_pool_size, params);
+    AkMemoryBlock *block = ALLOK_NULL;
+    result = akMemoryBlockFromPtr(&block, p_map, ptr);
     if (result != ALLOK_SUCCESS) {
         return result;
     }
 
+    *p_result = block->size;
+
     return ALLOK_SUCCESS;
 }
 
-AllokResult akAlloc(void **pp_result, const AllokSize size) {
-    AllokResult result;
-    if (g_map == ALLOK_NULL) {
-        result = akInit(ALLOK_DEFAULT_POOL_COUNT, ALLOK_DEFAULT_POOL_SIZE, (AkMemoryMapParams){ALLOK_DEFAULT_ALLOC_TYPE, ALLOK_DEFAULT_ALLOC_DYNAMIC});
-        if (result != ALLOK_SUCCESS) {
-            return result;
-        }
+AllokResult akGetUsableSize(AllokSize *p_result, const void *ptr) {
+    AkMemoryMap *map = global_map();
+    if (map == ALLOK_NULL) {
+        return ALLOK_UNINITIALIZED;
+    }
+    if (p_result == ALLOK_NULL || ptr == ALLOK_NULL) {
+        return ALLOK_NULL_PARAM;
     }
 
-    const AllokSize block_alloc_size = sizeof(AkMemoryBlock) + size;
-    AllokBool offset_found = ALLOK_FALSE;
+    map_lock(map);
+    const AllokResult result = heap_usable_size(p_result, map, ptr);
+    map_unlock(map);
 
-    AkMemoryPool *pool = g_map->p_pool_head;
-    AllokSize block_offset = 0;
-    while (pool != ALLOK_NULL) {
-        if (pool->alloc_size - pool->size >= block_alloc_size) {
-            if (find_block_fit(pool, size, &block_offset) == ALLOK_TRUE) {
-                offset_found = ALLOK_TRUE;
-                break;
-            }
-        }
-        pool = pool->p_next;
+    return result;
+}
+
+AkMemoryMapMetadata akGetAllocMetadata() {
+    AkMemoryMap *map = global_map();
+    if (map == ALLOK_NULL) {
+        return (AkMemoryMapMetadata){};
     }
 
-    if (offset_found == ALLOK_TRUE) {
-        AkMemoryBlock *block;
-        result = akMemoryBlockCreate(&block, pool, size, block_offset);
-        if (result != ALLOK_SUCCESS) {
-            return result;
-        }
+    map_lock(map);
+    const AkMemoryMapMetadata metadata = map->metadata;
+    map_unlock(map);
 
-        *pp_result = block->p_start;
-        return ALLOK_SUCCESS;
+    return metadata;
+}
 
+AllokResult akHeapWalk(AkHeapWalkFn fn, void *p_user) {
+    AkMemoryMap *map = global_map();
+    if (map == ALLOK_NULL) {
+        return ALLOK_UNINITIALIZED;
     }
 
-    if (g_map->params.is_dynamic == ALLOK_FALSE) {
-        return ALLOK_INSUFFICIENT_POOL_MEMORY;
-    }
+    map_lock(map);
+    const AllokResult result = akMemoryMapWalk(map, fn, p_user);
+    map_unlock(map);
 
-    AkMemoryPool *new_pool;
-    const AllokSize alloc_size = max_size(ALLOK_DEFAULT_POOL_SIZE, block_alloc_size);
-    result = akMemoryPoolAlloc(&new_pool, g_map, alloc_size);
-    if (result != ALLOK_SUCCESS) {
-        return result;
-    }
+    return result;
+}
 
-    AkMemoryBlock *block;
-    result = akMemoryBlockCreate(&block, new_pool, size, 0);
-    if (result != ALLOK_SUCCESS) {
-        return result;
+AllokResult akGetHeapReport(AkMemoryMapReport *p_result) {
+    AkMemoryMap *map = global_map();
+    if (map == ALLOK_NULL) {
+        return ALLOK_UNINITIALIZED;
     }
 
-    *pp_result = block->p_start;
+    map_lock(map);
+    const AllokResult result = akMemoryMapReport(p_result, map);
+    map_unlock(map);
 
-    return ALLOK_SUCCESS;
+    return result;
 }
 
-AllokResult akRealloc(void **pp_result, void *p_src, const AllokSize size) {
-    if (g_map == ALLOK_NULL || p_src == ALLOK_NULL) {
+AllokResult akTraceStart(const char *path, const AllokSize capacity) {
+    if (path == ALLOK_NULL) {
         return ALLOK_NULL_PARAM;
     }
 
-    AkMemoryBlock *block = ALLOK_NULL;
-    AllokResult result = akMemoryBlockFind(&block, g_map, p_src);
-    if (result != ALLOK_SUCCESS) {
-        return result;
+    if (trace_is_enabled() == ALLOK_TRUE) {
+        akTraceStop();
     }
 
-    AkMemoryPool *pool = block->p_parent;
-    AllokSize old_size = block->size;
-
-    if (size <= old_size) {
-        pool->size -= size - old_size;
-        block->size = size;
-        *pp_result = block->p_start;
-        return ALLOK_SUCCESS;
+    const AllokSize event_count = capacity > 0 ? capacity : ALLOK_TRACE_DEFAULT_CAPACITY;
+    if (event_count > (AllokSize)-1 / (2 * sizeof(AkTraceEvent))) {
+        return ALLOK_INVALID_SIZE;
     }
 
-    if (pool->p_tail == block && pool->size + (size - old_size) <= pool->alloc_size) {
-        pool->size += size - old_size;
-        block->size = size;
-        *pp_result = block->p_start;
-        return ALLOK_SUCCESS;
+    AkTraceEvent *events = os_mem_alloc(2 * event_count * sizeof(AkTraceEvent));
+    if (events == ALLOK_NULL) {
+        return ALLOK_OS_MEMORY_ALLOC_FAILED;
     }
 
-    result = akAlloc(pp_result, size);
-    if (result != ALLOK_SUCCESS) {
-        *pp_result = ALLOK_NULL;
-        return result;
+    AkOsFile file;
+    if (os_file_create(&file, path) == ALLOK_FALSE) {
+        os_mem_free(events, 2 * event_count * sizeof(AkTraceEvent));
+        return ALLOK_OS_FILE_FAILED;
     }
 
-    result = akMemcpy(pp_result, p_src, min_size(old_size, size));
-    if (result != ALLOK_SUCCESS) {
-        *pp_result = ALLOK_NULL;
-        return result;
+    const AkTraceHeader header = {ALLOK_TRACE_MAGIC, ALLOK_TRACE_VERSION, sizeof(AkTraceEvent)};
+    if (os_file_write(file, &header, sizeof(header)) == ALLOK_FALSE) {
+        os_file_close(file);
+        os_mem_free(events, 2 * event_count * sizeof(AkTraceEvent));
+        return ALLOK_OS_FILE_FAILED;
     }
 
-    akFree(&p_src);
+    spin_lock(&g_trace.write_lock);
+    spin_lock(&g_trace.lock);
+    g_trace.file = file;
+    g_trace.is_failed = ALLOK_FALSE;
+    g_trace.start_ns = os_clock_ns();
+    g_trace.p_buffer = events;
+    g_trace.p_events = events;
+    g_trace.p_spare = events + event_count;
+    g_trace.p_full = ALLOK_NULL;
+    g_trace.capacity = event_count;
+    g_trace.count = 0;
+    spin_unlock(&g_trace.lock);
+    spin_unlock(&g_trace.write_lock);
+
+    atomic_store_long(&g_trace.is_enabled, 1);
 
     return ALLOK_SUCCESS;
 }
 
-AllokResult akCalloc(void **pp_result, const AllokSize size) {
-    const AllokResult result = akAlloc(pp_result, size);
-    if (result != ALLOK_SUCCESS) {
-        return result;
+AllokResult akTraceFlush() {
+    spin_lock(&g_trace.write_lock);
+    if (g_trace.p_buffer == ALLOK_NULL) {
+        spin_unlock(&g_trace.write_lock);
+        return ALLOK_UNINITIALIZED;
     }
 
-    return akMemset(pp_result, 0, size);
+    trace_write_locked(ALLOK_TRUE);
+    const AllokBool is_failed = g_trace.is_failed;
+    spin_unlock(&g_trace.write_lock);
+
+    return is_failed == ALLOK_TRUE ? ALLOK_OS_FILE_FAILED : ALLOK_SUCCESS;
 }
 
-AllokSize akGetTotalAllocSize() {
-    AllokSize size = 0;
-    if (g_map == ALLOK_NULL || g_map->p_pool_head == ALLOK_NULL) {
-        return 0;
+AllokResult akTraceStop() {
+    atomic_store_long(&g_trace.is_enabled, 0);
+
+    spin_lock(&g_trace.write_lock);
+    spin_lock(&g_trace.lock);
+    AkTraceEvent *buffer = g_trace.p_buffer;
+    AkTraceEvent *events = g_trace.p_events;
+    const AllokSize count = g_trace.count;
+    // Appends that already passed trace_is_enabled find no buffer, and no half can be swapped out after this
+    g_trace.p_buffer = ALLOK_NULL;
+    g_trace.p_events = ALLOK_NULL;
+    g_trace.count = 0;
+    spin_unlock(&g_trace.lock);
+
+    if (buffer == ALLOK_NULL) {
+        spin_unlock(&g_trace.write_lock);
+        return ALLOK_UNINITIALIZED;
     }
 
-    AkMemoryPool *pool = g_map->p_pool_head;
-    while (pool != ALLOK_NULL) {
-        size += pool->size;
-        pool = pool->p_next;
+    trace_write_locked(ALLOK_FALSE);
+    if (count > 0 && os_file_write(g_trace.file, events, count * sizeof(AkTraceEvent)) == ALLOK_FALSE) {
+        g_trace.is_failed = ALLOK_TRUE;
     }
+    os_file_close(g_trace.file);
+    os_mem_free(buffer, 2 * g_trace.capacity * sizeof(AkTraceEvent));
+    g_trace.p_spare = ALLOK_NULL;
+    const AllokBool is_failed = g_trace.is_failed;
+    spin_unlock(&g_trace.write_lock);
 
-    return size;
+    return is_failed == ALLOK_TRUE ? ALLOK_OS_FILE_FAILED : ALLOK_SUCCESS;
 }
 
-AllokSize akGetTotalPoolCount() {
-    if (g_map == ALLOK_NULL) {
-        return 0;
+AllokResult akFree(void **pp_target) {
+    AkMemoryMap *map = global_map();
+    if (map == ALLOK_NULL || pp_target == ALLOK_NULL) {
+        return ALLOK_UNINITIALIZED;
     }
 
-    AllokSize count = 0;
-    const AkMemoryPool *pool = g_map->p_pool_head;
-    while (pool != ALLOK_NULL) {
-        count++;
-        pool = pool->p_next;
+    // Recorded before the free, so the address can't be handed out and traced again ahead of it
+    if (*pp_target != ALLOK_NULL) {
+        trace_record(ALLOK_TRACE_FREE, *pp_target, ALLOK_NULL, 0, 0);
     }
 
-    return count;
+    if (map->params.is_thread_safe == ALLOK_FALSE) {
+        return heap_free(pp_target, map);
+    }
+
+    if (map->params.is_slab_enabled == ALLOK_TRUE && slab_region_contains(map, *pp_target) == ALLOK_TRUE) {
+        return front_cache_free(pp_target, map);
+    }
+
+    spin_lock(&map->lock);
+    const AllokResult result = heap_free(pp_target, map);
+    spin_unlock(&map->lock);
+
+    return result;
 }
 
-AllokSize akGetTotalBlockCount() {
-    if (g_map == ALLOK_NULL) {
-        return 0;
+AllokResult akFreeBatch(void **pp_targets, const AllokSize count) {
+    AkMemoryMap *map = global_map();
+    if (map == ALLOK_NULL || pp_targets == ALLOK_NULL) {
+        return ALLOK_UNINITIALIZED;
     }
 
-    AllokSize count = 0;
-    const AkMemoryPool *pool = g_map->p_pool_head;
-    while (pool != ALLOK_NULL) {
-        const AkMemoryBlock *block = pool->p_head;
-        while (block != ALLOK_NULL) {
-            count++;
-            block = block->p_next;
+    if (trace_is_enabled() == ALLOK_TRUE) {
+        for (AllokSize i = 0; i < count; i++) {
+            if (pp_targets[i] != ALLOK_NULL) {
+                trace_record(ALLOK_TRACE_FREE, pp_targets[i], ALLOK_NULL, 0, 0);
+            }
         }
-        pool = pool->p_next;
     }
 
-    return count;
+    if (map->params.is_thread_safe == ALLOK_FALSE) {
+        return heap_free_batch(pp_targets, map, count);
+    }
+
+    AllokResult result = ALLOK_SUCCESS;
+    if (map->params.is_slab_enabled == ALLOK_TRUE) {
+        for (AllokSize i = 0; i < count; i++) {
+            if (slab_region_contains(map, pp_targets[i]) == ALLOK_TRUE) {
+                const AllokResult cache_result = front_cache_free(&pp_targets[i], map);
+                if (cache_result != ALLOK_SUCCESS && result == ALLOK_SUCCESS) {
+                    result = cache_result;
+                }
+            }
+        }
+    }
+
+    spin_lock(&map->lock);
+    const AllokResult batch_result = heap_free_batch(pp_targets, map, count);
+    spin_unlock(&map->lock);
+
+    return result != ALLOK_SUCCESS ? result : batch_result;
 }
 
-AkMemoryMapMetadata akGetAllocMetadata() {
-    if (g_map == ALLOK_NULL) {
-        return (AkMemoryMapMetadata){};
+void akThreadCacheFlush() {
+    AkMemoryMap *map = global_map();
+    if (map == ALLOK_NULL) {
+        return;
+    }
+
+    AkThreadCache *cache = thread_cache_get();
+    for (AllokSize i = 0; i < ALLOK_SLAB_CLASS_COUNT; i++) {
+        AkThreadCacheBin *bin = &cache->bins[i];
+        if (bin->p_head != ALLOK_NULL) {
+            thread_cache_flush_bin(map, bin, bin->count);
+        }
     }
+}
 
-    return g_map->metadata;
+void thread_cache_exit(void *p_value) {
+    (void)p_value;
+    akThreadCacheFlush();
 }
 
-AllokResult akFree(void **pp_target) {
-    if (g_map == ALLOK_NULL || pp_target == ALLOK_NULL) {
-        return ALLOK_UNINITIALIZED;
+AllokResult akThreadCacheFlushOnExit() {
+    spin_lock(&g_init_lock);
+    AllokResult result = ALLOK_SUCCESS;
+    if (atomic_load_long(&g_is_thread_exit_ready) == 0) {
+        if (os_thread_exit_create(thread_cache_exit) == ALLOK_TRUE) {
+            atomic_store_long(&g_is_thread_exit_ready, 1);
+        } else {
+            result = ALLOK_UNSUPPORTED;
+        }
     }
+    spin_unlock(&g_init_lock);
 
-    AkMemoryBlock *block = ALLOK_NULL;
-    const AllokResult result = akMemoryBlockFind(&block, g_map, *pp_target);
-    if (result != ALLOK_SUCCESS) {
-        return result;
+    return result;
+}
+
+void akForkPrepare() {
+    spin_lock(&g_init_lock);
+    AkMemoryMap *map = global_map();
+    if (map != ALLOK_NULL) {
+        // CPU caches are taken before the map lock, the same order their refills use
+        for (AllokSize i = 0; map->p_cpu_caches != ALLOK_NULL && i < map->cpu_count; i++) {
+            spin_lock(&map->p_cpu_caches[i].lock);
+        }
+        spin_lock(&map->lock);
     }
+    spin_lock(&g_trace.write_lock);
+    spin_lock(&g_trace.lock);
+}
 
-    akMemoryBlockFree(&block);
+void akForkParent() {
+    spin_unlock(&g_trace.lock);
+    spin_unlock(&g_trace.write_lock);
+    AkMemoryMap *map = global_map();
+    if (map != ALLOK_NULL) {
+        spin_unlock(&map->lock);
+        for (AllokSize i = 0; map->p_cpu_caches != ALLOK_NULL && i < map->cpu_count; i++) {
+            spin_unlock(&map->p_cpu_caches[i].lock);
+        }
+    }
+    spin_unlock(&g_init_lock);
+}
 
-    *pp_target = ALLOK_NULL;
+void akForkChild() {
+    // The parent keeps writing its trace, so the child drops its copy of the buffer rather than writing it twice
+    if (g_trace.p_buffer != ALLOK_NULL) {
+        atomic_store_long(&g_trace.is_enabled, 0);
+        os_file_close(g_trace.file);
+        os_mem_free(g_trace.p_buffer, 2 * g_trace.capacity * sizeof(AkTraceEvent));
+        g_trace.p_buffer = ALLOK_NULL;
+        g_trace.p_events = ALLOK_NULL;
+        g_trace.p_spare = ALLOK_NULL;
+        g_trace.p_full = ALLOK_NULL;
+        g_trace.count = 0;
+    }
 
-    return ALLOK_SUCCESS;
+    akForkParent();
 }
 
 void akDump() {
@@ -858,9 +5634,10 @@ void akDump() {
         return;
     }
 
-    akMemoryPoolFree(&g_map->p_pool_head, ALLOK_TRUE);
-    g_map = ALLOK_NULL;
+    AkMemoryMap *map = g_map;
+    atomic_store_ptr((void *volatile *)&g_map, ALLOK_NULL);
+    atomic_store_long(&g_map_generation, g_map_generation + 1);
 
-    akMemoryArenaDestroy(&g_map_arena, ALLOK_FALSE);
+    akMemoryMapDestroy(&map, &g_map_arena);
 
-}
\ No newline at end of file
+}
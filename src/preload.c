@@ -0,0 +1,168 @@
+// Replaces the libc allocator with the global allok MemoryMap when loaded with LD_PRELOAD
+// ALLOK_TYPE selects the AllokType, ALLOK_PER_CPU=1 switches to per-CPU caches and ALLOK_TRACE names a file to record an akTraceStart trace to
+
+#include <allok.h>
+
+#include <errno.h>
+#include <pthread.h>
+#include <stddef.h>
+#include <stdlib.h>
+
+#define ALLOK_EXPORT __attribute__((visibility("default")))
+
+static pthread_once_t g_init_once = PTHREAD_ONCE_INIT;
+static pthread_key_t g_thread_key;
+static volatile int g_is_key_ready;
+static __thread int t_is_registered;
+
+static void preload_init() {
+    // Nothing on this path may call malloc, akInit maps its memory straight from the OS
+    AllokType type = ALLOK_DEFAULT_ALLOC_TYPE;
+    const char *env_type = getenv("ALLOK_TYPE");
+    if (env_type != NULL && env_type[0] >= '0' && env_type[0] <= '0' + ALLOK_WORST_FIT && env_type[1] == '\0') {
+        type = (AllokType)(env_type[0] - '0');
+    }
+
+    const char *env_per_cpu = getenv("ALLOK_PER_CPU");
+    const AllokBool per_cpu = env_per_cpu != NULL && env_per_cpu[0] == '1' ? ALLOK_TRUE : ALLOK_DEFAULT_ALLOC_PER_CPU;
+
+    akInit(ALLOK_DEFAULT_POOL_COUNT, ALLOK_DEFAULT_POOL_SIZE, (AkMemoryMapParams){type, ALLOK_DEFAULT_ALLOC_DYNAMIC, ALLOK_DEFAULT_ALLOC_SLAB, ALLOK_TRUE, ALLOK_DEFAULT_ALLOC_REALLOC_HEADROOM, ALLOK_DEFAULT_LARGE_THRESHOLD, ALLOK_DEFAULT_HUGE_PAGES, ALLOK_DEFAULT_POOL_CACHE_SIZE, ALLOK_DEFAULT_POOL_CACHE_DECAY, per_cpu});
+
+    const char *env_trace = getenv("ALLOK_TRACE");
+    if (env_trace != NULL && env_trace[0] != '\0') {
+        akTraceStart(env_trace, 0);
+    }
+}
+
+static void preload_thread_exit(void *p_value) {
+    (void)p_value;
+    akThreadCacheFlush();
+}
+
+static inline void preload_enter() {
+    pthread_once(&g_init_once, preload_init);
+
+    // Threads return their cached objects when they exit, the flag is set first in case the key needs memory
+    if (t_is_registered == 0 && g_is_key_ready != 0) {
+        t_is_registered = 1;
+        pthread_setspecific(g_thread_key, (void *)1);
+    }
+}
+
+// pthread_atfork and pthread_key_create may allocate, so they are called once the map exists rather than inside preload_init
+__attribute__((constructor)) static void preload_constructor() {
+    pthread_once(&g_init_once, preload_init);
+    pthread_atfork(akForkPrepare, akForkParent, akForkChild);
+    if (pthread_key_create(&g_thread_key, preload_thread_exit) == 0) {
+        g_is_key_ready = 1;
+    }
+}
+
+__attribute__((destructor)) static void preload_destructor() {
+    akTraceStop();
+}
+
+static void *preload_alloc(size_t size, size_t alignment) {
+    preload_enter();
+
+    void *ptr = NULL;
+    if (akAllocAligned(&ptr, size > 0 ? size : 1, alignment) != ALLOK_SUCCESS) {
+        errno = ENOMEM;
+        return NULL;
+    }
+
+    return ptr;
+}
+
+ALLOK_EXPORT void *malloc(size_t size) {
+    return preload_alloc(size, ALLOK_DEFAULT_ALIGNMENT);
+}
+
+ALLOK_EXPORT void free(void *ptr) {
+    if (ptr != NULL) {
+        // Memory that allok does not own, such as the dynamic loader's early allocations, is left alone
+        akFree(&ptr);
+    }
+}
+
+ALLOK_EXPORT void *calloc(size_t count, size_t size) {
+    if (size != 0 && count > (size_t)-1 / size) {
+        errno = ENOMEM;
+        return NULL;
+    }
+
+    preload_enter();
+
+    void *ptr = NULL;
+    const size_t total = count * size;
+    if (akCalloc(&ptr, total > 0 ? total : 1) != ALLOK_SUCCESS) {
+        errno = ENOMEM;
+        return NULL;
+    }
+
+    return ptr;
+}
+
+ALLOK_EXPORT void *realloc(void *ptr, size_t size) {
+    if (ptr == NULL) {
+        return malloc(size);
+    }
+    if (size == 0) {
+        free(ptr);
+        return NULL;
+    }
+
+    preload_enter();
+
+    void *result = NULL;
+    if (akRealloc(&result, ptr, size) != ALLOK_SUCCESS) {
+        errno = ENOMEM;
+        return NULL;
+    }
+
+    return result;
+}
+
+ALLOK_EXPORT int posix_memalign(void **pp_result, size_t alignment, size_t size) {
+    if (alignment < sizeof(void *) || (alignment & (alignment - 1)) != 0) {
+        return EINVAL;
+    }
+
+    void *ptr = preload_alloc(size, alignment);
+    if (ptr == NULL) {
+        return ENOMEM;
+    }
+
+    *pp_result = ptr;
+    return 0;
+}
+
+ALLOK_EXPORT void *aligned_alloc(size_t alignment, size_t size) {
+    if (alignment == 0 || (alignment & (alignment - 1)) != 0) {
+        errno = EINVAL;
+        return NULL;
+    }
+
+    return preload_alloc(size, alignment);
+}
+
+ALLOK_EXPORT void *memalign(size_t alignment, size_t size) {
+    return aligned_alloc(alignment, size);
+}
+
+ALLOK_EXPORT void *valloc(size_t size) {
+    return preload_alloc(size, ALLOK_OS_PAGE_SIZE);
+}
+
+ALLOK_EXPORT void *pvalloc(size_t size) {
+    return preload_alloc((size + ALLOK_OS_PAGE_SIZE - 1) & ~(size_t)(ALLOK_OS_PAGE_SIZE - 1), ALLOK_OS_PAGE_SIZE);
+}
+
+ALLOK_EXPORT size_t malloc_usable_size(void *ptr) {
+    AllokSize size = 0;
+    if (ptr == NULL || akGetUsableSize(&size, ptr) != ALLOK_SUCCESS) {
+        return 0;
+    }
+
+    return size;
+}
@@ -0,0 +1,1490 @@
+// Randomized alloc/realloc/free churn that checks the gap, pool and slab bookkeeping after every few operations.
+// Built against the library source directly so the internal trees can be inspected.
+#include "../src/allok.c"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if __APPLE__ || __linux__
+#include <pthread.h>
+#endif
+#if __linux__
+#include <signal.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+#endif
+
+#define SLOT_COUNT 1000
+#define ITERATIONS 100000
+#define CHECK_INTERVAL 97
+
+#define EXPECT(condition, message)                                                   \
+    do {                                                                             \
+        if (!(condition)) {                                                          \
+            fprintf(stderr, "%s:%d: %s\n", __FILE__, __LINE__, message);             \
+            exit(1);                                                                 \
+        }                                                                            \
+    } while (0)
+
+static AllokByte *g_slots[SLOT_COUNT];
+static AllokSize g_sizes[SLOT_COUNT];
+static unsigned int g_seed = 7;
+
+unsigned int next_random() {
+    g_seed = g_seed * 1103515245u + 12345u;
+    return g_seed >> 8;
+}
+
+void fill_slot(const int slot) {
+    for (AllokSize i = 0; i < g_sizes[slot]; i++) {
+        g_slots[slot][i] = (AllokByte)(slot + i);
+    }
+}
+
+AllokBool check_slot(const int slot, const AllokSize size) {
+    for (AllokSize i = 0; i < size; i++) {
+        if (g_slots[slot][i] != (AllokByte)(slot + i)) {
+            return ALLOK_FALSE;
+        }
+    }
+    return ALLOK_TRUE;
+}
+
+AllokSize check_tree(const AkTreeNode *p_node, const AkTreeNode *p_low, const AkTreeNode *p_high) {
+    if (p_node == ALLOK_NULL) {
+        return 0;
+    }
+
+    EXPECT(p_low == ALLOK_NULL || tree_less(p_low, p_node) == ALLOK_TRUE, "tree order");
+    EXPECT(p_high == ALLOK_NULL || tree_less(p_node, p_high) == ALLOK_TRUE, "tree order");
+
+    const AllokSize left_height = tree_height(p_node->p_left);
+    const AllokSize right_height = tree_height(p_node->p_right);
+    EXPECT(p_node->height == 1 + max_size(left_height, right_height), "tree height");
+    EXPECT(left_height <= right_height + 1 && right_height <= left_height + 1, "tree balance");
+    EXPECT(p_node->max_value == max_size(p_node->value, max_size(tree_max_value(p_node->p_left), tree_max_value(p_node->p_right))), "tree max value");
+
+    return 1 + check_tree(p_node->p_left, p_low, p_node) + check_tree(p_node->p_right, p_node, p_high);
+}
+
+AllokBool tree_contains(const AkTreeNode *p_root, const AkTreeNode *p_node) {
+    while (p_root != ALLOK_NULL) {
+        if (p_root == p_node) {
+            return ALLOK_TRUE;
+        }
+        p_root = tree_less(p_node, p_root) == ALLOK_TRUE ? p_root->p_left : p_root->p_right;
+    }
+    return ALLOK_FALSE;
+}
+
+void check_pool(AkMemoryPool *p_pool) {
+    AllokSize gap_count = 0;
+    AllokSize used = 0;
+    AkMemoryBlock *prev = ALLOK_NULL;
+
+    for (AkMemoryBlock *block = p_pool->p_head;; block = block->p_next) {
+        AllokByte *gap_start = gap_start_after(p_pool, prev);
+        AllokByte *gap_end = gap_end_before(p_pool, block);
+        EXPECT(gap_start <= gap_end, "blocks overlap");
+
+        AkFreeGap *gap = gap_node_at(gap_start);
+        if ((AllokByte *)gap < gap_end && (AllokSize)(gap_end - (AllokByte *)gap) >= gap_min_size()) {
+            EXPECT(gap->node.key == (AllokSize)(gap_end - (AllokByte *)gap), "gap size");
+            EXPECT(gap->p_prev_block == prev, "gap previous block");
+            EXPECT(tree_contains(p_pool->p_gap_root, &gap->node) == ALLOK_TRUE, "gap not indexed");
+            gap_count++;
+        }
+
+        if (block == ALLOK_NULL) {
+            break;
+        }
+
+        EXPECT(block->p_prev == prev, "block links");
+        EXPECT(block->p_parent == p_pool, "block parent");
+        EXPECT(block->p_start == (AllokByte *)block + sizeof(AkMemoryBlock), "block start");
+        EXPECT(block->state == block_tag(p_pool, ALLOK_BLOCK_POOL) || block_is_pending(&block->state) == ALLOK_TRUE, "block tag");
+        used += block->size + sizeof(AkMemoryBlock);
+        prev = block;
+    }
+
+    EXPECT(p_pool->p_tail == prev, "pool tail");
+    EXPECT(p_pool->size == used, "pool size");
+    EXPECT(check_tree(p_pool->p_gap_root, ALLOK_NULL, ALLOK_NULL) == gap_count, "gap count");
+
+    const AkTreeNode *largest = tree_max(p_pool->p_gap_root);
+    EXPECT(p_pool->largest_gap == (largest == ALLOK_NULL ? 0 : largest->key), "largest gap");
+
+    const AllokSize fit_gap = p_pool->p_parent_map->params.type == ALLOK_FIRST_FIT ? p_pool->fit_node.value : p_pool->fit_node.key;
+    EXPECT(fit_gap == pool_fit_gap(p_pool), "pool fit gap");
+}
+
+void check_map(AkMemoryMap *p_map) {
+    AllokSize pool_count = 0;
+    AllokSize block_count = 0;
+    AllokSize alloc_size = p_map->slab.size;
+    AllokSize mapped_size = 0;
+    AllokSize header_size = 0;
+    for (AkMemoryPool *pool = p_map->p_pool_head; pool != ALLOK_NULL; pool = pool->p_next) {
+        check_pool(pool);
+        for (const AkMemoryBlock *block = pool->p_head; block != ALLOK_NULL; block = block->p_next) {
+            alloc_size += block->size;
+            block_count++;
+        }
+        mapped_size += pool->alloc_size + sizeof(AkMemoryPool);
+        header_size += sizeof(AkMemoryPool);
+        EXPECT(tree_contains(p_map->p_pool_root, &pool->fit_node) == ALLOK_TRUE, "pool not indexed by fit");
+        EXPECT(tree_contains(p_map->p_pool_addr_root, &pool->addr_node) == ALLOK_TRUE, "pool not indexed by address");
+        pool_count++;
+    }
+
+    EXPECT(check_tree(p_map->p_pool_root, ALLOK_NULL, ALLOK_NULL) == pool_count, "pool fit count");
+    EXPECT(check_tree(p_map->p_pool_addr_root, ALLOK_NULL, ALLOK_NULL) == pool_count, "pool address count");
+
+    AllokSize large_count = 0;
+    AkLargeBlock *prev_large = ALLOK_NULL;
+    for (AkLargeBlock *large = p_map->p_large_head; large != ALLOK_NULL; large = large->p_next) {
+        EXPECT(large->p_prev == prev_large, "large block links");
+        EXPECT(large->p_parent_map == p_map, "large block parent");
+        EXPECT(block_is_pending(&large->state) == ALLOK_TRUE || (large->state == block_tag(large, ALLOK_BLOCK_LARGE) && ((AllokSize *)large->p_start)[-1] == large->state), "large block tag");
+        EXPECT(large->alloc_size % ALLOK_OS_PAGE_SIZE == 0, "large block mapping size");
+        EXPECT((AllokByte *)large->p_start + large->size <= (AllokByte *)large + large->alloc_size, "large block overflows its mapping");
+        EXPECT(tree_contains(p_map->p_large_root, &large->addr_node) == ALLOK_TRUE, "large block not indexed by address");
+        alloc_size += large->size;
+        mapped_size += large->alloc_size;
+        header_size += (AllokSize)((AllokByte *)large->p_start - (AllokByte *)large);
+        prev_large = large;
+        large_count++;
+    }
+
+    AllokSize cache_count = 0;
+    AllokSize cache_size = 0;
+    AkMemoryPool *prev_cached = ALLOK_NULL;
+    for (AkMemoryPool *pool = p_map->p_pool_cache_head; pool != ALLOK_NULL; pool = pool->p_next) {
+        EXPECT(pool->p_prev == prev_cached, "pool cache links");
+        EXPECT(pool->p_head == ALLOK_NULL && pool->size == 0, "cached pool not empty");
+        EXPECT(pool->largest_gap + sizeof(AkMemoryPool) + gap_min_size() > pool->alloc_size, "cached pool lost its gap");
+        EXPECT(prev_cached == ALLOK_NULL || prev_cached->cache_stamp > pool->cache_stamp, "pool cache order");
+        EXPECT(tree_contains(p_map->p_pool_addr_root, &pool->addr_node) == ALLOK_FALSE, "cached pool still indexed");
+        cache_size += pool->alloc_size + sizeof(AkMemoryPool);
+        prev_cached = pool;
+        cache_count++;
+    }
+
+    EXPECT(p_map->p_pool_cache_tail == prev_cached, "pool cache tail");
+    EXPECT(p_map->pool_cache_count == cache_count && p_map->pool_cache_size == cache_size, "pool cache size");
+    EXPECT(cache_size <= p_map->params.pool_cache_size, "pool cache over its cap");
+    EXPECT(p_map->metadata.pools_created - p_map->metadata.pools_freed == pool_count + cache_count, "pool leaked");
+
+    AllokSize free_page_count = 0;
+    for (const AkSlabPage *page = p_map->slab.p_free_pages; page != ALLOK_NULL; page = page->p_next) {
+        free_page_count++;
+    }
+    const AllokSize slab_page_count = p_map->slab.committed_size / ALLOK_SLAB_PAGE_SIZE;
+    mapped_size += p_map->slab.committed_size - free_page_count * (ALLOK_SLAB_PAGE_SIZE - ALLOK_SLAB_PAGE_RESIDENT_SIZE);
+    header_size += (slab_page_count - free_page_count) * slab_page_header_size() + block_count * sizeof(AkMemoryBlock) + cache_count * sizeof(AkMemoryPool);
+
+    const AkMemoryMapMetadata *metadata = &p_map->metadata;
+    EXPECT(metadata->pool_count == pool_count && p_map->pool_count == pool_count, "pool counter");
+    EXPECT(metadata->block_count == block_count, "block counter");
+    EXPECT(metadata->large_block_count == large_count, "large block counter");
+    EXPECT(metadata->slab_object_count == metadata->slab_objects_created - metadata->slab_objects_freed, "slab object counter");
+    EXPECT(metadata->alloc_size == alloc_size, "alloc size counter");
+    EXPECT(metadata->peak_alloc_size >= alloc_size, "peak alloc size counter");
+    EXPECT(metadata->mapped_size == mapped_size + cache_size, "mapped size counter");
+    EXPECT(metadata->header_size == header_size, "header size counter");
+
+    EXPECT(p_map->large_count == large_count, "large block count");
+    EXPECT(check_tree(p_map->p_large_root, ALLOK_NULL, ALLOK_NULL) == large_count, "large block address count");
+
+    if (p_map->params.type == ALLOK_FIRST_FIT) {
+        for (AllokSize need = 64; need < 32 * 1024; need = need * 3 / 2) {
+            AkMemoryPool *first = p_map->p_pool_head;
+            while (first != ALLOK_NULL && pool_fit_gap(first) < need) {
+                first = first->p_next;
+            }
+            EXPECT(map_find_pool(p_map, need) == first, "first fit pool order");
+        }
+    }
+}
+
+void run(const AkMemoryMapParams params) {
+    akInit(ALLOK_DEFAULT_POOL_COUNT, ALLOK_DEFAULT_POOL_SIZE, params);
+
+    for (int i = 0; i < ITERATIONS; i++) {
+        const int slot = (int)(next_random() % SLOT_COUNT);
+        const AllokSize size = next_random() % 8 == 0 ? next_random() % 20000 + 1 : next_random() % 600 + 1;
+
+        if (g_slots[slot] == ALLOK_NULL) {
+            const AllokSize alignment = next_random() % 4 == 0 ? (AllokSize)1 << (next_random() % 13) : ALLOK_DEFAULT_ALIGNMENT;
+            void *ptr;
+            EXPECT(akAllocAligned(&ptr, size, alignment) == ALLOK_SUCCESS, "alloc");
+            EXPECT((AllokSize)ptr % max_size(alignment, ALLOK_DEFAULT_ALIGNMENT) == 0, "alignment");
+            g_slots[slot] = ptr;
+            g_sizes[slot] = size;
+            fill_slot(slot);
+        } else if (next_random() % 3 == 0) {
+            EXPECT(check_slot(slot, g_sizes[slot]) == ALLOK_TRUE, "data corrupted");
+            void *ptr = g_slots[slot];
+            EXPECT(akFree(&ptr) == ALLOK_SUCCESS, "free");
+            g_slots[slot] = ALLOK_NULL;
+        } else {
+            void *ptr;
+            EXPECT(akRealloc(&ptr, g_slots[slot], size) == ALLOK_SUCCESS, "realloc");
+            g_slots[slot] = ptr;
+            EXPECT(check_slot(slot, min_size(size, g_sizes[slot])) == ALLOK_TRUE, "realloc lost data");
+            g_sizes[slot] = size;
+            fill_slot(slot);
+        }
+
+        if (i % CHECK_INTERVAL == 0) {
+            check_map(g_map);
+        }
+    }
+
+    check_map(g_map);
+    for (int slot = 0; slot < SLOT_COUNT; slot++) {
+        if (g_slots[slot] != ALLOK_NULL) {
+            void *ptr = g_slots[slot];
+            EXPECT(akFree(&ptr) == ALLOK_SUCCESS, "free");
+            g_slots[slot] = ALLOK_NULL;
+        }
+    }
+
+    EXPECT(akGetTotalPoolCount() == 0 && akGetTotalBlockCount() == 0 && akGetTotalAllocSize() == 0, "memory leaked");
+    EXPECT(g_map->large_count == 0, "large block leaked");
+    akDump();
+}
+
+// Sizes around each vector width, moved between every misalignment and overlap, against a byte-wise reference
+void check_mem_kernels() {
+    static const AllokSize sizes[] = {0, 1, 2, 3, 7, 8, 9, 15, 16, 17, 31, 32, 33, 63, 64, 65, 127, 128, 129, 255, 256, 257, 511, 512, 513};
+    static const int shifts[] = {-65, -64, -33, -16, -7, -1, 1, 7, 16, 33, 64, 65};
+    static AllokByte buffer[1024];
+    static AllokByte expected[1024];
+    static AllokByte scratch[1024];
+
+    AllokMemKernel original;
+    EXPECT(akMemKernelGet(&original) == ALLOK_SUCCESS, "mem kernel get");
+
+    AllokSize supported = 0;
+    for (int kernel = 0; kernel < ALLOK_MEM_KERNEL_COUNT; kernel++) {
+        const AllokResult result = akMemKernelSet((AllokMemKernel)kernel);
+        if (result == ALLOK_UNSUPPORTED) {
+            continue;
+        }
+        EXPECT(result == ALLOK_SUCCESS, "mem kernel set");
+        supported++;
+
+        for (AllokSize s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+            const AllokSize size = sizes[s];
+            for (AllokSize align = 0; align < 4; align++) {
+                const AllokSize src = 160 + align;
+                for (AllokSize i = 0; i < sizeof(shifts) / sizeof(shifts[0]); i++) {
+                    const AllokSize dst = (AllokSize)((long)src + shifts[i]);
+                    for (AllokSize b = 0; b < sizeof(buffer); b++) {
+                        buffer[b] = expected[b] = (AllokByte)(b * 31 + (AllokSize)kernel);
+                    }
+                    for (AllokSize b = 0; b < size; b++) {
+                        scratch[b] = expected[src + b];
+                    }
+                    for (AllokSize b = 0; b < size; b++) {
+                        expected[dst + b] = scratch[b];
+                    }
+
+                    void *target = buffer + dst;
+                    EXPECT(akMemmove(&target, buffer + src, size) == ALLOK_SUCCESS && target == buffer + dst, "mem kernel move");
+                    EXPECT(memcmp(buffer, expected, sizeof(buffer)) == 0, "mem kernel move result");
+                }
+
+                for (AllokSize b = 0; b < sizeof(buffer); b++) {
+                    buffer[b] = expected[b] = (AllokByte)(b * 31 + (AllokSize)kernel);
+                }
+                for (AllokSize b = 0; b < size; b++) {
+                    expected[src + b] = (AllokByte)(0xA5 + align);
+                }
+                void *target = buffer + src;
+                EXPECT(akMemset(&target, (AllokByte)(0xA5 + align), size) == ALLOK_SUCCESS, "mem kernel set");
+                EXPECT(memcmp(buffer, expected, sizeof(buffer)) == 0, "mem kernel set result");
+            }
+        }
+    }
+    EXPECT(supported >= 2, "byte and word kernels always supported");
+
+    EXPECT(akMemKernelSet(original) == ALLOK_SUCCESS, "mem kernel restore");
+}
+
+void check_realloc_headroom(const AllokBool headroom) {
+    akInit(ALLOK_DEFAULT_POOL_COUNT, ALLOK_DEFAULT_POOL_SIZE, (AkMemoryMapParams){ALLOK_BEST_FIT, ALLOK_TRUE, ALLOK_TRUE, ALLOK_FALSE, headroom});
+
+    void *ptr;
+    EXPECT(akAlloc(&ptr, 1000) == ALLOK_SUCCESS, "alloc");
+    EXPECT(akRealloc(&ptr, ptr, 2000) == ALLOK_SUCCESS, "realloc");
+
+    AkMemoryBlock *block;
+    EXPECT(akMemoryBlockFromPtr(&block, g_map, ptr) == ALLOK_SUCCESS, "block lookup");
+    const AllokSize capacity = headroom == ALLOK_TRUE ? 2000 + (2000 >> ALLOK_REALLOC_HEADROOM_SHIFT) : 2000;
+    EXPECT(block->size == capacity, "realloc capacity");
+
+    // Shrinking within half the capacity keeps it
+    EXPECT(akRealloc(&ptr, ptr, 1600) == ALLOK_SUCCESS, "realloc");
+    EXPECT(block->size == (headroom == ALLOK_TRUE ? capacity : 1600), "realloc shrink");
+
+    EXPECT(akFree(&ptr) == ALLOK_SUCCESS, "free");
+    akDump();
+}
+
+void check_large_realloc() {
+    akInit(ALLOK_DEFAULT_POOL_COUNT, ALLOK_DEFAULT_POOL_SIZE, (AkMemoryMapParams){ALLOK_BEST_FIT, ALLOK_TRUE, ALLOK_TRUE, ALLOK_FALSE, ALLOK_FALSE, ALLOK_DEFAULT_LARGE_THRESHOLD});
+
+    // Large blocks stay out of the pools
+    AllokByte *ptr;
+    EXPECT(akAllocAligned(VPTR(ptr), ALLOK_DEFAULT_LARGE_THRESHOLD, 64 * 1024) == ALLOK_SUCCESS, "large alloc");
+    EXPECT((AllokSize)ptr % (64 * 1024) == 0, "large alignment");
+    EXPECT(akGetTotalPoolCount() == 0 && g_map->large_count == 1, "large block tracked as a pool");
+    for (AllokSize i = 0; i < ALLOK_DEFAULT_LARGE_THRESHOLD; i++) {
+        ptr[i] = (AllokByte)i;
+    }
+
+    void *interior = ptr + 1;
+    EXPECT(akFree(&interior) == ALLOK_INVALID_ADDR, "large interior free");
+
+    const AllokSize size = 16 * 1024 * 1024;
+    EXPECT(akRealloc(VPTR(ptr), ptr, size) == ALLOK_SUCCESS, "large realloc");
+    for (AllokSize i = 0; i < ALLOK_DEFAULT_LARGE_THRESHOLD; i++) {
+        EXPECT(ptr[i] == (AllokByte)i, "large realloc lost data");
+    }
+    ptr[size - 1] = 1;
+    EXPECT(akGetTotalAllocSize() == size, "large alloc size");
+#if __linux__
+    EXPECT(g_map->metadata.large_blocks_remapped == 1 && g_map->metadata.reallocs_moved == 0, "large realloc copied");
+#endif
+
+    EXPECT(akRealloc(VPTR(ptr), ptr, 100) == ALLOK_SUCCESS, "large shrink");
+    EXPECT(ptr[99] == 99, "large shrink lost data");
+
+    EXPECT(akFree(VPTR(ptr)) == ALLOK_SUCCESS, "large free");
+    EXPECT(g_map->large_count == 0 && g_map->p_large_root == ALLOK_NULL && akGetTotalAllocSize() == 0, "large free");
+    EXPECT(g_map->metadata.large_blocks_created == 1 && g_map->metadata.large_blocks_freed == 1, "large metadata");
+    akDump();
+}
+
+void check_huge_pages(const AllokHugePages huge_pages) {
+    // Mappings of at least a huge page are rounded up to whole huge pages, whether or not the OS provides them
+    akInit(1, 3 * 1024 * 1024, (AkMemoryMapParams){ALLOK_BEST_FIT, ALLOK_TRUE, ALLOK_TRUE, ALLOK_FALSE, ALLOK_FALSE, ALLOK_DEFAULT_LARGE_THRESHOLD, huge_pages});
+    EXPECT(g_map->p_pool_head->alloc_size + sizeof(AkMemoryPool) == 4 * 1024 * 1024, "huge pool size");
+
+    AllokByte *ptr;
+    EXPECT(akAlloc(VPTR(ptr), 3 * 1024 * 1024) == ALLOK_SUCCESS, "huge large alloc");
+    EXPECT(g_map->p_large_head->alloc_size % ALLOK_HUGE_PAGE_SIZE == 0, "huge large block size");
+    ptr[0] = 1;
+    EXPECT(akRealloc(VPTR(ptr), ptr, 5 * 1024 * 1024) == ALLOK_SUCCESS, "huge large realloc");
+    EXPECT(ptr[0] == 1, "huge large realloc lost data");
+    ptr[5 * 1024 * 1024 - 1] = 1;
+    check_map(g_map);
+    EXPECT(akFree(VPTR(ptr)) == ALLOK_SUCCESS, "huge large free");
+    akDump();
+
+    AkMemoryArena *arena;
+    EXPECT(akMemoryArenaAllocWithParams(&arena, 3 * 1024 * 1024, (AkMemoryArenaParams){huge_pages}) == ALLOK_SUCCESS, "huge arena alloc");
+    EXPECT((AllokSize)arena % ALLOK_HUGE_PAGE_SIZE == 0 && arena->alloc_size + sizeof(AkMemoryArena) == 4 * 1024 * 1024, "huge arena size");
+    EXPECT(akMemoryArenaClaim(VPTR(ptr), arena, arena->alloc_size) == ALLOK_SUCCESS, "huge arena claim");
+    ptr[arena->alloc_size - 1] = 1;
+    akMemoryArenaDestroy(&arena, ALLOK_FALSE);
+}
+
+void check_pool_cache() {
+    akInit(ALLOK_DEFAULT_POOL_COUNT, ALLOK_DEFAULT_POOL_SIZE, (AkMemoryMapParams){ALLOK_BEST_FIT, ALLOK_TRUE, ALLOK_FALSE, ALLOK_FALSE, ALLOK_FALSE, ALLOK_DEFAULT_LARGE_THRESHOLD, ALLOK_HUGE_PAGES_NONE, ALLOK_DEFAULT_POOL_CACHE_SIZE, 4});
+
+    // Oscillating across a pool boundary reuses the emptied pool instead of mapping a new one
+    void *ptr;
+    for (int i = 0; i < 10; i++) {
+        EXPECT(akAlloc(&ptr, ALLOK_DEFAULT_POOL_SIZE / 2) == ALLOK_SUCCESS, "alloc");
+        EXPECT(akFree(&ptr) == ALLOK_SUCCESS, "free");
+    }
+    EXPECT(g_map->metadata.pools_created == 1 && g_map->metadata.pool_cache_misses == 1 && g_map->metadata.pool_cache_hits == 9, "pool cache reuse");
+    EXPECT(akGetTotalPoolCount() == 0 && g_map->pool_cache_count == 1, "pool cache count");
+
+    // Pools left unused for more than pool_cache_decay pool requests are released
+    void *ptrs[6];
+    for (int i = 0; i < 6; i++) {
+        EXPECT(akAlloc(&ptrs[i], ALLOK_DEFAULT_POOL_SIZE * 2) == ALLOK_SUCCESS, "alloc");
+    }
+    EXPECT(g_map->pool_cache_count == 0, "pool cache decay");
+    for (int i = 0; i < 6; i++) {
+        EXPECT(akFree(&ptrs[i]) == ALLOK_SUCCESS, "free");
+    }
+    check_map(g_map);
+    akDump();
+}
+
+typedef struct HeapWalkTotals {
+    AllokSize entry_count;
+    AllokSize pool_count;
+    AllokSize block_count;
+    AllokSize block_size;
+    AllokSize gap_size;
+    AllokSize large_count;
+    AllokSize slab_used_size;
+    AllokSize limit;
+} HeapWalkTotals;
+
+AllokBool heap_walk_count(const AkHeapEntry *p_entry, void *p_user) {
+    HeapWalkTotals *totals = p_user;
+    totals->entry_count++;
+    switch (p_entry->type) {
+        case ALLOK_HEAP_ENTRY_POOL: {
+            totals->pool_count++;
+            break;
+        }
+        case ALLOK_HEAP_ENTRY_BLOCK: {
+            EXPECT(p_entry->p_pool != ALLOK_NULL && is_ptr_in_range(p_entry->p_start, p_entry->p_pool->p_start, p_entry->p_pool->alloc_size), "walk block outside its pool");
+            totals->block_count++;
+            totals->block_size += p_entry->size;
+            break;
+        }
+        case ALLOK_HEAP_ENTRY_GAP: {
+            totals->gap_size += p_entry->size;
+            break;
+        }
+        case ALLOK_HEAP_ENTRY_LARGE_BLOCK: {
+            totals->large_count++;
+            break;
+        }
+        case ALLOK_HEAP_ENTRY_SLAB_PAGE: {
+            totals->slab_used_size += p_entry->used_size;
+            break;
+        }
+    }
+    return totals->limit == 0 || totals->entry_count < totals->limit ? ALLOK_TRUE : ALLOK_FALSE;
+}
+
+void check_heap_report(const AllokType type) {
+    akInit(ALLOK_DEFAULT_POOL_COUNT, ALLOK_DEFAULT_POOL_SIZE, (AkMemoryMapParams){type, ALLOK_TRUE, ALLOK_TRUE, ALLOK_FALSE, ALLOK_FALSE, ALLOK_DEFAULT_LARGE_THRESHOLD});
+
+    void *ptrs[400];
+    for (int i = 0; i < 400; i++) {
+        EXPECT(akAlloc(&ptrs[i], i % 5 == 0 ? 64 : 300 + (AllokSize)i * 7) == ALLOK_SUCCESS, "alloc");
+    }
+    void *large;
+    EXPECT(akAlloc(&large, ALLOK_DEFAULT_LARGE_THRESHOLD) == ALLOK_SUCCESS, "large alloc");
+
+    // Freeing every third block fragments the pools
+    for (int i = 0; i < 400; i += 3) {
+        EXPECT(akFree(&ptrs[i]) == ALLOK_SUCCESS, "free");
+    }
+
+    HeapWalkTotals totals = {};
+    EXPECT(akHeapWalk(heap_walk_count, &totals) == ALLOK_SUCCESS, "heap walk");
+
+    AkMemoryMapReport report;
+    EXPECT(akGetHeapReport(&report) == ALLOK_SUCCESS, "heap report");
+    const AkMemoryMapMetadata metadata = akGetAllocMetadata();
+
+    EXPECT(totals.pool_count == report.pool_count && report.pool_count == metadata.pool_count, "report pool count");
+    EXPECT(totals.block_count == metadata.block_count, "walk block count");
+    EXPECT(totals.block_size + totals.slab_used_size + ALLOK_DEFAULT_LARGE_THRESHOLD == metadata.alloc_size, "walk sizes");
+    EXPECT(totals.large_count == 1 && report.large_block_count == 1 && report.large_block_size == ALLOK_DEFAULT_LARGE_THRESHOLD, "report large blocks");
+    EXPECT(totals.slab_used_size == report.slab_used_size, "report slab size");
+    EXPECT(totals.gap_size == report.pool_free_size, "walk gaps");
+    EXPECT(report.pool_used_size + report.pool_free_size == report.pool_size, "report pool size");
+    EXPECT(report.gap_size <= report.pool_free_size && report.largest_gap <= report.gap_size, "report gap size");
+    EXPECT(report.external_fragmentation >= 0.0 && report.external_fragmentation < 1.0, "report fragmentation");
+    EXPECT(report.min_pool_utilization <= report.max_pool_utilization && report.max_pool_utilization <= 1.0, "report utilization");
+    EXPECT(report.header_overhead > 0.0 && report.header_overhead < 1.0, "report header overhead");
+
+    AllokSize gap_count = 0;
+    AllokSize pool_count = 0;
+    for (int i = 0; i < ALLOK_REPORT_GAP_BUCKET_COUNT; i++) {
+        gap_count += report.gap_histogram[i];
+    }
+    for (int i = 0; i < ALLOK_REPORT_UTILIZATION_BUCKET_COUNT; i++) {
+        pool_count += report.pool_utilization_histogram[i];
+    }
+    EXPECT(gap_count == report.gap_count && pool_count == report.pool_count, "report histograms");
+
+    // Returning ALLOK_FALSE stops the walk
+    totals = (HeapWalkTotals){.limit = 3};
+    EXPECT(akHeapWalk(heap_walk_count, &totals) == ALLOK_SUCCESS && totals.entry_count == 3, "heap walk stop");
+
+    for (int i = 0; i < 400; i++) {
+        if (ptrs[i] != ALLOK_NULL) {
+            EXPECT(akFree(&ptrs[i]) == ALLOK_SUCCESS, "free");
+        }
+    }
+    EXPECT(akFree(&large) == ALLOK_SUCCESS, "large free");
+    akDump();
+}
+
+void check_stats() {
+    akInit(ALLOK_DEFAULT_POOL_COUNT, ALLOK_DEFAULT_POOL_SIZE, (AkMemoryMapParams){ALLOK_BEST_FIT, ALLOK_TRUE, ALLOK_TRUE, ALLOK_FALSE, ALLOK_FALSE, ALLOK_DEFAULT_LARGE_THRESHOLD});
+
+    void *ptrs[3];
+    EXPECT(akAlloc(&ptrs[0], 96) == ALLOK_SUCCESS && akAlloc(&ptrs[1], 1000) == ALLOK_SUCCESS && akAlloc(&ptrs[2], ALLOK_DEFAULT_LARGE_THRESHOLD) == ALLOK_SUCCESS, "alloc");
+    const AllokSize peak = 96 + 1000 + ALLOK_DEFAULT_LARGE_THRESHOLD;
+    EXPECT(akGetTotalAllocSize() == peak && akGetTotalBlockCount() == 1 && akGetTotalPoolCount() == 1, "live counters");
+
+    AllokSize usable[3];
+    for (int i = 0; i < 3; i++) {
+        EXPECT(akGetUsableSize(&usable[i], ptrs[i]) == ALLOK_SUCCESS, "usable size");
+    }
+    EXPECT(usable[0] == 96 && usable[1] == 1000 && usable[2] == ALLOK_DEFAULT_LARGE_THRESHOLD, "usable size of slab, block and large block");
+
+    void *failed;
+    EXPECT(akAlloc(&failed, (AllokSize)-1 / 2) != ALLOK_SUCCESS, "oversized alloc");
+    EXPECT(akFreeBatch(ptrs, 3) == ALLOK_SUCCESS, "batch free");
+
+    const AkMemoryMapMetadata metadata = akGetAllocMetadata();
+    EXPECT(metadata.alloc_size == 0 && metadata.peak_alloc_size == peak, "peak counter");
+    EXPECT(metadata.allocs_failed == 1, "failed alloc counter");
+    EXPECT(metadata.mapped_size > 0 && metadata.large_block_count == 0 && metadata.slab_object_count == 0, "mapped counter");
+    check_map(g_map);
+    akDump();
+}
+
+void check_batch(const AllokType type) {
+    akInit(ALLOK_DEFAULT_POOL_COUNT, ALLOK_DEFAULT_POOL_SIZE, (AkMemoryMapParams){type, ALLOK_TRUE, ALLOK_TRUE, ALLOK_FALSE, ALLOK_FALSE, ALLOK_DEFAULT_LARGE_THRESHOLD});
+
+    // A batch of pool sized blocks is carved into a single new pool
+    AllokByte *ptrs[500];
+    EXPECT(akAllocBatch(VPTR(ptrs), 500, 300) == ALLOK_SUCCESS, "batch alloc");
+    EXPECT(akGetTotalPoolCount() == 1 && akGetTotalBlockCount() == 500 && g_map->metadata.blocks_created == 500, "batch pool count");
+    for (int i = 0; i < 500; i++) {
+        EXPECT((AllokSize)ptrs[i] % ALLOK_DEFAULT_ALIGNMENT == 0, "batch alignment");
+        EXPECT(i == 0 || ptrs[i] > ptrs[i - 1] + 300, "batch overlap");
+        ptrs[i][0] = (AllokByte)i;
+        ptrs[i][299] = (AllokByte)i;
+    }
+    check_map(g_map);
+
+    // Freeing every other block leaves gaps a second batch fills without a new pool
+    for (int i = 0; i < 500; i += 2) {
+        EXPECT(akFree(VPTR(ptrs[i])) == ALLOK_SUCCESS, "free");
+    }
+    check_map(g_map);
+    AllokByte *refill[250];
+    EXPECT(akAllocBatch(VPTR(refill), 250, 300) == ALLOK_SUCCESS, "batch refill");
+    EXPECT(type == ALLOK_LINEAR_FIT || akGetTotalPoolCount() == 1, "batch refill mapped a pool");
+    check_map(g_map);
+    for (int i = 1; i < 500; i += 2) {
+        EXPECT(ptrs[i][0] == (AllokByte)i && ptrs[i][299] == (AllokByte)i, "batch data corrupted");
+    }
+
+    EXPECT(akFreeBatch(VPTR(refill), 250) == ALLOK_SUCCESS, "batch free");
+    EXPECT(akFreeBatch(VPTR(ptrs), 500) == ALLOK_SUCCESS, "batch free");
+    for (int i = 0; i < 500; i++) {
+        EXPECT(ptrs[i] == ALLOK_NULL && (i >= 250 || refill[i] == ALLOK_NULL), "batch free cleared");
+    }
+    check_map(g_map);
+
+    // Slab and large sizes go through the regular paths, and bad pointers don't stop the rest of a batch
+    void *mixed[4];
+    EXPECT(akAllocBatch(mixed, 2, 64) == ALLOK_SUCCESS, "batch slab alloc");
+    EXPECT(akAllocBatch(&mixed[2], 2, ALLOK_DEFAULT_LARGE_THRESHOLD) == ALLOK_SUCCESS, "batch large alloc");
+    EXPECT(g_map->large_count == 2, "batch large count");
+    void *stale = mixed[0];
+    EXPECT(akFreeBatch(mixed, 4) == ALLOK_SUCCESS, "batch mixed free");
+    EXPECT(akFreeBatch(&stale, 1) == ALLOK_INVALID_ADDR, "batch double free");
+
+    EXPECT(akGetTotalPoolCount() == 0 && akGetTotalAllocSize() == 0 && g_map->large_count == 0, "batch leaked");
+    akDump();
+}
+
+AllokSize arena_chunk_count(const AkMemoryArena *p_arena) {
+    AllokSize count = 0;
+    for (const AkMemoryArena *chunk = p_arena; chunk != ALLOK_NULL; chunk = chunk->p_next) {
+        EXPECT(chunk->p_next == ALLOK_NULL || chunk->p_next->p_prev == chunk, "arena chunk links");
+        EXPECT(chunk->size <= chunk->alloc_size, "arena chunk overflow");
+        count++;
+    }
+    return count;
+}
+
+#if __APPLE__ || __linux__
+#define TRACE_THREAD_COUNT 4
+#define TRACE_THREAD_ROUNDS 2000
+
+void *trace_churn(void *p_arg) {
+    (void)p_arg;
+    for (int i = 0; i < TRACE_THREAD_ROUNDS; i++) {
+        void *ptr;
+        EXPECT(akAlloc(&ptr, 64) == ALLOK_SUCCESS && akFree(&ptr) == ALLOK_SUCCESS, "traced thread alloc");
+    }
+    akThreadCacheFlush();
+
+    return ALLOK_NULL;
+}
+
+// Threads keep recording while the other buffer is written, so every event reaches the file exactly once
+void check_trace_threads(const AllokType type) {
+    akInit(ALLOK_DEFAULT_POOL_COUNT, ALLOK_DEFAULT_POOL_SIZE, (AkMemoryMapParams){type, ALLOK_TRUE, ALLOK_TRUE, ALLOK_TRUE, ALLOK_FALSE, ALLOK_DEFAULT_LARGE_THRESHOLD});
+
+    char path[64];
+    snprintf(path, sizeof(path), "allok_trace_threads_%d.bin", type);
+    EXPECT(akTraceStart(path, 16) == ALLOK_SUCCESS, "trace start");
+
+    pthread_t threads[TRACE_THREAD_COUNT];
+    for (int i = 0; i < TRACE_THREAD_COUNT; i++) {
+        EXPECT(pthread_create(&threads[i], ALLOK_NULL, trace_churn, ALLOK_NULL) == 0, "traced thread");
+    }
+    for (int i = 0; i < 100; i++) {
+        EXPECT(akTraceFlush() == ALLOK_SUCCESS, "trace flush while recording");
+    }
+    for (int i = 0; i < TRACE_THREAD_COUNT; i++) {
+        pthread_join(threads[i], ALLOK_NULL);
+    }
+    EXPECT(akTraceStop() == ALLOK_SUCCESS, "trace stop");
+
+    FILE *file = fopen(path, "rb");
+    EXPECT(file != ALLOK_NULL, "trace file");
+    AkTraceHeader header;
+    EXPECT(fread(&header, sizeof(header), 1, file) == 1, "trace header");
+
+    // Each thread's own events stay in the order it made them
+    unsigned long long last[TRACE_THREAD_COUNT + 1] = {};
+    AllokSize count = 0;
+    AkTraceEvent event;
+    while (fread(&event, sizeof(event), 1, file) == 1) {
+        const unsigned int slot = event.thread % (TRACE_THREAD_COUNT + 1);
+        EXPECT(event.timestamp >= last[slot], "trace thread order");
+        last[slot] = event.timestamp;
+        count++;
+    }
+    fclose(file);
+    remove(path);
+    EXPECT(count == TRACE_THREAD_COUNT * TRACE_THREAD_ROUNDS * 2, "trace threaded event count");
+
+    check_map(g_map);
+    akDump();
+}
+#endif
+
+void check_trace(const AllokType type) {
+    akInit(ALLOK_DEFAULT_POOL_COUNT, ALLOK_DEFAULT_POOL_SIZE, (AkMemoryMapParams){type, ALLOK_TRUE, ALLOK_TRUE, ALLOK_FALSE, ALLOK_FALSE, ALLOK_DEFAULT_LARGE_THRESHOLD});
+
+    // A buffer of 4 events is written out several times over the run
+    char path[64];
+    snprintf(path, sizeof(path), "allok_trace_%d.bin", type);
+    EXPECT(akTraceStart(path, 4) == ALLOK_SUCCESS, "trace start");
+
+    void *ptrs[4];
+    void *moved;
+    EXPECT(akAlloc(&ptrs[0], 100) == ALLOK_SUCCESS && akCalloc(&ptrs[1], 2000) == ALLOK_SUCCESS, "alloc");
+    EXPECT(akAllocAligned(&ptrs[2], 64, 256) == ALLOK_SUCCESS && akAllocBatch(&ptrs[3], 1, 48) == ALLOK_SUCCESS, "aligned alloc");
+    EXPECT(akRealloc(&moved, ptrs[1], 5000) == ALLOK_SUCCESS, "realloc");
+    const void *ids[] = {ptrs[0], ptrs[1], ptrs[2], ptrs[3], moved, ptrs[0], moved};
+    EXPECT(akFree(&ptrs[0]) == ALLOK_SUCCESS && akFree(&moved) == ALLOK_SUCCESS, "free");
+    EXPECT(akTraceStop() == ALLOK_SUCCESS, "trace stop");
+
+    // Untraced once stopped
+    EXPECT(akFreeBatch(&ptrs[2], 2) == ALLOK_SUCCESS, "batch free");
+    EXPECT(akTraceStop() == ALLOK_UNINITIALIZED, "trace stopped twice");
+
+    FILE *file = fopen(path, "rb");
+    EXPECT(file != ALLOK_NULL, "trace file");
+    AkTraceHeader header;
+    AkTraceEvent events[8];
+    EXPECT(fread(&header, sizeof(header), 1, file) == 1 && header.magic == ALLOK_TRACE_MAGIC && header.version == ALLOK_TRACE_VERSION && header.event_size == sizeof(AkTraceEvent), "trace header");
+    EXPECT(fread(events, sizeof(AkTraceEvent), 8, file) == 7, "trace event count");
+    fclose(file);
+    remove(path);
+
+    const AllokTraceOp ops[] = {ALLOK_TRACE_ALLOC, ALLOK_TRACE_CALLOC, ALLOK_TRACE_ALLOC, ALLOK_TRACE_ALLOC, ALLOK_TRACE_REALLOC, ALLOK_TRACE_FREE, ALLOK_TRACE_FREE};
+    const AllokSize sizes[] = {100, 2000, 64, 48, 5000, 0, 0};
+    for (int i = 0; i < 7; i++) {
+        EXPECT(events[i].op == ops[i] && events[i].size == sizes[i] && events[i].id == (unsigned long long)(AllokSize)ids[i], "trace event");
+        EXPECT(events[i].thread == events[0].thread && events[i].thread != 0, "trace thread");
+        EXPECT(i == 0 || events[i].timestamp >= events[i - 1].timestamp, "trace timestamp order");
+    }
+    EXPECT(events[2].alignment_shift == 8 && events[0].alignment_shift == 4, "trace alignment");
+    EXPECT(events[4].src_id == (unsigned long long)(AllokSize)ptrs[1], "trace realloc source");
+
+    check_map(g_map);
+    akDump();
+}
+
+void check_heaps(const AllokType type) {
+    // Two heaps side by side, each searching with its own strategy, and no global MemoryMap at all
+    AkMemoryMap *heaps[2];
+    AkMemoryArena *arenas[2];
+    const AllokType types[2] = {ALLOK_BEST_FIT, ALLOK_WORST_FIT};
+    for (int h = 0; h < 2; h++) {
+        EXPECT(akMemoryMapAlloc(&heaps[h], &arenas[h], 1, ALLOK_DEFAULT_POOL_SIZE, (AkMemoryMapParams){types[h], ALLOK_FALSE, ALLOK_FALSE, ALLOK_FALSE, ALLOK_FALSE}) == ALLOK_SUCCESS, "heap alloc");
+    }
+
+    AllokByte *ptrs[2][5];
+    for (int h = 0; h < 2; h++) {
+        const AllokSize sizes[5] = {100, 100, 100, 400, 100};
+        for (int i = 0; i < 5; i++) {
+            EXPECT(akHeapAlloc(VPTR(ptrs[h][i]), heaps[h], sizes[i]) == ALLOK_SUCCESS, "heap alloc block");
+        }
+        EXPECT(akHeapFree(VPTR(ptrs[h][1]), heaps[h]) == ALLOK_SUCCESS && akHeapFree(VPTR(ptrs[h][3]), heaps[h]) == ALLOK_SUCCESS, "heap free");
+        EXPECT(ptrs[h][1] == ALLOK_NULL, "heap free sets null");
+    }
+
+    // Best fit takes the smallest gap, worst fit the tail of the pool
+    AllokByte *fit[2];
+    for (int h = 0; h < 2; h++) {
+        EXPECT(akHeapAlloc(VPTR(fit[h]), heaps[h], 50) == ALLOK_SUCCESS, "heap fit");
+        check_map(heaps[h]);
+    }
+    EXPECT(fit[0] > ptrs[0][0] && fit[0] < ptrs[0][2], "best fit heap");
+    EXPECT(fit[1] > ptrs[1][4], "worst fit heap");
+
+    AllokByte *grown;
+    ptrs[0][0][0] = 42;
+    EXPECT(akHeapRealloc(VPTR(grown), heaps[0], ptrs[0][0], 3000) == ALLOK_SUCCESS && grown[0] == 42, "heap realloc");
+    EXPECT(akHeapRealloc(VPTR(grown), heaps[1], grown, 4000) != ALLOK_SUCCESS, "heap realloc from another heap");
+    AllokByte *zeroed;
+    EXPECT(akHeapCalloc(VPTR(zeroed), heaps[1], 64) == ALLOK_SUCCESS && zeroed[63] == 0, "heap calloc");
+    EXPECT(heaps[0]->metadata.block_count == 4 && heaps[1]->metadata.block_count == 5, "heap block counts");
+    EXPECT(g_map == ALLOK_NULL, "heaps touched the global map");
+
+    // Strategy of the caller's own type, torn down with live blocks
+    AkMemoryMap *heap;
+    AkMemoryArena *arena;
+    EXPECT(akMemoryMapAlloc(&heap, &arena, 0, ALLOK_DEFAULT_POOL_SIZE, (AkMemoryMapParams){type, ALLOK_TRUE, ALLOK_TRUE, ALLOK_TRUE, ALLOK_FALSE, ALLOK_DEFAULT_LARGE_THRESHOLD}) == ALLOK_SUCCESS, "heap alloc");
+    void *live[3];
+    EXPECT(akHeapAlloc(&live[0], heap, 32) == ALLOK_SUCCESS && akHeapAlloc(&live[1], heap, 3000) == ALLOK_SUCCESS && akHeapAlloc(&live[2], heap, ALLOK_DEFAULT_LARGE_THRESHOLD) == ALLOK_SUCCESS, "heap alloc kinds");
+    check_map(heap);
+
+    akMemoryMapDestroy(&heap, &arena);
+    EXPECT(heap == ALLOK_NULL && arena == ALLOK_NULL, "heap destroy");
+    for (int h = 0; h < 2; h++) {
+        akMemoryMapDestroy(&heaps[h], &arenas[h]);
+    }
+}
+
+void check_remote_free(const AllokType type) {
+    AkMemoryMap *heap;
+    AkMemoryArena *arena;
+    EXPECT(akMemoryMapAlloc(&heap, &arena, 0, ALLOK_DEFAULT_POOL_SIZE, (AkMemoryMapParams){type, ALLOK_TRUE, ALLOK_TRUE, ALLOK_FALSE, ALLOK_FALSE, ALLOK_DEFAULT_LARGE_THRESHOLD}) == ALLOK_SUCCESS, "heap alloc");
+    EXPECT(akHeapSetOwner(heap) == ALLOK_SUCCESS, "heap owner");
+
+    void *ptrs[4];
+    EXPECT(akHeapAlloc(&ptrs[0], heap, 32) == ALLOK_SUCCESS && akHeapAlloc(&ptrs[1], heap, 3000) == ALLOK_SUCCESS && akHeapAlloc(&ptrs[2], heap, ALLOK_DEFAULT_LARGE_THRESHOLD) == ALLOK_SUCCESS, "heap alloc kinds");
+    EXPECT(akHeapAllocAligned(&ptrs[3], heap, ALLOK_DEFAULT_LARGE_THRESHOLD, 64 * 1024) == ALLOK_SUCCESS, "heap alloc aligned large");
+    AllokByte *live;
+    EXPECT(akHeapAlloc(VPTR(live), heap, 64) == ALLOK_SUCCESS, "heap alloc");
+
+    // Hand ownership to another thread token so this thread's calls are the foreign ones
+    static AllokByte other_thread;
+    void *owner = heap->p_owner;
+    heap->p_owner = &other_thread;
+
+    void *foreign;
+    EXPECT(akHeapAlloc(&foreign, heap, 64) == ALLOK_UNSUPPORTED, "foreign alloc");
+    void *stale[4] = {ptrs[0], ptrs[1], ptrs[2], ptrs[3]};
+    for (int i = 0; i < 4; i++) {
+        EXPECT(akHeapFree(&ptrs[i], heap) == ALLOK_SUCCESS && ptrs[i] == ALLOK_NULL, "remote free");
+    }
+    EXPECT(heap->p_remote_head == stale[0] && heap->metadata.slab_object_count == 2, "remote free queued the slab object");
+    EXPECT(heap->p_remote_block_head != ALLOK_NULL && heap->metadata.block_count == 1 && heap->metadata.large_block_count == 2, "remote free queued the larger blocks");
+    void *block_head = heap->p_remote_block_head;
+
+    // Pointers the heap doesn't own and second frees are rejected without being written to
+    AkMemoryMap *other;
+    AkMemoryArena *other_arena;
+    EXPECT(akMemoryMapAlloc(&other, &other_arena, 0, ALLOK_DEFAULT_POOL_SIZE, (AkMemoryMapParams){type, ALLOK_TRUE, ALLOK_TRUE, ALLOK_FALSE, ALLOK_FALSE, ALLOK_DEFAULT_LARGE_THRESHOLD}) == ALLOK_SUCCESS, "other heap alloc");
+    AllokByte *others[3];
+    EXPECT(akHeapAlloc(VPTR(others[0]), other, 32) == ALLOK_SUCCESS && akHeapAlloc(VPTR(others[1]), other, 3000) == ALLOK_SUCCESS && akHeapAlloc(VPTR(others[2]), other, ALLOK_DEFAULT_LARGE_THRESHOLD) == ALLOK_SUCCESS, "other heap alloc kinds");
+    for (int i = 0; i < 3; i++) {
+        memset(others[i], 0x5A, 16);
+        void *target = others[i];
+        EXPECT(akHeapFree(&target, heap) == ALLOK_NOT_FOUND && target == others[i], "remote free of a foreign pointer");
+        for (int b = 0; b < 16; b++) {
+            EXPECT(others[i][b] == 0x5A, "remote free wrote to a foreign pointer");
+        }
+    }
+    for (int i = 0; i < 4; i++) {
+        EXPECT(akHeapFree(&stale[i], heap) == ALLOK_INVALID_ADDR && stale[i] != ALLOK_NULL, "remote double free");
+    }
+    void *interior = live + 16;
+    EXPECT(akHeapFree(&interior, heap) == ALLOK_INVALID_ADDR, "remote free of an interior pointer");
+    EXPECT(heap->p_remote_head == stale[0] && *(void **)stale[0] == ALLOK_NULL && heap->p_remote_block_head == block_head, "remote queue untouched by rejected frees");
+    akMemoryMapDestroy(&other, &other_arena);
+    EXPECT(akHeapCollect(heap) == ALLOK_UNSUPPORTED, "foreign collect");
+
+    // Queued blocks are already gone as far as the owner is concerned
+    heap->p_owner = owner;
+    AkMemoryBlock *block;
+    AkLargeBlock *large;
+    EXPECT(akMemoryBlockFromPtr(&block, heap, stale[1]) == ALLOK_INVALID_ADDR && akLargeBlockFind(&large, heap, stale[2]) == ALLOK_INVALID_ADDR, "queued blocks hidden from the owner");
+
+    // The owner's next alloc drains both queues in one go
+    void *next;
+    EXPECT(akHeapAlloc(&next, heap, 48) == ALLOK_SUCCESS, "owner alloc");
+    EXPECT(heap->p_remote_head == ALLOK_NULL && heap->p_remote_block_head == ALLOK_NULL && heap->metadata.remote_frees == 4, "remote queue drained");
+    EXPECT(akHeapFree(VPTR(live), heap) == ALLOK_SUCCESS, "owner free");
+    EXPECT(heap->metadata.block_count == 0 && heap->metadata.large_block_count == 0 && heap->metadata.slab_object_count == 1, "remote frees released");
+    check_map(heap);
+
+    EXPECT(akHeapFree(&next, heap) == ALLOK_SUCCESS && heap->metadata.slab_object_count == 0, "owner free");
+    EXPECT(akHeapCollect(heap) == ALLOK_SUCCESS, "owner collect");
+    akMemoryMapDestroy(&heap, &arena);
+}
+
+#if __APPLE__ || __linux__
+#define CACHE_THREAD_COUNT 4
+#define CACHE_THREAD_SLOTS 256
+
+// Every object is filled with a byte unique to its thread and slot, so an object handed out twice shows up on free
+void *thread_cache_churn(void *p_arg) {
+    const AllokSize tag = (AllokSize)p_arg;
+    AllokByte *ptrs[CACHE_THREAD_SLOTS] = {};
+    AllokSize sizes[CACHE_THREAD_SLOTS] = {};
+    unsigned int seed = (unsigned int)tag * 7919u + 1u;
+
+    for (int round = 0; round < 20000; round++) {
+        seed = seed * 1103515245u + 12345u;
+        const AllokSize slot = (seed >> 8) % CACHE_THREAD_SLOTS;
+        const AllokByte fill = (AllokByte)(tag * CACHE_THREAD_SLOTS + slot);
+        if (ptrs[slot] != ALLOK_NULL) {
+            for (AllokSize i = 0; i < sizes[slot]; i++) {
+                EXPECT(ptrs[slot][i] == fill, "thread cache object overlap");
+            }
+            EXPECT(akFree(VPTR(ptrs[slot])) == ALLOK_SUCCESS, "thread cache free");
+        } else {
+            sizes[slot] = ALLOK_SLAB_GRANULARITY * (1 + (seed >> 16) % ALLOK_SLAB_CLASS_COUNT);
+            EXPECT(akAlloc(VPTR(ptrs[slot]), sizes[slot]) == ALLOK_SUCCESS, "thread cache alloc");
+            memset(ptrs[slot], fill, sizes[slot]);
+        }
+
+        for (AllokSize i = 0; i < ALLOK_SLAB_CLASS_COUNT; i++) {
+            EXPECT(thread_cache_get()->bins[i].count <= ALLOK_THREAD_CACHE_MAX, "thread cache bin bound");
+        }
+    }
+
+    for (AllokSize slot = 0; slot < CACHE_THREAD_SLOTS; slot++) {
+        if (ptrs[slot] != ALLOK_NULL) {
+            EXPECT(akFree(VPTR(ptrs[slot])) == ALLOK_SUCCESS, "thread cache free");
+        }
+    }
+    akThreadCacheFlush();
+    for (AllokSize i = 0; i < ALLOK_SLAB_CLASS_COUNT; i++) {
+        EXPECT(thread_cache_get()->bins[i].count == 0 && thread_cache_get()->bins[i].p_head == ALLOK_NULL, "thread cache flushed");
+    }
+
+    return ALLOK_NULL;
+}
+
+// Leaves its objects in the thread's cache, the exit hook has to hand them back
+void *thread_cache_abandon(void *p_arg) {
+    (void)p_arg;
+    void *ptrs[ALLOK_THREAD_CACHE_BATCH];
+    for (AllokSize i = 0; i < ALLOK_THREAD_CACHE_BATCH; i++) {
+        EXPECT(akAlloc(&ptrs[i], 64) == ALLOK_SUCCESS, "abandoned thread alloc");
+    }
+    for (AllokSize i = 0; i < ALLOK_THREAD_CACHE_BATCH; i++) {
+        EXPECT(akFree(&ptrs[i]) == ALLOK_SUCCESS, "abandoned thread free");
+    }
+    EXPECT(t_cache.bins[slab_class_index(64)].count > 0, "abandoned thread cached");
+
+    return ALLOK_NULL;
+}
+#endif
+
+void check_thread_cache(const AllokType type) {
+#if __APPLE__ || __linux__
+    const AkMemoryMapParams params = {type, ALLOK_TRUE, ALLOK_TRUE, ALLOK_TRUE, ALLOK_FALSE, ALLOK_DEFAULT_LARGE_THRESHOLD, ALLOK_HUGE_PAGES_NONE, 0, 0, ALLOK_FALSE};
+    akInit(ALLOK_DEFAULT_POOL_COUNT, ALLOK_DEFAULT_POOL_SIZE, params);
+    EXPECT(g_map->p_cpu_caches == ALLOK_NULL, "thread cache mode");
+
+    pthread_t threads[CACHE_THREAD_COUNT];
+    for (AllokSize i = 0; i < CACHE_THREAD_COUNT; i++) {
+        EXPECT(pthread_create(&threads[i], ALLOK_NULL, thread_cache_churn, (void *)i) == 0, "thread cache thread");
+    }
+    for (AllokSize i = 0; i < CACHE_THREAD_COUNT; i++) {
+        pthread_join(threads[i], ALLOK_NULL);
+    }
+
+    // Every object went back through a flush, none are stranded in a cache
+    akThreadCacheFlush();
+    EXPECT(g_map->metadata.slab_object_count == 0, "thread cache objects returned");
+    check_map(g_map);
+
+    // A thread that exits without akThreadCacheFlush gives its objects back through the exit hook
+    EXPECT(akThreadCacheFlushOnExit() == ALLOK_SUCCESS && akThreadCacheFlushOnExit() == ALLOK_SUCCESS, "thread cache exit hook");
+    pthread_t abandon;
+    EXPECT(pthread_create(&abandon, ALLOK_NULL, thread_cache_abandon, ALLOK_NULL) == 0, "abandoned thread");
+    pthread_join(abandon, ALLOK_NULL);
+    EXPECT(g_map->metadata.slab_object_count == 0, "exited thread objects returned");
+    check_map(g_map);
+
+    // Objects left in this thread's cache belong to the map akDump releases, the next map refills from its own slab
+    void *ptr;
+    EXPECT(akAlloc(&ptr, 64) == ALLOK_SUCCESS && akFree(&ptr) == ALLOK_SUCCESS, "thread cache fill");
+    const AllokSize bin = slab_class_index(64);
+    EXPECT(t_cache.bins[bin].count == ALLOK_THREAD_CACHE_BATCH && g_map->metadata.slab_object_count == ALLOK_THREAD_CACHE_BATCH, "thread cache filled");
+    akDump();
+
+    akInit(ALLOK_DEFAULT_POOL_COUNT, ALLOK_DEFAULT_POOL_SIZE, params);
+    EXPECT(akAlloc(&ptr, 64) == ALLOK_SUCCESS, "thread cache alloc after akInit");
+    EXPECT(g_map->metadata.slab_object_count == ALLOK_THREAD_CACHE_BATCH && t_cache.bins[bin].count == ALLOK_THREAD_CACHE_BATCH - 1, "stale thread cache dropped");
+    EXPECT(akFree(&ptr) == ALLOK_SUCCESS, "thread cache free after akInit");
+    akThreadCacheFlush();
+    EXPECT(g_map->metadata.slab_object_count == 0, "thread cache objects returned");
+    check_map(g_map);
+
+    akDump();
+#else
+    (void)type;
+#endif
+}
+
+void check_per_cpu(const AllokType type) {
+    akInit(ALLOK_DEFAULT_POOL_COUNT, ALLOK_DEFAULT_POOL_SIZE, (AkMemoryMapParams){type, ALLOK_TRUE, ALLOK_TRUE, ALLOK_FALSE, ALLOK_FALSE, ALLOK_DEFAULT_LARGE_THRESHOLD, ALLOK_HUGE_PAGES_NONE, 0, 0, ALLOK_TRUE});
+    EXPECT(g_map->p_cpu_caches == ALLOK_NULL, "per-cpu caches without thread safety");
+    akDump();
+
+    akInit(ALLOK_DEFAULT_POOL_COUNT, ALLOK_DEFAULT_POOL_SIZE, (AkMemoryMapParams){type, ALLOK_TRUE, ALLOK_TRUE, ALLOK_TRUE, ALLOK_FALSE, ALLOK_DEFAULT_LARGE_THRESHOLD, ALLOK_HUGE_PAGES_NONE, 0, 0, ALLOK_TRUE});
+    EXPECT(g_map->p_cpu_caches != ALLOK_NULL && g_map->cpu_count > 0, "per-cpu caches");
+
+    AllokByte *ptrs[200];
+    for (int i = 0; i < 200; i++) {
+        EXPECT(akAlloc(VPTR(ptrs[i]), 16 + (AllokSize)(i % 8) * 24) == ALLOK_SUCCESS, "per-cpu alloc");
+        ptrs[i][0] = (AllokByte)i;
+    }
+    for (int i = 0; i < 200; i++) {
+        EXPECT(ptrs[i][0] == (AllokByte)i, "per-cpu object overlap");
+        EXPECT(akFree(VPTR(ptrs[i])) == ALLOK_SUCCESS && ptrs[i] == ALLOK_NULL, "per-cpu free");
+    }
+
+    // Each bin stays bounded and the thread's own cache is never touched
+    AllokSize cached = 0;
+    for (AllokSize c = 0; c < g_map->cpu_count; c++) {
+        EXPECT(g_map->p_cpu_caches[c].lock.state == 0, "per-cpu cache left locked");
+        for (AllokSize i = 0; i < ALLOK_SLAB_CLASS_COUNT; i++) {
+            EXPECT(g_map->p_cpu_caches[c].bins[i].count <= ALLOK_THREAD_CACHE_MAX, "per-cpu bin bound");
+            cached += g_map->p_cpu_caches[c].bins[i].count;
+        }
+    }
+    for (AllokSize i = 0; i < ALLOK_SLAB_CLASS_COUNT; i++) {
+        EXPECT(thread_cache_get()->bins[i].count == 0, "per-cpu mode used the thread cache");
+    }
+    EXPECT(cached > 0 && g_map->metadata.slab_object_count == cached, "per-cpu cached objects");
+
+    // A busy cache falls back to the map lock
+    AkCpuCache *cache = &g_map->p_cpu_caches[os_cpu_current() % g_map->cpu_count];
+    cache->lock.state = 1;
+    void *ptr;
+    EXPECT(akAlloc(&ptr, 64) == ALLOK_SUCCESS && akFree(&ptr) == ALLOK_SUCCESS, "per-cpu fallback");
+    cache->lock.state = 0;
+    EXPECT(g_map->metadata.slab_object_count == cached, "per-cpu fallback counts");
+    check_map(g_map);
+
+    akDump();
+}
+
+void check_handles(const AllokType type) {
+    akInit(ALLOK_DEFAULT_POOL_COUNT, ALLOK_DEFAULT_POOL_SIZE, (AkMemoryMapParams){type, ALLOK_TRUE, ALLOK_TRUE, ALLOK_FALSE, ALLOK_FALSE, ALLOK_DEFAULT_LARGE_THRESHOLD, ALLOK_HUGE_PAGES_NONE, 0});
+
+    AkHandle *handles[64];
+    for (int i = 0; i < 64; i++) {
+        EXPECT(akHandleAlloc(&handles[i], 1000) == ALLOK_SUCCESS, "handle alloc");
+        AllokByte *data;
+        EXPECT(akHandleLock(VPTR(data), handles[i]) == ALLOK_SUCCESS, "handle lock");
+        EXPECT(akSlabPageFind(&(AkSlabPage *){0}, g_map, data) != ALLOK_SUCCESS, "handle memory in the slab");
+        for (int j = 0; j < 1000; j++) {
+            data[j] = (AllokByte)(i + j);
+        }
+        EXPECT(akHandleUnlock(handles[i]) == ALLOK_SUCCESS, "handle unlock");
+    }
+    EXPECT(g_map->handle_count == 64, "handle count");
+
+    // Leave every pool a quarter full, with one handle pinned in place
+    for (int i = 0; i < 64; i++) {
+        if (i % 4 != 0) {
+            EXPECT(akHandleFree(&handles[i]) == ALLOK_SUCCESS && handles[i] == ALLOK_NULL, "handle free");
+        }
+    }
+    void *pinned;
+    EXPECT(akHandleLock(&pinned, handles[8]) == ALLOK_SUCCESS, "handle pin");
+    EXPECT(akHandleFree(&handles[8]) == ALLOK_HANDLE_LOCKED, "locked handle freed");
+    check_map(g_map);
+
+    // Freeing the handle the cursor rests on moves the cursor past it
+    AkHandle *spare;
+    EXPECT(akHandleAlloc(&spare, 1000) == ALLOK_SUCCESS, "handle alloc");
+    AkHandle *after = spare->p_next;
+    g_map->p_compact_cursor = spare;
+    EXPECT(akHandleFree(&spare) == ALLOK_SUCCESS && g_map->p_compact_cursor == after, "compact cursor freed");
+
+    const AllokSize pool_count = g_map->pool_count;
+    const AllokSize alloc_size = g_map->metadata.alloc_size;
+    AllokSize moved;
+
+    // A budget of one byte moves a single handle and leaves the cursor behind it
+    const AllokSize handles_moved = g_map->metadata.handles_moved;
+    EXPECT(akCompact(&moved, 1) == ALLOK_SUCCESS && moved == 1000 && g_map->metadata.handles_moved == handles_moved + 1, "compact one handle");
+    AkHandle *cursor = g_map->p_compact_cursor;
+    EXPECT(akCompact(&moved, 1) == ALLOK_SUCCESS && moved == 1000 && g_map->p_compact_cursor != cursor, "compact resumes");
+    check_map(g_map);
+
+    int calls = 0;
+    do {
+        EXPECT(akCompact(&moved, 2048) == ALLOK_SUCCESS, "compact");
+        EXPECT(moved < 2048 + 1000, "compact budget");
+        check_map(g_map);
+        calls++;
+    } while (moved > 0 && calls < 1000);
+    EXPECT(moved == 0, "compact never settled");
+    EXPECT(g_map->metadata.alloc_size == alloc_size && g_map->metadata.handles_moved > 0, "compact moved handles");
+    EXPECT(g_map->pool_count < pool_count && g_map->metadata.pools_compacted > 0, "compact released pools");
+
+    for (int i = 0; i < 64; i += 4) {
+        AllokByte *data;
+        EXPECT(akHandleLock(VPTR(data), handles[i]) == ALLOK_SUCCESS, "handle lock");
+        EXPECT(i != 8 || data == pinned, "pinned handle moved");
+        for (int j = 0; j < 1000; j++) {
+            EXPECT(data[j] == (AllokByte)(i + j), "handle data lost");
+        }
+        EXPECT(akHandleUnlock(handles[i]) == ALLOK_SUCCESS, "handle unlock");
+    }
+
+    EXPECT(akHandleUnlock(handles[8]) == ALLOK_SUCCESS && akHandleUnlock(handles[8]) == ALLOK_INVALID_ADDR, "handle unlock balance");
+    for (int i = 0; i < 64; i += 4) {
+        EXPECT(akHandleFree(&handles[i]) == ALLOK_SUCCESS, "handle free");
+    }
+    EXPECT(g_map->handle_count == 0 && g_map->metadata.block_count == 0, "handles released");
+
+    akDump();
+}
+
+typedef struct MappedNode {
+    AllokSize next;
+    AllokSize value;
+} MappedNode;
+
+void check_mapped_heap(const AllokType type) {
+    char path[64];
+    snprintf(path, sizeof(path), "allok_mapped_heap_%d.bin", type);
+    remove(path);
+
+    AkMappedHeap *heap;
+    EXPECT(akMappedHeapOpenFile(&heap, path, 0) == ALLOK_INVALID_SIZE, "mapped heap too small");
+    remove(path);
+    EXPECT(akMappedHeapOpenFile(&heap, path, 256 * 1024) == ALLOK_SUCCESS, "mapped heap create");
+    AkMappedHeap *second;
+    EXPECT(akMappedHeapOpenFile(&second, path, 0) == ALLOK_OS_FILE_FAILED, "mapped heap opened twice");
+
+    // A list linked by offsets, with every other node freed to leave holes behind
+    MappedNode *nodes[200];
+    for (int i = 0; i < 200; i++) {
+        EXPECT(akMappedHeapAlloc(VPTR(nodes[i]), heap, sizeof(MappedNode) + (AllokSize)(i % 7) * 40) == ALLOK_SUCCESS, "mapped alloc");
+        nodes[i]->value = (AllokSize)i;
+        nodes[i]->next = 0;
+    }
+    for (int i = 1; i < 200; i += 2) {
+        EXPECT(akMappedHeapFree(VPTR(nodes[i]), heap) == ALLOK_SUCCESS && nodes[i] == ALLOK_NULL, "mapped free");
+    }
+    for (int i = 0; i + 2 < 200; i += 2) {
+        EXPECT(akMappedHeapToOffset(&nodes[i]->next, heap, nodes[i + 2]) == ALLOK_SUCCESS, "mapped offset");
+    }
+    void *stale = nodes[0];
+    EXPECT(akMappedHeapFree(&stale, heap) == ALLOK_SUCCESS && akMappedHeapFree(VPTR(nodes[0]), heap) == ALLOK_INVALID_ADDR, "mapped double free");
+
+    // Zeroed or header-like bytes inside an allocation are not a block
+    AllokByte *inner;
+    EXPECT(akMappedHeapAlloc(VPTR(inner), heap, 128) == ALLOK_SUCCESS, "mapped alloc");
+    memset(inner, 0, 128);
+    void *interior = inner + 32;
+    EXPECT(akMappedHeapFree(&interior, heap) == ALLOK_INVALID_ADDR, "mapped interior free");
+    ((AkMappedBlock *)(inner + 48))->size = 64;
+    ((AkMappedBlock *)(inner + 48))->prev_size = 16;
+    interior = inner + 64;
+    EXPECT(akMappedHeapFree(&interior, heap) == ALLOK_INVALID_ADDR, "mapped forged header free");
+    EXPECT(akMappedHeapCheck(heap) == ALLOK_SUCCESS, "mapped interior check");
+    EXPECT(akMappedHeapFree(VPTR(inner), heap) == ALLOK_SUCCESS, "mapped free");
+
+    // Holes are reused before the top grows
+    const unsigned long long top = heap->p_header->top;
+    EXPECT(akMappedHeapAlloc(VPTR(nodes[0]), heap, sizeof(MappedNode)) == ALLOK_SUCCESS && heap->p_header->top == top, "mapped hole reuse");
+    nodes[0]->value = 0;
+    EXPECT(akMappedHeapToOffset(&nodes[0]->next, heap, nodes[2]) == ALLOK_SUCCESS, "mapped offset");
+    EXPECT(akMappedHeapSetRoot(heap, nodes[0]) == ALLOK_SUCCESS, "mapped root");
+    void *big;
+    EXPECT(akMappedHeapAlloc(&big, heap, 1024 * 1024) == ALLOK_INSUFFICIENT_POOL_MEMORY, "mapped heap bound");
+    EXPECT(akMappedHeapCheck(heap) == ALLOK_SUCCESS, "mapped check");
+    const unsigned long long block_count = heap->p_header->block_count;
+    EXPECT(akMappedHeapSync(heap) == ALLOK_SUCCESS, "mapped sync");
+    EXPECT(akMappedHeapClose(&heap) == ALLOK_SUCCESS && heap == ALLOK_NULL, "mapped close");
+
+    // Re-attached, the list is found through the root at whatever address the file maps to now
+    EXPECT(akMappedHeapOpenFile(&heap, path, 0) == ALLOK_SUCCESS, "mapped reopen");
+    EXPECT(heap->p_header->block_count == block_count && akMappedHeapCheck(heap) == ALLOK_SUCCESS, "mapped reopen check");
+    MappedNode *node;
+    EXPECT(akMappedHeapGetRoot(VPTR(node), heap) == ALLOK_SUCCESS, "mapped get root");
+    for (AllokSize i = 0; i < 100; i++) {
+        EXPECT(node->value == i * 2, "mapped list value");
+        if (node->next != 0) {
+            EXPECT(akMappedHeapFromOffset(VPTR(node), heap, node->next) == ALLOK_SUCCESS, "mapped from offset");
+        } else {
+            EXPECT(i == 99, "mapped list length");
+        }
+    }
+
+    // Left open as if the process died, with the free lists lost, the next open rebuilds them from the blocks
+    unsigned long long free_heads[ALLOK_MAPPED_HEAP_CLASS_COUNT];
+    for (AllokSize i = 0; i < ALLOK_MAPPED_HEAP_CLASS_COUNT; i++) {
+        free_heads[i] = heap->p_header->free_heads[i];
+        heap->p_header->free_heads[i] = 0;
+    }
+    EXPECT(akMappedHeapCheck(heap) == ALLOK_HEAP_CORRUPTED, "mapped lost free lists");
+    heap->p_header->lock.state = 1;
+    mapped_heap_release(heap);
+    EXPECT(akMappedHeapOpenFile(&heap, path, 0) == ALLOK_SUCCESS && akMappedHeapCheck(heap) == ALLOK_SUCCESS, "mapped recovery");
+    for (AllokSize i = 0; i < ALLOK_MAPPED_HEAP_CLASS_COUNT; i++) {
+        EXPECT((heap->p_header->free_heads[i] == 0) == (free_heads[i] == 0), "mapped recovered free lists");
+    }
+
+    // Damage to a block header is caught by the check and by the next open after a crash
+    const unsigned long long root = heap->p_header->root;
+    AkMappedBlock *header = (AkMappedBlock *)((AllokByte *)heap->p_header + root) - 1;
+    const unsigned long long size = header->size;
+    header->size = 8;
+    EXPECT(akMappedHeapCheck(heap) == ALLOK_HEAP_CORRUPTED, "mapped corruption check");
+    mapped_heap_release(heap);
+    EXPECT(akMappedHeapOpenFile(&heap, path, 0) == ALLOK_HEAP_CORRUPTED, "mapped corrupted reopen");
+
+    AkOsFile file;
+    EXPECT(os_file_open(&file, path) == ALLOK_TRUE, "mapped file");
+    AkOsFile mapping;
+    AllokByte *base = os_file_map(file, &mapping, os_file_size(file));
+    ((AkMappedBlock *)(base + root) - 1)->size = size;
+    os_file_unmap(base, mapping, os_file_size(file));
+    os_file_close(file);
+
+    // Freeing everything merges the holes and hands the space back to the top
+    EXPECT(akMappedHeapOpenFile(&heap, path, 0) == ALLOK_SUCCESS, "mapped repaired reopen");
+    akMappedHeapGetRoot(VPTR(node), heap);
+    while (node != ALLOK_NULL) {
+        MappedNode *next = ALLOK_NULL;
+        if (node->next != 0) {
+            akMappedHeapFromOffset(VPTR(next), heap, node->next);
+        }
+        EXPECT(akMappedHeapFree(VPTR(node), heap) == ALLOK_SUCCESS, "mapped free list");
+        node = next;
+    }
+    EXPECT(akMappedHeapGetRoot(VPTR(node), heap) == ALLOK_NOT_FOUND, "mapped root freed");
+    EXPECT(heap->p_header->block_count == 0 && heap->p_header->alloc_size == 0 && heap->p_header->top == mapped_data_start(), "mapped heap drained");
+    EXPECT(akMappedHeapCheck(heap) == ALLOK_SUCCESS, "mapped drained check");
+    EXPECT(akMappedHeapClose(&heap) == ALLOK_SUCCESS, "mapped close");
+    remove(path);
+}
+
+#if __linux__
+#define SHARED_RACE_BLOCKS 32
+#define SHARED_RACE_ROUNDS 4000
+
+static AkMappedHeap *volatile g_race_heap;
+static void *g_race_ptrs[SHARED_RACE_BLOCKS];
+static volatile sig_atomic_t g_race_stale_frees;
+
+// A timer signal frees the drained blocks again with the lock-free half of akMappedHeapFree, which lands it inside
+// the drain at arbitrary points even on a single core
+void shared_race_probe(int signal) {
+    (void)signal;
+    AkMappedHeap *heap = g_race_heap;
+    if (heap == ALLOK_NULL) {
+        return;
+    }
+    for (int i = 0; i < SHARED_RACE_BLOCKS; i++) {
+        unsigned long long offset;
+        if (mapped_block_find(&offset, heap, g_race_ptrs[i]) == ALLOK_SUCCESS && mapped_remote_push(heap, offset) == ALLOK_SUCCESS) {
+            g_race_stale_frees++;
+        }
+    }
+}
+#endif
+
+void check_shared_heap(const AllokType type) {
+#if __linux__
+    AkMappedHeap *heap;
+    EXPECT(akMappedHeapOpenShared(&heap, ALLOK_NULL, 0) == ALLOK_INVALID_SIZE, "shared heap too small");
+    EXPECT(akMappedHeapOpenShared(&heap, ALLOK_NULL, 1024 * 1024) == ALLOK_SUCCESS, "shared heap create");
+
+    // A forked child allocates messages and passes only their offsets, the parent reads them in place and frees them
+    // while the child is still allocating
+    int pipe_fds[2];
+    EXPECT(pipe(pipe_fds) == 0, "shared pipe");
+    const pid_t child = fork();
+    EXPECT(child >= 0, "shared fork");
+    if (child == 0) {
+        close(pipe_fds[0]);
+        for (AllokSize i = 0; i < 200; i++) {
+            AllokSize offset;
+            EXPECT(akMappedHeapAllocOffset(&offset, heap, sizeof(MappedNode) + (i % 5) * 24) == ALLOK_SUCCESS, "shared child alloc");
+            MappedNode *message;
+            EXPECT(akMappedHeapFromOffset(VPTR(message), heap, offset) == ALLOK_SUCCESS, "shared child from offset");
+            message->value = i;
+            message->next = offset;
+            EXPECT(write(pipe_fds[1], &offset, sizeof(offset)) == (ssize_t)sizeof(offset), "shared child write");
+        }
+        close(pipe_fds[1]);
+        _exit(0);
+    }
+
+    close(pipe_fds[1]);
+    AllokSize offset;
+    AllokSize count = 0;
+    while (read(pipe_fds[0], &offset, sizeof(offset)) == (ssize_t)sizeof(offset)) {
+        MappedNode *message;
+        EXPECT(akMappedHeapFromOffset(VPTR(message), heap, offset) == ALLOK_SUCCESS, "shared from offset");
+        EXPECT(message->value == count && message->next == offset, "shared message");
+        EXPECT(akMappedHeapFreeOffset(heap, offset) == ALLOK_SUCCESS, "shared free");
+        count++;
+    }
+    close(pipe_fds[0]);
+    int status;
+    EXPECT(waitpid(child, &status, 0) == child && WIFEXITED(status) && WEXITSTATUS(status) == 0, "shared child exit");
+    EXPECT(count == 200, "shared message count");
+
+    // Frees only reach the free lists at the next drain
+    EXPECT(heap->p_header->remote_frees + heap->p_header->block_count == 200, "shared pending frees");
+    EXPECT(akMappedHeapCheck(heap) == ALLOK_SUCCESS, "shared check");
+    EXPECT(heap->p_header->remote_frees == 200 && heap->p_header->block_count == 0 && heap->p_header->top == mapped_data_start(), "shared heap drained");
+
+    // A block waiting on the remote stack is claimed, so a second free of it is refused rather than pushed again
+    void *first;
+    void *second;
+    EXPECT(akMappedHeapAlloc(&first, heap, 64) == ALLOK_SUCCESS && akMappedHeapAlloc(&second, heap, 64) == ALLOK_SUCCESS, "shared alloc");
+    void *stale = first;
+    EXPECT(akMappedHeapFree(&first, heap) == ALLOK_SUCCESS && akMappedHeapFree(&stale, heap) == ALLOK_INVALID_ADDR && stale != ALLOK_NULL, "shared double free");
+    EXPECT(akMappedHeapToOffset(&offset, heap, stale) == ALLOK_SUCCESS && akMappedHeapFreeOffset(heap, offset) == ALLOK_INVALID_ADDR, "shared double free by offset");
+    EXPECT(heap->p_header->remote_head == offset - sizeof(AkMappedBlock) && mapped_links_at(heap, offset - sizeof(AkMappedBlock))->next == 0, "shared stack pushed once");
+    void *third;
+    EXPECT(akMappedHeapAlloc(&third, heap, 64) == ALLOK_SUCCESS && heap->p_header->remote_frees == 201, "shared drain after double free");
+    EXPECT(akMappedHeapCheck(heap) == ALLOK_SUCCESS, "shared check after double free");
+    EXPECT(akMappedHeapFree(&second, heap) == ALLOK_SUCCESS && akMappedHeapFree(&third, heap) == ALLOK_SUCCESS, "shared free");
+    EXPECT(akMappedHeapCheck(heap) == ALLOK_SUCCESS && heap->p_header->block_count == 0, "shared heap drained");
+
+    // A block stays claimed until the drain has marked it free, so a free racing the drain never pushes it twice
+    struct sigaction action = {0};
+    action.sa_handler = shared_race_probe;
+    EXPECT(sigaction(SIGALRM, &action, ALLOK_NULL) == 0, "shared race handler");
+    struct itimerval timer = {{0, 10}, {0, 10}};
+    EXPECT(setitimer(ITIMER_REAL, &timer, ALLOK_NULL) == 0, "shared race timer");
+    void *guard;
+    for (int round = 0; round < SHARED_RACE_ROUNDS; round++) {
+        for (int i = 0; i < SHARED_RACE_BLOCKS; i++) {
+            EXPECT(akMappedHeapAlloc(&g_race_ptrs[i], heap, 48 + (i % 4) * 16) == ALLOK_SUCCESS, "shared race alloc");
+        }
+        // A live block above the round keeps the drain on the free list path instead of shrinking the top
+        EXPECT(round > 0 || akMappedHeapAlloc(&guard, heap, 64) == ALLOK_SUCCESS, "shared race guard");
+        for (int i = 0; i < SHARED_RACE_BLOCKS; i++) {
+            void *ptr = g_race_ptrs[i];
+            EXPECT(akMappedHeapFree(&ptr, heap) == ALLOK_SUCCESS, "shared race free");
+        }
+        g_race_heap = heap;
+        EXPECT(akMappedHeapCheck(heap) == ALLOK_SUCCESS, "shared race drain");
+        g_race_heap = ALLOK_NULL;
+        EXPECT(g_race_stale_frees == 0, "shared race stale free");
+    }
+    timer = (struct itimerval){{0, 0}, {0, 0}};
+    setitimer(ITIMER_REAL, &timer, ALLOK_NULL);
+    action.sa_handler = SIG_DFL;
+    sigaction(SIGALRM, &action, ALLOK_NULL);
+    EXPECT(akMappedHeapFree(&guard, heap) == ALLOK_SUCCESS, "shared race guard free");
+    EXPECT(akMappedHeapCheck(heap) == ALLOK_SUCCESS && heap->p_header->block_count == 0, "shared race drained");
+
+    // A child that exits holding the lock is taken over by the parent, which is still waiting to reap it
+    EXPECT(akMappedHeapAlloc(&first, heap, 64) == ALLOK_SUCCESS, "shared alloc before owner death");
+    const pid_t owner = fork();
+    EXPECT(owner >= 0, "shared owner fork");
+    if (owner == 0) {
+        mapped_lock(heap);
+        _exit(0);
+    }
+    while (atomic_load_long(&heap->p_header->lock.state) != owner) {
+        os_thread_yield();
+    }
+    EXPECT(akMappedHeapAlloc(&second, heap, 64) == ALLOK_SUCCESS && heap->p_header->lock.state == 0, "shared lock taken over");
+    EXPECT(waitpid(owner, &status, 0) == owner, "shared owner reaped");
+    EXPECT(akMappedHeapFree(&first, heap) == ALLOK_SUCCESS && akMappedHeapFree(&second, heap) == ALLOK_SUCCESS, "shared free after owner death");
+    EXPECT(akMappedHeapCheck(heap) == ALLOK_SUCCESS && heap->p_header->block_count == 0, "shared check after owner death");
+
+    // An owner that died mid update leaves the lock poisoned rather than handing out damaged blocks
+    heap->p_header->lock.state = owner;
+    heap->p_header->top += 8;
+    EXPECT(akMappedHeapAlloc(&first, heap, 64) == ALLOK_HEAP_CORRUPTED, "shared damage found on takeover");
+    EXPECT(akMappedHeapCheck(heap) == ALLOK_HEAP_CORRUPTED && akMappedHeapSetRoot(heap, ALLOK_NULL) == ALLOK_HEAP_CORRUPTED, "shared lock poisoned");
+    EXPECT(akMappedHeapClose(&heap) == ALLOK_SUCCESS && heap == ALLOK_NULL, "shared close");
+
+    // A named heap opened twice maps at two addresses that agree on every offset
+    char name[64];
+    snprintf(name, sizeof(name), "/allok_shared_%d_%d", type, (int)getpid());
+    akMappedHeapUnlinkShared(name);
+    EXPECT(akMappedHeapOpenShared(&heap, name, 0) == ALLOK_INVALID_SIZE, "named heap too small");
+    EXPECT(akMappedHeapUnlinkShared(name) == ALLOK_OS_FILE_FAILED, "named heap unlinked when too small");
+    EXPECT(akMappedHeapOpenShared(&heap, name, 256 * 1024) == ALLOK_SUCCESS, "named heap create");
+    AkMappedHeap *other;
+    EXPECT(akMappedHeapOpenShared(&other, name, 0) == ALLOK_SUCCESS && other->p_header != heap->p_header && other->size == heap->size, "named heap open");
+
+    MappedNode *message;
+    EXPECT(akMappedHeapAllocOffset(&offset, heap, sizeof(MappedNode)) == ALLOK_SUCCESS, "named alloc");
+    EXPECT(akMappedHeapFromOffset(VPTR(message), heap, offset) == ALLOK_SUCCESS, "named from offset");
+    message->value = 42;
+    EXPECT(akMappedHeapFromOffset(VPTR(message), other, offset) == ALLOK_SUCCESS && message->value == 42, "named zero copy");
+    EXPECT(akMappedHeapSetRoot(other, message) == ALLOK_SUCCESS, "named root");
+    void *outside = heap->p_header;
+    EXPECT(akMappedHeapFree(&outside, other) == ALLOK_NOT_FOUND, "named free outside");
+    EXPECT(akMappedHeapFree(VPTR(message), other) == ALLOK_SUCCESS && message == ALLOK_NULL, "named free");
+
+    void *ptr;
+    EXPECT(akMappedHeapAlloc(&ptr, heap, sizeof(MappedNode)) == ALLOK_SUCCESS && heap->p_header->remote_frees == 1, "named drain on alloc");
+    EXPECT(akMappedHeapGetRoot(&ptr, other) == ALLOK_NOT_FOUND, "named root freed");
+    EXPECT(akMappedHeapCheck(other) == ALLOK_SUCCESS && other->p_header->block_count == 1, "named check");
+    EXPECT(akMappedHeapClose(&other) == ALLOK_SUCCESS && akMappedHeapClose(&heap) == ALLOK_SUCCESS, "named close");
+
+    // The name outlives every mapping until it is unlinked
+    EXPECT(akMappedHeapOpenShared(&heap, name, 0) == ALLOK_SUCCESS && heap->p_header->block_count == 1, "named reopen");
+    EXPECT(akMappedHeapClose(&heap) == ALLOK_SUCCESS, "named close");
+    EXPECT(akMappedHeapUnlinkShared(name) == ALLOK_SUCCESS && akMappedHeapUnlinkShared(name) == ALLOK_OS_FILE_FAILED, "named unlink");
+#else
+    (void)type;
+#endif
+}
+
+void check_growable_arena() {
+    AkMemoryArena *arena;
+    EXPECT(akMemoryArenaAlloc(&arena, 4096) == ALLOK_SUCCESS, "arena alloc");
+    void *ptr;
+    EXPECT(akMemoryArenaClaim(&ptr, arena, 8192) == ALLOK_INSUFFICIENT_ARENA_MEMORY, "fixed arena grew");
+    akMemoryArenaDestroy(&arena, ALLOK_FALSE);
+
+    EXPECT(akMemoryArenaAllocWithParams(&arena, 4096, (AkMemoryArenaParams){ALLOK_HUGE_PAGES_NONE, ALLOK_TRUE}) == ALLOK_SUCCESS, "growable arena alloc");
+
+    AllokByte *claims[200];
+    for (int i = 0; i < 200; i++) {
+        const AllokSize size = 1000 + (AllokSize)i * 50;
+        EXPECT(akMemoryArenaClaimAligned(VPTR(claims[i]), arena, size, 64) == ALLOK_SUCCESS, "growable arena claim");
+        EXPECT((AllokSize)claims[i] % 64 == 0, "growable arena alignment");
+        claims[i][0] = (AllokByte)i;
+        claims[i][size - 1] = (AllokByte)i;
+    }
+    for (int i = 0; i < 200; i++) {
+        EXPECT(claims[i][0] == (AllokByte)i && claims[i][1000 + i * 50 - 1] == (AllokByte)i, "growable arena lost data");
+    }
+
+    // Only the top claim of a chunk rewinds it
+    AkMemoryArena *active = arena->p_active;
+    void *top = claims[199];
+    const AllokSize used = active->size;
+    EXPECT(akMemoryArenaFree(&top, arena, 1000 + 199 * 50, ALLOK_FALSE) == ALLOK_SUCCESS, "arena free");
+    EXPECT(active->p_current == claims[199] && active->size == used - (1000 + 199 * 50), "arena free top");
+
+    AllokSize largest = 0;
+    for (AkMemoryArena *chunk = arena->p_next; chunk != ALLOK_NULL; chunk = chunk->p_next) {
+        largest = max_size(largest, chunk->alloc_size);
+    }
+    arena_chunk_count(arena);
+
+    // Reset keeps the largest chunk so the same burst fits again without mapping more memory
+    EXPECT(akMemoryArenaReset(arena) == ALLOK_SUCCESS, "arena reset");
+    EXPECT(arena_chunk_count(arena) <= 2 && arena->p_active == arena && arena->size == 0, "arena reset chunks");
+    EXPECT(arena->p_next == ALLOK_NULL || arena->p_next->alloc_size == largest, "arena reset kept the largest chunk");
+    EXPECT(akMemoryArenaClaim(&ptr, arena, largest / 2) == ALLOK_SUCCESS, "arena claim after reset");
+    EXPECT(arena_chunk_count(arena) <= 2, "arena grew after reset");
+
+    akMemoryArenaDestroy(&arena, ALLOK_TRUE);
+}
+
+void check_arena_rollback() {
+    AkMemoryArena *arena;
+    EXPECT(akMemoryArenaAllocWithParams(&arena, 4096, (AkMemoryArenaParams){ALLOK_HUGE_PAGES_NONE, ALLOK_TRUE}) == ALLOK_SUCCESS, "growable arena alloc");
+
+    AllokByte *kept;
+    EXPECT(akMemoryArenaClaim(VPTR(kept), arena, 100) == ALLOK_SUCCESS, "arena claim");
+    kept[99] = 7;
+
+    AkMemoryArenaMark mark;
+    EXPECT(akMemoryArenaMark(&mark, arena) == ALLOK_SUCCESS, "arena mark");
+
+    // A burst spanning several chunks is dropped at once, and the chunks it chained are reused afterwards
+    void *ptr;
+    for (int i = 0; i < 100; i++) {
+        EXPECT(akMemoryArenaClaim(&ptr, arena, 2000) == ALLOK_SUCCESS, "arena claim");
+    }
+    const AllokSize chunk_count = arena_chunk_count(arena);
+
+    EXPECT(akMemoryArenaRollback(&mark) == ALLOK_SUCCESS, "arena rollback");
+    EXPECT(arena->p_active == mark.p_chunk && arena->p_active->size == mark.size && arena->p_active->p_current == mark.p_current, "arena rollback top");
+    EXPECT(kept[99] == 7, "arena rollback lost data");
+
+    for (int i = 0; i < 100; i++) {
+        EXPECT(akMemoryArenaClaim(&ptr, arena, 2000) == ALLOK_SUCCESS, "arena claim");
+    }
+    EXPECT(arena_chunk_count(arena) == chunk_count, "arena rollback leaked chunks");
+
+    void *before = arena->p_active->p_current;
+    {
+        ALLOK_ARENA_SCOPE(arena);
+        for (int i = 0; i < 100; i++) {
+            EXPECT(akMemoryArenaClaim(&ptr, arena, 4000) == ALLOK_SUCCESS, "arena claim");
+        }
+    }
+    EXPECT(arena->p_active->p_current == before, "arena scope rollback");
+
+    // A reset may unmap the marked chunk, so the mark is rejected without being followed
+    EXPECT(akMemoryArenaMark(&mark, arena) == ALLOK_SUCCESS && mark.p_chunk != arena, "arena mark in chained chunk");
+    EXPECT(akMemoryArenaReset(arena) == ALLOK_SUCCESS, "arena reset");
+    EXPECT(akMemoryArenaRollback(&mark) == ALLOK_INVALID_ADDR, "arena rollback after reset");
+    EXPECT(arena->p_active == arena && arena->size == 0, "arena stale rollback moved top");
+
+    // So does a chunk that akMemoryArenaFree destroyed
+    EXPECT(akMemoryArenaClaim(&ptr, arena, arena->alloc_size) == ALLOK_SUCCESS, "arena fill");
+    AllokByte *chained;
+    EXPECT(akMemoryArenaClaim(VPTR(chained), arena, arena->alloc_size + 1) == ALLOK_SUCCESS && arena->p_active != arena, "arena chain");
+    EXPECT(akMemoryArenaMark(&mark, arena) == ALLOK_SUCCESS, "arena mark in chained chunk");
+    EXPECT(akMemoryArenaFree(VPTR(chained), arena, arena->p_active->size, ALLOK_TRUE) == ALLOK_SUCCESS, "arena free chunk");
+    EXPECT(akMemoryArenaRollback(&mark) == ALLOK_INVALID_ADDR, "arena rollback after chunk destroyed");
+    EXPECT(akMemoryArenaMark(&mark, arena) == ALLOK_SUCCESS && akMemoryArenaRollback(&mark) == ALLOK_SUCCESS, "arena fresh mark");
+
+    akMemoryArenaDestroy(&arena, ALLOK_TRUE);
+}
+
+int main(int argc, char **argv) {
+    if (argc < 2) {
+        fprintf(stderr, "usage: %s <AllokType>\n", argv[0]);
+        return 2;
+    }
+
+    const AllokType type = (AllokType)strtol(argv[1], ALLOK_NULL, 10);
+    if (type < ALLOK_LINEAR_FIT || type > ALLOK_WORST_FIT) {
+        fprintf(stderr, "unknown AllokType %d\n", type);
+        return 2;
+    }
+
+    run((AkMemoryMapParams){type, ALLOK_TRUE, ALLOK_FALSE, ALLOK_FALSE, ALLOK_FALSE});
+    run((AkMemoryMapParams){type, ALLOK_TRUE, ALLOK_TRUE, ALLOK_FALSE, ALLOK_FALSE});
+    run((AkMemoryMapParams){type, ALLOK_TRUE, ALLOK_TRUE, ALLOK_FALSE, ALLOK_TRUE});
+    run((AkMemoryMapParams){type, ALLOK_TRUE, ALLOK_TRUE, ALLOK_FALSE, ALLOK_TRUE, 4 * 1024});
+    run((AkMemoryMapParams){type, ALLOK_TRUE, ALLOK_TRUE, ALLOK_FALSE, ALLOK_FALSE, ALLOK_DEFAULT_LARGE_THRESHOLD, ALLOK_HUGE_PAGES_NONE, 64 * 1024, 8});
+    check_mem_kernels();
+    check_realloc_headroom(ALLOK_FALSE);
+    check_realloc_headroom(ALLOK_TRUE);
+    check_large_realloc();
+    check_pool_cache();
+    check_batch(type);
+    check_stats();
+    check_heap_report(type);
+    check_trace(type);
+#if __APPLE__ || __linux__
+    check_trace_threads(type);
+#endif
+    check_heaps(type);
+    check_remote_free(type);
+    check_thread_cache(type);
+    check_per_cpu(type);
+    check_handles(type);
+    check_mapped_heap(type);
+    check_shared_heap(type);
+    check_growable_arena();
+    check_arena_rollback();
+    check_huge_pages(ALLOK_HUGE_PAGES_TRANSPARENT);
+    check_huge_pages(ALLOK_HUGE_PAGES_EXPLICIT);
+
+    printf("invariants hold for AllokType %d\n", type);
+    return 0;
+}